@@ -1415,7 +1415,7 @@ static string translate_string_operand(string &in)
 
 // Printf/errorf instructions can potentially allow us to extract data from the
 // shader when the debug layer is enabled, potentially making them quite valuable
-static vector<DWORD> assemble_printf(string &s, vector<DWORD> &v, vector<string> &w, bool errorf)
+static void assemble_printf(string &s, vector<DWORD> &v, vector<string> &w, bool errorf)
 {
 	shader_ins ins = {0};
 	ins.opcode = 0x35;
@@ -1450,11 +1450,9 @@ static vector<DWORD> assemble_printf(string &s, vector<DWORD> &v, vector<string>
 	v.resize(insLen);
 	v[1] = insLen;
 	memcpy((char*)v.data() + msgOff, msg.c_str(), msgLen);
-
-	return v;
 }
 
-static vector<DWORD> assemble_undecipherable_custom_data(string &s, vector<DWORD> &v, vector<string> &w)
+static void assemble_undecipherable_custom_data(string &s, vector<DWORD> &v, vector<string> &w)
 {
 	uint32_t numOps, word, i;
 
@@ -1472,17 +1470,21 @@ static vector<DWORD> assemble_undecipherable_custom_data(string &s, vector<DWORD
 		sscanf_s(w[i + 3].c_str(), "%x", &word);
 		v.push_back(word);
 	}
-
-	return v;
 }
 
-static vector<DWORD> assembleIns(string s)
+// Assembles one instruction into v, which is cleared first. The assembler
+// passes the same vector in for every instruction so that its allocation is
+// reused, rather than returning a new one for each:
+static void assembleIns(string s, vector<DWORD> &v)
 {
 	unsigned msaa_samples = 0;
 
-	if (hackMap.find(s) != hackMap.end()) {
-		auto v = hackMap[s];
-		return v;
+	v.clear();
+
+	auto hack = hackMap.find(s);
+	if (hack != hackMap.end()) {
+		v = hack->second;
+		return;
 	}
 	DWORD op = 0;
 	shader_ins* ins = (shader_ins*)&op;
@@ -1528,7 +1530,6 @@ static vector<DWORD> assembleIns(string s)
 		s.erase(pos, 9);
 		ins->_11_23 = 1;
 	}
-	vector<DWORD> v;
 	vector<string> w = strToWords(s);
 	string o = w[0];
 	if (o == "sampleinfo" && ins->_11_23 == 2)
@@ -2270,15 +2271,21 @@ static vector<DWORD> assembleIns(string s)
 		for (int i = 0; i < numOps; i++)
 			v.insert(v.end(), os[i].begin(), os[i].end());
 	} else if (o == "printf") {
-		return assemble_printf(s, v, w, false);
+		assemble_printf(s, v, w, false);
 	} else if (o == "errorf") {
-		return assemble_printf(s, v, w, true);
+		assemble_printf(s, v, w, true);
 	} else if (o == "undecipherable") {
-		return assemble_undecipherable_custom_data(s, v, w);
+		assemble_undecipherable_custom_data(s, v, w);
 	} else {
 		throw AssemblerParseError(s, "Unrecognised instruction");
 	}
+}
 
+static vector<DWORD> assembleIns(string s)
+{
+	vector<DWORD> v;
+
+	assembleIns(s, v);
 	return v;
 }
 
@@ -2520,6 +2527,46 @@ static string assembleAndCompare(string s, vector<DWORD> v)
 	return ret;
 }
 
+// Bug fixed: This would not strip carriage returns from DOS style newlines if
+// they were the only character on the line, corrupting the resulting shader
+// binary. -DarkStarSword
+//
+// Strip whitespace from the end of each line. This isn't strictly necessary,
+// but the MS disassembler inserts an extra space after "ret ", "else " and
+// "endif ", which has been a gotcha for trying to match it with ShaderRegex
+// since it's easy to miss the fact that there is a space there and not
+// understand why the pattern isn't matching. By removing excess spaces from
+// the end of each line now we can make this gotcha go away.
+static inline void strip_line_ending(string *s)
+{
+	if (s->size() >= 1 && (*s)[s->size() - 1] == '\r')
+		s->erase(--s->end());
+
+	while (s->size() >= 1 && (*s)[s->size() - 1] == ' ')
+		s->erase(--s->end());
+}
+
+// Streaming equivalent of stringToLines() - reads the next line from the
+// buffer into a reusable string, advancing *pos past it. Returns false at the
+// end of the buffer or at a NULL terminator.
+static bool next_line(const char **pos, const char *end, string *line)
+{
+	const char *start = *pos;
+	const char *eol = start;
+
+	if (start >= end || *start == 0)
+		return false;
+
+	while (eol < end && *eol != '\n')
+		eol++;
+
+	line->assign(start, eol);
+	strip_line_ending(line);
+	*pos = eol + 1;
+
+	return true;
+}
+
 vector<string> stringToLines(const char* start, size_t size)
 {
 	vector<string> lines;
@@ -2540,27 +2587,8 @@ vector<string> stringToLines(const char* start, size_t size)
 			break;
 		}
 	}
-	for (unsigned int i = 0; i < lines.size(); i++) {
-		string s = lines[i];
-		// Bug fixed: This would not strip carriage returns from DOS
-		// style newlines if they were the only character on the line,
-		// corrupting the resulting shader binary. -DarkStarSword
-		if (s.size() >= 1 && s[s.size() - 1] == '\r')
-			s.erase(--s.end());
-
-		// Strip whitespace from the end of each line. This isn't
-		// strictly necessary, but the MS disassembler inserts an extra
-		// space after "ret ", "else " and "endif ", which has been a
-		// gotcha for trying to match it with ShaderRegex since it's
-		// easy to miss the fact that there is a space there and not
-		// understand why the pattern isn't matching. By removing
-		// excess spaces from the end of each line now we can make this
-		// gotcha go away.
-		while (s.size() >= 1 && s[s.size() - 1] == ' ')
-			s.erase(--s.end());
-
-		lines[i] = s;
-	}
+	for (unsigned int i = 0; i < lines.size(); i++)
+		strip_line_ending(&lines[i]);
 	return lines;
 }
 static vector<string> stringToLinesDX9(const char* start, size_t size) {
@@ -2609,10 +2637,50 @@ static vector<string> stringToLinesDX9(const char* start, size_t size) {
 	return lines;
 }
 
+// Output sink for the disassembler. Lines are appended directly to the
+// caller's buffer as they are produced rather than being collected into a
+// vector of strings and concatenated at the end. Only ever appends, so
+// anything that annotates a line (hexdumps) must be written before it. The
+// buffer may be a vector<byte> or a string, so that BinaryToAsmText() can
+// have the text written straight into the string it returns.
+template <typename Buffer>
+class DisassemblyWriter
+{
+	Buffer *buf;
+
+public:
+	DisassemblyWriter(Buffer *buf, size_t size_hint) :
+		buf(buf)
+	{
+		buf->clear();
+		buf->reserve(size_hint);
+	}
+
+	void write_line(const string &line)
+	{
+		buf->insert(buf->end(), line.begin(), line.end());
+		buf->push_back('\n');
+	}
+
+	// Writes each line of a multi-line instruction, stripped the same way
+	// as the lines read from the disassembly:
+	void write_lines(const string &lines)
+	{
+		const char *pos = lines.c_str();
+		const char *end = pos + lines.size();
+		string line;
+
+		while (next_line(&pos, end, &line))
+			write_line(line);
+	}
+};
+
+// Writes the hexdump for an instruction. Must be called before the
+// instruction itself is written, as the hexdump goes on the line(s) above it:
+template <typename Buffer>
 static void hexdump_instruction(string &s, vector<DWORD> &v,
-		vector<string> &lines, DWORD *i,
-		int *multiLines, uint32_t line_byte_offset,
-		int hexdump_mode)
+		DisassemblyWriter<Buffer> *writer,
+		uint32_t line_byte_offset, int hexdump_mode)
 {
 	string hd;
 	char buf[16];
@@ -2648,12 +2716,7 @@ static void hexdump_instruction(string &s, vector<DWORD> &v,
 		hd += "\n// * BUG * : " + parse_error + ":";
 	}
 
-	vector<string>::iterator pos = lines.begin() + (*i)++;
-	if (*multiLines)
-		pos -= *multiLines - 1;
-	*multiLines = 0;
-
-	lines.insert(pos, hd);
+	writer->write_line(hd);
 }
 
 static void encode_custom_data(string &s, vector<DWORD> &v)
@@ -2875,13 +2938,9 @@ HRESULT disassemblerDX9(vector<byte> *buffer, vector<byte> *ret, const char *com
 		asmSize = pDissassembly->GetBufferSize();
 	}
 	vector<string> lines = stringToLinesDX9(asmBuffer, asmSize);
-	ret->clear();
-	for (size_t i = 0; i < lines.size(); i++) {
-		for (size_t j = 0; j < lines[i].size(); j++) {
-			ret->insert(ret->end(), lines[i][j]);
-		}
-		ret->insert(ret->end(), '\n');
-	}
+	DisassemblyWriter<vector<byte>> writer(ret, asmSize);
+	for (size_t i = 0; i < lines.size(); i++)
+		writer.write_line(lines[i]);
 	if (pDissassembly)
 		pDissassembly->Release();
 	if (pD3DXDissassembly)
@@ -2890,7 +2949,8 @@ HRESULT disassemblerDX9(vector<byte> *buffer, vector<byte> *ret, const char *com
 }
 #endif
 
-HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *comment,
+template <typename Buffer>
+static HRESULT disassemble(vector<byte> *buffer, Buffer *ret, const char *comment,
 		int hexdump, bool d3dcompiler_46_compat,
 		bool disassemble_undecipherable_data,
 		bool patch_cb_offsets)
@@ -2948,22 +3008,23 @@ HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *commen
 			break;
 	}
 	// FIXME: If neither SHEX or SHDR was found in the shader, codeByteStart will be garbage
-	vector<string> lines = stringToLines(asmBuffer, asmSize);
 	DWORD* codeStart = (DWORD*)(codeByteStart + 8);
 	bool codeStarted = false;
 	bool multiLine = false;
-	int multiLines = 0;
-	string s2;
+	string s, s2;
 	vector<DWORD> o;
-	for (DWORD i = 0; i < lines.size(); i++) {
+	const char *asmPos = asmBuffer;
+	const char *asmEnd = asmBuffer + asmSize;
+	DisassemblyWriter<Buffer> writer(ret, asmSize + asmSize / 4);
+	while (next_line(&asmPos, asmEnd, &s)) {
 		uint32_t line_byte_offset = (uint32_t)((byte*)codeStart - buffer->data());
-		string s = lines[i];
 
 		if (!memcmp(s.c_str(), "//", 2)) {
 			if (d3dcompiler_46_compat)
-				patch_d3dcompiler_47_rdef(&lines[i], &rdef_state);
+				patch_d3dcompiler_47_rdef(&s, &rdef_state);
 			if (patch_cb_offsets)
-				replace_cb_offsets_with_indices(&lines[i]);
+				replace_cb_offsets_with_indices(&s);
+			writer.write_line(s);
 			continue;
 		}
 
@@ -2974,18 +3035,20 @@ HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *commen
 				v.push_back(*codeStart);
 				codeStart += 2;
 				s = assembleAndCompare(s, v);
-				lines[i] = s;
 			}
 		} else if (s.find("{ {") < s.size()) {
+			// The lines of a multi-line instruction are held back
+			// until the end, since they are replaced with the
+			// assembleAndCompare() output and the hexdump has to
+			// be written above them:
 			s2 = s;
 			multiLine = true;
-			multiLines = 1;
+			continue;
 		} else if (s.find("} }") < s.size()) {
 			s2.append("\n");
 			s2.append(s);
 			s = s2;
 			multiLine = false;
-			multiLines++;
 			shader_ins* ins = (shader_ins*)codeStart;
 			v.push_back(*codeStart);
 			codeStart++;
@@ -2997,16 +3060,14 @@ HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *commen
 				codeStart++;
 			}
 			s = assembleAndCompare(s, v);
-			auto sLines = stringToLines(s.c_str(), s.size());
-			size_t startLine = i - sLines.size() + 1;
-			for (size_t j = 0; j < sLines.size(); j++) {
-				lines[startLine + j] = sLines[j];
-			}
-			//lines[i] = s;
+			if (hexdump)
+				hexdump_instruction(s, v, &writer, line_byte_offset, hexdump);
+			writer.write_lines(s);
+			continue;
 		} else if (multiLine) {
 			s2.append("\n");
 			s2.append(s);
-			multiLines++;
+			continue;
 		} else if (s.size() > 0) {
 			shader_ins* ins = (shader_ins*)codeStart;
 			v.push_back(*codeStart);
@@ -3042,25 +3103,40 @@ HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *commen
 			} else {
 				s = assembleAndCompare(s, v);
 			}
-			lines[i] = s;
 		}
 
-		if (hexdump && !multiLine)
-			hexdump_instruction(s, v, lines, &i, &multiLines, line_byte_offset, hexdump);
-	}
-	ret->clear();
-	for (size_t i = 0; i < lines.size(); i++) {
-		for (size_t j = 0; j < lines[i].size(); j++) {
-			ret->insert(ret->end(), lines[i][j]);
-		}
-		ret->insert(ret->end(), '\n');
+		if (hexdump)
+			hexdump_instruction(s, v, &writer, line_byte_offset, hexdump);
+		writer.write_line(s);
 	}
 
+	// Should not happen, but don't lose a truncated multi-line instruction:
+	if (multiLine)
+		writer.write_lines(s2);
+
 	pDissassembly->Release();
 
 	return S_OK;
 }
 
+HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *comment,
+		int hexdump, bool d3dcompiler_46_compat,
+		bool disassemble_undecipherable_data,
+		bool patch_cb_offsets)
+{
+	return disassemble(buffer, ret, comment, hexdump, d3dcompiler_46_compat,
+			disassemble_undecipherable_data, patch_cb_offsets);
+}
+
+HRESULT disassembler(vector<byte> *buffer, string *ret, const char *comment,
+		int hexdump, bool d3dcompiler_46_compat,
+		bool disassemble_undecipherable_data,
+		bool patch_cb_offsets)
+{
+	return disassemble(buffer, ret, comment, hexdump, d3dcompiler_46_compat,
+			disassemble_undecipherable_data, patch_cb_offsets);
+}
+
 static void preprocessLine(string &line)
 {
 	const char *p;
@@ -3220,8 +3296,11 @@ static vector<DWORD> ComputeHash(byte const* input, DWORD size)
 
 // origByteCode is modified in this function, so passing it by value!
 // asmFile is not modified, so passing it by pointer -DarkStarSword
+//
+// If ctx is passed its scratch buffers will be reused rather than allocating
+// new ones for every shader, which adds up when assembling shaders in bulk.
 vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
-		vector<AssemblerParseError> *parse_errors)
+		vector<AssemblerParseError> *parse_errors, AssemblerContext *ctx)
 {
 	byte fourcc[4];
 	DWORD fHash[4];
@@ -3229,6 +3308,10 @@ vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
 	DWORD fSize;
 	DWORD numChunks;
 	vector<DWORD> chunkOffsets;
+	AssemblerContext local_ctx;
+
+	if (!ctx)
+		ctx = &local_ctx;
 
 	// TODO: Add robust error checking here (origBytecode is at least as large as
 	// the header, etc). I've added a check for numChunks < 1 as that
@@ -3249,10 +3332,8 @@ vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
 	chunkOffsets.resize(numChunks);
 	std::memcpy(chunkOffsets.data(), pPosition, 4 * numChunks);
 
-	char* asmBuffer;
-	size_t asmSize;
-	asmBuffer = asmFile->data();
-	asmSize = asmFile->size();
+	const char* asmPos = asmFile->data();
+	const char* asmEnd = asmPos + asmFile->size();
 	byte* codeByteStart;
 	int codeChunk = 0;
 	for (DWORD i = 1; i <= numChunks; i++) {
@@ -3262,22 +3343,21 @@ vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
 			break;
 	}
 	// FIXME: If neither SHEX or SHDR was found in the shader, codeByteStart will be garbage
-	vector<string> lines = stringToLines(asmBuffer, asmSize);
 	DWORD* codeStart = (DWORD*)(codeByteStart + 8);
 	bool codeStarted = false;
 	bool multiLine = false;
-	string s2;
-	vector<DWORD> o;
-	for (DWORD i = 0; i < lines.size(); i++) {
+	string &s = ctx->line;
+	string &s2 = ctx->multi_line;
+	vector<DWORD> &o = ctx->code;
+	o.clear();
+	for (DWORD i = 0; next_line(&asmPos, asmEnd, &s); i++) {
 		try {
-			string s = lines[i];
 			preprocessLine(s);
-			vector<DWORD> v;
 			if (!codeStarted) {
 				if (s.size() > 0 && s[0] != ' ') {
 					codeStarted = true;
-					vector<DWORD> ins = assembleIns(s);
-					o.insert(o.end(), ins.begin(), ins.end());
+					assembleIns(s, ctx->ins);
+					o.insert(o.end(), ctx->ins.begin(), ctx->ins.end());
 					o.push_back(0);
 				}
 			} else if (s.find("{ {") < s.size()) {
@@ -3286,16 +3366,15 @@ vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
 			} else if (s.find("} }") < s.size()) {
 				s2.append("\n");
 				s2.append(s);
-				s = s2;
 				multiLine = false;
-				vector<DWORD> ins = assembleIns(s);
-				o.insert(o.end(), ins.begin(), ins.end());
+				assembleIns(s2, ctx->ins);
+				o.insert(o.end(), ctx->ins.begin(), ctx->ins.end());
 			} else if (multiLine) {
 				s2.append("\n");
 				s2.append(s);
 			} else if (s.find_first_not_of(" ") != string::npos) {
-				vector<DWORD> ins = assembleIns(s);
-				o.insert(o.end(), ins.begin(), ins.end());
+				assembleIns(s, ctx->ins);
+				o.insert(o.end(), ctx->ins.begin(), ctx->ins.end());
 			}
 		} catch (AssemblerParseError &e) {
 			e.line_no = i + 1;
@@ -3319,16 +3398,21 @@ vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
 		}
 	}
 	codeStart = (DWORD*)(codeByteStart); // Endian bug, not that we care
-	auto it = origBytecode.begin() + chunkOffsets[codeChunk] + 8;
 	size_t codeSize = codeStart[1];
-	origBytecode.erase(it, it + codeSize);
 	size_t newCodeSize = 4 * o.size();
 	codeStart[1] = (DWORD)newCodeSize;
-	vector<byte> newCode(newCodeSize);
 	o[1] = (DWORD)o.size();
-	memcpy(newCode.data(), o.data(), newCodeSize);
-	it = origBytecode.begin() + chunkOffsets[codeChunk] + 8;
-	origBytecode.insert(it, newCode.begin(), newCode.end());
+	// Splice the new code over the old in place rather than erasing and
+	// re-inserting it, which would move the tail of the shader twice:
+	size_t codeOffset = chunkOffsets[codeChunk] + 8;
+	size_t tailOffset = codeOffset + codeSize;
+	size_t tailSize = origBytecode.size() - tailOffset;
+	if (newCodeSize > codeSize)
+		origBytecode.resize(origBytecode.size() + newCodeSize - codeSize);
+	memmove(origBytecode.data() + codeOffset + newCodeSize, origBytecode.data() + tailOffset, tailSize);
+	if (newCodeSize < codeSize)
+		origBytecode.resize(origBytecode.size() - (codeSize - newCodeSize));
+	memcpy(origBytecode.data() + codeOffset, o.data(), newCodeSize);
 	DWORD* dwordBuffer = (DWORD*)origBytecode.data();
 	for (DWORD i = codeChunk + 1; i < numChunks; i++) {
 		dwordBuffer[8 + i] += (DWORD)(newCodeSize - codeSize);
@@ -738,9 +738,10 @@ out_free:
 }
 
 HRESULT AssembleFluganWithSignatureParsing(vector<char> *assembly, vector<byte> *result_bytecode,
-		vector<AssemblerParseError> *parse_errors)
+		vector<AssemblerParseError> *parse_errors, AssemblerContext *ctx)
 {
-	vector<byte> manufactured_bytecode;
+	vector<byte> local_bytecode;
+	vector<byte> *manufactured_bytecode = ctx ? &ctx->manufactured_bytecode : &local_bytecode;
 	HRESULT hr;
 
 	// Flugan's assembler normally cheats and reuses sections from the
@@ -751,25 +752,25 @@ HRESULT AssembleFluganWithSignatureParsing(vector<char> *assembly, vector<byte>
 	// to Flugan's assembler. Later we should refactor this into the
 	// assembler itself.
 
-	hr = manufacture_shader_binary(assembly->data(), assembly->size(), &manufactured_bytecode);
+	hr = manufacture_shader_binary(assembly->data(), assembly->size(), manufactured_bytecode);
 	if (FAILED(hr))
 		return E_FAIL;
 
-	*result_bytecode = assembler(assembly, manufactured_bytecode, parse_errors);
+	*result_bytecode = assembler(assembly, *manufactured_bytecode, parse_errors, ctx);
 
 	return S_OK;
 }
 vector<byte> AssembleFluganWithOptionalSignatureParsing(vector<char> *assembly,
 		bool assemble_signatures, vector<byte> *orig_bytecode,
-		vector<AssemblerParseError> *parse_errors)
+		vector<AssemblerParseError> *parse_errors, AssemblerContext *ctx)
 {
 	vector<byte> new_bytecode;
 	HRESULT hr;
 
 	if (!assemble_signatures)
-		return assembler(assembly, *orig_bytecode, parse_errors);
+		return assembler(assembly, *orig_bytecode, parse_errors, ctx);
 
-	hr = AssembleFluganWithSignatureParsing(assembly, &new_bytecode, parse_errors);
+	hr = AssembleFluganWithSignatureParsing(assembly, &new_bytecode, parse_errors, ctx);
 	if (FAILED(hr))
 		throw parseError;
 
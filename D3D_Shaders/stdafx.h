@@ -39,7 +39,7 @@ public:
 		msg += ", " + desc + ":\n\"" + context + "\"";
 	}
 
-	const char* what() const
+	const char* what() const noexcept
 	{
 		return msg.c_str();
 	}
@@ -83,14 +83,30 @@ struct token_operand
 	};
 };
 
+// Scratch buffers used by the assembler. Callers assembling many shaders can
+// keep one of these around (one per thread) and pass it in to each call so the
+// buffers are reused instead of being allocated afresh for every shader.
+struct AssemblerContext
+{
+	string line;
+	string multi_line;
+	vector<DWORD> ins;
+	vector<DWORD> code;
+	vector<byte> manufactured_bytecode;
+};
+
 vector<string> stringToLines(const char* start, size_t size);
 HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *comment,
 		int hexdump = 0, bool d3dcompiler_46_compat = false,
 		bool disassemble_undecipherable_data = false,
 		bool patch_cb_offsets = false);
+HRESULT disassembler(vector<byte> *buffer, string *ret, const char *comment,
+		int hexdump = 0, bool d3dcompiler_46_compat = false,
+		bool disassemble_undecipherable_data = false,
+		bool patch_cb_offsets = false);
 HRESULT disassemblerDX9(vector<byte> *buffer, vector<byte> *ret, const char *comment);
-vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode, vector<AssemblerParseError> *parse_errors = NULL);
+vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode, vector<AssemblerParseError> *parse_errors = NULL, AssemblerContext *ctx = NULL);
 vector<byte> assemblerDX9(vector<char> *asmFile);
 void writeLUT();
-HRESULT AssembleFluganWithSignatureParsing(vector<char> *assembly, vector<byte> *result_bytecode, vector<AssemblerParseError> *parse_errors = NULL);
-vector<byte> AssembleFluganWithOptionalSignatureParsing(vector<char> *assembly, bool assemble_signatures, vector<byte> *orig_bytecode, vector<AssemblerParseError> *parse_errors = NULL);
+HRESULT AssembleFluganWithSignatureParsing(vector<char> *assembly, vector<byte> *result_bytecode, vector<AssemblerParseError> *parse_errors = NULL, AssemblerContext *ctx = NULL);
+vector<byte> AssembleFluganWithOptionalSignatureParsing(vector<char> *assembly, bool assemble_signatures, vector<byte> *orig_bytecode, vector<AssemblerParseError> *parse_errors = NULL, AssemblerContext *ctx = NULL);
@@ -0,0 +1,775 @@
+#include "BindingShadow.h"
+
+#include <string.h>
+
+BindingShadowStage binding_shadow_stage(wchar_t shader_type)
+{
+	switch (shader_type) {
+	case L'v':
+		return BindingShadowStage::VS;
+	case L'h':
+		return BindingShadowStage::HS;
+	case L'd':
+		return BindingShadowStage::DS;
+	case L'g':
+		return BindingShadowStage::GS;
+	case L'p':
+		return BindingShadowStage::PS;
+	case L'c':
+		return BindingShadowStage::CS;
+	}
+	return BindingShadowStage::COUNT;
+}
+
+// Returns the resource a view refers to without holding a reference. This is
+// only valid for as long as the view is alive, which is as long as it remains
+// bound to the pipeline.
+static ID3D11Resource* view_resource(ID3D11View *view)
+{
+	ID3D11Resource *resource = NULL;
+
+	if (!view)
+		return NULL;
+
+	view->GetResource(&resource);
+	if (resource)
+		resource->Release();
+
+	return resource;
+}
+
+// As above, but if the same view is already recorded in the slot being bound
+// to we already know its resource. The view can't have been released and its
+// address reused in the meantime, because the pipeline has held a reference
+// to it for as long as it has been recorded in a valid category. Games rebind
+// the same views over and over, so this saves most of the GetResource calls.
+static ID3D11Resource* view_resource(ID3D11View *view, bool valid,
+		ID3D11View *recorded_view, ID3D11Resource *recorded_resource)
+{
+	if (valid && view == recorded_view)
+		return recorded_resource;
+
+	return view_resource(view);
+}
+
+static bool contains(ID3D11Resource *const *resources, UINT num, ID3D11Resource *resource)
+{
+	UINT i;
+
+	for (i = 0; i < num; i++) {
+		if (resources[i] == resource)
+			return true;
+	}
+
+	return false;
+}
+
+static bool contains(ID3D11Buffer *const *buffers, UINT num, ID3D11Resource *resource)
+{
+	UINT i;
+
+	for (i = 0; i < num; i++) {
+		if (buffers[i] == resource)
+			return true;
+	}
+
+	return false;
+}
+
+BindingShadow::BindingShadow() :
+	num_uav_slots(D3D11_PS_CS_UAV_REGISTER_COUNT)
+{
+	// We may be wrapping a context that has already been used, so we
+	// don't know what is bound until we ask:
+	Reset();
+	Invalidate();
+}
+
+void BindingShadow::SetFeatureLevel(D3D_FEATURE_LEVEL level)
+{
+	num_uav_slots = (level >= D3D_FEATURE_LEVEL_11_1 ? D3D11_1_UAV_SLOT_COUNT : D3D11_PS_CS_UAV_REGISTER_COUNT);
+}
+
+void BindingShadow::Reset()
+{
+	int i;
+
+	memset(stages, 0, sizeof(stages));
+	for (i = 0; i < (int)BindingShadowStage::COUNT; i++) {
+		stages[i].srvs_valid = true;
+		stages[i].cbs_valid = true;
+	}
+
+	memset(vbs, 0, sizeof(vbs));
+	memset(vb_strides, 0, sizeof(vb_strides));
+	memset(vb_offsets, 0, sizeof(vb_offsets));
+	num_vbs = 0;
+	vbs_valid = true;
+
+	ib = NULL;
+	ib_format = DXGI_FORMAT_UNKNOWN;
+	ib_offset = 0;
+	ib_valid = true;
+
+	memset(so_targets, 0, sizeof(so_targets));
+	so_valid = true;
+
+	memset(rtvs, 0, sizeof(rtvs));
+	memset(rtv_resources, 0, sizeof(rtv_resources));
+	dsv = NULL;
+	dsv_resource = NULL;
+	om_valid = true;
+
+	memset(ps_uavs, 0, sizeof(ps_uavs));
+	memset(ps_uav_resources, 0, sizeof(ps_uav_resources));
+	num_ps_uavs = 0;
+	ps_uavs_valid = true;
+
+	memset(cs_uavs, 0, sizeof(cs_uavs));
+	memset(cs_uav_resources, 0, sizeof(cs_uav_resources));
+	num_cs_uavs = 0;
+	cs_uavs_valid = true;
+}
+
+void BindingShadow::Invalidate()
+{
+	int i;
+
+	for (i = 0; i < (int)BindingShadowStage::COUNT; i++) {
+		stages[i].srvs_valid = false;
+		stages[i].cbs_valid = false;
+	}
+	vbs_valid = false;
+	ib_valid = false;
+	so_valid = false;
+	om_valid = false;
+	ps_uavs_valid = false;
+	cs_uavs_valid = false;
+}
+
+void BindingShadow::InvalidateOutputMerger()
+{
+	om_valid = false;
+	ps_uavs_valid = false;
+}
+
+// -----------------------------------------------------------------------------
+// Resynchronisation from the driver, used after a category was invalidated:
+
+void BindingShadow::SyncShaderResources(ID3D11DeviceContext *context, BindingShadowStage stage)
+{
+	ShaderStageBindings *s = &stages[(int)stage];
+	ID3D11ShaderResourceView *views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+	UINT i;
+
+	switch (stage) {
+	case BindingShadowStage::VS:
+		context->VSGetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, views);
+		break;
+	case BindingShadowStage::HS:
+		context->HSGetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, views);
+		break;
+	case BindingShadowStage::DS:
+		context->DSGetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, views);
+		break;
+	case BindingShadowStage::GS:
+		context->GSGetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, views);
+		break;
+	case BindingShadowStage::PS:
+		context->PSGetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, views);
+		break;
+	case BindingShadowStage::CS:
+		context->CSGetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, views);
+		break;
+	default:
+		return;
+	}
+
+	s->num_srvs = 0;
+	for (i = 0; i < D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT; i++) {
+		s->srvs[i] = views[i];
+		s->srv_resources[i] = view_resource(views[i]);
+		if (views[i]) {
+			s->num_srvs = i + 1;
+			views[i]->Release();
+		}
+	}
+	s->srvs_valid = true;
+}
+
+void BindingShadow::SyncConstantBuffers(ID3D11DeviceContext *context, BindingShadowStage stage)
+{
+	ShaderStageBindings *s = &stages[(int)stage];
+	UINT i;
+
+	switch (stage) {
+	case BindingShadowStage::VS:
+		context->VSGetConstantBuffers(0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, s->cbs);
+		break;
+	case BindingShadowStage::HS:
+		context->HSGetConstantBuffers(0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, s->cbs);
+		break;
+	case BindingShadowStage::DS:
+		context->DSGetConstantBuffers(0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, s->cbs);
+		break;
+	case BindingShadowStage::GS:
+		context->GSGetConstantBuffers(0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, s->cbs);
+		break;
+	case BindingShadowStage::PS:
+		context->PSGetConstantBuffers(0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, s->cbs);
+		break;
+	case BindingShadowStage::CS:
+		context->CSGetConstantBuffers(0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, s->cbs);
+		break;
+	default:
+		return;
+	}
+
+	for (i = 0; i < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT; i++) {
+		if (s->cbs[i])
+			s->cbs[i]->Release();
+	}
+	s->cbs_valid = true;
+}
+
+void BindingShadow::SyncVertexBuffers(ID3D11DeviceContext *context)
+{
+	UINT i;
+
+	context->IAGetVertexBuffers(0, D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT, vbs, vb_strides, vb_offsets);
+
+	num_vbs = 0;
+	for (i = 0; i < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT; i++) {
+		if (vbs[i]) {
+			num_vbs = i + 1;
+			vbs[i]->Release();
+		}
+	}
+	vbs_valid = true;
+}
+
+void BindingShadow::SyncIndexBuffer(ID3D11DeviceContext *context)
+{
+	context->IAGetIndexBuffer(&ib, &ib_format, &ib_offset);
+	if (ib)
+		ib->Release();
+	ib_valid = true;
+}
+
+void BindingShadow::SyncStreamOutputTargets(ID3D11DeviceContext *context)
+{
+	UINT i;
+
+	context->SOGetTargets(D3D11_SO_BUFFER_SLOT_COUNT, so_targets);
+	for (i = 0; i < D3D11_SO_BUFFER_SLOT_COUNT; i++) {
+		if (so_targets[i])
+			so_targets[i]->Release();
+	}
+	so_valid = true;
+}
+
+void BindingShadow::SyncOutputMerger(ID3D11DeviceContext *context)
+{
+	UINT i;
+
+	context->OMGetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, rtvs, &dsv);
+	for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+		rtv_resources[i] = view_resource(rtvs[i]);
+		if (rtvs[i])
+			rtvs[i]->Release();
+	}
+	dsv_resource = view_resource(dsv);
+	if (dsv)
+		dsv->Release();
+	om_valid = true;
+}
+
+void BindingShadow::SyncPixelShaderUAVs(ID3D11DeviceContext *context)
+{
+	UINT i, start = 0;
+
+	// The UAVs share slots with the render targets, so as in
+	// save_om_state() we only ask for the slots after the last RTV:
+	if (!om_valid)
+		SyncOutputMerger(context);
+	for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+		if (rtvs[i])
+			start = i + 1;
+	}
+
+	memset(ps_uavs, 0, sizeof(ps_uavs));
+	memset(ps_uav_resources, 0, sizeof(ps_uav_resources));
+	if (start < num_uav_slots) {
+		context->OMGetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL,
+				start, num_uav_slots - start, ps_uavs + start);
+	}
+	num_ps_uavs = 0;
+	for (i = start; i < num_uav_slots; i++) {
+		ps_uav_resources[i] = view_resource(ps_uavs[i]);
+		if (ps_uavs[i]) {
+			num_ps_uavs = i + 1;
+			ps_uavs[i]->Release();
+		}
+	}
+	ps_uavs_valid = true;
+}
+
+void BindingShadow::SyncComputeShaderUAVs(ID3D11DeviceContext *context)
+{
+	UINT i;
+
+	memset(cs_uavs, 0, sizeof(cs_uavs));
+	memset(cs_uav_resources, 0, sizeof(cs_uav_resources));
+	context->CSGetUnorderedAccessViews(0, num_uav_slots, cs_uavs);
+	num_cs_uavs = 0;
+	for (i = 0; i < num_uav_slots; i++) {
+		cs_uav_resources[i] = view_resource(cs_uavs[i]);
+		if (cs_uavs[i]) {
+			num_cs_uavs = i + 1;
+			cs_uavs[i]->Release();
+		}
+	}
+	cs_uavs_valid = true;
+}
+
+// -----------------------------------------------------------------------------
+// Hazard tracking. The runtime will not allow a resource to be bound as an
+// input and an output at the same time, but it does not tell us when it
+// resolves such a conflict. We check at resource granularity and invalidate
+// the affected input category, since the runtime may or may not have unbound
+// it depending on the subresources involved.
+
+bool BindingShadow::IsBoundAsOutput(ID3D11DeviceContext *context, ID3D11Resource *resource)
+{
+	if (!om_valid)
+		SyncOutputMerger(context);
+	if (!ps_uavs_valid)
+		SyncPixelShaderUAVs(context);
+	if (!cs_uavs_valid)
+		SyncComputeShaderUAVs(context);
+	if (!so_valid)
+		SyncStreamOutputTargets(context);
+
+	return contains(rtv_resources, D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, resource) ||
+		dsv_resource == resource ||
+		contains(ps_uav_resources, num_ps_uavs, resource) ||
+		contains(cs_uav_resources, num_cs_uavs, resource) ||
+		contains(so_targets, D3D11_SO_BUFFER_SLOT_COUNT, resource);
+}
+
+void BindingShadow::InvalidateInputsBoundTo(ID3D11Resource *resource)
+{
+	ShaderStageBindings *s;
+	int i;
+
+	if (!resource)
+		return;
+
+	for (i = 0; i < (int)BindingShadowStage::COUNT; i++) {
+		s = &stages[i];
+		if (s->srvs_valid && contains(s->srv_resources, s->num_srvs, resource))
+			s->srvs_valid = false;
+		if (s->cbs_valid && contains(s->cbs, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, resource))
+			s->cbs_valid = false;
+	}
+
+	if (vbs_valid && contains(vbs, num_vbs, resource))
+		vbs_valid = false;
+	if (ib_valid && ib == resource)
+		ib_valid = false;
+}
+
+// Outputs in different parts of the pipeline can conflict as well, e.g. a
+// buffer bound as both a compute UAV and a stream output target. This is
+// called before the new outputs are recorded, so the category being changed
+// will be overwritten regardless.
+void BindingShadow::InvalidateOutputsBoundTo(ID3D11Resource *resource)
+{
+	if (!resource)
+		return;
+
+	if (om_valid && (contains(rtv_resources, D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, resource) || dsv_resource == resource))
+		om_valid = false;
+	if (ps_uavs_valid && contains(ps_uav_resources, num_ps_uavs, resource))
+		ps_uavs_valid = false;
+	if (cs_uavs_valid && contains(cs_uav_resources, num_cs_uavs, resource))
+		cs_uavs_valid = false;
+	if (so_valid && contains(so_targets, D3D11_SO_BUFFER_SLOT_COUNT, resource))
+		so_valid = false;
+}
+
+// -----------------------------------------------------------------------------
+// Updates from the binding calls:
+
+void BindingShadow::SetShaderResources(ID3D11DeviceContext *context, BindingShadowStage stage,
+		UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView *const *ppShaderResourceViews)
+{
+	ShaderStageBindings *s = &stages[(int)stage];
+	ID3D11ShaderResourceView *view;
+	ID3D11Resource *resource;
+	UINT i, slot;
+
+	for (i = 0; i < NumViews; i++) {
+		slot = StartSlot + i;
+		if (slot >= D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT)
+			break;
+
+		view = ppShaderResourceViews ? ppShaderResourceViews[i] : NULL;
+
+		// Rebinding the view we already have recorded changes
+		// nothing, and can't be a hazard since binding its resource
+		// as an output would have invalidated the category:
+		if (s->srvs_valid && view == s->srvs[slot])
+			continue;
+
+		resource = view_resource(view);
+		if (resource && s->srvs_valid && IsBoundAsOutput(context, resource))
+			s->srvs_valid = false;
+
+		s->srvs[slot] = view;
+		s->srv_resources[slot] = resource;
+		if (view && slot >= s->num_srvs)
+			s->num_srvs = slot + 1;
+	}
+}
+
+void BindingShadow::SetConstantBuffers(ID3D11DeviceContext *context, BindingShadowStage stage,
+		UINT StartSlot, UINT NumBuffers, ID3D11Buffer *const *ppConstantBuffers)
+{
+	ShaderStageBindings *s = &stages[(int)stage];
+	ID3D11Buffer *buf;
+	UINT i, slot;
+
+	for (i = 0; i < NumBuffers; i++) {
+		slot = StartSlot + i;
+		if (slot >= D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT)
+			break;
+
+		buf = ppConstantBuffers ? ppConstantBuffers[i] : NULL;
+		if (buf && s->cbs_valid && IsBoundAsOutput(context, buf))
+			s->cbs_valid = false;
+
+		s->cbs[slot] = buf;
+	}
+}
+
+void BindingShadow::SetVertexBuffers(ID3D11DeviceContext *context, UINT StartSlot, UINT NumBuffers,
+		ID3D11Buffer *const *ppVertexBuffers, const UINT *pStrides, const UINT *pOffsets)
+{
+	ID3D11Buffer *buf;
+	UINT i, slot;
+
+	for (i = 0; i < NumBuffers; i++) {
+		slot = StartSlot + i;
+		if (slot >= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT)
+			break;
+
+		buf = ppVertexBuffers ? ppVertexBuffers[i] : NULL;
+		if (buf && vbs_valid && IsBoundAsOutput(context, buf))
+			vbs_valid = false;
+
+		vbs[slot] = buf;
+		vb_strides[slot] = pStrides ? pStrides[i] : 0;
+		vb_offsets[slot] = pOffsets ? pOffsets[i] : 0;
+		if (buf && slot >= num_vbs)
+			num_vbs = slot + 1;
+	}
+}
+
+void BindingShadow::SetIndexBuffer(ID3D11DeviceContext *context, ID3D11Buffer *pIndexBuffer, DXGI_FORMAT Format, UINT Offset)
+{
+	ib = pIndexBuffer;
+	ib_format = Format;
+	ib_offset = Offset;
+	ib_valid = !(pIndexBuffer && IsBoundAsOutput(context, pIndexBuffer));
+}
+
+void BindingShadow::SetStreamOutputTargets(UINT NumBuffers, ID3D11Buffer *const *ppSOTargets)
+{
+	ID3D11Buffer *buf;
+	UINT i;
+
+	// Any slots past NumBuffers are unbound:
+	for (i = 0; i < D3D11_SO_BUFFER_SLOT_COUNT; i++) {
+		buf = (ppSOTargets && i < NumBuffers) ? ppSOTargets[i] : NULL;
+		if (buf) {
+			InvalidateInputsBoundTo(buf);
+			InvalidateOutputsBoundTo(buf);
+		}
+		so_targets[i] = buf;
+	}
+	so_valid = true;
+}
+
+void BindingShadow::SetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs,
+		ID3D11RenderTargetView *const *ppRenderTargetViews,
+		ID3D11DepthStencilView *pDepthStencilView,
+		UINT UAVStartSlot, UINT NumUAVs,
+		ID3D11UnorderedAccessView *const *ppUnorderedAccessViews)
+{
+	ID3D11RenderTargetView *rtv;
+	ID3D11UnorderedAccessView *uav;
+	ID3D11Resource *resource;
+	UINT i;
+
+	if (NumRTVs != D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL) {
+		// Any render targets past NumRTVs are unbound:
+		for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+			rtv = (ppRenderTargetViews && i < NumRTVs) ? ppRenderTargetViews[i] : NULL;
+			resource = view_resource(rtv, om_valid, rtvs[i], rtv_resources[i]);
+			if (resource) {
+				InvalidateInputsBoundTo(resource);
+				if (cs_uavs_valid && contains(cs_uav_resources, num_cs_uavs, resource))
+					cs_uavs_valid = false;
+				if (so_valid && contains(so_targets, D3D11_SO_BUFFER_SLOT_COUNT, resource))
+					so_valid = false;
+			}
+			rtvs[i] = rtv;
+			rtv_resources[i] = resource;
+		}
+
+		dsv_resource = view_resource(pDepthStencilView, om_valid, dsv, dsv_resource);
+		dsv = pDepthStencilView;
+		if (dsv_resource) {
+			InvalidateInputsBoundTo(dsv_resource);
+			if (cs_uavs_valid && contains(cs_uav_resources, num_cs_uavs, dsv_resource))
+				cs_uavs_valid = false;
+			if (so_valid && contains(so_targets, D3D11_SO_BUFFER_SLOT_COUNT, dsv_resource))
+				so_valid = false;
+		}
+		om_valid = true;
+
+		// Render targets and pixel shader UAVs share slots, so if we
+		// are keeping the UAVs we don't know which the runtime unbound:
+		if (NumUAVs == D3D11_KEEP_UNORDERED_ACCESS_VIEWS)
+			ps_uavs_valid = false;
+	} else if (NumUAVs != D3D11_KEEP_UNORDERED_ACCESS_VIEWS && om_valid) {
+		// Likewise if we are keeping the render targets and the UAVs
+		// overlap them:
+		for (i = UAVStartSlot; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+			if (rtvs[i])
+				om_valid = false;
+		}
+	}
+
+	if (NumUAVs != D3D11_KEEP_UNORDERED_ACCESS_VIEWS) {
+		// Any UAVs outside of the range being set are unbound:
+		num_ps_uavs = 0;
+		for (i = 0; i < num_uav_slots; i++) {
+			uav = NULL;
+			if (ppUnorderedAccessViews && i >= UAVStartSlot && i - UAVStartSlot < NumUAVs)
+				uav = ppUnorderedAccessViews[i - UAVStartSlot];
+			resource = view_resource(uav, ps_uavs_valid, ps_uavs[i], ps_uav_resources[i]);
+			if (resource) {
+				InvalidateInputsBoundTo(resource);
+				if (om_valid && (contains(rtv_resources, D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, resource) || dsv_resource == resource))
+					om_valid = false;
+				if (cs_uavs_valid && contains(cs_uav_resources, num_cs_uavs, resource))
+					cs_uavs_valid = false;
+				if (so_valid && contains(so_targets, D3D11_SO_BUFFER_SLOT_COUNT, resource))
+					so_valid = false;
+				num_ps_uavs = i + 1;
+			}
+			ps_uavs[i] = uav;
+			ps_uav_resources[i] = resource;
+		}
+		ps_uavs_valid = true;
+
+		// UAVs in slots this feature level does not have should be
+		// rejected by the runtime, but we don't count on it:
+		for (i = 0; ppUnorderedAccessViews && i < NumUAVs; i++) {
+			if (UAVStartSlot + i >= num_uav_slots)
+				InvalidateInputsBoundTo(view_resource(ppUnorderedAccessViews[i]));
+		}
+	}
+}
+
+void BindingShadow::SetComputeShaderUAVs(UINT StartSlot, UINT NumUAVs,
+		ID3D11UnorderedAccessView *const *ppUnorderedAccessViews)
+{
+	ID3D11UnorderedAccessView *uav;
+	ID3D11Resource *resource;
+	UINT i, slot;
+
+	for (i = 0; i < NumUAVs; i++) {
+		slot = StartSlot + i;
+		uav = ppUnorderedAccessViews ? ppUnorderedAccessViews[i] : NULL;
+
+		// UAVs in slots this feature level does not have should be
+		// rejected by the runtime, but we don't count on it:
+		if (slot >= num_uav_slots) {
+			InvalidateInputsBoundTo(view_resource(uav));
+			continue;
+		}
+
+		resource = view_resource(uav, cs_uavs_valid, cs_uavs[slot], cs_uav_resources[slot]);
+		if (resource) {
+			InvalidateInputsBoundTo(resource);
+			if (om_valid && (contains(rtv_resources, D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, resource) || dsv_resource == resource))
+				om_valid = false;
+			if (ps_uavs_valid && contains(ps_uav_resources, num_ps_uavs, resource))
+				ps_uavs_valid = false;
+			if (so_valid && contains(so_targets, D3D11_SO_BUFFER_SLOT_COUNT, resource))
+				so_valid = false;
+			if (slot >= num_cs_uavs)
+				num_cs_uavs = slot + 1;
+		}
+		cs_uavs[slot] = uav;
+		cs_uav_resources[slot] = resource;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Reads for the command lists:
+
+ID3D11ShaderResourceView* BindingShadow::GetShaderResource(ID3D11DeviceContext *context,
+		BindingShadowStage stage, UINT slot, ID3D11Resource **resource)
+{
+	ShaderStageBindings *s;
+
+	*resource = NULL;
+	if (stage >= BindingShadowStage::COUNT || slot >= D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT)
+		return NULL;
+
+	s = &stages[(int)stage];
+	if (!s->srvs_valid)
+		SyncShaderResources(context, stage);
+
+	if (!s->srvs[slot] || !s->srv_resources[slot])
+		return NULL;
+
+	s->srvs[slot]->AddRef();
+	s->srv_resources[slot]->AddRef();
+	*resource = s->srv_resources[slot];
+	return s->srvs[slot];
+}
+
+ID3D11Buffer* BindingShadow::GetConstantBuffer(ID3D11DeviceContext *context, BindingShadowStage stage, UINT slot)
+{
+	ShaderStageBindings *s;
+
+	if (stage >= BindingShadowStage::COUNT || slot >= D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT)
+		return NULL;
+
+	s = &stages[(int)stage];
+	if (!s->cbs_valid)
+		SyncConstantBuffers(context, stage);
+
+	if (s->cbs[slot])
+		s->cbs[slot]->AddRef();
+	return s->cbs[slot];
+}
+
+ID3D11Buffer* BindingShadow::GetVertexBuffer(ID3D11DeviceContext *context, UINT slot, UINT *stride, UINT *offset)
+{
+	if (slot >= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT)
+		return NULL;
+
+	if (!vbs_valid)
+		SyncVertexBuffers(context);
+
+	if (stride)
+		*stride = vb_strides[slot];
+	if (offset)
+		*offset = vb_offsets[slot];
+	if (vbs[slot])
+		vbs[slot]->AddRef();
+	return vbs[slot];
+}
+
+ID3D11Buffer* BindingShadow::GetIndexBuffer(ID3D11DeviceContext *context, DXGI_FORMAT *format, UINT *offset)
+{
+	if (!ib_valid)
+		SyncIndexBuffer(context);
+
+	if (format)
+		*format = ib_format;
+	if (offset)
+		*offset = ib_offset;
+	if (ib)
+		ib->AddRef();
+	return ib;
+}
+
+ID3D11Buffer* BindingShadow::GetStreamOutputTarget(ID3D11DeviceContext *context, UINT slot)
+{
+	if (slot >= D3D11_SO_BUFFER_SLOT_COUNT)
+		return NULL;
+
+	if (!so_valid)
+		SyncStreamOutputTargets(context);
+
+	if (so_targets[slot])
+		so_targets[slot]->AddRef();
+	return so_targets[slot];
+}
+
+ID3D11RenderTargetView* BindingShadow::GetRenderTarget(ID3D11DeviceContext *context, UINT slot, ID3D11Resource **resource)
+{
+	*resource = NULL;
+	if (slot >= D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT)
+		return NULL;
+
+	if (!om_valid)
+		SyncOutputMerger(context);
+
+	if (!rtvs[slot] || !rtv_resources[slot])
+		return NULL;
+
+	rtvs[slot]->AddRef();
+	rtv_resources[slot]->AddRef();
+	*resource = rtv_resources[slot];
+	return rtvs[slot];
+}
+
+ID3D11DepthStencilView* BindingShadow::GetDepthStencil(ID3D11DeviceContext *context, ID3D11Resource **resource)
+{
+	*resource = NULL;
+
+	if (!om_valid)
+		SyncOutputMerger(context);
+
+	if (!dsv || !dsv_resource)
+		return NULL;
+
+	dsv->AddRef();
+	dsv_resource->AddRef();
+	*resource = dsv_resource;
+	return dsv;
+}
+
+ID3D11UnorderedAccessView* BindingShadow::GetUnorderedAccessView(ID3D11DeviceContext *context,
+		BindingShadowStage stage, UINT slot, ID3D11Resource **resource)
+{
+	ID3D11UnorderedAccessView *uav;
+
+	*resource = NULL;
+	if (slot >= num_uav_slots)
+		return NULL;
+
+	switch (stage) {
+	case BindingShadowStage::PS:
+		if (!ps_uavs_valid)
+			SyncPixelShaderUAVs(context);
+		uav = ps_uavs[slot];
+		*resource = ps_uav_resources[slot];
+		break;
+	case BindingShadowStage::CS:
+		if (!cs_uavs_valid)
+			SyncComputeShaderUAVs(context);
+		uav = cs_uavs[slot];
+		*resource = cs_uav_resources[slot];
+		break;
+	default:
+		return NULL;
+	}
+
+	if (!uav || !*resource) {
+		*resource = NULL;
+		return NULL;
+	}
+
+	uav->AddRef();
+	(*resource)->AddRef();
+	return uav;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <d3d11_1.h>
+
+// Per-context shadow copy of the resources the game (and 3DMigoto) have bound
+// to the pipeline, maintained from the hooks HackerContext already intercepts.
+// This allows command lists to read what is bound in a given slot without a
+// round trip through the driver's Get*() calls, which AddRef every view they
+// return, and in the case of OMGetRenderTargets and SOGetTargets every lower
+// slot as well.
+//
+// The shadow does not hold references - anything recorded in it is held by
+// the pipeline itself for as long as it remains bound. Since a stale entry
+// would be a dangling pointer, each category of binding carries a valid flag
+// and anything we cannot track precisely clears that flag rather than guess:
+//
+//  - State changes we don't see the details of (SwapDeviceContextState,
+//    3DMigoto restoring a saved output merger state, etc) invalidate the
+//    affected categories.
+//  - The runtime silently unbinds inputs that are bound as an output, and
+//    refuses to bind an input that is currently bound as an output. We don't
+//    try to replicate its subresource granularity - any time the same
+//    resource is seen as both an input and an output the affected input
+//    category is invalidated.
+//
+// Binding a view asks it for its resource so that we can check for these
+// hazards, except when the same view is rebound to a slot it is already
+// recorded in, which is by far the most common case and is skipped entirely.
+//
+// An invalid category is resynchronised from the driver the next time it is
+// read, or the next time an input is bound while it is one of the outputs we
+// need to check against. ClearState() and friends reset everything to a
+// known empty state.
+//
+// Each HackerContext owns its own shadow, and a context is only ever used from
+// one thread at a time, so no locking is required. This also makes it safe
+// for deferred contexts - their state is independent of the immediate
+// context, and the interactions between them are limited to
+// ExecuteCommandList and FinishCommandList, which either leave the state
+// untouched or reset it to defaults depending on the Restore*State flag.
+
+enum class BindingShadowStage {
+	VS,
+	HS,
+	DS,
+	GS,
+	PS,
+	CS,
+
+	COUNT
+};
+
+BindingShadowStage binding_shadow_stage(wchar_t shader_type);
+
+class BindingShadow
+{
+private:
+	struct ShaderStageBindings {
+		ID3D11ShaderResourceView *srvs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+		ID3D11Resource *srv_resources[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+		UINT num_srvs; // High water mark to limit hazard scans
+		bool srvs_valid;
+
+		ID3D11Buffer *cbs[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+		bool cbs_valid;
+	};
+
+	ShaderStageBindings stages[(int)BindingShadowStage::COUNT];
+
+	ID3D11Buffer *vbs[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	UINT vb_strides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	UINT vb_offsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	UINT num_vbs;
+	bool vbs_valid;
+
+	ID3D11Buffer *ib;
+	DXGI_FORMAT ib_format;
+	UINT ib_offset;
+	bool ib_valid;
+
+	ID3D11Buffer *so_targets[D3D11_SO_BUFFER_SLOT_COUNT];
+	bool so_valid;
+
+	ID3D11RenderTargetView *rtvs[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+	ID3D11Resource *rtv_resources[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+	ID3D11DepthStencilView *dsv;
+	ID3D11Resource *dsv_resource;
+	bool om_valid;
+
+	// Sized for feature level 11.1. Only the first num_uav_slots of these
+	// are ever used, which is 8 on lower feature levels:
+	UINT num_uav_slots;
+
+	ID3D11UnorderedAccessView *ps_uavs[D3D11_1_UAV_SLOT_COUNT];
+	ID3D11Resource *ps_uav_resources[D3D11_1_UAV_SLOT_COUNT];
+	UINT num_ps_uavs; // High water mark to limit hazard scans
+	bool ps_uavs_valid;
+
+	ID3D11UnorderedAccessView *cs_uavs[D3D11_1_UAV_SLOT_COUNT];
+	ID3D11Resource *cs_uav_resources[D3D11_1_UAV_SLOT_COUNT];
+	UINT num_cs_uavs; // High water mark to limit hazard scans
+	bool cs_uavs_valid;
+
+	void SyncShaderResources(ID3D11DeviceContext *context, BindingShadowStage stage);
+	void SyncConstantBuffers(ID3D11DeviceContext *context, BindingShadowStage stage);
+	void SyncVertexBuffers(ID3D11DeviceContext *context);
+	void SyncIndexBuffer(ID3D11DeviceContext *context);
+	void SyncStreamOutputTargets(ID3D11DeviceContext *context);
+	void SyncOutputMerger(ID3D11DeviceContext *context);
+	void SyncPixelShaderUAVs(ID3D11DeviceContext *context);
+	void SyncComputeShaderUAVs(ID3D11DeviceContext *context);
+
+	bool IsBoundAsOutput(ID3D11DeviceContext *context, ID3D11Resource *resource);
+	void InvalidateInputsBoundTo(ID3D11Resource *resource);
+	void InvalidateOutputsBoundTo(ID3D11Resource *resource);
+
+public:
+	BindingShadow();
+
+	// Sets the number of UAV slots from the device's feature level:
+	void SetFeatureLevel(D3D_FEATURE_LEVEL level);
+
+	// Called after the corresponding call has been passed to the driver:
+	void SetShaderResources(ID3D11DeviceContext *context, BindingShadowStage stage,
+			UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView *const *ppShaderResourceViews);
+	void SetConstantBuffers(ID3D11DeviceContext *context, BindingShadowStage stage,
+			UINT StartSlot, UINT NumBuffers, ID3D11Buffer *const *ppConstantBuffers);
+	void SetVertexBuffers(ID3D11DeviceContext *context, UINT StartSlot, UINT NumBuffers,
+			ID3D11Buffer *const *ppVertexBuffers, const UINT *pStrides, const UINT *pOffsets);
+	void SetIndexBuffer(ID3D11DeviceContext *context, ID3D11Buffer *pIndexBuffer, DXGI_FORMAT Format, UINT Offset);
+	void SetStreamOutputTargets(UINT NumBuffers, ID3D11Buffer *const *ppSOTargets);
+	void SetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs,
+			ID3D11RenderTargetView *const *ppRenderTargetViews,
+			ID3D11DepthStencilView *pDepthStencilView,
+			UINT UAVStartSlot, UINT NumUAVs,
+			ID3D11UnorderedAccessView *const *ppUnorderedAccessViews);
+	void SetComputeShaderUAVs(UINT StartSlot, UINT NumUAVs,
+			ID3D11UnorderedAccessView *const *ppUnorderedAccessViews);
+
+	// The pipeline has been reset to its default (empty) state:
+	void Reset();
+	// The state of the pipeline is unknown:
+	void Invalidate();
+	void InvalidateOutputMerger();
+
+	// These return the bound objects with a reference held, like the
+	// corresponding Get*() calls. Views are only returned together with
+	// their resource - if either is NULL both will be:
+	ID3D11ShaderResourceView* GetShaderResource(ID3D11DeviceContext *context,
+			BindingShadowStage stage, UINT slot, ID3D11Resource **resource);
+	ID3D11Buffer* GetConstantBuffer(ID3D11DeviceContext *context, BindingShadowStage stage, UINT slot);
+	ID3D11Buffer* GetVertexBuffer(ID3D11DeviceContext *context, UINT slot, UINT *stride, UINT *offset);
+	ID3D11Buffer* GetIndexBuffer(ID3D11DeviceContext *context, DXGI_FORMAT *format, UINT *offset);
+	ID3D11Buffer* GetStreamOutputTarget(ID3D11DeviceContext *context, UINT slot);
+	ID3D11RenderTargetView* GetRenderTarget(ID3D11DeviceContext *context, UINT slot, ID3D11Resource **resource);
+	ID3D11DepthStencilView* GetDepthStencil(ID3D11DeviceContext *context, ID3D11Resource **resource);
+	ID3D11UnorderedAccessView* GetUnorderedAccessView(ID3D11DeviceContext *context,
+			BindingShadowStage stage, UINT slot, ID3D11Resource **resource);
+};
@@ -1,5 +1,3 @@
-// Include before util.h (or any header that includes util.h) to get pretty
-// version of LockResourceCreationMode:
 #include "lock.h"
 
 #include "CommandList.h"
@@ -120,6 +118,42 @@ static inline void profile_command_list_cmd_end(CommandListCommand *cmd, Command
 	}
 }
 
+// Runs the most common commands via a switch rather than a virtual call. The
+// qualified calls are resolved statically and can be inlined, which is only
+// valid because these commands' run() implementations are all final:
+static inline void run_command(CommandListCommand *cmd, CommandListState *state)
+{
+	switch (cmd->dispatch) {
+	case CommandListDispatch::PARAM_OVERRIDE:
+		static_cast<ParamOverride*>(cmd)->ParamOverride::run(state);
+		break;
+	case CommandListDispatch::VARIABLE_ASSIGNMENT:
+		static_cast<VariableAssignment*>(cmd)->VariableAssignment::run(state);
+		break;
+	case CommandListDispatch::IF:
+		static_cast<IfCommand*>(cmd)->IfCommand::run(state);
+		break;
+	case CommandListDispatch::CHECK_TEXTURE_OVERRIDE:
+		static_cast<CheckTextureOverrideCommand*>(cmd)->CheckTextureOverrideCommand::run(state);
+		break;
+	case CommandListDispatch::RUN_EXPLICIT_COMMAND_LIST:
+		static_cast<RunExplicitCommandList*>(cmd)->RunExplicitCommandList::run(state);
+		break;
+	case CommandListDispatch::RUN_LINKED_COMMAND_LIST:
+		static_cast<RunLinkedCommandList*>(cmd)->RunLinkedCommandList::run(state);
+		break;
+	case CommandListDispatch::RUN_CUSTOM_SHADER:
+		static_cast<RunCustomShaderCommand*>(cmd)->RunCustomShaderCommand::run(state);
+		break;
+	case CommandListDispatch::RESOURCE_COPY:
+		static_cast<ResourceCopyOperation*>(cmd)->ResourceCopyOperation::run(state);
+		break;
+	default:
+		cmd->run(state);
+		break;
+	}
+}
+
 static void _RunCommandList(CommandList *command_list, CommandListState *state, bool recursive=true)
 {
 	CommandList::Commands::iterator i;
@@ -142,7 +176,7 @@ static void _RunCommandList(CommandList *command_list, CommandListState *state,
 
 	for (i = command_list->commands.begin(); i < command_list->commands.end() && !state->aborted; i++) {
 		profile_command_list_cmd_start(i->get(), &profiling_state);
-		(*i)->run(state);
+		run_command(i->get(), state);
 		profile_command_list_cmd_end(i->get(), state, &profiling_state);
 	}
 
@@ -237,6 +271,8 @@ void RunViewCommandList(HackerDevice *mHackerDevice,
 		res->Release();
 }
 
+static void PublishPreSubstantiationRoots();
+
 void optimise_command_lists(HackerDevice *device)
 {
 	bool making_progress;
@@ -308,10 +344,388 @@ void optimise_command_lists(HackerDevice *device)
 	Profiling::update_cto_warning(!ignore_cto_post);
 
 	LogInfo("Command List Optimiser finished after %ums\n", GetTickCount() - start);
+
+	// Done here so that anything that was optimised out is not queued.
+	// Only the first device to be created after a config (re)load gets
+	// the registered command lists:
+	if (!registered_command_lists.empty())
+		PublishPreSubstantiationRoots();
+
 	registered_command_lists.clear();
 	dynamically_allocated_command_lists.clear();
 }
 
+// Custom resources and shaders are substantiated the first time a command
+// list uses them, which happens on the render thread in the middle of a frame
+// and can cause a noticeable hitch the first time a mod kicks in, especially
+// for resources loaded from large files. To hide this we substantiate them
+// ahead of time from the Present call within a small time budget each frame,
+// starting with anything used from [Present] and then [ShaderOverride]
+// sections, since those are the most likely to be needed first. The files
+// used by [Resource] sections are read from disk on a background thread in
+// the same order so that this does not block on I/O. Anything that has not
+// been reached by the time it is first used is still substantiated on demand,
+// exactly as before.
+//
+// optimise_command_lists() may run on whichever thread creates the device, so
+// it only hands the registered command lists over under
+// pre_substantiation_lock. The queue itself is built and processed by
+// RunPreSubstantiation() on the thread calling Present, which is also where
+// ReloadConfig() frees the customResources and customShaders it points into -
+// ReloadConfig() calls CancelPreSubstantiation() before doing so. The reader
+// thread only touches the shared CustomResourceFileData, so a reload is free
+// to drop the queue while it is still running.
+//
+// Once the config is loaded any thread running a command list (including a
+// deferred context) may substantiate a custom resource at the same time as
+// the Present thread. CustomResource::file_data is therefore attached when
+// the command lists are handed over, before anything can run them, and the
+// Present thread and reader thread only ever use their own references to it
+// after that. Whichever thread wins the interlocked substantiated flag in
+// Substantiate() is the only one to touch the resource's copy.
+
+CRITICAL_SECTION pre_substantiation_lock;
+
+// Per-frame time budget for pre-substantiation. At least one item will be
+// substantiated each frame regardless, so this is mostly to stop a large
+// number of cheap items adding up:
+static const double PRE_SUBSTANTIATION_BUDGET_MS = 1.0;
+
+// Creating a shader makes the driver compile it, which takes roughly in
+// proportion to the size of the bytecode and can run into tens of
+// milliseconds for a large compute shader. Since the first item each frame is
+// not subject to the budget, custom shaders larger than this are left to be
+// substantiated on demand rather than risk a hitch on every Present:
+static const SIZE_T PRE_SUBSTANTIATION_MAX_SHADER_BYTES = 32 * 1024;
+
+typedef std::unordered_map<CustomResource*, std::shared_ptr<CustomResourceFileData>> PreSubstantiationFiles;
+
+// Handed from optimise_command_lists() to the Present thread, protected by
+// pre_substantiation_lock:
+static std::vector<CommandList*> pre_substantiation_roots;
+static PreSubstantiationFiles pre_substantiation_files;
+static bool pre_substantiation_pending;
+
+struct PreSubstantiationItem {
+	CustomResource *resource;
+	CustomShader *shader;
+	std::shared_ptr<CustomResourceFileData> file;
+};
+static std::vector<PreSubstantiationItem> pre_substantiation_queue;
+static size_t pre_substantiation_next;
+
+static void queue_pre_substantiation(CommandList *command_list,
+		std::unordered_set<CommandList*> *visited,
+		std::unordered_set<void*> *queued,
+		PreSubstantiationFiles *attached,
+		std::vector<std::shared_ptr<CustomResourceFileData>> *files);
+
+static void queue_pre_substantiation(CustomResource *resource,
+		std::unordered_set<void*> *queued,
+		PreSubstantiationFiles *attached,
+		std::vector<std::shared_ptr<CustomResourceFileData>> *files)
+{
+	PreSubstantiationFiles::iterator i;
+
+	if (InterlockedCompareExchange(&resource->substantiated, 0, 0) || resource->defer_substantiation)
+		return;
+
+	// Resources without a file or type are only ever copied to, and
+	// Substantiate() would do nothing with them:
+	if (resource->filename.empty() && resource->override_type == CustomResourceType::INVALID)
+		return;
+
+	if (!queued->insert(resource).second)
+		return;
+
+	// Our own reference to the file data that was attached to the
+	// resource before it could be used, never resource->file_data itself:
+	i = attached->find(resource);
+	if (i != attached->end()) {
+		files->push_back(i->second);
+		pre_substantiation_queue.push_back({resource, NULL, i->second});
+	} else
+		pre_substantiation_queue.push_back({resource, NULL, NULL});
+}
+
+static SIZE_T custom_shader_bytecode_size(CustomShader *shader)
+{
+	ID3DBlob *blobs[] = {shader->vs_bytecode, shader->hs_bytecode, shader->ds_bytecode,
+		shader->gs_bytecode, shader->ps_bytecode, shader->cs_bytecode};
+	SIZE_T size = 0;
+
+	for (ID3DBlob *blob : blobs) {
+		if (blob)
+			size += blob->GetBufferSize();
+	}
+
+	return size;
+}
+
+static void queue_pre_substantiation(CustomShader *shader,
+		std::unordered_set<CommandList*> *visited,
+		std::unordered_set<void*> *queued,
+		PreSubstantiationFiles *attached,
+		std::vector<std::shared_ptr<CustomResourceFileData>> *files)
+{
+	if (!shader->substantiated && queued->insert(shader).second) {
+		if (custom_shader_bytecode_size(shader) <= PRE_SUBSTANTIATION_MAX_SHADER_BYTES)
+			pre_substantiation_queue.push_back({NULL, shader, NULL});
+	}
+
+	queue_pre_substantiation(&shader->command_list, visited, queued, attached, files);
+	queue_pre_substantiation(&shader->post_command_list, visited, queued, attached, files);
+}
+
+// Walks a command list and anything it runs, queuing the custom resources and
+// shaders it uses in the order they are encountered. This only needs to find
+// the common cases - anything missed will be substantiated on demand:
+static void queue_pre_substantiation(CommandList *command_list,
+		std::unordered_set<CommandList*> *visited,
+		std::unordered_set<void*> *queued,
+		PreSubstantiationFiles *attached,
+		std::vector<std::shared_ptr<CustomResourceFileData>> *files)
+{
+	ResourceCopyOperation *copy;
+	RunExplicitCommandList *run_explicit;
+	IfCommand *if_command;
+
+	if (!command_list || !visited->insert(command_list).second)
+		return;
+
+	for (auto &command : command_list->commands) {
+		switch (command->dispatch) {
+		case CommandListDispatch::RESOURCE_COPY:
+			copy = static_cast<ResourceCopyOperation*>(command.get());
+			if (copy->src.type == ResourceCopyTargetType::CUSTOM_RESOURCE)
+				queue_pre_substantiation(copy->src.custom_resource, queued, attached, files);
+			break;
+		case CommandListDispatch::RUN_CUSTOM_SHADER:
+			queue_pre_substantiation(static_cast<RunCustomShaderCommand*>(command.get())->custom_shader,
+					visited, queued, attached, files);
+			break;
+		case CommandListDispatch::RUN_EXPLICIT_COMMAND_LIST:
+			run_explicit = static_cast<RunExplicitCommandList*>(command.get());
+			queue_pre_substantiation(&run_explicit->command_list_section->command_list, visited, queued, attached, files);
+			queue_pre_substantiation(&run_explicit->command_list_section->post_command_list, visited, queued, attached, files);
+			break;
+		case CommandListDispatch::RUN_LINKED_COMMAND_LIST:
+			queue_pre_substantiation(static_cast<RunLinkedCommandList*>(command.get())->link,
+					visited, queued, attached, files);
+			break;
+		case CommandListDispatch::IF:
+			if_command = static_cast<IfCommand*>(command.get());
+			queue_pre_substantiation(if_command->true_commands_pre.get(), visited, queued, attached, files);
+			queue_pre_substantiation(if_command->true_commands_post.get(), visited, queued, attached, files);
+			queue_pre_substantiation(if_command->false_commands_pre.get(), visited, queued, attached, files);
+			queue_pre_substantiation(if_command->false_commands_post.get(), visited, queued, attached, files);
+			break;
+		}
+	}
+}
+
+static DWORD WINAPI pre_substantiation_reader(LPVOID param)
+{
+	std::vector<std::shared_ptr<CustomResourceFileData>> *files =
+		(std::vector<std::shared_ptr<CustomResourceFileData>>*)param;
+	DWORD size, read_size;
+	HANDLE f;
+
+	for (auto &file : *files) {
+		// Skip anything that has already been loaded on demand, or
+		// dropped by a config reload:
+		if (InterlockedCompareExchange(&file->ready, 0, 0) || file.use_count() == 1)
+			continue;
+
+		f = CreateFile(file->filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (f == INVALID_HANDLE_VALUE)
+			goto err;
+
+		size = GetFileSize(f, 0);
+		if (size == INVALID_FILE_SIZE)
+			goto err_close;
+
+		try {
+			file->data.resize(size);
+		} catch (std::bad_alloc) {
+			goto err_close;
+		}
+
+		if (!ReadFile(f, file->data.data(), size, &read_size, 0) || size != read_size)
+			goto err_close;
+
+		CloseHandle(f);
+		InterlockedExchange(&file->ready, 1);
+		continue;
+err_close:
+		CloseHandle(f);
+err:
+		// Errors are reported when the file is loaded on demand:
+		file->data.clear();
+		InterlockedExchange(&file->ready, -1);
+	}
+
+	delete files;
+	return 0;
+}
+
+static void PublishPreSubstantiationRoots()
+{
+	std::unordered_set<CommandList*> dynamic;
+
+	// The if/else command lists are freed along with
+	// dynamically_allocated_command_lists if their IfCommand was optimised
+	// out, so only the sections themselves are handed over. Any surviving
+	// if/else blocks are reached through their IfCommand anyway:
+	for (auto &command_list : dynamically_allocated_command_lists)
+		dynamic.insert(command_list.get());
+
+	EnterCriticalSectionPretty(&pre_substantiation_lock);
+	pre_substantiation_roots.clear();
+	pre_substantiation_files.clear();
+	for (CommandList *command_list : registered_command_lists) {
+		if (!dynamic.count(command_list))
+			pre_substantiation_roots.push_back(command_list);
+	}
+	// Nothing can run the new command lists yet, so this is the last
+	// chance to attach the file data without racing Substantiate():
+	for (auto &i : customResources) {
+		CustomResource *resource = &i.second;
+
+		if (resource->filename.empty() || resource->defer_substantiation ||
+		    resource->substantiated || resource->file_data)
+			continue;
+
+		resource->file_data = std::make_shared<CustomResourceFileData>(resource->filename);
+		pre_substantiation_files[resource] = resource->file_data;
+	}
+	pre_substantiation_pending = true;
+	LeaveCriticalSectionPretty(&pre_substantiation_lock);
+}
+
+// Called from ReloadConfig() before the config is freed:
+void CancelPreSubstantiation()
+{
+	EnterCriticalSectionPretty(&pre_substantiation_lock);
+	pre_substantiation_roots.clear();
+	pre_substantiation_files.clear();
+	pre_substantiation_pending = false;
+	LeaveCriticalSectionPretty(&pre_substantiation_lock);
+
+	pre_substantiation_queue.clear();
+	pre_substantiation_next = 0;
+}
+
+static void SchedulePreSubstantiation(std::vector<CommandList*> *roots,
+		PreSubstantiationFiles *attached)
+{
+	std::vector<std::shared_ptr<CustomResourceFileData>> *files;
+	std::unordered_set<CommandList*> visited;
+	std::unordered_set<void*> queued;
+	HANDLE thread;
+	int pass;
+
+	pre_substantiation_queue.clear();
+	pre_substantiation_next = 0;
+
+	files = new std::vector<std::shared_ptr<CustomResourceFileData>>;
+
+	queue_pre_substantiation(&G->present_command_list, &visited, &queued, attached, files);
+	queue_pre_substantiation(&G->post_present_command_list, &visited, &queued, attached, files);
+	for (pass = 0; pass < 2; pass++) {
+		for (CommandList *command_list : *roots) {
+			if (pass == 0 && _wcsnicmp(command_list->ini_section.c_str(), L"ShaderOverride", 14))
+				continue;
+			queue_pre_substantiation(command_list, &visited, &queued, attached, files);
+		}
+	}
+
+	if (pre_substantiation_queue.empty()) {
+		delete files;
+		return;
+	}
+
+	LogInfo("Queued %Iu custom resources and shaders for pre-substantiation, %Iu files to read\n",
+			pre_substantiation_queue.size(), files->size());
+
+	if (files->empty()) {
+		delete files;
+		return;
+	}
+
+	thread = CreateThread(NULL, 0, pre_substantiation_reader, files, 0, NULL);
+	if (!thread) {
+		// Everything will be read on demand instead:
+		for (auto &file : *files)
+			InterlockedExchange(&file->ready, -1);
+		delete files;
+		return;
+	}
+	SetThreadPriority(thread, THREAD_PRIORITY_BELOW_NORMAL);
+	CloseHandle(thread);
+}
+
+// Called from Present with the device that is actually rendering the game:
+void RunPreSubstantiation(HackerDevice *device)
+{
+	std::vector<CommandList*> roots;
+	PreSubstantiationFiles attached;
+	LARGE_INTEGER start, now, freq;
+	PreSubstantiationItem *item;
+	ID3D11Device1 *mOrigDevice1;
+	bool pending;
+
+	EnterCriticalSectionPretty(&pre_substantiation_lock);
+	pending = pre_substantiation_pending;
+	if (pending) {
+		roots.swap(pre_substantiation_roots);
+		attached.swap(pre_substantiation_files);
+		pre_substantiation_pending = false;
+	}
+	LeaveCriticalSectionPretty(&pre_substantiation_lock);
+
+	if (pending) {
+		SchedulePreSubstantiation(&roots, &attached);
+		// Start on it next frame - this one already paid for the walk:
+		return;
+	}
+
+	if (pre_substantiation_next >= pre_substantiation_queue.size())
+		return;
+
+	mOrigDevice1 = device->GetPassThroughOrigDevice1();
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&start);
+
+	while (pre_substantiation_next < pre_substantiation_queue.size()) {
+		item = &pre_substantiation_queue[pre_substantiation_next];
+
+		if (item->resource) {
+			// Don't stall waiting for the reader thread - we
+			// will get to this one in a later frame:
+			if (item->file && !InterlockedCompareExchange(&item->file->ready, 0, 0))
+				break;
+			item->resource->Substantiate(mOrigDevice1, device->mStereoHandle,
+					(D3D11_BIND_FLAG)0, (D3D11_RESOURCE_MISC_FLAG)0);
+		} else
+			item->shader->substantiate(mOrigDevice1);
+
+		pre_substantiation_next++;
+
+		QueryPerformanceCounter(&now);
+		if ((now.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart >= PRE_SUBSTANTIATION_BUDGET_MS)
+			break;
+	}
+
+	if (pre_substantiation_next == pre_substantiation_queue.size()) {
+		LogInfo("Pre-substantiation of %Iu custom resources and shaders complete\n",
+				pre_substantiation_queue.size());
+		pre_substantiation_queue.clear();
+		pre_substantiation_next = 0;
+	}
+}
+
 static bool AddCommandToList(CommandListCommand *command,
 		CommandList *explicit_command_list,
 		CommandList *sensible_command_list,
@@ -1198,6 +1612,11 @@ void DrawCommand::run(CommandListState *state)
 
 	Profiling::injected_draw_calls++;
 
+	// Frame analysis doesn't see our draw calls, so it can't tell what
+	// this might write to and needs to assume it could be anything:
+	if (G->analyse_frame)
+		MarkAllResourcesWritten();
+
 	switch (type) {
 		case DrawCommandType::DRAW:
 			eval_args(2, eargs, state);
@@ -1810,7 +2229,36 @@ CustomShader::~CustomShader()
 		sampler_state->Release();
 }
 
-static bool load_cached_shader(FILETIME hlsl_timestamp, wchar_t *cache_path, ID3DBlob **ppBytecode)
+CustomShaderCompileJob::CustomShaderCompileJob(CustomShader *shader, char type, const wchar_t *filename,
+		const wstring *namespace_path, D3DCompileFlags compile_flags) :
+	shader(shader),
+	type(type),
+	filename(filename),
+	namespace_path(*namespace_path),
+	compile_flags(compile_flags),
+	bytecode(NULL),
+	failed(false),
+	done(false),
+	store_cache(false)
+{}
+
+CustomShaderCompileJob::~CustomShaderCompileJob()
+{
+	if (bytecode)
+		bytecode->Release();
+}
+
+static void job_log(CustomShaderCompileJob *job, int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	job->log.vLog(level, fmt, ap);
+	va_end(ap);
+}
+
+static bool load_cached_shader(FILETIME hlsl_timestamp, const wchar_t *cache_path, ID3DBlob **ppBytecode,
+		CustomShaderCompileJob *job)
 {
 	FILETIME cache_timestamp;
 	HANDLE f_cache;
@@ -1822,23 +2270,23 @@ static bool load_cached_shader(FILETIME hlsl_timestamp, wchar_t *cache_path, ID3
 
 	if (!GetFileTime(f_cache, NULL, NULL, &cache_timestamp)
 	 || CompareFileTime(&hlsl_timestamp, &cache_timestamp)) {
-		LogInfo("    Discarding stale cached shader: %S\n", cache_path);
+		job_log(job, -1, "    Discarding stale cached shader: %S\n", cache_path);
 		goto err_close;
 	}
 
 	filesize = GetFileSize(f_cache, 0);
 	if (FAILED(D3DCreateBlob(filesize, ppBytecode))) {
-		LogInfo("    D3DCreateBlob failed\n");
+		job_log(job, -1, "    D3DCreateBlob failed\n");
 		goto err_close;
 	}
 
 	if (!ReadFile(f_cache, (*ppBytecode)->GetBufferPointer(), (DWORD)(*ppBytecode)->GetBufferSize(), &readsize, 0)
 			|| readsize != filesize) {
-		LogInfo("    Error reading cached shader\n");
+		job_log(job, -1, "    Error reading cached shader\n");
 		goto err_free;
 	}
 
-	LogInfo("    Loaded cached shader: %S\n", cache_path);
+	job_log(job, -1, "    Loaded cached shader: %S\n", cache_path);
 	CloseHandle(f_cache);
 	return true;
 
@@ -1857,9 +2305,12 @@ static const D3D_SHADER_MACRO gs_macros[] = { "GEOMETRY_SHADER", "", NULL, NULL
 static const D3D_SHADER_MACRO ps_macros[] = { "PIXEL_SHADER", "", NULL, NULL };
 static const D3D_SHADER_MACRO cs_macros[] = { "COMPUTE_SHADER", "", NULL, NULL };
 
-// This is similar to the other compile routines, but still distinct enough to
-// get it's own function for now - TODO: Refactor out the common code
-bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, const wstring *namespace_path)
+// Loads a custom shader from the shader cache or compiles it from source. This
+// may be called from a worker thread, so it must not touch anything other than
+// the job - anything it would log, including from the include handler, is
+// recorded in the job to be replayed later and the shader cache is written
+// when the result is consumed.
+static void compile_custom_shader(CustomShaderCompileJob *job)
 {
 	wchar_t wpath[MAX_PATH], cache_path[MAX_PATH];
 	char apath[MAX_PATH];
@@ -1868,99 +2319,83 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 	vector<char> srcData;
 	HRESULT hr;
 	char shaderModel[7];
-	ID3DBlob **ppBytecode = NULL;
 	ID3DBlob *pErrorMsgs = NULL;
 	const D3D_SHADER_MACRO *macros = NULL;
 	bool found = false;
-	FILETIME timestamp;
 
-	LogInfo("  %cs=%S\n", type, filename);
+	job->done = true;
+	job->failed = true;
 
-	switch(type) {
+	switch(job->type) {
 		case 'v':
-			ppBytecode = &vs_bytecode;
 			macros = vs_macros;
-			vs_override = true;
 			break;
 		case 'h':
-			ppBytecode = &hs_bytecode;
 			macros = hs_macros;
-			hs_override = true;
 			break;
 		case 'd':
-			ppBytecode = &ds_bytecode;
 			macros = ds_macros;
-			ds_override = true;
 			break;
 		case 'g':
-			ppBytecode = &gs_bytecode;
 			macros = gs_macros;
-			gs_override = true;
 			break;
 		case 'p':
-			ppBytecode = &ps_bytecode;
 			macros = ps_macros;
-			ps_override = true;
 			break;
 		case 'c':
-			ppBytecode = &cs_bytecode;
 			macros = cs_macros;
-			cs_override = true;
 			break;
 		default:
 			// Should not happen
-			LogOverlay(LOG_DIRE, "CustomShader::compile: invalid shader type\n");
-			goto err;
+			job_log(job, LOG_DIRE, "CustomShader::compile: invalid shader type\n");
+			return;
 	}
 
-	// Special value to unbind the shader instead:
-	if (!_wcsicmp(filename, L"null"))
-		return false;
-
 	// If this section was not in the main d3dx.ini, look
 	// for a file relative to the config it came from
 	// first, then try relative to the 3DMigoto directory:
 	found = false;
-	if (!namespace_path->empty()) {
+	if (!job->namespace_path.empty()) {
 		GetModuleFileName(migoto_handle, wpath, MAX_PATH);
 		wcsrchr(wpath, L'\\')[1] = 0;
-		wcscat(wpath, namespace_path->c_str());
-		wcscat(wpath, filename);
+		wcscat(wpath, job->namespace_path.c_str());
+		wcscat(wpath, job->filename.c_str());
 		if (GetFileAttributes(wpath) != INVALID_FILE_ATTRIBUTES)
 			found = true;
 	}
 	if (!found) {
 		if (!GetModuleFileName(migoto_handle, wpath, MAX_PATH)) {
-			LogOverlay(LOG_DIRE, "CustomShader::compile: GetModuleFileName failed\n");
-			goto err;
+			job_log(job, LOG_DIRE, "CustomShader::compile: GetModuleFileName failed\n");
+			return;
 		}
 		wcsrchr(wpath, L'\\')[1] = 0;
-		wcscat(wpath, filename);
+		wcscat(wpath, job->filename.c_str());
 	}
 
 	f = CreateFile(wpath, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (f == INVALID_HANDLE_VALUE) {
-		LogOverlay(LOG_WARNING, "Shader not found: %S\n", wpath);
-		goto err;
+		job_log(job, LOG_WARNING, "Shader not found: %S\n", wpath);
+		return;
 	}
 
 	// Currently always using shader model 5, could allow this to be
 	// overridden in the future:
-	_snprintf_s(shaderModel, 7, 7, "%cs_5_0", type);
+	_snprintf_s(shaderModel, 7, 7, "%cs_5_0", job->type);
 
 	// XXX: If we allow the compilation to be customised further (e.g. with
 	// addition preprocessor defines), make the cache filename unique for
 	// each possible combination
 	wchar_t *ext = wcsrchr(wpath, L'.');
 	if (ext > wcsrchr(wpath, L'\\'))
-		swprintf_s(cache_path, MAX_PATH, L"%.*s.%S.%x.bin", (int)(ext - wpath), wpath, shaderModel, (UINT)compile_flags);
+		swprintf_s(cache_path, MAX_PATH, L"%.*s.%S.%x.bin", (int)(ext - wpath), wpath, shaderModel, (UINT)job->compile_flags);
 	else
-		swprintf_s(cache_path, MAX_PATH, L"%s.%S.%x.bin", wpath, shaderModel, (UINT)compile_flags);
+		swprintf_s(cache_path, MAX_PATH, L"%s.%S.%x.bin", wpath, shaderModel, (UINT)job->compile_flags);
 
-	GetFileTime(f, NULL, NULL, &timestamp);
-	if (load_cached_shader(timestamp, cache_path, ppBytecode)) {
+	GetFileTime(f, NULL, NULL, &job->timestamp);
+	if (load_cached_shader(job->timestamp, cache_path, &job->bytecode, job)) {
 		CloseHandle(f);
-		return false;
+		job->failed = false;
+		return;
 	}
 
 	srcDataSize = GetFileSize(f, 0);
@@ -1968,8 +2403,9 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 
 	if (!ReadFile(f, srcData.data(), srcDataSize, &readSize, 0)
 			|| srcDataSize != readSize) {
-		LogInfo("    Error reading HLSL file\n");
-		goto err_close;
+		job_log(job, -1, "    Error reading HLSL file\n");
+		CloseHandle(f);
+		return;
 	}
 	CloseHandle(f);
 
@@ -1983,45 +2419,149 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 	// that we can make reloading work better when using includes:
 	wcstombs(apath, wpath, MAX_PATH);
 	{
-		MigotoIncludeHandler include_handler(apath);
+		MigotoIncludeHandler include_handler(apath, &job->log);
 		hr = D3DCompile(srcData.data(), srcDataSize, apath, macros,
 			G->recursive_include == -1 ? D3D_COMPILE_STANDARD_FILE_INCLUDE : &include_handler,
-			"main", shaderModel, (UINT)compile_flags, 0, ppBytecode, &pErrorMsgs);
+			"main", shaderModel, (UINT)job->compile_flags, 0, &job->bytecode, &pErrorMsgs);
 	}
 
 	if (pErrorMsgs) {
 		LPVOID errMsg = pErrorMsgs->GetBufferPointer();
 		SIZE_T errSize = pErrorMsgs->GetBufferSize();
-		LogInfo("--------------------------------------------- BEGIN ---------------------------------------------\n");
-		LogOverlay(LOG_NOTICE, "%*s\n", errSize, errMsg);
-		LogInfo("---------------------------------------------- END ----------------------------------------------\n");
+		job_log(job, -1, "--------------------------------------------- BEGIN ---------------------------------------------\n");
+		job_log(job, LOG_NOTICE, "%*s\n", errSize, errMsg);
+		job_log(job, -1, "---------------------------------------------- END ----------------------------------------------\n");
 		pErrorMsgs->Release();
 	}
 
 	if (FAILED(hr)) {
-		LogOverlay(LOG_WARNING, "Error compiling custom shader\n");
-		goto err;
+		job_log(job, LOG_WARNING, "Error compiling custom shader\n");
+		return;
+	}
+
+	job->cache_path = cache_path;
+	job->store_cache = true;
+	job->failed = false;
+}
+
+static DWORD WINAPI compile_custom_shaders_worker(LPVOID param)
+{
+	CustomShaderCompileQueue *queue = (CustomShaderCompileQueue*)param;
+
+	queue->Work(compile_custom_shader);
+
+	return 0;
+}
+
+// Runs the jobs on a pool of worker threads and waits for them to finish. If
+// the pool cannot be started the jobs are left undone, and will be compiled
+// serially as they are consumed instead.
+void compile_custom_shaders(CustomShaderCompileQueue *queue)
+{
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	SYSTEM_INFO sysinfo;
+	DWORD num_threads, started, i;
+
+	GetSystemInfo(&sysinfo);
+	num_threads = min(sysinfo.dwNumberOfProcessors, (DWORD)queue->jobs.size());
+	num_threads = min(num_threads, (DWORD)MAXIMUM_WAIT_OBJECTS);
+	if (num_threads < 2)
+		return;
+
+	for (started = 0; started < num_threads; started++) {
+		threads[started] = CreateThread(NULL, 0, compile_custom_shaders_worker, queue, 0, NULL);
+		if (!threads[started])
+			break;
 	}
+	if (!started)
+		return;
 
-	if (G->CACHE_SHADERS) {
+	LogInfo("Compiling %Iu custom shaders on %u threads\n", queue->jobs.size(), started);
+
+	WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+	for (i = 0; i < started; i++)
+		CloseHandle(threads[i]);
+}
+
+bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, const wstring *namespace_path,
+		CustomShaderCompileJob *job)
+{
+	std::unique_ptr<CustomShaderCompileJob> serial_job;
+	ID3DBlob **ppBytecode = NULL;
+
+	LogInfo("  %cs=%S\n", type, filename);
+
+	switch(type) {
+		case 'v':
+			ppBytecode = &vs_bytecode;
+			vs_override = true;
+			break;
+		case 'h':
+			ppBytecode = &hs_bytecode;
+			hs_override = true;
+			break;
+		case 'd':
+			ppBytecode = &ds_bytecode;
+			ds_override = true;
+			break;
+		case 'g':
+			ppBytecode = &gs_bytecode;
+			gs_override = true;
+			break;
+		case 'p':
+			ppBytecode = &ps_bytecode;
+			ps_override = true;
+			break;
+		case 'c':
+			ppBytecode = &cs_bytecode;
+			cs_override = true;
+			break;
+		default:
+			// Should not happen
+			LogOverlay(LOG_DIRE, "CustomShader::compile: invalid shader type\n");
+			return true;
+	}
+
+	// Special value to unbind the shader instead:
+	if (!_wcsicmp(filename, L"null"))
+		return false;
+
+	// Only use a precompiled result if it was compiled from the same
+	// inputs we have now, otherwise compile it here:
+	if (!job || !job->done || job->shader != this || job->type != type
+			|| job->compile_flags != compile_flags
+			|| _wcsicmp(job->filename.c_str(), filename)
+			|| job->namespace_path != *namespace_path) {
+		serial_job.reset(new CustomShaderCompileJob(this, type, filename, namespace_path, compile_flags));
+		job = serial_job.get();
+		compile_custom_shader(job);
+	}
+
+	job->log.Replay(
+		[](const char *msg) { LogInfo("%s", msg); },
+		[](int level, const char *msg) { LogOverlay((LogLevel)level, "%s", msg); });
+
+	if (job->failed)
+		return true;
+
+	*ppBytecode = job->bytecode;
+	job->bytecode = NULL;
+
+	if (G->CACHE_SHADERS && job->store_cache) {
 		FILE *fw;
 
-		wfopen_ensuring_access(&fw, cache_path, L"wb");
+		wfopen_ensuring_access(&fw, job->cache_path.c_str(), L"wb");
 		if (fw) {
-			LogInfo("    Storing compiled shader to %S\n", cache_path);
+			LogInfo("    Storing compiled shader to %S\n", job->cache_path.c_str());
 			fwrite((*ppBytecode)->GetBufferPointer(), 1, (*ppBytecode)->GetBufferSize(), fw);
 			fclose(fw);
 
-			set_file_last_write_time(cache_path, &timestamp);
+			set_file_last_write_time(&job->cache_path[0], &job->timestamp);
 		} else
-			LogInfo("    Error writing compiled shader to %S\n", cache_path);
+			LogInfo("    Error writing compiled shader to %S\n", job->cache_path.c_str());
 	}
 
 	return false;
-err_close:
-	CloseHandle(f);
-err:
-	return true;
 }
 
 void CustomShader::substantiate(ID3D11Device *mOrigDevice1)
@@ -2080,20 +2620,6 @@ void CustomShader::substantiate(ID3D11Device *mOrigDevice1)
 		mOrigDevice1->CreateSamplerState(&sampler_desc, &sampler_state);
 }
 
-// Similar to memcpy, but also takes a mask. Any bits in the mask that are set
-// to 0 will be unchanged in the destination, while bits that are set to 1 will
-// be copied from the source buffer.
-static void memcpy_masked_merge(void *dest, void *src, void *mask, size_t n)
-{
-	char *c_dest = (char*)dest;
-	char *c_src = (char*)src;
-	char *c_mask = (char*)mask;
-	size_t i;
-
-	for (i = 0; i < n; i++)
-		c_dest[i] = c_dest[i] & ~c_mask[i] | c_src[i] & c_mask[i];
-}
-
 void CustomShader::merge_blend_states(ID3D11BlendState *src_state, FLOAT src_blend_factor[4], UINT src_sample_mask, ID3D11Device *mOrigDevice1)
 {
 	D3D11_BLEND_DESC src_desc;
@@ -2102,9 +2628,19 @@ void CustomShader::merge_blend_states(ID3D11BlendState *src_state, FLOAT src_ble
 	if (blend_override != 2)
 		return;
 
+	for (i = 0; i < 4; i++) {
+		if (blend_factor_merge_mask[i])
+			blend_factor[i] = src_blend_factor[i];
+	}
+	blend_sample_mask = blend_sample_mask & ~blend_sample_mask_merge_mask | src_sample_mask & blend_sample_mask_merge_mask;
+
 	if (blend_state)
 		blend_state->Release();
-	blend_state = NULL;
+	blend_state = merged_blend_states.find(src_state);
+	if (blend_state) {
+		blend_state->AddRef();
+		return;
+	}
 
 	if (src_state) {
 		src_state->GetDesc(&src_desc);
@@ -2128,13 +2664,8 @@ void CustomShader::merge_blend_states(ID3D11BlendState *src_state, FLOAT src_ble
 
 	memcpy_masked_merge(&blend_desc, &src_desc, &blend_mask, sizeof(D3D11_BLEND_DESC));
 
-	for (i = 0; i < 4; i++) {
-		if (blend_factor_merge_mask[i])
-			blend_factor[i] = src_blend_factor[i];
-	}
-	blend_sample_mask = blend_sample_mask & ~blend_sample_mask_merge_mask | src_sample_mask & blend_sample_mask_merge_mask;
-
 	mOrigDevice1->CreateBlendState(&blend_desc, &blend_state);
+	merged_blend_states.insert(src_state, blend_state);
 }
 
 void CustomShader::merge_depth_stencil_states(ID3D11DepthStencilState *src_state, UINT src_stencil_ref, ID3D11Device *mOrigDevice1)
@@ -2144,9 +2675,15 @@ void CustomShader::merge_depth_stencil_states(ID3D11DepthStencilState *src_state
 	if (depth_stencil_override != 2)
 		return;
 
+	stencil_ref = stencil_ref & ~stencil_ref_mask | src_stencil_ref & stencil_ref_mask;
+
 	if (depth_stencil_state)
 		depth_stencil_state->Release();
-	depth_stencil_state = NULL;
+	depth_stencil_state = merged_depth_stencil_states.find(src_state);
+	if (depth_stencil_state) {
+		depth_stencil_state->AddRef();
+		return;
+	}
 
 	if (src_state) {
 		src_state->GetDesc(&src_desc);
@@ -2171,9 +2708,9 @@ void CustomShader::merge_depth_stencil_states(ID3D11DepthStencilState *src_state
 	}
 
 	memcpy_masked_merge(&depth_stencil_desc, &src_desc, &depth_stencil_mask, sizeof(D3D11_DEPTH_STENCIL_DESC));
-	stencil_ref = stencil_ref & ~stencil_ref_mask | src_stencil_ref & stencil_ref_mask;
 
 	mOrigDevice1->CreateDepthStencilState(&depth_stencil_desc, &depth_stencil_state);
+	merged_depth_stencil_states.insert(src_state, depth_stencil_state);
 }
 
 void CustomShader::merge_rasterizer_states(ID3D11RasterizerState *src_state, ID3D11Device *mOrigDevice1)
@@ -2185,7 +2722,11 @@ void CustomShader::merge_rasterizer_states(ID3D11RasterizerState *src_state, ID3
 
 	if (rs_state)
 		rs_state->Release();
-	rs_state = NULL;
+	rs_state = merged_rs_states.find(src_state);
+	if (rs_state) {
+		rs_state->AddRef();
+		return;
+	}
 
 	if (src_state) {
 		src_state->GetDesc(&src_desc);
@@ -2208,6 +2749,7 @@ void CustomShader::merge_rasterizer_states(ID3D11RasterizerState *src_state, ID3
 	memcpy_masked_merge(&rs_desc, &src_desc, &rs_mask, sizeof(D3D11_RASTERIZER_DESC));
 
 	mOrigDevice1->CreateRasterizerState(&rs_desc, &rs_state);
+	merged_rs_states.insert(src_state, rs_state);
 }
 
 struct saved_shader_inst
@@ -2375,6 +2917,7 @@ void RunCustomShaderCommand::run(CommandListState *state)
 
 	mOrigContext1->RSSetViewports(num_viewports, saved_viewports);
 	restore_om_state(mOrigContext1, &om_state);
+	state->mHackerContext->GetBindingShadow()->InvalidateOutputMerger();
 
 	if (saved_vs)
 		saved_vs->Release();
@@ -2768,7 +3311,7 @@ static void _CreateTextureFromBitmap(HDC dc, BITMAP *bitmap_obj,
 	desc.CPUAccessFlags = 0;
 	desc.MiscFlags = 0;
 
-	LockResourceCreationMode();
+	LockResourceCreationModeShared();
 	hr = state->mOrigDevice1->CreateTexture2D(&desc, &data, tex);
 	UnlockResourceCreationMode();
 	if (FAILED(hr)) {
@@ -4285,6 +4828,7 @@ CustomResource::CustomResource() :
 	view(NULL),
 	is_null(true),
 	substantiated(false),
+	defer_substantiation(false),
 	bind_flags((D3D11_BIND_FLAG)0),
 	misc_flags((D3D11_RESOURCE_MISC_FLAG)0),
 	stride(0),
@@ -4358,10 +4902,11 @@ void CustomResource::Substantiate(ID3D11Device *mOrigDevice1, StereoHandle mSter
 	// We only allow a custom resource to be substantiated once. Otherwise
 	// we could end up reloading it again if it is later set to null. Also
 	// prevents us from endlessly retrying to load a custom resource from a
-	// file that doesn't exist:
-	if (substantiated)
+	// file that doesn't exist. This may race with pre-substantiation from
+	// the Present thread, so only the thread that sets the flag goes on
+	// to substantiate it and use file_data:
+	if (InterlockedCompareExchange(&substantiated, 1, 0))
 		return;
-	substantiated = true;
 
 	// If this custom resource has already been set through other means we
 	// won't overwrite it:
@@ -4387,7 +4932,10 @@ void CustomResource::Substantiate(ID3D11Device *mOrigDevice1, StereoHandle mSter
 	// parameters while probing the hardware before it settles on the one
 	// it will actually use.
 
-	LockResourceCreationMode();
+	if (override_mode == CustomResourceMode::DEFAULT)
+		LockResourceCreationModeShared();
+	else
+		LockResourceCreationMode();
 
 	restore_create_mode = OverrideSurfaceCreationMode(mStereoHandle, &orig_mode);
 
@@ -4425,6 +4973,26 @@ void CustomResource::LoadBufferFromFile(ID3D11Device *mOrigDevice1)
 	void *buf = NULL;
 	HANDLE f;
 
+	// Marks it failed if the reader hasn't started on it yet, so that it
+	// doesn't read it again behind our back:
+	if (file_data && InterlockedCompareExchange(&file_data->ready, -1, 0) == 1) {
+		size = (DWORD)file_data->data.size();
+		buf = malloc(size); // malloc to allow realloc to resize it if the user overrode the size
+		if (!buf) {
+			LogOverlay(LOG_DIRE, "Out of memory loading %S\n", filename.c_str());
+			return;
+		}
+		memcpy(buf, file_data->data.data(), size);
+		file_data.reset();
+		SubstantiateBuffer(mOrigDevice1, &buf, size);
+		free(buf);
+		return;
+	}
+	// Otherwise the file hasn't been read in the background (yet), so
+	// read it now. If the background read failed we will fail the same
+	// way, and report why.
+	file_data.reset();
+
 	f = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (f == INVALID_HANDLE_VALUE) {
 		LogOverlay(LOG_WARNING, "Failed to load custom buffer resource %S: %d\n", filename.c_str(), GetLastError());
@@ -4486,20 +5054,41 @@ void CustomResource::LoadFromFile(ID3D11Device *mOrigDevice1)
 	// could do something smart here, like only using it if the
 	// bind_flags indicate it will be used as a shader resource.
 
+	// Use the copy of the file read by the background reader if it is
+	// ready, otherwise read it from disk now and tell the reader not to
+	// bother if it hasn't started on it yet:
+	if (file_data && InterlockedCompareExchange(&file_data->ready, -1, 0) != 1)
+		file_data.reset();
+
 	ext = filename.substr(filename.rfind(L"."));
 	if (!_wcsicmp(ext.c_str(), L".dds")) {
 		LogInfoW(L"Loading custom resource %s as DDS, bind_flags=0x%03x\n", filename.c_str(), bind_flags);
-		hr = DirectX::CreateDDSTextureFromFileEx(mOrigDevice1,
-				filename.c_str(), 0,
-				D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags,
-				false, &resource, NULL, NULL);
+		if (file_data) {
+			hr = DirectX::CreateDDSTextureFromMemoryEx(mOrigDevice1,
+					file_data->data.data(), file_data->data.size(), 0,
+					D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags,
+					false, &resource, NULL, NULL);
+		} else {
+			hr = DirectX::CreateDDSTextureFromFileEx(mOrigDevice1,
+					filename.c_str(), 0,
+					D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags,
+					false, &resource, NULL, NULL);
+		}
 	} else {
 		LogInfoW(L"Loading custom resource %s as WIC, bind_flags=0x%03x\n", filename.c_str(), bind_flags);
-		hr = DirectX::CreateWICTextureFromFileEx(mOrigDevice1,
-				filename.c_str(), 0,
-				D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags,
-				false, &resource, NULL);
+		if (file_data) {
+			hr = DirectX::CreateWICTextureFromMemoryEx(mOrigDevice1,
+					file_data->data.data(), file_data->data.size(), 0,
+					D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags,
+					false, &resource, NULL);
+		} else {
+			hr = DirectX::CreateWICTextureFromFileEx(mOrigDevice1,
+					filename.c_str(), 0,
+					D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags,
+					false, &resource, NULL);
+		}
 	}
+	file_data.reset();
 	if (SUCCEEDED(hr)) {
 		device = mOrigDevice1;
 		is_null = false;
@@ -5123,7 +5712,7 @@ void CustomResource::expire(ID3D11Device *mOrigDevice1, ID3D11DeviceContext *mOr
 	} else {
 		// Inter-device copy failed / skipped. Flag resource for
 		// re-substantiation (if possible for this resource):
-		substantiated = false;
+		InterlockedExchange(&substantiated, 0);
 		resource = NULL;
 		device = NULL;
 		is_null = true;
@@ -5382,6 +5971,13 @@ bool ParseCommandListResourceCopyDirective(const wchar_t *section,
 			(operation->src.custom_resource->bind_flags | operation->dst.BindFlags(NULL, &misc_flags));
 		operation->src.custom_resource->misc_flags = (D3D11_RESOURCE_MISC_FLAG)
 			(operation->src.custom_resource->misc_flags | misc_flags);
+
+		// These are exactly the cases where the bind flags we just
+		// deduced may be incomplete, so leave creating the resource
+		// until it is used and we know for sure:
+		if (operation->dst.type == ResourceCopyTargetType::CUSTOM_RESOURCE ||
+		    operation->dst.type == ResourceCopyTargetType::THIS_RESOURCE)
+			operation->src.custom_resource->defer_substantiation = true;
 	}
 
 	operation->ini_line = L"[" + wstring(section) + L"] " + wstring(key) + L" = " + *val;
@@ -5544,6 +6140,7 @@ bool ParseCommandListFlowControl(const wchar_t *section, const wstring *line,
 }
 
 IfCommand::IfCommand(const wchar_t *section) :
+	CommandListCommand(CommandListDispatch::IF),
 	pre_finalised(false),
 	post_finalised(false),
 	has_nested_else_if(false),
@@ -5661,81 +6258,22 @@ ID3D11Resource *ResourceCopyTarget::GetResource(
 	HackerDevice *mHackerDevice = state->mHackerDevice;
 	ID3D11Device *mOrigDevice1 = state->mOrigDevice1;
 	ID3D11DeviceContext *mOrigContext1 = state->mOrigContext1;
+	BindingShadow *bindings = state->mHackerContext->GetBindingShadow();
 	ID3D11Resource *res = NULL;
-	ID3D11Buffer *buf = NULL;
-	ID3D11Buffer *so_bufs[D3D11_SO_STREAM_COUNT];
-	ID3D11ShaderResourceView *resource_view = NULL;
-	ID3D11RenderTargetView *render_view[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
-	ID3D11DepthStencilView *depth_view = NULL;
-	ID3D11UnorderedAccessView *unordered_view = NULL;
 	D3D11_BIND_FLAG bind_flags = (D3D11_BIND_FLAG)0;
 	D3D11_RESOURCE_MISC_FLAG misc_flags = (D3D11_RESOURCE_MISC_FLAG)0;
-	unsigned i;
 
+	// Bound resources are read from the context's shadow binding table,
+	// which saves going through the driver and AddRef'ing things we don't
+	// need. It returns objects with a reference held, same as the driver.
 	switch(type) {
 	case ResourceCopyTargetType::CONSTANT_BUFFER:
 		// FIXME: On win8 (or with evil update?), we should use
 		// Get/SetConstantBuffers1 and copy the offset into the buffer as well
-		switch(shader_type) {
-		case L'v':
-			mOrigContext1->VSGetConstantBuffers(slot, 1, &buf);
-			return buf;
-		case L'h':
-			mOrigContext1->HSGetConstantBuffers(slot, 1, &buf);
-			return buf;
-		case L'd':
-			mOrigContext1->DSGetConstantBuffers(slot, 1, &buf);
-			return buf;
-		case L'g':
-			mOrigContext1->GSGetConstantBuffers(slot, 1, &buf);
-			return buf;
-		case L'p':
-			mOrigContext1->PSGetConstantBuffers(slot, 1, &buf);
-			return buf;
-		case L'c':
-			mOrigContext1->CSGetConstantBuffers(slot, 1, &buf);
-			return buf;
-		default:
-			// Should not happen
-			return NULL;
-		}
-		break;
+		return bindings->GetConstantBuffer(mOrigContext1, binding_shadow_stage(shader_type), slot);
 
 	case ResourceCopyTargetType::SHADER_RESOURCE:
-		switch(shader_type) {
-		case L'v':
-			mOrigContext1->VSGetShaderResources(slot, 1, &resource_view);
-			break;
-		case L'h':
-			mOrigContext1->HSGetShaderResources(slot, 1, &resource_view);
-			break;
-		case L'd':
-			mOrigContext1->DSGetShaderResources(slot, 1, &resource_view);
-			break;
-		case L'g':
-			mOrigContext1->GSGetShaderResources(slot, 1, &resource_view);
-			break;
-		case L'p':
-			mOrigContext1->PSGetShaderResources(slot, 1, &resource_view);
-			break;
-		case L'c':
-			mOrigContext1->CSGetShaderResources(slot, 1, &resource_view);
-			break;
-		default:
-			// Should not happen
-			return NULL;
-		}
-
-		if (!resource_view)
-			return NULL;
-
-		resource_view->GetResource(&res);
-		if (!res) {
-			resource_view->Release();
-			return NULL;
-		}
-
-		*view = resource_view;
+		*view = bindings->GetShaderResource(mOrigContext1, binding_shadow_stage(shader_type), slot, &res);
 		return res;
 
 	// TODO: case ResourceCopyTargetType::SAMPLER: // Not an ID3D11Resource, need to think about this one
@@ -5745,95 +6283,33 @@ ID3D11Resource *ResourceCopyTarget::GetResource(
 		// TODO: If copying this to a constant buffer, provide some
 		// means to get the strides + offsets from within the shader.
 		// Perhaps as an IniParam, or in another constant buffer?
-		mOrigContext1->IAGetVertexBuffers(slot, 1, &buf, stride, offset);
-		return buf;
+		return bindings->GetVertexBuffer(mOrigContext1, slot, stride, offset);
 
 	case ResourceCopyTargetType::INDEX_BUFFER:
 		// TODO: Similar comment as vertex buffers above, provide a
 		// means for a shader to get format + offset.
-		mOrigContext1->IAGetIndexBuffer(&buf, format, offset);
-		if (stride && format)
-			*stride = dxgi_format_size(*format);
-		return buf;
+		{
+			ID3D11Buffer *buf = bindings->GetIndexBuffer(mOrigContext1, format, offset);
+			if (stride && format)
+				*stride = dxgi_format_size(*format);
+			return buf;
+		}
 
 	case ResourceCopyTargetType::STREAM_OUTPUT:
 		// XXX: Does not give us the offset
-		mOrigContext1->SOGetTargets(slot + 1, so_bufs);
-
-		// Release any buffers we aren't after:
-		for (i = 0; i < slot; i++) {
-			if (so_bufs[i]) {
-				so_bufs[i]->Release();
-				so_bufs[i] = NULL;
-			}
-		}
-
-		return so_bufs[slot];
+		return bindings->GetStreamOutputTarget(mOrigContext1, slot);
 
 	case ResourceCopyTargetType::RENDER_TARGET:
-		mOrigContext1->OMGetRenderTargets(slot + 1, render_view, NULL);
-
-		// Release any views we aren't after:
-		for (i = 0; i < slot; i++) {
-			if (render_view[i]) {
-				render_view[i]->Release();
-				render_view[i] = NULL;
-			}
-		}
-
-		if (!render_view[slot])
-			return NULL;
-
-		render_view[slot]->GetResource(&res);
-		if (!res) {
-			render_view[slot]->Release();
-			return NULL;
-		}
-
-		*view = render_view[slot];
+		*view = bindings->GetRenderTarget(mOrigContext1, slot, &res);
 		return res;
 
 	case ResourceCopyTargetType::DEPTH_STENCIL_TARGET:
-		mOrigContext1->OMGetRenderTargets(0, NULL, &depth_view);
-		if (!depth_view)
-			return NULL;
-
-		depth_view->GetResource(&res);
-		if (!res) {
-			depth_view->Release();
-			return NULL;
-		}
-
 		// Depth buffers can't be buffers
-
-		*view = depth_view;
+		*view = bindings->GetDepthStencil(mOrigContext1, &res);
 		return res;
 
 	case ResourceCopyTargetType::UNORDERED_ACCESS_VIEW:
-		switch(shader_type) {
-		case L'p':
-			// XXX: Not clear if the start slot is ok like this from the docs?
-			// Particularly, what happens if we retrieve a subsequent UAV?
-			mOrigContext1->OMGetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL, slot, 1, &unordered_view);
-			break;
-		case L'c':
-			mOrigContext1->CSGetUnorderedAccessViews(slot, 1, &unordered_view);
-			break;
-		default:
-			// Should not happen
-			return NULL;
-		}
-
-		if (!unordered_view)
-			return NULL;
-
-		unordered_view->GetResource(&res);
-		if (!res) {
-			unordered_view->Release();
-			return NULL;
-		}
-
-		*view = unordered_view;
+		*view = bindings->GetUnorderedAccessView(mOrigContext1, binding_shadow_stage(shader_type), slot, &res);
 		return res;
 
 	case ResourceCopyTargetType::CUSTOM_RESOURCE:
@@ -5922,7 +6398,7 @@ ID3D11Resource *ResourceCopyTarget::GetResource(
 			HackerSwapChain *mHackerSwapChain = mHackerDevice->GetHackerSwapChain();
 			if (mHackerSwapChain) {
 				if (G->bb_is_upscaling_bb)
-					mHackerSwapChain->GetBuffer(0, __uuidof(ID3D11Resource), (void**)&res);
+					mHackerSwapChain->GetPresentedBuffer(__uuidof(ID3D11Resource), (void**)&res);
 				else
 					mHackerSwapChain->GetOrigSwapChain1()->GetBuffer(0, __uuidof(ID3D11Resource), (void**)&res);
 			} else
@@ -5944,7 +6420,7 @@ ID3D11Resource *ResourceCopyTarget::GetResource(
 		{
 			HackerSwapChain *mHackerSwapChain = mHackerDevice->GetHackerSwapChain();
 			if (mHackerSwapChain)
-				mHackerSwapChain->GetBuffer(0, __uuidof(ID3D11Resource), (void**)&res);
+				mHackerSwapChain->GetPresentedBuffer(__uuidof(ID3D11Resource), (void**)&res);
 			else
 				COMMAND_LIST_LOG(state, "  Unable to get access to fake swap chain\n");
 		}
@@ -5964,6 +6440,7 @@ void ResourceCopyTarget::SetResource(
 		UINT buf_size)
 {
 	ID3D11DeviceContext *mOrigContext1 = state->mOrigContext1;
+	BindingShadow *bindings = state->mHackerContext->GetBindingShadow();
 	ID3D11Buffer *buf = NULL;
 	ID3D11Buffer *so_bufs[D3D11_SO_STREAM_COUNT];
 	ID3D11ShaderResourceView *resource_view = NULL;
@@ -5981,21 +6458,27 @@ void ResourceCopyTarget::SetResource(
 		switch(shader_type) {
 		case L'v':
 			mOrigContext1->VSSetConstantBuffers(slot, 1, &buf);
+			bindings->SetConstantBuffers(mOrigContext1, BindingShadowStage::VS, slot, 1, &buf);
 			return;
 		case L'h':
 			mOrigContext1->HSSetConstantBuffers(slot, 1, &buf);
+			bindings->SetConstantBuffers(mOrigContext1, BindingShadowStage::HS, slot, 1, &buf);
 			return;
 		case L'd':
 			mOrigContext1->DSSetConstantBuffers(slot, 1, &buf);
+			bindings->SetConstantBuffers(mOrigContext1, BindingShadowStage::DS, slot, 1, &buf);
 			return;
 		case L'g':
 			mOrigContext1->GSSetConstantBuffers(slot, 1, &buf);
+			bindings->SetConstantBuffers(mOrigContext1, BindingShadowStage::GS, slot, 1, &buf);
 			return;
 		case L'p':
 			mOrigContext1->PSSetConstantBuffers(slot, 1, &buf);
+			bindings->SetConstantBuffers(mOrigContext1, BindingShadowStage::PS, slot, 1, &buf);
 			return;
 		case L'c':
 			mOrigContext1->CSSetConstantBuffers(slot, 1, &buf);
+			bindings->SetConstantBuffers(mOrigContext1, BindingShadowStage::CS, slot, 1, &buf);
 			return;
 		default:
 			// Should not happen
@@ -6008,21 +6491,27 @@ void ResourceCopyTarget::SetResource(
 		switch(shader_type) {
 		case L'v':
 			mOrigContext1->VSSetShaderResources(slot, 1, &resource_view);
+			bindings->SetShaderResources(mOrigContext1, BindingShadowStage::VS, slot, 1, &resource_view);
 			break;
 		case L'h':
 			mOrigContext1->HSSetShaderResources(slot, 1, &resource_view);
+			bindings->SetShaderResources(mOrigContext1, BindingShadowStage::HS, slot, 1, &resource_view);
 			break;
 		case L'd':
 			mOrigContext1->DSSetShaderResources(slot, 1, &resource_view);
+			bindings->SetShaderResources(mOrigContext1, BindingShadowStage::DS, slot, 1, &resource_view);
 			break;
 		case L'g':
 			mOrigContext1->GSSetShaderResources(slot, 1, &resource_view);
+			bindings->SetShaderResources(mOrigContext1, BindingShadowStage::GS, slot, 1, &resource_view);
 			break;
 		case L'p':
 			mOrigContext1->PSSetShaderResources(slot, 1, &resource_view);
+			bindings->SetShaderResources(mOrigContext1, BindingShadowStage::PS, slot, 1, &resource_view);
 			break;
 		case L'c':
 			mOrigContext1->CSSetShaderResources(slot, 1, &resource_view);
+			bindings->SetShaderResources(mOrigContext1, BindingShadowStage::CS, slot, 1, &resource_view);
 			break;
 		default:
 			// Should not happen
@@ -6036,11 +6525,13 @@ void ResourceCopyTarget::SetResource(
 	case ResourceCopyTargetType::VERTEX_BUFFER:
 		buf = (ID3D11Buffer*)res;
 		mOrigContext1->IASetVertexBuffers(slot, 1, &buf, &stride, &offset);
+		bindings->SetVertexBuffers(mOrigContext1, slot, 1, &buf, &stride, &offset);
 		return;
 
 	case ResourceCopyTargetType::INDEX_BUFFER:
 		buf = (ID3D11Buffer*)res;
 		mOrigContext1->IASetIndexBuffer(buf, format, offset);
+		bindings->SetIndexBuffer(mOrigContext1, buf, format, offset);
 		break;
 
 	case ResourceCopyTargetType::STREAM_OUTPUT:
@@ -6054,6 +6545,7 @@ void ResourceCopyTarget::SetResource(
 		// them, but I'm not sure how to get their original values,
 		// so... too bad. Probably will never even use this anyway.
 		mOrigContext1->SOSetTargets(D3D11_SO_STREAM_COUNT, so_bufs, NULL);
+		bindings->SetStreamOutputTargets(D3D11_SO_STREAM_COUNT, so_bufs);
 
 		for (i = 0; i < D3D11_SO_STREAM_COUNT; i++) {
 			if (so_bufs[i])
@@ -6070,6 +6562,8 @@ void ResourceCopyTarget::SetResource(
 		render_view[slot] = (ID3D11RenderTargetView*)view;
 
 		mOrigContext1->OMSetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, render_view, depth_view);
+		bindings->SetRenderTargetsAndUnorderedAccessViews(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT,
+				render_view, depth_view, D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, 0, NULL);
 
 		for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
 			if (i != slot && render_view[i])
@@ -6088,6 +6582,8 @@ void ResourceCopyTarget::SetResource(
 		depth_view = (ID3D11DepthStencilView*)view;
 
 		mOrigContext1->OMSetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, render_view, depth_view);
+		bindings->SetRenderTargetsAndUnorderedAccessViews(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT,
+				render_view, depth_view, D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, 0, NULL);
 
 		for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
 			if (render_view[i])
@@ -6104,10 +6600,13 @@ void ResourceCopyTarget::SetResource(
 			// TODO: Allow pUAVInitialCounts to optionally be set
 			mOrigContext1->OMSetRenderTargetsAndUnorderedAccessViews(D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL,
 				NULL, NULL, slot, 1, &unordered_view, &uav_counter);
+			bindings->SetRenderTargetsAndUnorderedAccessViews(D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL,
+				NULL, NULL, slot, 1, &unordered_view);
 			return;
 		case L'c':
 			// TODO: Allow pUAVInitialCounts to optionally be set
 			mOrigContext1->CSSetUnorderedAccessViews(slot, 1, &unordered_view, &uav_counter);
+			bindings->SetComputeShaderUAVs(slot, 1, &unordered_view);
 			return;
 		default:
 			// Should not happen
@@ -6676,7 +7175,12 @@ static void RecreateCompatibleResource(
 	if (dst)
 		bind_flags = dst->BindFlags(state, &misc_flags);
 
-	LockResourceCreationMode();
+	if ((options & ResourceCopyOptions::CREATEMODE_MASK) ||
+	    (dst && dst->type == ResourceCopyTargetType::CUSTOM_RESOURCE &&
+	     dst->custom_resource->override_mode != CustomResourceMode::DEFAULT))
+		LockResourceCreationMode();
+	else
+		LockResourceCreationModeShared();
 
 	if (options & ResourceCopyOptions::CREATEMODE_MASK) {
 		Profiling::NvAPI_Stereo_GetSurfaceCreationMode(mStereoHandle, &orig_mode);
@@ -7268,6 +7772,7 @@ static void SetViewportFromResource(CommandListState *state, ID3D11Resource *res
 }
 
 ResourceCopyOperation::ResourceCopyOperation() :
+	CommandListCommand(CommandListDispatch::RESOURCE_COPY),
 	options(ResourceCopyOptions::INVALID),
 	cached_resource(NULL),
 	cached_view(NULL),
@@ -7623,10 +8128,13 @@ void ClearViewCommand::run(CommandListState *state)
 	if (!view)
 		view = create_best_view(resource, state, stride, offset, format, buf_src_size);
 
-	if (view)
+	if (view) {
 		clear_unknown_view(view, state);
-	else
+		if (G->analyse_frame)
+			MarkResourceWritten(resource);
+	} else {
 		COMMAND_LIST_LOG(state, "  No view and unable to create view to clear resource\n");
+	}
 
 	if (resource)
 		resource->Release();
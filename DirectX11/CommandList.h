@@ -11,6 +11,9 @@
 
 #include "DrawCallInfo.h"
 #include "ResourceHash.h"
+#include "DeferredLog.h"
+#include "CompileJobQueue.h"
+#include "CustomShaderState.h"
 
 // Used to prevent typos leading to infinite recursion (or at least overflowing
 // the real stack) due to a section running itself or a circular reference. 64
@@ -75,8 +78,26 @@ public:
 	~CommandListState();
 };
 
+// Commands that are run often enough that _RunCommandList dispatches them
+// directly rather than through a virtual call. These commands must not be
+// subclassed with a different run() implementation (their run() is marked
+// final to enforce that):
+enum class CommandListDispatch {
+	VIRTUAL,
+	PARAM_OVERRIDE,
+	VARIABLE_ASSIGNMENT,
+	IF,
+	CHECK_TEXTURE_OVERRIDE,
+	RUN_EXPLICIT_COMMAND_LIST,
+	RUN_LINKED_COMMAND_LIST,
+	RUN_CUSTOM_SHADER,
+	RESOURCE_COPY,
+};
+
 class CommandListCommand {
 public:
+	CommandListDispatch dispatch;
+
 	wstring ini_line;
 
 	// For performance metrics:
@@ -85,6 +106,9 @@ public:
 	unsigned pre_executions;
 	unsigned post_executions;
 
+	CommandListCommand(CommandListDispatch dispatch = CommandListDispatch::VIRTUAL) :
+		dispatch(dispatch)
+	{}
 	virtual ~CommandListCommand() {};
 
 	virtual void run(CommandListState*) = 0;
@@ -166,6 +190,7 @@ public:
 };
 
 extern std::vector<CommandList*> registered_command_lists;
+extern CRITICAL_SECTION pre_substantiation_lock;
 extern std::unordered_set<CommandList*> command_lists_profiling;
 extern std::unordered_set<CommandListCommand*> command_lists_cmd_profiling;
 
@@ -202,11 +227,12 @@ public:
 	bool run_pre_and_post_together;
 
 	RunExplicitCommandList() :
+		CommandListCommand(CommandListDispatch::RUN_EXPLICIT_COMMAND_LIST),
 		command_list_section(NULL),
 		run_pre_and_post_together(false)
 	{}
 
-	void run(CommandListState*) override;
+	void run(CommandListState*) override final;
 	bool noop(bool post, bool ignore_cto_pre, bool ignore_cto_post) override;
 };
 
@@ -218,10 +244,11 @@ public:
 	CommandList *link;
 
 	RunLinkedCommandList(CommandList *link) :
+		CommandListCommand(CommandListDispatch::RUN_LINKED_COMMAND_LIST),
 		link(link)
 	{}
 
-	void run(CommandListState*) override;
+	void run(CommandListState*) override final;
 	bool noop(bool post, bool ignore_cto_pre, bool ignore_cto_post) override;
 };
 
@@ -301,17 +328,20 @@ public:
 	ID3D11BlendState *blend_state;
 	FLOAT blend_factor[4], blend_factor_merge_mask[4];
 	UINT blend_sample_mask, blend_sample_mask_merge_mask;
+	CustomShaderStateCache<ID3D11BlendState> merged_blend_states;
 
 	int depth_stencil_override;
 	D3D11_DEPTH_STENCIL_DESC depth_stencil_desc;
 	D3D11_DEPTH_STENCIL_DESC depth_stencil_mask;
 	ID3D11DepthStencilState *depth_stencil_state;
 	UINT stencil_ref, stencil_ref_mask;
+	CustomShaderStateCache<ID3D11DepthStencilState> merged_depth_stencil_states;
 
 	int rs_override;
 	D3D11_RASTERIZER_DESC rs_desc;
 	D3D11_RASTERIZER_DESC rs_mask;
 	ID3D11RasterizerState *rs_state;
+	CustomShaderStateCache<ID3D11RasterizerState> merged_rs_states;
 
 	int sampler_override;
 	D3D11_SAMPLER_DESC sampler_desc;
@@ -331,7 +361,8 @@ public:
 	CustomShader();
 	~CustomShader();
 
-	bool compile(char type, wchar_t *filename, const wstring *wname, const wstring *mod_namespace);
+	bool compile(char type, wchar_t *filename, const wstring *wname, const wstring *mod_namespace,
+			CustomShaderCompileJob *job = NULL);
 	void substantiate(ID3D11Device *mOrigDevice);
 
 	void merge_blend_states(ID3D11BlendState *state, FLOAT blend_factor[4], UINT sample_mask, ID3D11Device *mOrigDevice);
@@ -342,15 +373,50 @@ public:
 typedef std::unordered_map<std::wstring, class CustomShader> CustomShaders;
 extern CustomShaders customShaders;
 
+// Compiling the shaders in [CustomShader] sections is the most expensive part
+// of loading the config, and each compile is independent of every other
+// section, so the config parser runs them on a pool of worker threads up front
+// and then consumes the results serially in section order. Anything the
+// compile would have logged is buffered in the job and replayed when the
+// result is consumed, so the log reads the same as a serial compile.
+struct CustomShaderCompileJob {
+	// Inputs:
+	CustomShader *shader;
+	char type;
+	wstring filename;
+	wstring namespace_path;
+	D3DCompileFlags compile_flags;
+
+	// Results:
+	ID3DBlob *bytecode;
+	bool failed;
+	bool done;
+	DeferredLog log;
+
+	// Shader cache files are written when the result is consumed, in case
+	// several sections compile the same shader:
+	wstring cache_path;
+	FILETIME timestamp;
+	bool store_cache;
+
+	CustomShaderCompileJob(CustomShader *shader, char type, const wchar_t *filename,
+			const wstring *namespace_path, D3DCompileFlags compile_flags);
+	~CustomShaderCompileJob();
+};
+
+typedef CompileJobQueue<CustomShaderCompileJob> CustomShaderCompileQueue;
+void compile_custom_shaders(CustomShaderCompileQueue *queue);
+
 class RunCustomShaderCommand : public CommandListCommand {
 public:
 	CustomShader *custom_shader;
 
 	RunCustomShaderCommand() :
+		CommandListCommand(CommandListDispatch::RUN_CUSTOM_SHADER),
 		custom_shader(NULL)
 	{}
 
-	void run(CommandListState*) override;
+	void run(CommandListState*) override final;
 	bool noop(bool post, bool ignore_cto_pre, bool ignore_cto_post) override;
 };
 
@@ -485,6 +551,21 @@ public:
 	void emplace(uint32_t hash, ID3D11Resource *resource, ID3D11Device *device);
 };
 
+// File data for a [Resource] section read ahead of time on a background
+// thread by the pre-substantiation scheduler. This is shared between the
+// resource and the reader thread so that a config reload can free the
+// resource without having to wait for the thread to finish with it.
+struct CustomResourceFileData {
+	wstring filename;
+	std::vector<uint8_t> data;
+	volatile LONG ready; // 0 = pending, 1 = loaded, -1 = failed or loaded on demand
+
+	CustomResourceFileData(const wstring &filename) :
+		filename(filename),
+		ready(0)
+	{}
+};
+
 class CustomResource
 {
 public:
@@ -509,7 +590,16 @@ public:
 	int copies_this_frame;
 
 	wstring filename;
-	bool substantiated;
+	// Set by whichever thread substantiates this, which may be the
+	// Present thread racing a deferred context:
+	volatile LONG substantiated;
+
+	// Set when the bind flags cannot be fully deduced until the resource
+	// is used, which rules it out of pre-substantiation:
+	bool defer_substantiation;
+	// Attached before the command lists are handed to the Present thread,
+	// and only touched by the thread that substantiates this after that:
+	std::shared_ptr<CustomResourceFileData> file_data;
 
 	// Used to override description when copying or synthesise resources
 	// from scratch:
@@ -698,7 +788,7 @@ public:
 	ResourceCopyOperation();
 	~ResourceCopyOperation();
 
-	void run(CommandListState*) override;
+	void run(CommandListState*) override final;
 };
 
 class ResourceStagingOperation : public ResourceCopyOperation {
@@ -1010,6 +1100,10 @@ class AssignmentCommand : public CommandListCommand {
 public:
 	CommandListExpression expression;
 
+	AssignmentCommand(CommandListDispatch dispatch) :
+		CommandListCommand(dispatch)
+	{}
+
 	bool optimise(HackerDevice *device) override;
 };
 
@@ -1019,11 +1113,12 @@ public:
 	float DirectX::XMFLOAT4::*param_component;
 
 	ParamOverride() :
+		AssignmentCommand(CommandListDispatch::PARAM_OVERRIDE),
 		param_idx(-1),
 		param_component(NULL)
 	{}
 
-	void run(CommandListState*) override;
+	void run(CommandListState*) override final;
 };
 
 class VariableAssignment : public AssignmentCommand {
@@ -1031,10 +1126,11 @@ public:
 	CommandListVariable *var;
 
 	VariableAssignment() :
+		AssignmentCommand(CommandListDispatch::VARIABLE_ASSIGNMENT),
 		var(NULL)
 	{}
 
-	void run(CommandListState*) override;
+	void run(CommandListState*) override final;
 };
 
 class IfCommand : public CommandListCommand {
@@ -1056,7 +1152,7 @@ public:
 
 	IfCommand(const wchar_t *section);
 
-	void run(CommandListState*) override;
+	void run(CommandListState*) override final;
 	bool optimise(HackerDevice *device) override;
 	bool noop(bool post, bool ignore_cto_pre, bool ignore_cto_post) override;
 };
@@ -1083,10 +1179,11 @@ public:
 	bool run_pre_and_post_together;
 
 	CheckTextureOverrideCommand() :
+		CommandListCommand(CommandListDispatch::CHECK_TEXTURE_OVERRIDE),
 		run_pre_and_post_together(false)
 	{}
 
-	void run(CommandListState*) override;
+	void run(CommandListState*) override final;
 	bool noop(bool post, bool ignore_cto_pre, bool ignore_cto_post) override;
 };
 
@@ -1304,5 +1401,7 @@ bool ParseCommandListFlowControl(const wchar_t *section, const wstring *line,
 std::shared_ptr<RunLinkedCommandList>
 		LinkCommandLists(CommandList *dst, CommandList *link, const wstring *ini_line);
 void optimise_command_lists(HackerDevice *device);
+void RunPreSubstantiation(HackerDevice *device);
+void CancelPreSubstantiation();
 bool parse_command_list_var_name(const wstring &name, const wstring *ini_namespace, CommandListVariable **target);
 bool valid_variable_name(const wstring &name);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <windows.h>
+#include <memory>
+#include <vector>
+
+// Queue of independent jobs from the config load, such as compiling the
+// shaders in [CustomShader] sections, that are run on a pool of worker threads
+// up front and then consumed serially by the config parser in the order they
+// were queued. The workers finish the jobs in whatever order they get to
+// them, but since they only ever touch their own job, and anything they log
+// is buffered in a DeferredLog to be replayed by the consumer, the result is
+// the same as running them serially as they are consumed.
+//
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests, which check it against a serial run with jobs that finish
+// out of order.
+template <class Job>
+class CompileJobQueue
+{
+private:
+	volatile LONG next_job;
+	size_t next_consumed;
+
+public:
+	std::vector<std::unique_ptr<Job>> jobs;
+
+	CompileJobQueue() :
+		next_job(0),
+		next_consumed(0)
+	{}
+
+	// Run by each worker thread until there are no jobs left. The jobs are
+	// handed out in queue order, but may finish in any order:
+	template <class Run>
+	void Work(Run run)
+	{
+		LONG i;
+
+		while ((i = InterlockedIncrement(&next_job) - 1) < (LONG)jobs.size())
+			run(jobs[i].get());
+	}
+
+	// Called from the config parser in the same order the jobs were queued.
+	// Returns the next job if is_next(job) agrees that it is the one being
+	// consumed, otherwise NULL, in which case the caller has to do the work
+	// itself - e.g. if a section has changed since the jobs were queued:
+	template <class IsNext>
+	Job* Next(IsNext is_next)
+	{
+		Job *job;
+
+		if (next_consumed >= jobs.size())
+			return NULL;
+
+		job = jobs[next_consumed].get();
+		if (!is_next(job))
+			return NULL;
+
+		next_consumed++;
+		return job;
+	}
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <unordered_map>
+
+// The parts of a [CustomShader] partial state override (blend = ... with merge
+// masks, i.e. override mode 2) that don't need to talk to DirectX: merging the
+// game's state description into ours, and caching the resulting state objects.
+//
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests, which use plain structs in place of the state
+// descriptions and objects.
+
+// Similar to memcpy, but also takes a mask. Any bits in the mask that are set
+// to 0 will be unchanged in the destination, while bits that are set to 1 will
+// be copied from the source buffer.
+//
+// Every masked bit is overwritten on each merge and no other bit is ever
+// changed, so the result depends only on the source and not on anything that
+// was merged before. That is what allows the merged state objects to be
+// cached by which source state they came from.
+static inline void memcpy_masked_merge(void *dest, void *src, void *mask, size_t n)
+{
+	char *c_dest = (char*)dest;
+	char *c_src = (char*)src;
+	char *c_mask = (char*)mask;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		c_dest[i] = (c_dest[i] & ~c_mask[i]) | (c_src[i] & c_mask[i]);
+}
+
+// Caches the state objects created by merging a custom shader's partial
+// blend/depth/rasterizer override with the game's current state. State
+// objects are immutable, so the merged result depends only on which state
+// object the game had bound. We hold a reference on the game's state object
+// for as long as it is in the cache so that its address can't be reused by a
+// different state while we are using it as the key.
+template <class State>
+class CustomShaderStateCache
+{
+public:
+	// Bound on the number of entries. A custom shader is usually only run
+	// in a handful of distinct states, so if we exceed this something is
+	// churning through state objects and caching them is not helping:
+	static const size_t MAX_ENTRIES = 64;
+
+private:
+	std::unordered_map<State*, State*> cache;
+
+public:
+	~CustomShaderStateCache()
+	{
+		clear();
+	}
+
+	State* find(State *src)
+	{
+		auto i = cache.find(src);
+		if (i == cache.end())
+			return NULL;
+		return i->second;
+	}
+
+	void insert(State *src, State *merged)
+	{
+		if (!merged)
+			return;
+
+		if (cache.size() >= MAX_ENTRIES)
+			clear();
+
+		if (src)
+			src->AddRef();
+		merged->AddRef();
+		cache[src] = merged;
+	}
+
+	void clear()
+	{
+		for (auto &i : cache) {
+			if (i.first)
+				i.first->Release();
+			i.second->Release();
+		}
+		cache.clear();
+	}
+
+	size_t size() const
+	{
+		return cache.size();
+	}
+};
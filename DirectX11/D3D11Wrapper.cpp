@@ -6,6 +6,7 @@
 #include "HookedDXGI.h"
 
 #include "nvprofile.h"
+#include "ShaderPipeline.h"
 
 //#include <Shlobj.h>
 //#include <Winuser.h>
@@ -36,15 +37,49 @@ FILE *LogFile = 0;		// off by default.
 bool gLogDebug = false;
 
 
-// This critical section must be held to avoid race conditions when creating
-// any resource. The nvapi functions used to set the resource creation mode
-// affect global state, so if multiple threads are creating resources
-// simultaneously it is possible for a StereoMode override or stereo/mono copy
-// on one thread to affect another. This should be taken before setting the
-// surface creation mode and released only after it has been restored. If the
-// creation mode is not being set it should still be taken around the actual
-// CreateXXX call.
-CRITICAL_SECTION resource_creation_mode_lock;
+// This lock must be held to avoid race conditions when creating any resource.
+// The nvapi functions used to set the resource creation mode affect global
+// state, so if multiple threads are creating resources simultaneously it is
+// possible for a StereoMode override or stereo/mono copy on one thread to
+// affect another. This should be taken exclusively before setting the surface
+// creation mode and released only after it has been restored. If the creation
+// mode is not being set it should still be taken shared around the actual
+// CreateXXX call - most resources fall into this category, and taking it
+// shared allows the game to keep creating them from multiple threads.
+static ResourceCreationLock resource_creation_mode_lock(&Profiling::resource_creation_lock_contention);
+
+static SRWLOCK upgrade_reported_lock = SRWLOCK_INIT;
+static std::set<std::pair<char*, int>> upgrade_reported;
+
+void _LockResourceCreationMode(bool exclusive, char *function, int line)
+{
+	bool reported;
+
+	if (resource_creation_mode_lock.Lock(&get_tls()->resource_creation_lock_nesting, exclusive, function, line))
+		return;
+
+	// Someone further up the stack took the lock shared, but we are
+	// about to change the creation mode. Fix that caller to take it
+	// exclusively - we are carrying on under the shared lock, since
+	// dropping it to upgrade would hand the creation mode to another
+	// thread in the middle of the outer creation.
+	AcquireSRWLockExclusive(&upgrade_reported_lock);
+	reported = !upgrade_reported.insert({function, line}).second;
+	ReleaseSRWLockExclusive(&upgrade_reported_lock);
+	if (reported)
+		return;
+
+	LogOverlay(LOG_DIRE, "%04x: BUG: Resource creation mode lock needed exclusively while held shared in %s(%d)\n",
+			GetCurrentThreadId(), function, line);
+
+	if (IsDebuggerPresent())
+		__debugbreak();
+}
+
+void UnlockResourceCreationMode()
+{
+	resource_creation_mode_lock.Unlock(&get_tls()->resource_creation_lock_nesting);
+}
 
 // This function checks if 3DMigoto is running in the intended executable - it
 // is similar to verify_intended_target() that we use in DllMain to bail out of
@@ -436,9 +471,13 @@ void InitD311()
 
 	if (hD3D11) return;
 
-	InitializeCriticalSectionPretty(&G->mCriticalSection);
-	InitializeCriticalSectionPretty(&G->mResourcesLock);
-	InitializeCriticalSectionPretty(&resource_creation_mode_lock);
+	InitializeCriticalSectionRanked(&G->mCriticalSection, LockRank::CONFIG);
+	InitializeCriticalSectionRanked(&G->mHuntingLock, LockRank::HUNTING);
+	InitializeCriticalSectionRanked(&G->mResourceInfoLock, LockRank::RESOURCE_INFO);
+	InitializeCriticalSectionRanked(&G->mResourcesLock, LockRank::RESOURCES);
+	InitializeCriticalSectionRanked(&shader_pipeline_cache_lock, LockRank::LEAF);
+	resource_creation_mode_lock.SetName("resource_creation_mode_lock");
+	InitializeCriticalSectionRanked(&pre_substantiation_lock, LockRank::LEAF);
 
 	InitializeDLL();
 	
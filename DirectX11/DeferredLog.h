@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Log messages from work that may run on a worker thread, such as compiling
+// the shaders in [CustomShader] sections. They are buffered here in the order
+// they were logged, and whoever consumes the result of the work replays them
+// into the real log, so the log reads the same whether the work ran serially
+// or on a pool of threads.
+//
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests.
+class DeferredLog
+{
+public:
+	// LogLevel, or -1 for LogInfo:
+	std::vector<std::pair<int, std::string>> entries;
+
+	void vLog(int level, const char *fmt, va_list ap)
+	{
+		va_list ap_size;
+		int len;
+
+		// The arguments are walked once to size the message and again
+		// to format it. A va_list cannot be reused once it has been
+		// walked, so the first pass uses a copy:
+		va_copy(ap_size, ap);
+		len = vsnprintf(NULL, 0, fmt, ap_size);
+		va_end(ap_size);
+		if (len <= 0)
+			return;
+
+		std::string msg(len + 1, '\0');
+		vsnprintf(&msg[0], len + 1, fmt, ap);
+		msg.resize(len);
+		entries.emplace_back(level, std::move(msg));
+	}
+
+	void Log(int level, const char *fmt, ...)
+	{
+		va_list ap;
+
+		va_start(ap, fmt);
+		vLog(level, fmt, ap);
+		va_end(ap);
+	}
+
+	// Replays the messages in the order they were logged, passing those
+	// logged with LogInfo to info(msg) and the rest to overlay(level, msg):
+	template <class Info, class Overlay>
+	void Replay(Info info, Overlay overlay) const
+	{
+		for (auto &msg : entries) {
+			if (msg.first < 0)
+				info(msg.second.c_str());
+			else
+				overlay(msg.first, msg.second.c_str());
+		}
+	}
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+// Bookkeeping for the ring of fake back buffers used by upscale_mode=0. If the
+// game rendered every frame into the same fake back buffer, it would be
+// writing frame N+1 to the texture the upscaling command list is still
+// sampling for frame N, and the driver would have to serialise the two. We
+// avoid this by handing out the next buffer in the ring from GetBuffer(0)
+// each frame, like the real swap chain does with its own buffers.
+//
+// That only helps games that call GetBuffer(0) every frame - most get the
+// back buffer once and keep rendering to it, so we only start rotating once
+// the game has fetched it on two consecutive frames, and always present the
+// buffer the game most recently fetched. A game that holds onto its first
+// buffer therefore keeps using that one buffer, as it always has.
+//
+// This deals purely in indices so that it has no dependencies on DirectX, and
+// can be built by the unit tests.
+class FakeBackBufferRing
+{
+private:
+	unsigned count;
+	unsigned current;
+	unsigned presented;
+	unsigned consecutive_frames_fetched;
+	bool fetched_this_frame;
+
+public:
+	FakeBackBufferRing()
+	{
+		Reset(1);
+	}
+
+	void Reset(unsigned new_count)
+	{
+		count = new_count ? new_count : 1;
+		current = 0;
+		presented = 0;
+		consecutive_frames_fetched = 0;
+		fetched_this_frame = false;
+	}
+
+	unsigned Count() const
+	{
+		return count;
+	}
+
+	// GetBuffer(0): The buffer the game should render the next frame into
+	unsigned Fetch()
+	{
+		fetched_this_frame = true;
+		presented = current;
+		return current;
+	}
+
+	// GetBuffer(n): Peek at buffers further along the ring without
+	// affecting the rotation, like a sequential swap chain
+	unsigned Peek(unsigned n) const
+	{
+		return (current + n) % count;
+	}
+
+	// The buffer the game rendered the frame being presented into
+	unsigned Presented() const
+	{
+		return presented;
+	}
+
+	// Called once per frame, after the frame has been presented
+	void FramePresented()
+	{
+		if (fetched_this_frame) {
+			if (consecutive_frames_fetched < 2)
+				consecutive_frames_fetched++;
+		} else
+			consecutive_frames_fetched = 0;
+		fetched_this_frame = false;
+
+		if (consecutive_frames_fetched >= 2)
+			current = (current + 1) % count;
+	}
+};
@@ -1,5 +1,3 @@
-// Include before util.h (or any header that includes util.h) to get pretty
-// version of LockResourceCreationMode:
 #include "lock.h"
 
 #include "D3D11Wrapper.h"
@@ -35,6 +33,10 @@ FrameAnalysisContext::FrameAnalysisContext(ID3D11Device1 *pDevice, ID3D11DeviceC
 	frame_analysis_log = NULL;
 	draw_call = 0;
 	non_draw_call_dump_counter = 0;
+	dump_cache_epoch = 0;
+	readback_queued = false;
+	num_uav_slots = (pDevice->GetFeatureLevel() >= D3D_FEATURE_LEVEL_11_1 ?
+			D3D11_1_UAV_SLOT_COUNT : D3D11_PS_CS_UAV_REGISTER_COUNT);
 }
 
 FrameAnalysisContext::~FrameAnalysisContext()
@@ -145,7 +147,7 @@ void FrameAnalysisContext::FrameAnalysisLogShaderHash(ID3D11Shader *shader)
 	if (hash != end(G->mShaders))
 		fprintf(frame_analysis_log, " hash=%016llx", hash->second);
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 
 	fprintf(frame_analysis_log, "\n");
 }
@@ -166,7 +168,9 @@ void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource
 		return;
 	}
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	DrainResourceInfo();
+
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
 	EnterCriticalSectionPretty(&G->mResourcesLock);
 
 	try {
@@ -192,8 +196,8 @@ void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource
 	} catch (std::out_of_range) {
 	}
 
-	LeaveCriticalSection(&G->mResourcesLock);
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mResourcesLock);
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
 
 	fprintf(frame_analysis_log, "\n");
 }
@@ -417,6 +421,8 @@ void FrameAnalysisContext::Dump2DResourceImmediateCtx(ID3D11Texture2D *staging,
 	size_t ext, save_ext;
 
 	save_filename = dedupe_tex2d_filename(staging, orig_desc, dedupe_filename, MAX_PATH, filename.c_str(), format);
+	if (save_filename != filename)
+		last_dedupe_filename = save_filename;
 
 	ext = filename.find_last_of(L'.');
 	save_ext = save_filename.find_last_of(L'.');
@@ -498,8 +504,15 @@ void FrameAnalysisContext::Dump2DResource(ID3D11Texture2D *resource, wchar_t
 	if (!orig_desc)
 		desc = &staging_desc;
 
-	if (!DeferDump2DResource(staging, filename, stereo, desc, format))
-		Dump2DResourceImmediateCtx(staging, filename, stereo, desc, format);
+	// Only staging resources we created ourselves can be read back later -
+	// if the game passed us a staging resource of its own it may change
+	// in the meantime. Stereo dumps always arrive here in a staging
+	// resource created by DumpStereoResource.
+	if (!DeferDump2DResource(staging, filename, stereo, desc, format)) {
+		if (!(staging != resource || stereo) ||
+		    !QueueReadback2DResource(staging, filename, stereo, desc, format))
+			Dump2DResourceImmediateCtx(staging, filename, stereo, desc, format);
+	}
 
 	if (staging != resource)
 		staging->Release();
@@ -509,6 +522,7 @@ HRESULT FrameAnalysisContext::CreateStagingResource(ID3D11Texture2D **resource,
 		D3D11_TEXTURE2D_DESC desc, bool stereo, bool msaa, DXGI_FORMAT format)
 {
 	NVAPI_STEREO_SURFACECREATEMODE orig_mode = NVAPI_STEREO_SURFACECREATEMODE_AUTO;
+	FrameAnalysisStagingPool::iterator pool_entry;
 	HRESULT hr;
 
 	// NOTE: desc is passed by value - this is intentional so we don't
@@ -548,7 +562,18 @@ HRESULT FrameAnalysisContext::CreateStagingResource(ID3D11Texture2D **resource,
 	if (format != DXGI_FORMAT_UNKNOWN)
 		desc.Format = format;
 
-	LockResourceCreationMode();
+	// Reuse a staging resource from an earlier readback if we have one:
+	pool_entry = staging_pool.find(staging_key(&desc, !!(analyse_options & FrameAnalysisOptions::STEREO)));
+	if (pool_entry != staging_pool.end()) {
+		*resource = pool_entry->second.Detach();
+		staging_pool.erase(pool_entry);
+		return S_OK;
+	}
+
+	if (analyse_options & FrameAnalysisOptions::STEREO)
+		LockResourceCreationMode();
+	else
+		LockResourceCreationModeShared();
 
 	if (analyse_options & FrameAnalysisOptions::STEREO) {
 		// If we are dumping stereo at all force surface creation mode
@@ -1545,6 +1570,107 @@ bool FrameAnalysisContext::DeferDump2DResource(ID3D11Texture2D *staging,
 	return true;
 }
 
+FrameAnalysisStagingKey FrameAnalysisContext::staging_key(D3D11_TEXTURE2D_DESC *desc, bool forced_stereo)
+{
+	FrameAnalysisStagingKey key;
+
+	key.width = desc->Width;
+	key.height = desc->Height;
+	key.mip_levels = desc->MipLevels;
+	key.array_size = desc->ArraySize;
+	key.format = desc->Format;
+	key.usage = desc->Usage;
+	key.misc_flags = desc->MiscFlags;
+	key.forced_stereo = forced_stereo;
+
+	return key;
+}
+
+// Returns a staging resource to the pool once it has been read back. The
+// caller must hold the only remaining reference to it. forced_stereo must
+// match whether the stereo surface creation mode was forced when it was
+// created, since that is not reflected in its description.
+void FrameAnalysisContext::recycle_staging_resource(ID3D11Texture2D *staging, bool forced_stereo)
+{
+	D3D11_TEXTURE2D_DESC desc;
+
+	// Resources of every size come and go through a frame, so this only
+	// needs to be enough to cover those in use by a few draw calls:
+	if (staging_pool.size() >= 64)
+		return;
+
+	staging->GetDesc(&desc);
+	staging_pool.emplace(staging_key(&desc, forced_stereo), staging);
+}
+
+bool FrameAnalysisContext::QueueReadback2DResource(ID3D11Texture2D *staging,
+		wchar_t *filename, bool stereo, D3D11_TEXTURE2D_DESC *orig_desc, DXGI_FORMAT format)
+{
+	if (!G->analyse_readback_depth)
+		return false;
+
+	if (GetPassThroughOrigContext1()->GetType() != D3D11_DEVICE_CONTEXT_IMMEDIATE)
+		return false;
+
+	readbacks.emplace_back(FrameAnalysisDeferredDumpTex2DArgs(analyse_options,
+			staging, filename, stereo, orig_desc, format), draw_call);
+	readback_queued = true;
+
+	return true;
+}
+
+// Dumps any queued Texture2D readbacks whose copies the GPU has completed,
+// without waiting on any that it has not unless they have been in the queue
+// for analyse_readback_depth draw calls, or we are flushing the queue. Copies
+// complete in the order they were issued, so we stop at the first one that is
+// still in flight.
+//
+// Only Texture2Ds go through this queue - buffers are still read back
+// synchronously when they are dumped.
+void FrameAnalysisContext::process_readback_queue(bool flush)
+{
+	FrameAnalysisOptions saved_analyse_options = analyse_options;
+	unsigned saved_draw_call = draw_call;
+	D3D11_MAPPED_SUBRESOURCE map;
+	HRESULT hr;
+
+	while (!readbacks.empty()) {
+		FrameAnalysisReadback &readback = readbacks.front();
+
+		if (!flush && draw_call - readback.draw_call < G->analyse_readback_depth) {
+			hr = GetPassThroughOrigContext1()->Map(readback.args.staging.Get(), 0,
+					D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &map);
+			if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+				break;
+			if (SUCCEEDED(hr))
+				GetPassThroughOrigContext1()->Unmap(readback.args.staging.Get(), 0);
+		}
+
+		// Log the dump against the draw call that queued it, since that
+		// is the one the filename refers to and where anyone reading
+		// the log will look for it:
+		analyse_options = readback.args.analyse_options;
+		last_dedupe_filename.clear();
+		draw_call = readback.draw_call;
+		Dump2DResourceImmediateCtx(readback.args.staging.Get(), readback.args.filename,
+				readback.args.stereo, &readback.args.orig_desc, readback.args.format);
+		draw_call = saved_draw_call;
+		update_dump_cache(&readback.ticket);
+
+		recycle_staging_resource(readback.args.staging.Get(),
+				!!(readback.args.analyse_options & FrameAnalysisOptions::STEREO));
+		readbacks.pop_front();
+	}
+
+	analyse_options = saved_analyse_options;
+}
+
+void FrameAnalysisContext::FrameAnalysisFlush()
+{
+	process_readback_queue(true);
+	staging_pool.clear();
+}
+
 bool FrameAnalysisContext::DeferDumpBuffer(ID3D11Buffer *staging,
 		D3D11_BUFFER_DESC *orig_desc, wchar_t *filename,
 		FrameAnalysisOptions buf_type_mask, int idx, DXGI_FORMAT ib_fmt,
@@ -1581,12 +1707,19 @@ void FrameAnalysisContext::dump_deferred_resources(ID3D11CommandList *command_li
 	if (frame_analysis_deferred_buffer_lists.empty() && frame_analysis_deferred_tex2d_lists.empty())
 		return;
 
+	// Only hold the lock while we take ownership of the lists - once they
+	// are ours, nothing else can touch them while we dump them:
 	EnterCriticalSectionPretty(&G->mCriticalSection);
-
 	try {
 		deferred_buffers = std::move(frame_analysis_deferred_buffer_lists.at(command_list));
 		frame_analysis_deferred_buffer_lists.erase(command_list);
 	} catch (std::out_of_range) {}
+	try {
+		deferred_tex2d = std::move(frame_analysis_deferred_tex2d_lists.at(command_list));
+		frame_analysis_deferred_tex2d_lists.erase(command_list);
+	} catch (std::out_of_range) {}
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
+
 	if (deferred_buffers) {
 		for (FrameAnalysisDeferredDumpBufferArgs &i : *deferred_buffers) {
 			// Process key inputs to allow user to abort long running frame analysis sessions:
@@ -1603,10 +1736,6 @@ void FrameAnalysisContext::dump_deferred_resources(ID3D11CommandList *command_li
 		}
 	}
 
-	try {
-		deferred_tex2d = std::move(frame_analysis_deferred_tex2d_lists.at(command_list));
-		frame_analysis_deferred_tex2d_lists.erase(command_list);
-	} catch (std::out_of_range) {}
 	if (deferred_tex2d) {
 		for (FrameAnalysisDeferredDumpTex2DArgs &i : *deferred_tex2d) {
 			// Process key inputs to allow user to abort long running frame analysis sessions:
@@ -1619,8 +1748,6 @@ void FrameAnalysisContext::dump_deferred_resources(ID3D11CommandList *command_li
 					i.stereo, &i.orig_desc, i.format);
 		}
 	}
-
-	LeaveCriticalSection(&G->mCriticalSection);
 }
 
 void FrameAnalysisContext::finish_deferred_resources(ID3D11CommandList *command_list)
@@ -1642,7 +1769,7 @@ void FrameAnalysisContext::finish_deferred_resources(ID3D11CommandList *command_
 		frame_analysis_deferred_tex2d_lists.emplace(command_list, std::move(deferred_tex2d));
 	}
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 }
 
 void FrameAnalysisContext::determine_vb_count(UINT *count, ID3D11Buffer *staged_ib_for_vb,
@@ -1725,6 +1852,7 @@ void FrameAnalysisContext::DumpBufferImmediateCtx(ID3D11Buffer *staging, D3D11_B
 	}
 
 	dedupe_buf_filename(staging, orig_desc, &map, bin_filename, MAX_PATH);
+	last_dedupe_filename = bin_filename;
 
 	ext = filename.find_last_of(L'.');
 	bin_ext = wcsrchr(bin_filename, L'.');
@@ -1809,6 +1937,8 @@ void FrameAnalysisContext::DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
 {
 	D3D11_BUFFER_DESC desc, orig_desc;
 	ID3D11Buffer *staging = NULL;
+	FrameAnalysisDumpCacheTicket ticket;
+	wstring dedupe_filename;
 	HRESULT hr;
 
 	// Process key inputs to allow user to abort long running frame
@@ -1818,6 +1948,16 @@ void FrameAnalysisContext::DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
 	if (!G->analyse_frame)
 		return;
 
+	// If the caller needs the staged index buffer back we have to stage
+	// it regardless of whether it has changed:
+	check_dump_cache(buffer, false, DXGI_FORMAT_UNKNOWN, &ticket, &dedupe_filename);
+	if (!staged_ib_ret && !dedupe_filename.empty()) {
+		if (link_unchanged_buffer(filename, dedupe_filename, buf_type_mask, idx, ib_fmt,
+				stride, offset, first, count, layout, topology, call_info,
+				staged_ib_for_vb, ib_off_for_vb))
+			return;
+	}
+
 	buffer->GetDesc(&desc);
 	memcpy(&orig_desc, &desc, sizeof(D3D11_BUFFER_DESC));
 
@@ -1826,7 +1966,7 @@ void FrameAnalysisContext::DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
 	desc.MiscFlags = 0;
 	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
 
-	LockResourceCreationMode();
+	LockResourceCreationModeShared();
 	hr = GetHackerDevice()->GetPassThroughOrigDevice1()->CreateBuffer(&desc, NULL, &staging);
 	UnlockResourceCreationMode();
 	if (FAILED(hr)) {
@@ -1836,8 +1976,10 @@ void FrameAnalysisContext::DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
 
 	GetDumpingContext()->CopyResource(staging, buffer);
 
+	last_dedupe_filename.clear();
 	if (!DeferDumpBuffer(staging, &orig_desc, filename, buf_type_mask, idx, ib_fmt, stride, offset, first, count, layout, topology, call_info, staged_ib_for_vb, ib_off_for_vb))
 		DumpBufferImmediateCtx(staging, &orig_desc, filename, buf_type_mask, idx, ib_fmt, stride, offset, first, count, layout, topology, call_info, staged_ib_for_vb, ib_off_for_vb);
+	update_dump_cache(&ticket);
 
 	// We can return the staged index buffer for later use when dumping the
 	// vertex buffers as text, to determine the maximum vertex count:
@@ -1849,6 +1991,31 @@ void FrameAnalysisContext::DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
 	staging->Release();
 }
 
+void FrameAnalysisContext::Dump2DResourceIfChanged(ID3D11Texture2D *resource,
+		wchar_t *filename, bool stereo, DXGI_FORMAT format)
+{
+	FrameAnalysisDumpCacheTicket ticket;
+	wstring dedupe_filename;
+
+	check_dump_cache(resource, stereo, format, &ticket, &dedupe_filename);
+	if (!dedupe_filename.empty() && link_unchanged_tex2d(filename, dedupe_filename, stereo))
+		return;
+
+	last_dedupe_filename.clear();
+	readback_queued = false;
+	if (stereo)
+		DumpStereoResource(resource, filename, format);
+	else
+		Dump2DResource(resource, filename, false, NULL, format);
+
+	// If the readback was queued the cache will be updated once it has
+	// been completed:
+	if (readback_queued && !readbacks.empty())
+		readbacks.back().ticket = ticket;
+	else
+		update_dump_cache(&ticket);
+}
+
 void FrameAnalysisContext::DumpResource(ID3D11Resource *resource, wchar_t *filename,
 		FrameAnalysisOptions buf_type_mask, int idx, DXGI_FORMAT format,
 		UINT stride, UINT offset)
@@ -1876,9 +2043,9 @@ void FrameAnalysisContext::DumpResource(ID3D11Resource *resource, wchar_t *filen
 		case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
 			if (analyse_options & FrameAnalysisOptions::FMT_2D_MASK) {
 				if (analyse_options & FrameAnalysisOptions::STEREO)
-					DumpStereoResource((ID3D11Texture2D*)resource, filename, format);
+					Dump2DResourceIfChanged((ID3D11Texture2D*)resource, filename, true, format);
 				if (analyse_options & FrameAnalysisOptions::MONO)
-					Dump2DResource((ID3D11Texture2D*)resource, filename, false, NULL, format);
+					Dump2DResourceIfChanged((ID3D11Texture2D*)resource, filename, false, format);
 			} else
 				FALogInfo("Skipped dumping Texture2D (No Texture2D formats enabled): %S\n", filename);
 			break;
@@ -1891,6 +2058,226 @@ void FrameAnalysisContext::DumpResource(ID3D11Resource *resource, wchar_t *filen
 	}
 }
 
+// Fills out the snapshot of a resource's hash tracking information. Must be
+// called with both mResourceInfoLock and mResourcesLock held, and with the
+// snapshot zeroed:
+static void lookup_resource_hash(ID3D11Resource *handle, FrameAnalysisHashSnapshot *snapshot)
+{
+	ResourceMap::iterator resource;
+	ResourceInfoMap::iterator info;
+
+	resource = G->mResources.find(handle);
+	if (resource == G->mResources.end())
+		return;
+
+	snapshot->hash = resource->second.hash;
+	snapshot->orig_hash = resource->second.orig_hash;
+	if (!snapshot->hash)
+		return;
+
+	info = G->mResourceInfo.find(snapshot->orig_hash);
+	if (info == G->mResourceInfo.end())
+		return;
+
+	snapshot->contaminated = info->second.hash_contaminated;
+	snapshot->map_contamination = !info->second.map_contamination.empty();
+	snapshot->update_contamination = !info->second.update_contamination.empty();
+	snapshot->copy_contamination = !info->second.copy_contamination.empty();
+	snapshot->region_contamination = !info->second.region_contamination.empty();
+}
+
+// Snapshots a single resource, for dumps that only involve one resource and
+// any resource that was somehow missed by snapshot_bound_resources():
+static void snapshot_resource_hash(ID3D11Resource *handle, FrameAnalysisHashSnapshot *snapshot)
+{
+	memset(snapshot, 0, sizeof(FrameAnalysisHashSnapshot));
+
+	DrainResourceInfo();
+
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
+	EnterCriticalSectionPretty(&G->mResourcesLock);
+	lookup_resource_hash(handle, snapshot);
+	LeaveCriticalSectionPretty(&G->mResourcesLock);
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
+}
+
+// Adds the buffers fetched from the pipeline to the snapshot table. The
+// references taken by the Get call are released straight away - the pipeline
+// keeps them bound until the dump that follows, and only this thread can
+// change this context's bindings.
+static void add_buffer_snapshots(FrameAnalysisSnapshotTable *table, ID3D11Buffer **buffers, UINT count)
+{
+	UINT i;
+
+	for (i = 0; i < count; i++) {
+		if (!buffers[i])
+			continue;
+		table->add(buffers[i]);
+		buffers[i]->Release();
+	}
+}
+
+template <class ID3D11View>
+static void add_view_snapshots(FrameAnalysisSnapshotTable *table, ID3D11View **views, UINT count)
+{
+	ID3D11Resource *resource;
+	UINT i;
+
+	for (i = 0; i < count; i++) {
+		if (!views[i])
+			continue;
+		views[i]->GetResource(&resource);
+		if (resource) {
+			table->add(resource);
+			resource->Release();
+		}
+		views[i]->Release();
+	}
+}
+
+// Snapshots the hashes of everything bound to the draw or dispatch call that
+// the Dump* routines below may dump, in one pass under the locks before any of
+// them are copied or written out, so every file from the same draw call is
+// named from a consistent view of the resource tables.
+void FrameAnalysisContext::snapshot_bound_resources(bool compute)
+{
+	ID3D11DeviceContext1 *context = GetPassThroughOrigContext1();
+	ID3D11Buffer *buffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	ID3D11ShaderResourceView *srvs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+	ID3D11RenderTargetView *rtvs[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+	ID3D11UnorderedAccessView *uavs[D3D11_1_UAV_SLOT_COUNT];
+	ID3D11DepthStencilView *dsv = NULL;
+	ID3D11Buffer *ib = NULL;
+	DXGI_FORMAT ib_fmt;
+	UINT ib_off;
+	UINT strides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	UINT offsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	const UINT num_cbs = D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT;
+	const UINT num_srvs = D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT;
+
+	draw_snapshots.clear();
+
+	if (analyse_options & FrameAnalysisOptions::DUMP_CB) {
+		if (compute) {
+			if (mCurrentComputeShader) {
+				context->CSGetConstantBuffers(0, num_cbs, buffers);
+				add_buffer_snapshots(&draw_snapshots, buffers, num_cbs);
+			}
+		} else {
+			if (mCurrentVertexShader) {
+				context->VSGetConstantBuffers(0, num_cbs, buffers);
+				add_buffer_snapshots(&draw_snapshots, buffers, num_cbs);
+			}
+			if (mCurrentHullShader) {
+				context->HSGetConstantBuffers(0, num_cbs, buffers);
+				add_buffer_snapshots(&draw_snapshots, buffers, num_cbs);
+			}
+			if (mCurrentDomainShader) {
+				context->DSGetConstantBuffers(0, num_cbs, buffers);
+				add_buffer_snapshots(&draw_snapshots, buffers, num_cbs);
+			}
+			if (mCurrentGeometryShader) {
+				context->GSGetConstantBuffers(0, num_cbs, buffers);
+				add_buffer_snapshots(&draw_snapshots, buffers, num_cbs);
+			}
+			if (mCurrentPixelShader) {
+				context->PSGetConstantBuffers(0, num_cbs, buffers);
+				add_buffer_snapshots(&draw_snapshots, buffers, num_cbs);
+			}
+		}
+	}
+
+	// DumpMesh() may stage the index buffer even if only vertex buffers
+	// are being dumped, so take both whenever either is:
+	if (!compute && (analyse_options & (FrameAnalysisOptions::DUMP_VB | FrameAnalysisOptions::DUMP_IB))) {
+		context->IAGetIndexBuffer(&ib, &ib_fmt, &ib_off);
+		add_buffer_snapshots(&draw_snapshots, &ib, 1);
+		context->IAGetVertexBuffers(0, D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT, buffers, strides, offsets);
+		add_buffer_snapshots(&draw_snapshots, buffers, D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT);
+	}
+
+	if (analyse_options & FrameAnalysisOptions::DUMP_SRV) {
+		if (compute) {
+			if (mCurrentComputeShader) {
+				context->CSGetShaderResources(0, num_srvs, srvs);
+				add_view_snapshots(&draw_snapshots, srvs, num_srvs);
+			}
+		} else {
+			if (mCurrentVertexShader) {
+				context->VSGetShaderResources(0, num_srvs, srvs);
+				add_view_snapshots(&draw_snapshots, srvs, num_srvs);
+			}
+			if (mCurrentHullShader) {
+				context->HSGetShaderResources(0, num_srvs, srvs);
+				add_view_snapshots(&draw_snapshots, srvs, num_srvs);
+			}
+			if (mCurrentDomainShader) {
+				context->DSGetShaderResources(0, num_srvs, srvs);
+				add_view_snapshots(&draw_snapshots, srvs, num_srvs);
+			}
+			if (mCurrentGeometryShader) {
+				context->GSGetShaderResources(0, num_srvs, srvs);
+				add_view_snapshots(&draw_snapshots, srvs, num_srvs);
+			}
+			if (mCurrentPixelShader) {
+				context->PSGetShaderResources(0, num_srvs, srvs);
+				add_view_snapshots(&draw_snapshots, srvs, num_srvs);
+			}
+		}
+	}
+
+	if (analyse_options & FrameAnalysisOptions::DUMP_RT) {
+		if (compute) {
+			context->CSGetUnorderedAccessViews(0, num_uav_slots, uavs);
+		} else {
+			context->OMGetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, rtvs, NULL);
+			add_view_snapshots(&draw_snapshots, rtvs, D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT);
+			context->OMGetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL, 0, num_uav_slots, uavs);
+		}
+		add_view_snapshots(&draw_snapshots, uavs, num_uav_slots);
+	}
+
+	if ((analyse_options & FrameAnalysisOptions::DUMP_DEPTH) && !compute) {
+		context->OMGetRenderTargets(0, NULL, &dsv);
+		add_view_snapshots(&draw_snapshots, &dsv, 1);
+	}
+
+	if (draw_snapshots.empty())
+		return;
+
+	DrainResourceInfo();
+
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
+	EnterCriticalSectionPretty(&G->mResourcesLock);
+	draw_snapshots.take(lookup_resource_hash);
+	LeaveCriticalSectionPretty(&G->mResourcesLock);
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
+}
+
+static void append_resource_hash(wchar_t **pos, size_t *rem, const FrameAnalysisHashSnapshot *snapshot)
+{
+	if (!snapshot->hash)
+		return;
+
+	if (snapshot->contaminated) {
+		StringCchPrintfExW(*pos, *rem, pos, rem, NULL, L"=!");
+		if (snapshot->map_contamination)
+			StringCchPrintfExW(*pos, *rem, pos, rem, NULL, L"M");
+		if (snapshot->update_contamination)
+			StringCchPrintfExW(*pos, *rem, pos, rem, NULL, L"U");
+		if (snapshot->copy_contamination)
+			StringCchPrintfExW(*pos, *rem, pos, rem, NULL, L"C");
+		if (snapshot->region_contamination)
+			StringCchPrintfExW(*pos, *rem, pos, rem, NULL, L"S");
+		StringCchPrintfExW(*pos, *rem, pos, rem, NULL, L"!");
+	}
+
+	StringCchPrintfExW(*pos, *rem, pos, rem, NULL, L"=%08x", snapshot->hash);
+
+	if (snapshot->hash != snapshot->orig_hash)
+		StringCchPrintfExW(*pos, *rem, pos, rem, NULL, L"(%08x)", snapshot->orig_hash);
+}
+
 static BOOL CreateDeferredFADirectory(LPCWSTR path)
 {
 	DWORD err;
@@ -1926,8 +2313,8 @@ void FrameAnalysisContext::get_deduped_dir(wchar_t *path, size_t size)
 HRESULT FrameAnalysisContext::FrameAnalysisFilename(wchar_t *filename, size_t size, bool compute,
 		wchar_t *reg, char shader_type, int idx, ID3D11Resource *handle)
 {
-	struct ResourceHashInfo *info;
-	uint32_t hash, orig_hash;
+	const FrameAnalysisHashSnapshot *snapshot_ptr;
+	FrameAnalysisHashSnapshot snapshot;
 	wchar_t *pos;
 	size_t rem;
 	HRESULT hr;
@@ -1963,37 +2350,12 @@ HRESULT FrameAnalysisContext::FrameAnalysisFilename(wchar_t *filename, size_t si
 		StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"%06i", draw_call);
 	}
 
-	EnterCriticalSectionPretty(&G->mResourcesLock);
-	try {
-		hash = G->mResources.at(handle).hash;
-		orig_hash = G->mResources.at(handle).orig_hash;
-	} catch (std::out_of_range) {
-		hash = orig_hash = 0;
-	}
-	LeaveCriticalSection(&G->mResourcesLock);
-
-	if (hash) {
-		try {
-			info = &G->mResourceInfo.at(orig_hash);
-			if (info->hash_contaminated) {
-				StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"=!");
-				if (!info->map_contamination.empty())
-					StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"M");
-				if (!info->update_contamination.empty())
-					StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"U");
-				if (!info->copy_contamination.empty())
-					StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"C");
-				if (!info->region_contamination.empty())
-					StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"S");
-				StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"!");
-			}
-		} catch (std::out_of_range) {}
-
-		StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"=%08x", hash);
-
-		if (hash != orig_hash)
-			StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"(%08x)", orig_hash);
+	snapshot_ptr = draw_snapshots.find(handle);
+	if (!snapshot_ptr) {
+		snapshot_resource_hash(handle, &snapshot);
+		snapshot_ptr = &snapshot;
 	}
+	append_resource_hash(&pos, &rem, snapshot_ptr);
 	if (analyse_options & FrameAnalysisOptions::FILENAME_HANDLE)
 		StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"@%p", handle);
 
@@ -2024,8 +2386,7 @@ HRESULT FrameAnalysisContext::FrameAnalysisFilename(wchar_t *filename, size_t si
 
 HRESULT FrameAnalysisContext::FrameAnalysisFilenameResource(wchar_t *filename, size_t size, const wchar_t *type, ID3D11Resource *handle, bool force_filename_handle)
 {
-	struct ResourceHashInfo *info;
-	uint32_t hash, orig_hash;
+	FrameAnalysisHashSnapshot snapshot;
 	wchar_t *pos;
 	size_t rem;
 	HRESULT hr;
@@ -2045,37 +2406,8 @@ HRESULT FrameAnalysisContext::FrameAnalysisFilenameResource(wchar_t *filename, s
 
 	StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"%s", type);
 
-	EnterCriticalSectionPretty(&G->mResourcesLock);
-	try {
-		hash = G->mResources.at(handle).hash;
-		orig_hash = G->mResources.at(handle).orig_hash;
-	} catch (std::out_of_range) {
-		hash = orig_hash = 0;
-	}
-	LeaveCriticalSection(&G->mResourcesLock);
-
-	if (hash) {
-		try {
-			info = &G->mResourceInfo.at(orig_hash);
-			if (info->hash_contaminated) {
-				StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"=!");
-				if (!info->map_contamination.empty())
-					StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"M");
-				if (!info->update_contamination.empty())
-					StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"U");
-				if (!info->copy_contamination.empty())
-					StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"C");
-				if (!info->region_contamination.empty())
-					StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"S");
-				StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"!");
-			}
-		} catch (std::out_of_range) {}
-
-		StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"=%08x", hash);
-
-		if (hash != orig_hash)
-			StringCchPrintfExW(pos, rem, &pos, &rem, NULL, L"(%08x)", orig_hash);
-	}
+	snapshot_resource_hash(handle, &snapshot);
+	append_resource_hash(&pos, &rem, &snapshot);
 
 	// Always do this for update/unmap resource dumps since hashes are likely to clash:
 	if (force_filename_handle || (analyse_options & FrameAnalysisOptions::FILENAME_HANDLE))
@@ -2088,6 +2420,167 @@ HRESULT FrameAnalysisContext::FrameAnalysisFilenameResource(wchar_t *filename, s
 	return hr;
 }
 
+// Fills out the ticket with the resource's current write generation, to be
+// passed to update_dump_cache() once it has been dumped. If the resource has
+// not been written to since it was last dumped with the same format,
+// dedupe_filename is also filled out with where that dump was saved to.
+void FrameAnalysisContext::check_dump_cache(ID3D11Resource *resource, bool stereo,
+		DXGI_FORMAT format, FrameAnalysisDumpCacheTicket *ticket, wstring *dedupe_filename)
+{
+	FrameAnalysisDumpCache::iterator i;
+
+	ticket->key = {resource, format, stereo};
+	dedupe_filename->clear();
+
+	ticket->tracked = GetResourceWriteGeneration(resource, &ticket->generation, &ticket->epoch);
+	if (!ticket->tracked)
+		return;
+
+	// Something we couldn't attribute to any specific resource may have
+	// written to anything, or a new frame analysis session has started
+	// with a new deduped directory - either way, start over:
+	if (ticket->epoch != dump_cache_epoch) {
+		dump_cache.clear();
+		dump_cache_epoch = ticket->epoch;
+		return;
+	}
+
+	i = dump_cache.find(ticket->key);
+	if (i != dump_cache.end() && i->second.generation == ticket->generation)
+		*dedupe_filename = i->second.dedupe_filename;
+}
+
+// Call after dumping a resource with the ticket from check_dump_cache(). If the
+// dump was deferred or could not be deduplicated last_dedupe_filename will be
+// empty and we forget about it.
+void FrameAnalysisContext::update_dump_cache(FrameAnalysisDumpCacheTicket *ticket)
+{
+	if (!ticket->tracked)
+		return;
+
+	// Everything has been invalidated since we took the ticket:
+	if (ticket->epoch != dump_cache_epoch)
+		return;
+
+	if (last_dedupe_filename.empty()) {
+		dump_cache.erase(ticket->key);
+		return;
+	}
+
+	dump_cache[ticket->key] = {ticket->generation, last_dedupe_filename};
+}
+
+// Links a set of previously deduplicated files into the current dump location
+// for a resource that has not changed since. Only proceeds if every requested
+// file is still there, otherwise returns false so the caller can fall back to
+// dumping it the slow way.
+bool FrameAnalysisContext::link_unchanged_files(wstring filename,
+		const vector<pair<const wchar_t*, wstring>> &files, const wchar_t *type)
+{
+	size_t ext;
+
+	ext = filename.find_last_of(L'.');
+	if (ext == wstring::npos || files.empty())
+		return false;
+
+	for (auto &file : files) {
+		if (GetFileAttributes(file.second.c_str()) == INVALID_FILE_ATTRIBUTES)
+			return false;
+	}
+
+	for (auto &file : files) {
+		filename.replace(ext, wstring::npos, file.first);
+		FALogInfo("Dumping unchanged %S %S -> %S\n", type, filename.c_str(), file.second.c_str());
+		link_deduplicated_files(filename.c_str(), file.second.c_str());
+	}
+
+	return true;
+}
+
+// Mirrors the format selection in Dump2DResourceImmediateCtx()
+bool FrameAnalysisContext::link_unchanged_tex2d(wchar_t *filename, wstring dedupe_filename, bool stereo)
+{
+	vector<pair<const wchar_t*, wstring>> files;
+	const wchar_t *wic_ext = (stereo ? L".jps" : L".jpg");
+	size_t ext;
+
+	ext = dedupe_filename.find_last_of(L'.');
+	if (ext == wstring::npos)
+		return false;
+
+	if ((analyse_options & FrameAnalysisOptions::FMT_2D_JPS) ||
+	    (analyse_options & FrameAnalysisOptions::FMT_2D_AUTO)) {
+		dedupe_filename.replace(ext, wstring::npos, wic_ext);
+		if (GetFileAttributes(dedupe_filename.c_str()) != INVALID_FILE_ATTRIBUTES)
+			files.emplace_back(wic_ext, dedupe_filename);
+		else if (!(analyse_options & FrameAnalysisOptions::FMT_2D_AUTO))
+			return false;
+		else if (!(analyse_options & FrameAnalysisOptions::FMT_2D_DDS)) {
+			// Saving as JPS failed last time, so we fell back to DDS:
+			dedupe_filename.replace(ext, wstring::npos, L".dds");
+			files.emplace_back(L".dds", dedupe_filename);
+		}
+	}
+
+	if (analyse_options & FrameAnalysisOptions::FMT_2D_DDS) {
+		dedupe_filename.replace(ext, wstring::npos, L".dds");
+		files.emplace_back(L".dds", dedupe_filename);
+	}
+
+	if (analyse_options & FrameAnalysisOptions::FMT_DESC) {
+		dedupe_filename.replace(ext, wstring::npos, L".dsc");
+		files.emplace_back(L".dsc", dedupe_filename);
+	}
+
+	return link_unchanged_files(filename, files, L"Texture2D");
+}
+
+// Mirrors the format selection in DumpBufferImmediateCtx(). The text dumps
+// are deduplicated by the binary filename and the parameters used to
+// interpret it, so we can work out which one to link without the data.
+bool FrameAnalysisContext::link_unchanged_buffer(wchar_t *filename, wstring dedupe_filename,
+		FrameAnalysisOptions buf_type_mask, int idx, DXGI_FORMAT ib_fmt,
+		UINT stride, UINT offset, UINT first, UINT count, ID3DBlob *layout,
+		D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info,
+		ID3D11Buffer *staged_ib_for_vb, UINT ib_off_for_vb)
+{
+	vector<pair<const wchar_t*, wstring>> files;
+	wchar_t bin_filename[MAX_PATH], txt_filename[MAX_PATH];
+	wchar_t *bin_ext;
+
+	if (wcscpy_s(bin_filename, MAX_PATH, dedupe_filename.c_str()))
+		return false;
+	bin_ext = wcsrchr(bin_filename, L'.');
+	if (!bin_ext)
+		return false;
+
+	if (analyse_options & FrameAnalysisOptions::FMT_BUF_BIN) {
+		wcscpy_s(bin_ext, MAX_PATH + bin_filename - bin_ext, L".buf");
+		files.emplace_back(L".buf", bin_filename);
+	}
+
+	if (analyse_options & FrameAnalysisOptions::FMT_BUF_TXT) {
+		if (buf_type_mask & FrameAnalysisOptions::DUMP_CB) {
+			dedupe_buf_filename_txt(bin_filename, txt_filename, MAX_PATH, 'c', idx, stride, offset);
+		} else if (buf_type_mask & FrameAnalysisOptions::DUMP_VB) {
+			determine_vb_count(&count, staged_ib_for_vb, call_info, ib_off_for_vb, ib_fmt);
+			dedupe_buf_filename_vb_txt(bin_filename, txt_filename, MAX_PATH, idx, stride, offset, first, count, layout, topology, call_info);
+		} else if (buf_type_mask & FrameAnalysisOptions::DUMP_IB) {
+			dedupe_buf_filename_ib_txt(bin_filename, txt_filename, MAX_PATH, ib_fmt, offset, first, count, topology);
+		} else {
+			dedupe_buf_filename_txt(bin_filename, txt_filename, MAX_PATH, '?', idx, stride, offset);
+		}
+		files.emplace_back(L".txt", txt_filename);
+	}
+
+	if (analyse_options & FrameAnalysisOptions::FMT_DESC) {
+		wcscpy_s(bin_ext, MAX_PATH + bin_filename - bin_ext, L".dsc");
+		files.emplace_back(L".dsc", bin_filename);
+	}
+
+	return link_unchanged_files(filename, files, L"Buffer");
+}
+
 const wchar_t* FrameAnalysisContext::dedupe_tex2d_filename(ID3D11Texture2D *resource,
 		D3D11_TEXTURE2D_DESC *orig_desc, wchar_t *dedupe_filename,
 		size_t size, const wchar_t *traditional_filename, DXGI_FORMAT format)
@@ -2663,18 +3156,18 @@ void FrameAnalysisContext::DumpDepthStencilTargets()
 void FrameAnalysisContext::DumpUAVs(bool compute)
 {
 	UINT i;
-	ID3D11UnorderedAccessView *uavs[D3D11_PS_CS_UAV_REGISTER_COUNT];
+	ID3D11UnorderedAccessView *uavs[D3D11_1_UAV_SLOT_COUNT]; // DX11: 8, DX11.1: 64
 	ID3D11Resource *resource;
 	D3D11_UNORDERED_ACCESS_VIEW_DESC view_desc;
 	wchar_t filename[MAX_PATH];
 	HRESULT hr;
 
 	if (compute)
-		GetPassThroughOrigContext1()->CSGetUnorderedAccessViews(0, D3D11_PS_CS_UAV_REGISTER_COUNT, uavs);
+		GetPassThroughOrigContext1()->CSGetUnorderedAccessViews(0, num_uav_slots, uavs);
 	else
-		GetPassThroughOrigContext1()->OMGetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL, 0, D3D11_PS_CS_UAV_REGISTER_COUNT, uavs);
+		GetPassThroughOrigContext1()->OMGetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL, 0, num_uav_slots, uavs);
 
-	for (i = 0; i < D3D11_PS_CS_UAV_REGISTER_COUNT && G->analyse_frame; ++i) {
+	for (i = 0; i < num_uav_slots && G->analyse_frame; ++i) {
 		if (!uavs[i])
 			continue;
 
@@ -2701,6 +3194,84 @@ void FrameAnalysisContext::DumpUAVs(bool compute)
 	}
 }
 
+// Bumps the write generation of everything bound as an output to the draw or
+// dispatch call that just completed, since it may have been written to.
+//
+// This runs after every draw and dispatch while frame analysis is active and
+// costs one Get call per binding point plus an AddRef/Release and a
+// mResourcesLock lookup per bound output. On feature level 11.1 that means
+// fetching all 64 UAV slots, though empty slots are cheap to skip:
+void FrameAnalysisContext::mark_bound_targets_written(bool compute)
+{
+	ID3D11RenderTargetView *rtvs[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT] = {0};
+	ID3D11DepthStencilView *dsv = NULL;
+	ID3D11UnorderedAccessView *uavs[D3D11_1_UAV_SLOT_COUNT] = {0}; // DX11: 8, DX11.1: 64
+	ID3D11Buffer *so_targets[D3D11_SO_BUFFER_SLOT_COUNT] = {0};
+	ID3D11Resource *resources[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT + 1 +
+		D3D11_1_UAV_SLOT_COUNT + D3D11_SO_BUFFER_SLOT_COUNT];
+	unsigned num_resources = 0;
+	UINT i;
+
+	if (compute) {
+		GetPassThroughOrigContext1()->CSGetUnorderedAccessViews(0, num_uav_slots, uavs);
+	} else {
+		GetPassThroughOrigContext1()->OMGetRenderTargetsAndUnorderedAccessViews(
+				D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, rtvs, &dsv,
+				0, num_uav_slots, uavs);
+		GetPassThroughOrigContext1()->SOGetTargets(D3D11_SO_BUFFER_SLOT_COUNT, so_targets);
+	}
+
+	// Only the addresses are needed to look up the resources, so the
+	// references from GetResource() are released straight away. The views
+	// are still holding them until they are released below:
+	for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+		if (rtvs[i]) {
+			rtvs[i]->GetResource(&resources[num_resources]);
+			if (resources[num_resources])
+				resources[num_resources++]->Release();
+		}
+	}
+
+	if (dsv) {
+		dsv->GetResource(&resources[num_resources]);
+		if (resources[num_resources])
+			resources[num_resources++]->Release();
+	}
+
+	for (i = 0; i < num_uav_slots; i++) {
+		if (uavs[i]) {
+			uavs[i]->GetResource(&resources[num_resources]);
+			if (resources[num_resources])
+				resources[num_resources++]->Release();
+		}
+	}
+
+	for (i = 0; i < D3D11_SO_BUFFER_SLOT_COUNT; i++) {
+		if (so_targets[i])
+			resources[num_resources++] = so_targets[i];
+	}
+
+	// This has to happen on every draw call, including those that the fast
+	// path in FrameAnalysisAfterDraw() skips, since the write generations
+	// are shared with the dump caches of every context:
+	MarkResourcesWritten(resources, num_resources);
+
+	for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+		if (rtvs[i])
+			rtvs[i]->Release();
+	}
+	if (dsv)
+		dsv->Release();
+	for (i = 0; i < num_uav_slots; i++) {
+		if (uavs[i])
+			uavs[i]->Release();
+	}
+	for (i = 0; i < D3D11_SO_BUFFER_SLOT_COUNT; i++) {
+		if (so_targets[i])
+			so_targets[i]->Release();
+	}
+}
+
 void FrameAnalysisContext::FrameAnalysisClearRT(ID3D11RenderTargetView *target)
 {
 	FLOAT colour[4] = {0,0,0,0};
@@ -2726,6 +3297,7 @@ void FrameAnalysisContext::FrameAnalysisClearRT(ID3D11RenderTargetView *target)
 	G->frame_analysis_seen_rts.insert(resource);
 
 	GetPassThroughOrigContext1()->ClearRenderTargetView(target, colour);
+	MarkResourceWritten(resource);
 }
 
 void FrameAnalysisContext::FrameAnalysisClearUAV(ID3D11UnorderedAccessView *uav)
@@ -2753,6 +3325,7 @@ void FrameAnalysisContext::FrameAnalysisClearUAV(ID3D11UnorderedAccessView *uav)
 	G->frame_analysis_seen_rts.insert(resource);
 
 	GetPassThroughOrigContext1()->ClearUnorderedAccessViewUint(uav, values);
+	MarkResourceWritten(resource);
 }
 
 void FrameAnalysisContext::FrameAnalysisTrigger(FrameAnalysisOptions new_options)
@@ -2835,8 +3408,27 @@ void FrameAnalysisContext::FrameAnalysisAfterDraw(bool compute, DrawCallInfo *ca
 {
 	NvAPI_Status nvret;
 
+	// These two stay ahead of the fast path below. The bound targets must
+	// be marked written for every draw call so that no context links a
+	// stale dump of them, and any readbacks queued by earlier draw calls
+	// still need to be drained (that is only a check of an empty queue
+	// when nothing has been queued):
+	mark_bound_targets_written(compute);
+	process_readback_queue(false);
+
 	update_per_draw_analyse_options();
 
+	// By this point the ShaderOverride and TextureOverride command lists
+	// for this draw call have already run, so we know exactly which
+	// options apply to it. When only specific shaders or textures have
+	// been set up to trigger a dump (no bind flags in the global
+	// analyse_options), most draw calls won't dump anything, so skip
+	// straight past them without asking nvapi about the stereo mode:
+	if (!(analyse_options & FrameAnalysisOptions::DUMP_BIND_MASK)) {
+		draw_call++;
+		return;
+	}
+
 	// Update: We now have an option to allow analysis on deferred
 	// contexts, because it can still be useful to dump some types of
 	// resources in these cases. Render and depth targets will be pretty
@@ -2878,9 +3470,12 @@ void FrameAnalysisContext::FrameAnalysisAfterDraw(bool compute, DrawCallInfo *ca
 		}
 	}
 
-	// Grab the critical section now as we may need it several times during
-	// dumping for mResources
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	// We no longer hold the critical section for the duration of the dump.
+	// Anything we need from mResources or mResourceInfo to name the files
+	// is snapshotted under the locks here before anything is dumped, and
+	// the resources themselves are kept alive by the references we take
+	// when fetching them from the pipeline.
+	snapshot_bound_resources(compute);
 
 	if (analyse_options & FrameAnalysisOptions::DUMP_CB)
 		DumpCBs(compute);
@@ -2902,14 +3497,13 @@ void FrameAnalysisContext::FrameAnalysisAfterDraw(bool compute, DrawCallInfo *ca
 	if (analyse_options & FrameAnalysisOptions::DUMP_DEPTH && !compute)
 		DumpDepthStencilTargets();
 
-	LeaveCriticalSection(&G->mCriticalSection);
-
 	if ((analyse_options & FrameAnalysisOptions::FMT_2D_MASK) &&
 	    (analyse_options & FrameAnalysisOptions::STEREO) &&
 	    (GetDumpingContext()->GetType() == D3D11_DEVICE_CONTEXT_IMMEDIATE)) {
 		Profiling::NvAPI_Stereo_ReverseStereoBlitControl(GetHackerDevice()->mStereoHandle, false);
 	}
 
+	draw_snapshots.clear();
 	draw_call++;
 }
 
@@ -2937,8 +3531,6 @@ void FrameAnalysisContext::_FrameAnalysisAfterUpdate(ID3D11Resource *resource,
 
 	set_default_dump_formats(false);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-
 	// We don't have a view at this point to get a fully typed format, so
 	// we leave format as DXGI_FORMAT_UNKNOWN, which will use the format
 	// from the resource description.
@@ -2948,8 +3540,6 @@ void FrameAnalysisContext::_FrameAnalysisAfterUpdate(ID3D11Resource *resource,
 		DumpResource(resource, filename, analyse_options, -1, DXGI_FORMAT_UNKNOWN, 0, 0);
 	}
 
-	LeaveCriticalSection(&G->mCriticalSection);
-
 	non_draw_call_dump_counter++;
 }
 
@@ -2996,8 +3586,6 @@ void FrameAnalysisContext::FrameAnalysisDump(ID3D11Resource *resource, FrameAnal
 		}
 	}
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-
 	hr = FrameAnalysisFilenameResource(filename, MAX_PATH, target, resource, false);
 	if (FAILED(hr)) {
 		// If the ini section and resource name makes the filename too
@@ -3007,8 +3595,6 @@ void FrameAnalysisContext::FrameAnalysisDump(ID3D11Resource *resource, FrameAnal
 	if (SUCCEEDED(hr))
 		DumpResource(resource, filename, analyse_options, -1, format, stride, offset);
 
-	LeaveCriticalSection(&G->mCriticalSection);
-
 	if ((analyse_options & FrameAnalysisOptions::STEREO) &&
 	    (GetDumpingContext()->GetType() == D3D11_DEVICE_CONTEXT_IMMEDIATE)) {
 		Profiling::NvAPI_Stereo_ReverseStereoBlitControl(GetHackerDevice()->mStereoHandle, false);
@@ -3114,6 +3700,9 @@ STDMETHODIMP FrameAnalysisContext::Map(THIS_
 			pResource, Subresource, MapType, MapFlags, pMappedResource);
 	FrameAnalysisLogResourceHash(pResource);
 
+	if (G->analyse_frame && MapType != D3D11_MAP_READ)
+		MarkResourceWritten(pResource);
+
 	return HackerContext::Map(pResource, Subresource, MapType, MapFlags, pMappedResource);
 }
 
@@ -3467,6 +4056,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::CopySubresourceRegion(THIS_
 
 	HackerContext::CopySubresourceRegion(pDstResource, DstSubresource, DstX, DstY, DstZ,
 			pSrcResource, SrcSubresource, pSrcBox);
+
+	if (G->analyse_frame)
+		MarkResourceWritten(pDstResource);
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::CopyResource(THIS_
@@ -3481,6 +4073,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::CopyResource(THIS_
 	FrameAnalysisLogResource(-1, "Dst", pDstResource);
 
 	HackerContext::CopyResource(pDstResource, pSrcResource);
+
+	if (G->analyse_frame)
+		MarkResourceWritten(pDstResource);
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::UpdateSubresource(THIS_
@@ -3504,8 +4099,10 @@ STDMETHODIMP_(void) FrameAnalysisContext::UpdateSubresource(THIS_
 	HackerContext::UpdateSubresource(pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch,
 			SrcDepthPitch);
 
-	if (G->analyse_frame)
+	if (G->analyse_frame) {
+		MarkResourceWritten(pDstResource);
 		FrameAnalysisAfterUpdate(pDstResource);
+	}
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::CopyStructureCount(THIS_
@@ -3522,6 +4119,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::CopyStructureCount(THIS_
 	FrameAnalysisLogResource(-1, "Dst", pDstBuffer);
 
 	HackerContext::CopyStructureCount(pDstBuffer, DstAlignedByteOffset, pSrcView);
+
+	if (G->analyse_frame)
+		MarkResourceWritten(pDstBuffer);
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::ClearUnorderedAccessViewUint(THIS_
@@ -3535,6 +4135,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::ClearUnorderedAccessViewUint(THIS_
 	FrameAnalysisLogView(-1, "", pUnorderedAccessView);
 
 	HackerContext::ClearUnorderedAccessViewUint(pUnorderedAccessView, Values);
+
+	if (G->analyse_frame)
+		MarkViewResourceWritten(pUnorderedAccessView);
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::ClearUnorderedAccessViewFloat(THIS_
@@ -3548,6 +4151,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::ClearUnorderedAccessViewFloat(THIS_
 	FrameAnalysisLogView(-1, "", pUnorderedAccessView);
 
 	HackerContext::ClearUnorderedAccessViewFloat(pUnorderedAccessView, Values);
+
+	if (G->analyse_frame)
+		MarkViewResourceWritten(pUnorderedAccessView);
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::ClearDepthStencilView(THIS_
@@ -3565,6 +4171,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::ClearDepthStencilView(THIS_
 	FrameAnalysisLogView(-1, "", pDepthStencilView);
 
 	HackerContext::ClearDepthStencilView(pDepthStencilView, ClearFlags, Depth, Stencil);
+
+	if (G->analyse_frame)
+		MarkViewResourceWritten(pDepthStencilView);
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::GenerateMips(THIS_
@@ -3576,6 +4185,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::GenerateMips(THIS_
 	FrameAnalysisLogView(-1, "", pShaderResourceView);
 
 	HackerContext::GenerateMips(pShaderResourceView);
+
+	if (G->analyse_frame)
+		MarkViewResourceWritten(pShaderResourceView);
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::SetResourceMinLOD(THIS_
@@ -3620,6 +4232,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::ResolveSubresource(THIS_
 	FrameAnalysisLogResource(-1, "Dst", pDstResource);
 
 	HackerContext::ResolveSubresource(pDstResource, DstSubresource, pSrcResource, SrcSubresource, Format);
+
+	if (G->analyse_frame)
+		MarkResourceWritten(pDstResource);
 }
 
 STDMETHODIMP_(void) FrameAnalysisContext::ExecuteCommandList(THIS_
@@ -3646,9 +4261,15 @@ STDMETHODIMP_(void) FrameAnalysisContext::ExecuteCommandList(THIS_
 
 	HackerContext::ExecuteCommandList(pCommandList, RestoreContextState);
 
-	if (G->analyse_frame)
+	if (G->analyse_frame) {
 		Profiling::NvAPI_Stereo_ReverseStereoBlitControl(GetHackerDevice()->mStereoHandle, false);
 
+		// We saw the commands in the command list as they were
+		// recorded, not as they are executed, so we can't tell what
+		// it may have written to here:
+		MarkAllResourcesWritten();
+	}
+
 	dump_deferred_resources(pCommandList);
 }
 
@@ -4769,6 +5390,9 @@ STDMETHODIMP_(void) FrameAnalysisContext::ClearRenderTargetView(THIS_
 	FrameAnalysisLogView(-1, "", pRenderTargetView);
 
 	HackerContext::ClearRenderTargetView(pRenderTargetView, ColorRGBA);
+
+	if (G->analyse_frame)
+		MarkViewResourceWritten(pRenderTargetView);
 }
 
 void STDMETHODCALLTYPE FrameAnalysisContext::CopySubresourceRegion1(
@@ -4797,6 +5421,9 @@ void STDMETHODCALLTYPE FrameAnalysisContext::CopySubresourceRegion1(
 	FrameAnalysisLogResource(-1, "Dst", pDstResource);
 
 	HackerContext::CopySubresourceRegion1(pDstResource, DstSubresource, DstX, DstY, DstZ, pSrcResource, SrcSubresource, pSrcBox, CopyFlags);
+
+	if (G->analyse_frame)
+		MarkResourceWritten(pDstResource);
 }
 
 void STDMETHODCALLTYPE FrameAnalysisContext::UpdateSubresource1(
@@ -4820,6 +5447,9 @@ void STDMETHODCALLTYPE FrameAnalysisContext::UpdateSubresource1(
 	FrameAnalysisLogResourceHash(pDstResource);
 
 	HackerContext::UpdateSubresource1(pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch, SrcDepthPitch, CopyFlags);
+
+	if (G->analyse_frame)
+		MarkResourceWritten(pDstResource);
 }
 
 void STDMETHODCALLTYPE FrameAnalysisContext::DiscardResource(
@@ -4831,6 +5461,9 @@ void STDMETHODCALLTYPE FrameAnalysisContext::DiscardResource(
 	FrameAnalysisLogResourceHash(pResource);
 
 	HackerContext::DiscardResource(pResource);
+
+	if (G->analyse_frame)
+		MarkResourceWritten(pResource);
 }
 
 void STDMETHODCALLTYPE FrameAnalysisContext::DiscardView(
@@ -4842,6 +5475,9 @@ void STDMETHODCALLTYPE FrameAnalysisContext::DiscardView(
 	FrameAnalysisLogView(-1, "", pResourceView);
 
 	HackerContext::DiscardView(pResourceView);
+
+	if (G->analyse_frame)
+		MarkViewResourceWritten(pResourceView);
 }
 
 void STDMETHODCALLTYPE FrameAnalysisContext::VSSetConstantBuffers1(
@@ -5098,6 +5734,9 @@ void STDMETHODCALLTYPE FrameAnalysisContext::ClearView(
 	FrameAnalysisLogView(-1, "", pView);
 
 	HackerContext::ClearView(pView, Color, pRect, NumRects);
+
+	if (G->analyse_frame)
+		MarkViewResourceWritten(pView);
 }
 
 void STDMETHODCALLTYPE FrameAnalysisContext::DiscardView1(
@@ -5112,4 +5751,7 @@ void STDMETHODCALLTYPE FrameAnalysisContext::DiscardView1(
 	FrameAnalysisLogView(-1, "", pResourceView);
 
 	HackerContext::DiscardView1(pResourceView, pRects, NumRects);
+
+	if (G->analyse_frame)
+		MarkViewResourceWritten(pResourceView);
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <d3d11_1.h>
+#include <deque>
 #include "HackerContext.h"
+#include "FrameAnalysisSnapshot.h"
 
 // {2AEE5B3A-68ED-44E9-AA4D-9EAA6315D72B}
 DEFINE_GUID(IID_FrameAnalysisContext,
@@ -81,6 +83,95 @@ typedef std::unique_ptr<FrameAnalysisDeferredBuffers> FrameAnalysisDeferredBuffe
 typedef vector<FrameAnalysisDeferredDumpTex2DArgs> FrameAnalysisDeferredTex2D;
 typedef std::unique_ptr<FrameAnalysisDeferredTex2D> FrameAnalysisDeferredTex2DPtr;
 
+// Records where the last dump of a resource was deduplicated to, so that if
+// the resource's write generation has not changed when we are asked to dump it
+// again we can link the existing files without staging it from the GPU:
+struct FrameAnalysisDumpCacheKey {
+	ID3D11Resource *resource;
+	DXGI_FORMAT format;
+	bool stereo;
+
+	bool operator==(const FrameAnalysisDumpCacheKey &other) const
+	{
+		return resource == other.resource &&
+			format == other.format &&
+			stereo == other.stereo;
+	}
+};
+struct FrameAnalysisDumpCacheKeyHash {
+	size_t operator()(const FrameAnalysisDumpCacheKey &key) const
+	{
+		return std::hash<ID3D11Resource*>()(key.resource) ^
+			((size_t)key.format << 1) ^ (size_t)key.stereo;
+	}
+};
+struct FrameAnalysisDumpCacheEntry {
+	uint64_t generation;
+	wstring dedupe_filename;
+};
+typedef std::unordered_map<FrameAnalysisDumpCacheKey, FrameAnalysisDumpCacheEntry,
+	FrameAnalysisDumpCacheKeyHash> FrameAnalysisDumpCache;
+
+// Taken from the cache before dumping a resource and handed back once the dump
+// has completed (which may be several draw calls later), so that we record
+// the write generation the resource had at the time it was copied:
+struct FrameAnalysisDumpCacheTicket {
+	FrameAnalysisDumpCacheKey key;
+	uint64_t generation;
+	LONG epoch;
+	bool tracked;
+};
+
+// Texture2D dumps on the immediate context are copied to a staging resource
+// straight away, but are not read back until a few draw calls later so that
+// we are not stalling the pipeline waiting on every copy to complete:
+struct FrameAnalysisReadback {
+	FrameAnalysisDeferredDumpTex2DArgs args;
+	unsigned draw_call;
+	FrameAnalysisDumpCacheTicket ticket;
+
+	FrameAnalysisReadback(FrameAnalysisDeferredDumpTex2DArgs args, unsigned draw_call) :
+		args(args), draw_call(draw_call)
+	{
+		ticket.tracked = false;
+	}
+};
+
+// Staging resources are recycled once they have been read back rather than
+// creating new ones for every resource in every draw call:
+struct FrameAnalysisStagingKey {
+	UINT width;
+	UINT height;
+	UINT mip_levels;
+	UINT array_size;
+	DXGI_FORMAT format;
+	D3D11_USAGE usage;
+	UINT misc_flags;
+	bool forced_stereo;
+
+	bool operator==(const FrameAnalysisStagingKey &other) const
+	{
+		return width == other.width &&
+			height == other.height &&
+			mip_levels == other.mip_levels &&
+			array_size == other.array_size &&
+			format == other.format &&
+			usage == other.usage &&
+			misc_flags == other.misc_flags &&
+			forced_stereo == other.forced_stereo;
+	}
+};
+struct FrameAnalysisStagingKeyHash {
+	size_t operator()(const FrameAnalysisStagingKey &key) const
+	{
+		return std::hash<UINT>()(key.width) ^ (std::hash<UINT>()(key.height) << 1) ^
+			((size_t)key.mip_levels << 8) ^ ((size_t)key.array_size << 12) ^
+			((size_t)key.format << 16) ^ (size_t)key.forced_stereo;
+	}
+};
+typedef std::unordered_multimap<FrameAnalysisStagingKey, Microsoft::WRL::ComPtr<ID3D11Texture2D>,
+	FrameAnalysisStagingKeyHash> FrameAnalysisStagingPool;
+
 // We make the frame analysis context directly implement ID3D11DeviceContext1 -
 // no funky implementation inheritance or alternate versions here, just a
 // straight forward object implementing an interface. Accessing it as
@@ -106,12 +197,47 @@ private:
 	FrameAnalysisDeferredBuffersPtr deferred_buffers;
 	FrameAnalysisDeferredTex2DPtr deferred_tex2d;
 
+	FrameAnalysisDumpCache dump_cache;
+	LONG dump_cache_epoch;
+	wstring last_dedupe_filename;
+
+	std::deque<FrameAnalysisReadback> readbacks;
+	bool readback_queued;
+	FrameAnalysisStagingPool staging_pool;
+
+	// Hashes of everything bound to the draw call being dumped, taken
+	// before any of it is dumped:
+	FrameAnalysisSnapshotTable draw_snapshots;
+
+	// D3D11_1_UAV_SLOT_COUNT if the device supports feature level 11.1,
+	// otherwise D3D11_PS_CS_UAV_REGISTER_COUNT:
+	UINT num_uav_slots;
+
+	void check_dump_cache(ID3D11Resource *resource, bool stereo, DXGI_FORMAT format,
+			FrameAnalysisDumpCacheTicket *ticket, wstring *dedupe_filename);
+	void update_dump_cache(FrameAnalysisDumpCacheTicket *ticket);
+	bool link_unchanged_files(wstring filename,
+			const vector<pair<const wchar_t*, wstring>> &files, const wchar_t *type);
+	bool link_unchanged_tex2d(wchar_t *filename, wstring dedupe_filename, bool stereo);
+	bool link_unchanged_buffer(wchar_t *filename, wstring dedupe_filename,
+			FrameAnalysisOptions buf_type_mask, int idx, DXGI_FORMAT ib_fmt,
+			UINT stride, UINT offset, UINT first, UINT count, ID3DBlob *layout,
+			D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info,
+			ID3D11Buffer *staged_ib_for_vb, UINT ib_off_for_vb);
+	void mark_bound_targets_written(bool compute);
+	void snapshot_bound_resources(bool compute);
+
 	ID3D11DeviceContext* GetDumpingContext();
 
 	void Dump2DResource(ID3D11Texture2D *resource, wchar_t *filename,
 			bool stereo, D3D11_TEXTURE2D_DESC *orig_desc, DXGI_FORMAT format);
 	bool DeferDump2DResource(ID3D11Texture2D *staging, wchar_t *filename,
 			bool stereo, D3D11_TEXTURE2D_DESC *orig_desc, DXGI_FORMAT format);
+	bool QueueReadback2DResource(ID3D11Texture2D *staging, wchar_t *filename,
+			bool stereo, D3D11_TEXTURE2D_DESC *orig_desc, DXGI_FORMAT format);
+	void process_readback_queue(bool flush);
+	void recycle_staging_resource(ID3D11Texture2D *staging, bool forced_stereo);
+	static FrameAnalysisStagingKey staging_key(D3D11_TEXTURE2D_DESC *desc, bool forced_stereo);
 	void Dump2DResourceImmediateCtx(ID3D11Texture2D *staging, wstring filename,
 			bool stereo, D3D11_TEXTURE2D_DESC *orig_desc, DXGI_FORMAT format);
 
@@ -123,6 +249,8 @@ private:
 		D3D11_TEXTURE2D_DESC desc, bool stereo, bool msaa, DXGI_FORMAT format);
 
 	void DumpStereoResource(ID3D11Texture2D *resource, wchar_t *filename, DXGI_FORMAT format);
+	void Dump2DResourceIfChanged(ID3D11Texture2D *resource, wchar_t *filename,
+			bool stereo, DXGI_FORMAT format);
 	void DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
 			UINT size, char type, int idx, UINT stride, UINT offset);
 	void DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
@@ -232,6 +360,7 @@ public:
 	void FrameAnalysisTrigger(FrameAnalysisOptions new_options) override;
 	void FrameAnalysisDump(ID3D11Resource *resource, FrameAnalysisOptions options,
 		const wchar_t *target, DXGI_FORMAT format, UINT stride, UINT offset) override;
+	void FrameAnalysisFlush() override;
 
 	/*** IUnknown methods ***/
 
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// The hash tracking information frame analysis uses to name the files it
+// dumps, copied out of mResources and mResourceInfo so that the slow parts of
+// dumping (staging, readback and file I/O) can run without holding the locks
+// protecting them.
+//
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests, which check it against a fake resource table being
+// released from another thread.
+
+struct ID3D11Resource;
+
+struct FrameAnalysisHashSnapshot
+{
+	uint32_t hash;
+	uint32_t orig_hash;
+	bool contaminated;
+	bool map_contamination;
+	bool update_contamination;
+	bool copy_contamination;
+	bool region_contamination;
+};
+
+// Every resource bound to a draw call that may be dumped, snapshotted in one
+// pass with the locks held before any of them are copied or written out. A
+// resource released or a hash updated on another thread part way through the
+// dump can therefore never give two files from the same draw call (e.g. the
+// same texture bound to two slots) names that disagree with each other.
+class FrameAnalysisSnapshotTable
+{
+private:
+	std::vector<std::pair<ID3D11Resource*, FrameAnalysisHashSnapshot>> entries;
+
+	static bool handle_less(const std::pair<ID3D11Resource*, FrameAnalysisHashSnapshot> &lhs,
+			ID3D11Resource *rhs)
+	{
+		return lhs.first < rhs;
+	}
+
+public:
+	void clear()
+	{
+		entries.clear();
+	}
+
+	void add(ID3D11Resource *handle)
+	{
+		FrameAnalysisHashSnapshot empty;
+
+		if (!handle)
+			return;
+
+		memset(&empty, 0, sizeof(FrameAnalysisHashSnapshot));
+		entries.emplace_back(handle, empty);
+	}
+
+	// Must be called with whatever locks protect the lookup held, once
+	// everything has been added. lookup(handle, &snapshot) fills out the
+	// snapshot, which has been zeroed for resources it doesn't know about.
+	template <class Lookup>
+	void take(Lookup lookup)
+	{
+		std::sort(entries.begin(), entries.end(),
+			[](const std::pair<ID3D11Resource*, FrameAnalysisHashSnapshot> &lhs,
+			   const std::pair<ID3D11Resource*, FrameAnalysisHashSnapshot> &rhs) {
+				return lhs.first < rhs.first;
+			});
+		entries.erase(std::unique(entries.begin(), entries.end(),
+			[](const std::pair<ID3D11Resource*, FrameAnalysisHashSnapshot> &lhs,
+			   const std::pair<ID3D11Resource*, FrameAnalysisHashSnapshot> &rhs) {
+				return lhs.first == rhs.first;
+			}), entries.end());
+
+		for (auto &entry : entries)
+			lookup(entry.first, &entry.second);
+	}
+
+	// Returns NULL if the resource was not snapshotted:
+	const FrameAnalysisHashSnapshot* find(ID3D11Resource *handle) const
+	{
+		auto i = std::lower_bound(entries.begin(), entries.end(), handle, handle_less);
+
+		if (i == entries.end() || i->first != handle)
+			return NULL;
+		return &i->second;
+	}
+
+	bool empty() const
+	{
+		return entries.empty();
+	}
+
+	size_t size() const
+	{
+		return entries.size();
+	}
+};
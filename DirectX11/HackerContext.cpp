@@ -18,6 +18,7 @@
 #include "Globals.h"
 
 #include "HackerDevice.h"
+#include "ShaderPipeline.h"
 #include "D3D11Wrapper.h"
 //#include "ResourceHash.h"
 //#include "Override.h"
@@ -87,6 +88,10 @@ HackerContext::HackerContext(ID3D11Device1 *pDevice1, ID3D11DeviceContext1 *pCon
 	mCurrentDepthTarget = NULL;
 	mCurrentPSUAVStartSlot = 0;
 	mCurrentPSNumUAVs = 0;
+	mDrawProcessingMask = 0;
+	mDrawProcessingEpoch = G->draw_processing_epoch - 1; // Refresh on first draw
+	if (pDevice1)
+		mBindingShadow.SetFeatureLevel(pDevice1->GetFeatureLevel());
 }
 
 
@@ -122,6 +127,14 @@ ID3D11DeviceContext1* HackerContext::GetPassThroughOrigContext1(void)
 	return mOrigContext1;
 }
 
+// Command lists use this to find what is bound without querying the driver.
+// Anything binding resources through the pass through context must keep it
+// up to date (or invalidate it):
+BindingShadow* HackerContext::GetBindingShadow()
+{
+	return &mBindingShadow;
+}
+
 void HackerContext::HookContext()
 {
 	// This will install hooks in the original context (if they have not
@@ -136,81 +149,103 @@ void HackerContext::HookContext()
 // -----------------------------------------------------------------------------
 
 
-// Records the hash of this shader resource view for later lookup. Returns the
-// handle to the resource, but be aware that it no longer has a reference and
-// should only be used for map lookups.
-ID3D11Resource* HackerContext::RecordResourceViewStats(ID3D11View *view, std::set<uint32_t> *resource_info)
+static ResourceSnapshot SnapshotResource(ID3D11Resource *handle)
 {
-	ID3D11Resource *resource = NULL;
-	uint32_t orig_hash = 0;
+	uint32_t hash = 0, orig_hash = 0;
+	ResourceHandleInfo *info;
 
-	if (!view)
-		return NULL;
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
+	info = GetResourceHandleInfo(handle);
+	if (info) {
+		hash = info->hash;
+		orig_hash = info->orig_hash;
+	}
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
 
-	view->GetResource(&resource);
-	if (!resource)
-		return NULL;
+	return ResourceSnapshot(handle, hash, orig_hash);
+}
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+// Appends a usage record to this context. The resource hashes are snapshotted
+// now, at the time of the draw call, as hash tracking may have changed them by
+// the time the records are flushed. Records we have already seen since the
+// last flush are dropped by the batch.
+void HackerContext::RecordShaderUsage(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 currentShader,
+		ShaderUsageType type, int slot, ID3D11Resource *resource, UINT64 peer)
+{
+	ResourceSnapshot snapshot(NULL, 0, 0);
 
-		// We are using the original resource hash for stat collection - things
-		// get tricky otherwise
-		orig_hash = GetOrigResourceHash(resource);
+	if (resource)
+		snapshot = SnapshotResource(resource);
 
-		resource->Release();
+	if (mShaderUsage.Record(ShaderInfo, currentShader, type, slot, snapshot, peer))
+		FlushShaderUsage();
+}
+
+void HackerContext::RecordViewUsage(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 currentShader,
+		ShaderUsageType type, int slot, ID3D11View *view)
+{
+	ID3D11Resource *resource = NULL;
 
-		if (orig_hash)
-			resource_info->insert(orig_hash);
+	view->GetResource(&resource);
+	if (!resource)
+		return;
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	RecordShaderUsage(ShaderInfo, currentShader, type, slot, resource);
 
-	return resource;
+	resource->Release();
 }
 
-static ResourceSnapshot SnapshotResource(ID3D11Resource *handle)
+// Merges the usage records collected on this context into the global
+// ShaderInfoData maps for ShaderUsage.txt. Must be called on the thread that
+// owns this context - at present time for the immediate context and when a
+// command list is finished for deferred contexts.
+void HackerContext::FlushShaderUsage()
 {
-	uint32_t hash = 0, orig_hash = 0;
+	Profiling::State profiling_state;
 
-	ResourceHandleInfo *info = GetResourceHandleInfo(handle);
-	if (info) {
-		hash = info->hash;
-		orig_hash = info->orig_hash;
-	}
+	if (mShaderUsage.empty())
+		return;
 
-	return ResourceSnapshot(handle, hash, orig_hash);
+	if (Profiling::mode == Profiling::Mode::SUMMARY)
+		Profiling::start(&profiling_state);
+
+	EnterCriticalSectionPretty(&G->mHuntingLock);
+	mShaderUsage.Merge(&G->mShaderResourceInfo, &G->mUnorderedAccessInfo);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
+
+	if (Profiling::mode == Profiling::Mode::SUMMARY)
+		Profiling::end(&profiling_state, &Profiling::stat_overhead);
 }
 
-void HackerContext::_RecordShaderResourceUsage(ShaderInfoData *shader_info, ID3D11ShaderResourceView *views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT])
+void HackerContext::_RecordShaderResourceUsage(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 currentShader,
+		ID3D11ShaderResourceView *views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT])
 {
-	ID3D11Resource *resource;
 	int i;
 
 	for (i = 0; i < D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT; i++) {
 		if (views[i]) {
-			resource = RecordResourceViewStats(views[i], &G->mShaderResourceInfo);
-			if (resource)
-				shader_info->ResourceRegisters[i].insert(SnapshotResource(resource));
+			RecordViewUsage(ShaderInfo, currentShader, ShaderUsageType::REGISTER, i, views[i]);
 			views[i]->Release();
 		}
 	}
 }
 
-void HackerContext::RecordPeerShaders(std::set<UINT64> *PeerShaders, UINT64 this_shader_hash)
+void HackerContext::RecordPeerShaders(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 this_shader_hash)
 {
 	if (mCurrentVertexShader && mCurrentVertexShader != this_shader_hash)
-		PeerShaders->insert(mCurrentVertexShader);
+		RecordShaderUsage(ShaderInfo, this_shader_hash, ShaderUsageType::PEER, -1, NULL, mCurrentVertexShader);
 
 	if (mCurrentHullShader && mCurrentHullShader != this_shader_hash)
-		PeerShaders->insert(mCurrentHullShader);
+		RecordShaderUsage(ShaderInfo, this_shader_hash, ShaderUsageType::PEER, -1, NULL, mCurrentHullShader);
 
 	if (mCurrentDomainShader && mCurrentDomainShader != this_shader_hash)
-		PeerShaders->insert(mCurrentDomainShader);
+		RecordShaderUsage(ShaderInfo, this_shader_hash, ShaderUsageType::PEER, -1, NULL, mCurrentDomainShader);
 
 	if (mCurrentGeometryShader && mCurrentGeometryShader != this_shader_hash)
-		PeerShaders->insert(mCurrentGeometryShader);
+		RecordShaderUsage(ShaderInfo, this_shader_hash, ShaderUsageType::PEER, -1, NULL, mCurrentGeometryShader);
 
 	if (mCurrentPixelShader && mCurrentPixelShader != this_shader_hash)
-		PeerShaders->insert(mCurrentPixelShader);
+		RecordShaderUsage(ShaderInfo, this_shader_hash, ShaderUsageType::PEER, -1, NULL, mCurrentPixelShader);
 }
 
 
@@ -218,28 +253,20 @@ template <void (__stdcall ID3D11DeviceContext::*GetShaderResources)(THIS_
 		UINT StartSlot,
 		UINT NumViews,
 		ID3D11ShaderResourceView **ppShaderResourceViews)>
-void HackerContext::RecordShaderResourceUsage(std::map<UINT64, ShaderInfoData> &ShaderInfo, UINT64 currentShader)
+void HackerContext::RecordShaderResourceUsage(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 currentShader)
 {
 	ID3D11ShaderResourceView *views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
-	ShaderInfoData *info;
 
 	(mOrigContext1->*GetShaderResources)(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, views);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-
-		info = &ShaderInfo[currentShader];
-		_RecordShaderResourceUsage(info, views);
-		RecordPeerShaders(&info->PeerShaders, currentShader);
-
-	LeaveCriticalSection(&G->mCriticalSection);
+	_RecordShaderResourceUsage(ShaderInfo, currentShader, views);
+	RecordPeerShaders(ShaderInfo, currentShader);
 }
 
 void HackerContext::RecordGraphicsShaderStats()
 {
 	ID3D11UnorderedAccessView *uavs[D3D11_1_UAV_SLOT_COUNT]; // DX11: 8, DX11.1: 64
 	UINT selectedRenderTargetPos;
-	ShaderInfoData *info;
-	ID3D11Resource *resource;
 	UINT i;
 	Profiling::State profiling_state;
 
@@ -248,22 +275,22 @@ void HackerContext::RecordGraphicsShaderStats()
 
 	if (mCurrentVertexShader) {
 		RecordShaderResourceUsage<&ID3D11DeviceContext::VSGetShaderResources>
-			(G->mVertexShaderInfo, mCurrentVertexShader);
+			(&G->mVertexShaderInfo, mCurrentVertexShader);
 	}
 
 	if (mCurrentHullShader) {
 		RecordShaderResourceUsage<&ID3D11DeviceContext::HSGetShaderResources>
-			(G->mHullShaderInfo, mCurrentHullShader);
+			(&G->mHullShaderInfo, mCurrentHullShader);
 	}
 
 	if (mCurrentDomainShader) {
 		RecordShaderResourceUsage<&ID3D11DeviceContext::DSGetShaderResources>
-			(G->mDomainShaderInfo, mCurrentDomainShader);
+			(&G->mDomainShaderInfo, mCurrentDomainShader);
 	}
 
 	if (mCurrentGeometryShader) {
 		RecordShaderResourceUsage<&ID3D11DeviceContext::GSGetShaderResources>
-			(G->mGeometryShaderInfo, mCurrentGeometryShader);
+			(&G->mGeometryShaderInfo, mCurrentGeometryShader);
 	}
 
 	if (mCurrentPixelShader) {
@@ -272,33 +299,25 @@ void HackerContext::RecordGraphicsShaderStats()
 		OMGetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL, mCurrentPSUAVStartSlot, mCurrentPSNumUAVs, uavs);
 
 		RecordShaderResourceUsage<&ID3D11DeviceContext::PSGetShaderResources>
-			(G->mPixelShaderInfo, mCurrentPixelShader);
-
-		EnterCriticalSectionPretty(&G->mCriticalSection);
-			info = &G->mPixelShaderInfo[mCurrentPixelShader];
-
-			for (selectedRenderTargetPos = 0; selectedRenderTargetPos < mCurrentRenderTargets.size(); ++selectedRenderTargetPos) {
-				if (selectedRenderTargetPos >= info->RenderTargets.size())
-					info->RenderTargets.push_back(std::set<ResourceSnapshot>());
+			(&G->mPixelShaderInfo, mCurrentPixelShader);
 
-				info->RenderTargets[selectedRenderTargetPos].insert(SnapshotResource(mCurrentRenderTargets[selectedRenderTargetPos]));
-			}
-
-			if (mCurrentDepthTarget)
-				info->DepthTargets.insert(SnapshotResource(mCurrentDepthTarget));
+		for (selectedRenderTargetPos = 0; selectedRenderTargetPos < mCurrentRenderTargets.size(); ++selectedRenderTargetPos) {
+			RecordShaderUsage(&G->mPixelShaderInfo, mCurrentPixelShader, ShaderUsageType::RENDER_TARGET,
+					selectedRenderTargetPos, mCurrentRenderTargets[selectedRenderTargetPos]);
+		}
 
-			if (mCurrentPSNumUAVs) {
-				for (i = 0; i < mCurrentPSNumUAVs; i++) {
-					if (uavs[i]) {
-						resource = RecordResourceViewStats(uavs[i], &G->mUnorderedAccessInfo);
-						if (resource)
-							info->UAVs[i + mCurrentPSUAVStartSlot].insert(SnapshotResource(resource));
+		if (mCurrentDepthTarget) {
+			RecordShaderUsage(&G->mPixelShaderInfo, mCurrentPixelShader, ShaderUsageType::DEPTH_TARGET,
+					-1, mCurrentDepthTarget);
+		}
 
-						uavs[i]->Release();
-					}
-				}
+		for (i = 0; i < mCurrentPSNumUAVs; i++) {
+			if (uavs[i]) {
+				RecordViewUsage(&G->mPixelShaderInfo, mCurrentPixelShader, ShaderUsageType::UAV,
+						i + mCurrentPSUAVStartSlot, uavs[i]);
+				uavs[i]->Release();
 			}
-		LeaveCriticalSection(&G->mCriticalSection);
+		}
 	}
 
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
@@ -309,10 +328,8 @@ void HackerContext::RecordComputeShaderStats()
 {
 	ID3D11ShaderResourceView *srvs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
 	ID3D11UnorderedAccessView *uavs[D3D11_1_UAV_SLOT_COUNT]; // DX11: 8, DX11.1: 64
-	ShaderInfoData *info;
 	D3D_FEATURE_LEVEL level = mOrigDevice1->GetFeatureLevel();
 	UINT num_uavs = (level >= D3D_FEATURE_LEVEL_11_1 ? D3D11_1_UAV_SLOT_COUNT : D3D11_PS_CS_UAV_REGISTER_COUNT);
-	ID3D11Resource *resource;
 	UINT i;
 	Profiling::State profiling_state;
 
@@ -322,25 +339,17 @@ void HackerContext::RecordComputeShaderStats()
 	mOrigContext1->CSGetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, srvs);
 	mOrigContext1->CSGetUnorderedAccessViews(0, num_uavs, uavs);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	_RecordShaderResourceUsage(&G->mComputeShaderInfo, mCurrentComputeShader, srvs);
 
-		info = &G->mComputeShaderInfo[mCurrentComputeShader];
-		_RecordShaderResourceUsage(info, srvs);
-
-		for (i = 0; i < num_uavs; i++) {
-			if (uavs[i]) {
-				resource = RecordResourceViewStats(uavs[i], &G->mUnorderedAccessInfo);
-				if (resource)
-					info->UAVs[i].insert(SnapshotResource(resource));
-
-				uavs[i]->Release();
-			}
+	for (i = 0; i < num_uavs; i++) {
+		if (uavs[i]) {
+			RecordViewUsage(&G->mComputeShaderInfo, mCurrentComputeShader, ShaderUsageType::UAV, i, uavs[i]);
+			uavs[i]->Release();
 		}
+	}
 
-		if (Profiling::mode == Profiling::Mode::SUMMARY)
-			Profiling::end(&profiling_state, &Profiling::stat_overhead);
-
-	LeaveCriticalSection(&G->mCriticalSection);
+	if (Profiling::mode == Profiling::Mode::SUMMARY)
+		Profiling::end(&profiling_state, &Profiling::stat_overhead);
 }
 
 void HackerContext::RecordRenderTargetInfo(ID3D11RenderTargetView *target, UINT view_num)
@@ -358,7 +367,7 @@ void HackerContext::RecordRenderTargetInfo(ID3D11RenderTargetView *target, UINT
 	if (!resource)
 		return;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 
 		// We are using the original resource hash for stat collection - things
 		// get tricky otherwise
@@ -374,7 +383,7 @@ void HackerContext::RecordRenderTargetInfo(ID3D11RenderTargetView *target, UINT
 		G->mRenderTargetInfo.insert(orig_hash);
 
 out_unlock:
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 
 void HackerContext::RecordDepthStencil(ID3D11DepthStencilView *target)
@@ -392,7 +401,7 @@ void HackerContext::RecordDepthStencil(ID3D11DepthStencilView *target)
 
 	target->GetDesc(&desc);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 
 		// We are using the original resource hash for stat collection - things
 		// get tricky otherwise
@@ -403,7 +412,7 @@ void HackerContext::RecordDepthStencil(ID3D11DepthStencilView *target)
 		mCurrentDepthTarget = resource;
 		G->mDepthTargetInfo.insert(orig_hash);
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 
 ID3D11VertexShader* HackerContext::SwitchVSShader(ID3D11VertexShader *shader)
@@ -567,9 +576,16 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 		LogInfo("Loaded %S %016I64x bytecode from ShaderRegex cache\n", shader_type, hash);
 		break;
 	case ShaderRegexCache::NO_CACHE:
+		if (!shader_regex_groups_want_model(orig_info->byteCode->GetBufferPointer(),
+				orig_info->byteCode->GetBufferSize(), &orig_info->shaderModel)) {
+			LogDebug("%S %016I64x model %s not used by any ShaderRegex\n",
+					shader_type, hash, orig_info->shaderModel.c_str());
+			goto out_drop;
+		}
+
 		LogInfo("Performing deferred shader analysis on %S %016I64x...\n", shader_type, hash);
 
-		asm_text = BinaryToAsmText(orig_info->byteCode->GetBufferPointer(),
+		asm_text = CachedBinaryToAsmText(hash, orig_info->byteCode->GetBufferPointer(),
 				orig_info->byteCode->GetBufferSize(),
 				G->patch_cb_offsets,
 				G->disassemble_undecipherable_custom_data);
@@ -597,7 +613,7 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 
 		try {
 			vector<AssemblerParseError> parse_errors;
-			hr = AssembleFluganWithSignatureParsing(&asm_vector, &patched_bytecode, &parse_errors);
+			hr = AssembleFluganWithSignatureParsing(&asm_vector, &patched_bytecode, &parse_errors, &get_tls()->assembler_ctx);
 			if (FAILED(hr)) {
 				LogInfo("    *** Assembling patched shader failed\n");
 				goto out_drop;
@@ -637,7 +653,7 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 	// critical section before calling into DirectX to bind the replacement
 	// shader. This was necessary to avoid a deadlock with the resource
 	// release tracker, but that now uses a different lock.
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 
 	// And bind the replaced shader in time for this draw call:
 	// VSBUGWORKAROUND: VS2013 toolchain has a bug that mistakes a member
@@ -656,7 +672,7 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 	return;
 
 out_drop:
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 }
 
 void HackerContext::DeferredShaderReplacementBeforeDraw()
@@ -724,6 +740,104 @@ void HackerContext::DeferredShaderReplacementBeforeDispatch()
 		(mCurrentComputeShaderHandle, mCurrentComputeShader, L"cs");
 }
 
+static inline unsigned draw_processing_bit(BindingShadowStage stage)
+{
+	return 1u << (unsigned)stage;
+}
+
+// Stored in mDrawProcessingMask after the per-stage bits:
+static const unsigned DRAW_PROCESSING_HUNTING = 1u << (unsigned)BindingShadowStage::COUNT;
+
+static const unsigned DRAW_PROCESSING_DRAW_MASK =
+	draw_processing_bit(BindingShadowStage::VS) |
+	draw_processing_bit(BindingShadowStage::HS) |
+	draw_processing_bit(BindingShadowStage::DS) |
+	draw_processing_bit(BindingShadowStage::GS) |
+	draw_processing_bit(BindingShadowStage::PS) |
+	DRAW_PROCESSING_HUNTING;
+
+static const unsigned DRAW_PROCESSING_DISPATCH_MASK =
+	draw_processing_bit(BindingShadowStage::CS) |
+	DRAW_PROCESSING_HUNTING;
+
+// Mirrors the checks in BeforeDraw and BeforeDispatch that depend on the
+// shader bound to a given stage. Hunting is accounted for separately.
+bool HackerContext::ShaderNeedsProcessing(ID3D11DeviceChild *shader, UINT64 hash)
+{
+	ShaderReloadMap::iterator i;
+
+	if (!shader)
+		return false;
+
+	if (!G->mShaderOverrideMap.empty() && lookup_shaderoverride(hash) != G->mShaderOverrideMap.end())
+		return true;
+
+	// DeferredShaderReplacement() only does anything the first time a
+	// candidate is drawn with after each config reload. If that happens
+	// while it is bound we will keep taking the slow path until it is next
+	// set, which is harmless:
+	if (!shader_regex_groups.empty()) {
+		i = lookup_reloaded_shader(shader);
+		if (i != G->mReloadedShaders.end() &&
+		    i->second.deferred_replacement_candidate &&
+		    !i->second.deferred_replacement_processed)
+			return true;
+	}
+
+	return false;
+}
+
+void HackerContext::SetShaderNeedsProcessing(BindingShadowStage stage, bool needs_processing)
+{
+	if (needs_processing)
+		mDrawProcessingMask |= draw_processing_bit(stage);
+	else
+		mDrawProcessingMask &= ~draw_processing_bit(stage);
+}
+
+void HackerContext::RefreshDrawProcessingMask()
+{
+	// Update the epoch first, so that if it is bumped again while we are
+	// in here we will come back around on the next draw call:
+	mDrawProcessingEpoch = G->draw_processing_epoch;
+	mDrawProcessingMask = 0;
+
+	SetShaderNeedsProcessing(BindingShadowStage::VS, ShaderNeedsProcessing(mCurrentVertexShaderHandle, mCurrentVertexShader));
+	SetShaderNeedsProcessing(BindingShadowStage::HS, ShaderNeedsProcessing(mCurrentHullShaderHandle, mCurrentHullShader));
+	SetShaderNeedsProcessing(BindingShadowStage::DS, ShaderNeedsProcessing(mCurrentDomainShaderHandle, mCurrentDomainShader));
+	SetShaderNeedsProcessing(BindingShadowStage::GS, ShaderNeedsProcessing(mCurrentGeometryShaderHandle, mCurrentGeometryShader));
+	SetShaderNeedsProcessing(BindingShadowStage::PS, ShaderNeedsProcessing(mCurrentPixelShaderHandle, mCurrentPixelShader));
+	SetShaderNeedsProcessing(BindingShadowStage::CS, ShaderNeedsProcessing(mCurrentComputeShaderHandle, mCurrentComputeShader));
+
+	if (G->hunting == HUNTING_MODE_ENABLED)
+		mDrawProcessingMask |= DRAW_PROCESSING_HUNTING;
+}
+
+// Returns false if nothing in BeforeDraw / AfterDraw could possibly apply to
+// this draw call, in which case the caller passes it straight through:
+bool HackerContext::DrawNeedsProcessing()
+{
+	if (mDrawProcessingEpoch != G->draw_processing_epoch)
+		RefreshDrawProcessingMask();
+
+	if (mDrawProcessingMask & DRAW_PROCESSING_DRAW_MASK)
+		return true;
+
+	Profiling::fast_path_draw_calls++;
+	return false;
+}
+
+bool HackerContext::DispatchNeedsProcessing()
+{
+	if (mDrawProcessingEpoch != G->draw_processing_epoch)
+		RefreshDrawProcessingMask();
+
+	if (mDrawProcessingMask & DRAW_PROCESSING_DISPATCH_MASK)
+		return true;
+
+	Profiling::fast_path_draw_calls++;
+	return false;
+}
 
 void HackerContext::BeforeDraw(DrawContext &data)
 {
@@ -745,7 +859,7 @@ void HackerContext::BeforeDraw(DrawContext &data)
 		if (G->DumpUsage)
 			RecordGraphicsShaderStats();
 
-		EnterCriticalSectionPretty(&G->mCriticalSection);
+		EnterCriticalSectionPretty(&G->mHuntingLock);
 		{
 			// Selection
 			for (selectedVertexBufferPos = 0; selectedVertexBufferPos < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT; ++selectedVertexBufferPos) {
@@ -832,7 +946,7 @@ void HackerContext::BeforeDraw(DrawContext &data)
 				}
 			}
 		}
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mHuntingLock);
 	}
 
 	if (!G->fix_enabled)
@@ -948,6 +1062,8 @@ STDMETHODIMP_(ULONG) HackerContext::Release(THIS)
 	{
 		LogInfo("  deleting self\n");
 
+		FlushShaderUsage();
+
 		if (mHackerDevice != nullptr) {
 			if (mHackerDevice->GetHackerContext() == this) {
 				LogInfo("  clearing mHackerDevice->mHackerContext\n");
@@ -1112,6 +1228,7 @@ STDMETHODIMP_(void) HackerContext::VSSetConstantBuffers(THIS_
 	__in_ecount(NumBuffers) ID3D11Buffer *const *ppConstantBuffers)
 {
 	mOrigContext1->VSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers);
+	mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::VS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 bool HackerContext::MapDenyCPURead(
@@ -1132,9 +1249,7 @@ bool HackerContext::MapDenyCPURead(
 	if (G->mTextureOverrideMap.empty())
 		return false;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-		hash = GetResourceHash(pResource);
-	LeaveCriticalSection(&G->mCriticalSection);
+	hash = GetResourceHash(pResource);
 
 	i = lookup_textureoverride(hash);
 	if (i == G->mTextureOverrideMap.end())
@@ -1329,6 +1444,7 @@ STDMETHODIMP_(void) HackerContext::PSSetConstantBuffers(THIS_
 	__in_ecount(NumBuffers) ID3D11Buffer *const *ppConstantBuffers)
 {
 	 mOrigContext1->PSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers);
+	 mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::PS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 STDMETHODIMP_(void) HackerContext::IASetInputLayout(THIS_
@@ -1351,9 +1467,10 @@ STDMETHODIMP_(void) HackerContext::IASetVertexBuffers(THIS_
 	__in_ecount(NumBuffers)  const UINT *pOffsets)
 {
 	 mOrigContext1->IASetVertexBuffers(StartSlot, NumBuffers, ppVertexBuffers, pStrides, pOffsets);
+	 mBindingShadow.SetVertexBuffers(mOrigContext1, StartSlot, NumBuffers, ppVertexBuffers, pStrides, pOffsets);
 
 	 if (G->hunting == HUNTING_MODE_ENABLED) {
-		EnterCriticalSectionPretty(&G->mCriticalSection);
+		EnterCriticalSectionPretty(&G->mHuntingLock);
 		for (UINT i = StartSlot; (i < StartSlot + NumBuffers) && (i < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT); i++) {
 			if (ppVertexBuffers && ppVertexBuffers[i]) {
 				mCurrentVertexBuffers[i] = GetResourceHash(ppVertexBuffers[i]);
@@ -1361,7 +1478,7 @@ STDMETHODIMP_(void) HackerContext::IASetVertexBuffers(THIS_
 			} else
 				mCurrentVertexBuffers[i] = 0;
 		}
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mHuntingLock);
 	 }
 }
 
@@ -1374,6 +1491,7 @@ STDMETHODIMP_(void) HackerContext::GSSetConstantBuffers(THIS_
 	__in_ecount(NumBuffers) ID3D11Buffer *const *ppConstantBuffers)
 {
 	 mOrigContext1->GSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers);
+	 mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::GS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 STDMETHODIMP_(void) HackerContext::GSSetShader(THIS_
@@ -1388,7 +1506,8 @@ STDMETHODIMP_(void) HackerContext::GSSetShader(THIS_
 		 &G->mVisitedGeometryShaders,
 		 G->mSelectedGeometryShader,
 		 &mCurrentGeometryShader,
-		 &mCurrentGeometryShaderHandle);
+		 &mCurrentGeometryShaderHandle,
+		 BindingShadowStage::GS);
 }
 
 STDMETHODIMP_(void) HackerContext::IASetPrimitiveTopology(THIS_
@@ -1464,7 +1583,7 @@ STDMETHODIMP_(void) HackerContext::GSSetShaderResources(THIS_
 	/* [annotation] */
 	__in_ecount(NumViews) ID3D11ShaderResourceView *const *ppShaderResourceViews)
 {
-	SetShaderResources<&ID3D11DeviceContext::GSSetShaderResources>(StartSlot, NumViews, ppShaderResourceViews);
+	SetShaderResources<&ID3D11DeviceContext::GSSetShaderResources>(BindingShadowStage::GS, StartSlot, NumViews, ppShaderResourceViews);
 }
 
 STDMETHODIMP_(void) HackerContext::GSSetSamplers(THIS_
@@ -1507,6 +1626,7 @@ STDMETHODIMP_(void) HackerContext::SOSetTargets(THIS_
 	__in_ecount_opt(NumBuffers)  const UINT *pOffsets)
 {
 	 mOrigContext1->SOSetTargets(NumBuffers, ppSOTargets, pOffsets);
+	 mBindingShadow.SetStreamOutputTargets(NumBuffers, ppSOTargets);
 }
 
 bool HackerContext::BeforeDispatch(DispatchContext *context)
@@ -1559,6 +1679,11 @@ STDMETHODIMP_(void) HackerContext::Dispatch(THIS_
 	/* [annotation] */
 	__in  UINT ThreadGroupCountZ)
 {
+	if (!DispatchNeedsProcessing()) {
+		mOrigContext1->Dispatch(ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ);
+		return;
+	}
+
 	DispatchContext context{ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ};
 
 	if (BeforeDispatch(&context))
@@ -1575,6 +1700,11 @@ STDMETHODIMP_(void) HackerContext::DispatchIndirect(THIS_
 	/* [annotation] */
 	__in  UINT AlignedByteOffsetForArgs)
 {
+	if (!DispatchNeedsProcessing()) {
+		mOrigContext1->DispatchIndirect(pBufferForArgs, AlignedByteOffsetForArgs);
+		return;
+	}
+
 	DispatchContext context{&pBufferForArgs, AlignedByteOffsetForArgs};
 
 	if (BeforeDispatch(&context))
@@ -1636,10 +1766,8 @@ bool HackerContext::ExpandRegionCopy(ID3D11Resource *pDstResource, UINT DstX,
 
 	srcTex->GetDesc(&srcDesc);
 	dstTex->GetDesc(&dstDesc);
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-		srcHash = GetResourceHash(srcTex);
-		dstHash = GetResourceHash(dstTex);
-	LeaveCriticalSection(&G->mCriticalSection);
+	srcHash = GetResourceHash(srcTex);
+	dstHash = GetResourceHash(dstTex);
 
 	LogDebug("CopySubresourceRegion %08lx (%u:%u x %u:%u / %u x %u) -> %08lx (%u x %u / %u x %u)\n",
 			srcHash, pSrcBox->left, pSrcBox->right, pSrcBox->top, pSrcBox->bottom, srcDesc.Width, srcDesc.Height, 
@@ -1845,6 +1973,9 @@ STDMETHODIMP_(void) HackerContext::ExecuteCommandList(THIS_
 		mOrigContext1->ExecuteCommandList(pCommandList, RestoreContextState);
 
 	if (!RestoreContextState) {
+		if (G->deferred_contexts_enabled)
+			mBindingShadow.Reset();
+
 		// This is equivalent to calling ClearState() afterwards, so we
 		// need to rebind the 3DMigoto resources now. See also
 		// FinishCommandList's RestoreDeferredContextState:
@@ -1860,7 +1991,7 @@ STDMETHODIMP_(void) HackerContext::HSSetShaderResources(THIS_
 	/* [annotation] */
 	__in_ecount(NumViews)  ID3D11ShaderResourceView *const *ppShaderResourceViews)
 {
-	SetShaderResources<&ID3D11DeviceContext::HSSetShaderResources>(StartSlot, NumViews, ppShaderResourceViews);
+	SetShaderResources<&ID3D11DeviceContext::HSSetShaderResources>(BindingShadowStage::HS, StartSlot, NumViews, ppShaderResourceViews);
 }
 
 STDMETHODIMP_(void) HackerContext::HSSetShader(THIS_
@@ -1875,7 +2006,8 @@ STDMETHODIMP_(void) HackerContext::HSSetShader(THIS_
 		 &G->mVisitedHullShaders,
 		 G->mSelectedHullShader,
 		 &mCurrentHullShader,
-		 &mCurrentHullShaderHandle);
+		 &mCurrentHullShaderHandle,
+		 BindingShadowStage::HS);
 }
 
 STDMETHODIMP_(void) HackerContext::HSSetSamplers(THIS_
@@ -1898,6 +2030,7 @@ STDMETHODIMP_(void) HackerContext::HSSetConstantBuffers(THIS_
 	__in_ecount(NumBuffers)  ID3D11Buffer *const *ppConstantBuffers)
 {
 	 mOrigContext1->HSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers);
+	 mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::HS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 STDMETHODIMP_(void) HackerContext::DSSetShaderResources(THIS_
@@ -1908,7 +2041,7 @@ STDMETHODIMP_(void) HackerContext::DSSetShaderResources(THIS_
 	/* [annotation] */
 	__in_ecount(NumViews)  ID3D11ShaderResourceView *const *ppShaderResourceViews)
 {
-	SetShaderResources<&ID3D11DeviceContext::DSSetShaderResources>(StartSlot, NumViews, ppShaderResourceViews);
+	SetShaderResources<&ID3D11DeviceContext::DSSetShaderResources>(BindingShadowStage::DS, StartSlot, NumViews, ppShaderResourceViews);
 }
 
 STDMETHODIMP_(void) HackerContext::DSSetShader(THIS_
@@ -1923,7 +2056,8 @@ STDMETHODIMP_(void) HackerContext::DSSetShader(THIS_
 		 &G->mVisitedDomainShaders,
 		 G->mSelectedDomainShader,
 		 &mCurrentDomainShader,
-		 &mCurrentDomainShaderHandle);
+		 &mCurrentDomainShaderHandle,
+		 BindingShadowStage::DS);
 }
 
 STDMETHODIMP_(void) HackerContext::DSSetSamplers(THIS_
@@ -1946,6 +2080,7 @@ STDMETHODIMP_(void) HackerContext::DSSetConstantBuffers(THIS_
 	__in_ecount(NumBuffers)  ID3D11Buffer *const *ppConstantBuffers)
 {
 	 mOrigContext1->DSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers);
+	 mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::DS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 STDMETHODIMP_(void) HackerContext::CSSetShaderResources(THIS_
@@ -1956,7 +2091,7 @@ STDMETHODIMP_(void) HackerContext::CSSetShaderResources(THIS_
 	/* [annotation] */
 	__in_ecount(NumViews)  ID3D11ShaderResourceView *const *ppShaderResourceViews)
 {
-	SetShaderResources<&ID3D11DeviceContext::CSSetShaderResources>(StartSlot, NumViews, ppShaderResourceViews);
+	SetShaderResources<&ID3D11DeviceContext::CSSetShaderResources>(BindingShadowStage::CS, StartSlot, NumViews, ppShaderResourceViews);
 }
 
 STDMETHODIMP_(void) HackerContext::CSSetUnorderedAccessViews(THIS_
@@ -1979,6 +2114,7 @@ STDMETHODIMP_(void) HackerContext::CSSetUnorderedAccessViews(THIS_
 	}
 
 	mOrigContext1->CSSetUnorderedAccessViews(StartSlot, NumUAVs, ppUnorderedAccessViews, pUAVInitialCounts);
+	mBindingShadow.SetComputeShaderUAVs(StartSlot, NumUAVs, ppUnorderedAccessViews);
 }
 
 
@@ -1998,7 +2134,8 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 	std::set<UINT64> *visitedShaders,
 	UINT64 selectedShader,
 	UINT64 *currentShaderHash,
-	ID3D11Shader **currentShaderHandle)
+	ID3D11Shader **currentShaderHandle,
+	BindingShadowStage stage)
 {
 	ID3D11Shader *repl_shader = pShader;
 
@@ -2022,9 +2159,9 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 				LogDebug("  shader found: handle = %p, hash = %016I64x\n", *currentShaderHandle, *currentShaderHash);
 
 				if ((G->hunting == HUNTING_MODE_ENABLED) && visitedShaders) {
-					EnterCriticalSectionPretty(&G->mCriticalSection);
+					EnterCriticalSectionPretty(&G->mHuntingLock);
 					visitedShaders->insert(i->second);
-					LeaveCriticalSection(&G->mCriticalSection);
+					LeaveCriticalSectionPretty(&G->mHuntingLock);
 				}
 			}
 			else
@@ -2068,6 +2205,8 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 		*currentShaderHash = 0;
 	}
 
+	SetShaderNeedsProcessing(stage, ShaderNeedsProcessing(pShader, *currentShaderHash));
+
 	// Call through to original XXSetShader, but pShader may have been replaced.
 	(mOrigContext1->*OrigSetShader)(repl_shader, ppClassInstances, NumClassInstances);
 }
@@ -2084,7 +2223,8 @@ STDMETHODIMP_(void) HackerContext::CSSetShader(THIS_
 		 &G->mVisitedComputeShaders,
 		 G->mSelectedComputeShader,
 		 &mCurrentComputeShader,
-		 &mCurrentComputeShaderHandle);
+		 &mCurrentComputeShaderHandle,
+		 BindingShadowStage::CS);
 }
 
 STDMETHODIMP_(void) HackerContext::CSSetSamplers(THIS_
@@ -2107,6 +2247,7 @@ STDMETHODIMP_(void) HackerContext::CSSetConstantBuffers(THIS_
 	__in_ecount(NumBuffers)  ID3D11Buffer *const *ppConstantBuffers)
 {
 	 mOrigContext1->CSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers);
+	 mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::CS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 STDMETHODIMP_(void) HackerContext::VSGetConstantBuffers(THIS_
@@ -2521,6 +2662,7 @@ STDMETHODIMP_(void) HackerContext::CSGetConstantBuffers(THIS_
 STDMETHODIMP_(void) HackerContext::ClearState(THIS)
 {
 	 mOrigContext1->ClearState();
+	 mBindingShadow.Reset();
 
 	 // ClearState() will unbind StereoParams and IniParams, so we need to
 	 // rebind them now:
@@ -2549,6 +2691,13 @@ STDMETHODIMP HackerContext::FinishCommandList(THIS_
 {
 	BOOL ret = mOrigContext1->FinishCommandList(RestoreDeferredContextState, ppCommandList);
 
+	FlushShaderUsage();
+
+	if (FAILED(ret))
+		mBindingShadow.Invalidate();
+	else if (!RestoreDeferredContextState)
+		mBindingShadow.Reset();
+
 	if (!RestoreDeferredContextState) {
 		// This is equivalent to calling ClearState() afterwards, so we
 		// need to rebind the 3DMigoto resources now. See also
@@ -2566,7 +2715,7 @@ template <void (__stdcall ID3D11DeviceContext::*OrigSetShaderResources)(THIS_
 		UINT StartSlot,
 		UINT NumViews,
 		ID3D11ShaderResourceView *const *ppShaderResourceViews)>
-void HackerContext::BindStereoResources()
+void HackerContext::BindStereoResources(BindingShadowStage stage)
 {
 	if (!mHackerDevice) {
 		LogInfo("  error querying device. Can't set NVidia stereo parameter texture.\n");
@@ -2578,6 +2727,7 @@ void HackerContext::BindStereoResources()
 		LogDebug("  adding NVidia stereo parameter texture to shader resources in slot %i.\n", G->StereoParamsReg);
 
 		(mOrigContext1->*OrigSetShaderResources)(G->StereoParamsReg, 1, &mHackerDevice->mStereoResourceView);
+		mBindingShadow.SetShaderResources(mOrigContext1, stage, G->StereoParamsReg, 1, &mHackerDevice->mStereoResourceView);
 	}
 
 	// Set constants from ini file if they exist
@@ -2585,6 +2735,7 @@ void HackerContext::BindStereoResources()
 		LogDebug("  adding ini constants as texture to shader resources in slot %i.\n", G->IniParamsReg);
 
 		(mOrigContext1->*OrigSetShaderResources)(G->IniParamsReg, 1, &mHackerDevice->mIniResourceView);
+		mBindingShadow.SetShaderResources(mOrigContext1, stage, G->IniParamsReg, 1, &mHackerDevice->mIniResourceView);
 	}
 }
 
@@ -2601,12 +2752,12 @@ void HackerContext::Bind3DMigotoResources()
 	// Our new strategy is to bind them when the context is created, then
 	// make sure that they stay bound in the SetShaderResource() calls. We
 	// do this after the SetHackerDevice call because we need mHackerDevice
-	BindStereoResources<&ID3D11DeviceContext::VSSetShaderResources>();
-	BindStereoResources<&ID3D11DeviceContext::HSSetShaderResources>();
-	BindStereoResources<&ID3D11DeviceContext::DSSetShaderResources>();
-	BindStereoResources<&ID3D11DeviceContext::GSSetShaderResources>();
-	BindStereoResources<&ID3D11DeviceContext::PSSetShaderResources>();
-	BindStereoResources<&ID3D11DeviceContext::CSSetShaderResources>();
+	BindStereoResources<&ID3D11DeviceContext::VSSetShaderResources>(BindingShadowStage::VS);
+	BindStereoResources<&ID3D11DeviceContext::HSSetShaderResources>(BindingShadowStage::HS);
+	BindStereoResources<&ID3D11DeviceContext::DSSetShaderResources>(BindingShadowStage::DS);
+	BindStereoResources<&ID3D11DeviceContext::GSSetShaderResources>(BindingShadowStage::GS);
+	BindStereoResources<&ID3D11DeviceContext::PSSetShaderResources>(BindingShadowStage::PS);
+	BindStereoResources<&ID3D11DeviceContext::CSSetShaderResources>(BindingShadowStage::CS);
 }
 
 void HackerContext::InitIniParams()
@@ -2691,40 +2842,42 @@ template <void (__stdcall ID3D11DeviceContext::*OrigSetShaderResources)(THIS_
 		UINT StartSlot,
 		UINT NumViews,
 		ID3D11ShaderResourceView *const *ppShaderResourceViews)>
-void HackerContext::SetShaderResources(UINT StartSlot, UINT NumViews,
+void HackerContext::SetShaderResources(BindingShadowStage stage, UINT StartSlot, UINT NumViews,
 		ID3D11ShaderResourceView *const *ppShaderResourceViews)
 {
-	ID3D11ShaderResourceView **override_srvs = NULL;
+	ID3D11ShaderResourceView *override_srvs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+	ID3D11ShaderResourceView *const *srvs = ppShaderResourceViews;
 
 	if (!mHackerDevice)
 		return;
 
+	// Invalid, but make sure we can't overflow override_srvs:
+	if (NumViews > D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT)
+		goto out_set;
+
 	if (mHackerDevice->mStereoResourceView && G->StereoParamsReg >= 0) {
 		if (NumViews > G->StereoParamsReg - StartSlot) {
 			LogDebug("  Game attempted to unbind StereoParams, pinning in slot %i\n", G->StereoParamsReg);
-			override_srvs = new ID3D11ShaderResourceView*[NumViews];
 			memcpy(override_srvs, ppShaderResourceViews, sizeof(ID3D11ShaderResourceView*) * NumViews);
 			override_srvs[G->StereoParamsReg - StartSlot] = mHackerDevice->mStereoResourceView;
+			srvs = override_srvs;
 		}
 	}
 
 	if (mHackerDevice->mIniResourceView && G->IniParamsReg >= 0) {
 		if (NumViews > G->IniParamsReg - StartSlot) {
 			LogDebug("  Game attempted to unbind IniParams, pinning in slot %i\n", G->IniParamsReg);
-			if (!override_srvs) {
-				override_srvs = new ID3D11ShaderResourceView*[NumViews];
+			if (srvs != override_srvs) {
 				memcpy(override_srvs, ppShaderResourceViews, sizeof(ID3D11ShaderResourceView*) * NumViews);
+				srvs = override_srvs;
 			}
 			override_srvs[G->IniParamsReg - StartSlot] = mHackerDevice->mIniResourceView;
 		}
 	}
 
-	if (override_srvs) {
-		(mOrigContext1->*OrigSetShaderResources)(StartSlot, NumViews, override_srvs);
-		delete [] override_srvs;
-	} else {
-		(mOrigContext1->*OrigSetShaderResources)(StartSlot, NumViews, ppShaderResourceViews);
-	}
+out_set:
+	(mOrigContext1->*OrigSetShaderResources)(StartSlot, NumViews, srvs);
+	mBindingShadow.SetShaderResources(mOrigContext1, stage, StartSlot, NumViews, srvs);
 }
 
 // The rest of these methods are all the primary code for the tool, Direct3D calls that we override
@@ -2742,7 +2895,8 @@ STDMETHODIMP_(void) HackerContext::VSSetShader(THIS_
 		 &G->mVisitedVertexShaders,
 		 G->mSelectedVertexShader,
 		 &mCurrentVertexShader,
-		 &mCurrentVertexShaderHandle);
+		 &mCurrentVertexShaderHandle,
+		 BindingShadowStage::VS);
 }
 
 STDMETHODIMP_(void) HackerContext::PSSetShaderResources(THIS_
@@ -2753,7 +2907,7 @@ STDMETHODIMP_(void) HackerContext::PSSetShaderResources(THIS_
 	/* [annotation] */
 	__in_ecount(NumViews) ID3D11ShaderResourceView *const *ppShaderResourceViews)
 {
-	SetShaderResources<&ID3D11DeviceContext::PSSetShaderResources>(StartSlot, NumViews, ppShaderResourceViews);
+	SetShaderResources<&ID3D11DeviceContext::PSSetShaderResources>(BindingShadowStage::PS, StartSlot, NumViews, ppShaderResourceViews);
 }
 
 STDMETHODIMP_(void) HackerContext::PSSetShader(THIS_
@@ -2768,7 +2922,8 @@ STDMETHODIMP_(void) HackerContext::PSSetShader(THIS_
 		 &G->mVisitedPixelShaders,
 		 G->mSelectedPixelShader,
 		 &mCurrentPixelShader,
-		 &mCurrentPixelShaderHandle);
+		 &mCurrentPixelShaderHandle,
+		 BindingShadowStage::PS);
 
 	if (pPixelShader) {
 		// Set custom depth texture.
@@ -2777,6 +2932,7 @@ STDMETHODIMP_(void) HackerContext::PSSetShader(THIS_
 			LogDebug("  adding Z buffer to shader resources in slot 126.\n");
 
 			mOrigContext1->PSSetShaderResources(126, 1, &mHackerDevice->mZBufferResourceView);
+			mBindingShadow.SetShaderResources(mOrigContext1, BindingShadowStage::PS, 126, 1, &mHackerDevice->mZBufferResourceView);
 		}
 	}
 }
@@ -2789,6 +2945,11 @@ STDMETHODIMP_(void) HackerContext::DrawIndexed(THIS_
 	/* [annotation] */
 	__in  INT BaseVertexLocation)
 {
+	if (!DrawNeedsProcessing()) {
+		mOrigContext1->DrawIndexed(IndexCount, StartIndexLocation, BaseVertexLocation);
+		return;
+	}
+
 	DrawContext c = DrawContext(DrawCall::DrawIndexed, 0, IndexCount, 0, BaseVertexLocation, StartIndexLocation, 0, NULL, 0);
 	BeforeDraw(c);
 
@@ -2803,6 +2964,11 @@ STDMETHODIMP_(void) HackerContext::Draw(THIS_
 	/* [annotation] */
 	__in  UINT StartVertexLocation)
 {
+	if (!DrawNeedsProcessing()) {
+		mOrigContext1->Draw(VertexCount, StartVertexLocation);
+		return;
+	}
+
 	DrawContext c = DrawContext(DrawCall::Draw, VertexCount, 0, 0, StartVertexLocation, 0, 0, NULL, 0);
 	BeforeDraw(c);
 
@@ -2820,6 +2986,7 @@ STDMETHODIMP_(void) HackerContext::IASetIndexBuffer(THIS_
 	__in  UINT Offset)
 {
 	mOrigContext1->IASetIndexBuffer(pIndexBuffer, Format, Offset);
+	mBindingShadow.SetIndexBuffer(mOrigContext1, pIndexBuffer, Format, Offset);
 
 	// This is only used for index buffer hunting nowadays since the
 	// command list checks the hash on demand only when it is needed
@@ -2828,9 +2995,9 @@ STDMETHODIMP_(void) HackerContext::IASetIndexBuffer(THIS_
 		mCurrentIndexBuffer = GetResourceHash(pIndexBuffer);
 		if (mCurrentIndexBuffer) {
 			// When hunting, save this as a visited index buffer to cycle through.
-			EnterCriticalSectionPretty(&G->mCriticalSection);
+			EnterCriticalSectionPretty(&G->mHuntingLock);
 			G->mVisitedIndexBuffers.insert(mCurrentIndexBuffer);
-			LeaveCriticalSection(&G->mCriticalSection);
+			LeaveCriticalSectionPretty(&G->mHuntingLock);
 		}
 	}
 }
@@ -2847,6 +3014,12 @@ STDMETHODIMP_(void) HackerContext::DrawIndexedInstanced(THIS_
 	/* [annotation] */
 	__in  UINT StartInstanceLocation)
 {
+	if (!DrawNeedsProcessing()) {
+		mOrigContext1->DrawIndexedInstanced(IndexCountPerInstance, InstanceCount, StartIndexLocation,
+			BaseVertexLocation, StartInstanceLocation);
+		return;
+	}
+
 	DrawContext c = DrawContext(DrawCall::DrawIndexedInstanced, 0, IndexCountPerInstance, InstanceCount, BaseVertexLocation, StartIndexLocation, StartInstanceLocation, NULL, 0);
 	BeforeDraw(c);
 
@@ -2866,6 +3039,11 @@ STDMETHODIMP_(void) HackerContext::DrawInstanced(THIS_
 	/* [annotation] */
 	__in  UINT StartInstanceLocation)
 {
+	if (!DrawNeedsProcessing()) {
+		mOrigContext1->DrawInstanced(VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation);
+		return;
+	}
+
 	DrawContext c = DrawContext(DrawCall::DrawInstanced, VertexCountPerInstance, 0, InstanceCount, StartVertexLocation, 0, StartInstanceLocation, NULL, 0);
 	BeforeDraw(c);
 
@@ -2882,7 +3060,7 @@ STDMETHODIMP_(void) HackerContext::VSSetShaderResources(THIS_
 	/* [annotation] */
 	__in_ecount(NumViews) ID3D11ShaderResourceView *const *ppShaderResourceViews)
 {
-	SetShaderResources<&ID3D11DeviceContext::VSSetShaderResources>(StartSlot, NumViews, ppShaderResourceViews);
+	SetShaderResources<&ID3D11DeviceContext::VSSetShaderResources>(BindingShadowStage::VS, StartSlot, NumViews, ppShaderResourceViews);
 }
 
 STDMETHODIMP_(void) HackerContext::OMSetRenderTargets(THIS_
@@ -2896,11 +3074,11 @@ STDMETHODIMP_(void) HackerContext::OMSetRenderTargets(THIS_
 	Profiling::State profiling_state;
 
 	if (G->hunting == HUNTING_MODE_ENABLED) {
-		EnterCriticalSectionPretty(&G->mCriticalSection);
+		EnterCriticalSectionPretty(&G->mHuntingLock);
 			mCurrentRenderTargets.clear();
 			mCurrentDepthTarget = NULL;
 			mCurrentPSNumUAVs = 0;
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mHuntingLock);
 
 		if (G->DumpUsage) {
 			if (Profiling::mode == Profiling::Mode::SUMMARY)
@@ -2922,6 +3100,8 @@ STDMETHODIMP_(void) HackerContext::OMSetRenderTargets(THIS_
 	}
 
 	mOrigContext1->OMSetRenderTargets(NumViews, ppRenderTargetViews, pDepthStencilView);
+	// OMSetRenderTargets also unbinds any pixel shader UAVs:
+	mBindingShadow.SetRenderTargetsAndUnorderedAccessViews(NumViews, ppRenderTargetViews, pDepthStencilView, NumViews, 0, NULL);
 }
 
 STDMETHODIMP_(void) HackerContext::OMSetRenderTargetsAndUnorderedAccessViews(THIS_
@@ -2943,7 +3123,7 @@ STDMETHODIMP_(void) HackerContext::OMSetRenderTargetsAndUnorderedAccessViews(THI
 	Profiling::State profiling_state;
 
 	if (G->hunting == HUNTING_MODE_ENABLED) {
-		EnterCriticalSectionPretty(&G->mCriticalSection);
+		EnterCriticalSectionPretty(&G->mHuntingLock);
 
 		if (NumRTVs != D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL) {
 			mCurrentRenderTargets.clear();
@@ -2971,15 +3151,22 @@ STDMETHODIMP_(void) HackerContext::OMSetRenderTargetsAndUnorderedAccessViews(THI
 			// TODO: Record UAV stats
 		}
 
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mHuntingLock);
 	}
 
 	mOrigContext1->OMSetRenderTargetsAndUnorderedAccessViews(NumRTVs, ppRenderTargetViews, pDepthStencilView,
 		UAVStartSlot, NumUAVs, ppUnorderedAccessViews, pUAVInitialCounts);
+	mBindingShadow.SetRenderTargetsAndUnorderedAccessViews(NumRTVs, ppRenderTargetViews, pDepthStencilView,
+		UAVStartSlot, NumUAVs, ppUnorderedAccessViews);
 }
 
 STDMETHODIMP_(void) HackerContext::DrawAuto(THIS)
 {
+	if (!DrawNeedsProcessing()) {
+		mOrigContext1->DrawAuto();
+		return;
+	}
+
 	DrawContext c = DrawContext(DrawCall::DrawAuto, 0, 0, 0, 0, 0, 0, NULL, 0);
 	BeforeDraw(c);
 
@@ -2994,6 +3181,11 @@ STDMETHODIMP_(void) HackerContext::DrawIndexedInstancedIndirect(THIS_
 	/* [annotation] */
 	__in  UINT AlignedByteOffsetForArgs)
 {
+	if (!DrawNeedsProcessing()) {
+		mOrigContext1->DrawIndexedInstancedIndirect(pBufferForArgs, AlignedByteOffsetForArgs);
+		return;
+	}
+
 	DrawContext c = DrawContext(DrawCall::DrawIndexedInstancedIndirect, 0, 0, 0, 0, 0, 0, &pBufferForArgs, AlignedByteOffsetForArgs);
 	BeforeDraw(c);
 
@@ -3008,6 +3200,11 @@ STDMETHODIMP_(void) HackerContext::DrawInstancedIndirect(THIS_
 	/* [annotation] */
 	__in  UINT AlignedByteOffsetForArgs)
 {
+	if (!DrawNeedsProcessing()) {
+		mOrigContext1->DrawInstancedIndirect(pBufferForArgs, AlignedByteOffsetForArgs);
+		return;
+	}
+
 	DrawContext c = DrawContext(DrawCall::DrawInstancedIndirect, 0, 0, 0, 0, 0, 0, &pBufferForArgs, AlignedByteOffsetForArgs);
 	BeforeDraw(c);
 
@@ -3109,6 +3306,7 @@ void STDMETHODCALLTYPE HackerContext::VSSetConstantBuffers1(
 	_In_reads_opt_(NumBuffers)  const UINT *pNumConstants)
 {
 	mOrigContext1->VSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants);
+	mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::VS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 
@@ -3125,6 +3323,7 @@ void STDMETHODCALLTYPE HackerContext::HSSetConstantBuffers1(
 	_In_reads_opt_(NumBuffers)  const UINT *pNumConstants)
 {
 	mOrigContext1->HSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants);
+	mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::HS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 
@@ -3141,6 +3340,7 @@ void STDMETHODCALLTYPE HackerContext::DSSetConstantBuffers1(
 	_In_reads_opt_(NumBuffers)  const UINT *pNumConstants)
 {
 	mOrigContext1->DSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants);
+	mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::DS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 
@@ -3158,6 +3358,7 @@ void STDMETHODCALLTYPE HackerContext::GSSetConstantBuffers1(
 	_In_reads_opt_(NumBuffers)  const UINT *pNumConstants)
 {
 	mOrigContext1->GSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants);
+	mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::GS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 
@@ -3175,6 +3376,7 @@ void STDMETHODCALLTYPE HackerContext::PSSetConstantBuffers1(
 	_In_reads_opt_(NumBuffers)  const UINT *pNumConstants)
 {
 	mOrigContext1->PSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants);
+	mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::PS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 
@@ -3192,6 +3394,7 @@ void STDMETHODCALLTYPE HackerContext::CSSetConstantBuffers1(
 	_In_reads_opt_(NumBuffers)  const UINT *pNumConstants)
 {
 	mOrigContext1->CSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants);
+	mBindingShadow.SetConstantBuffers(mOrigContext1, BindingShadowStage::CS, StartSlot, NumBuffers, ppConstantBuffers);
 }
 
 
@@ -3301,6 +3504,7 @@ void STDMETHODCALLTYPE HackerContext::SwapDeviceContextState(
 	_Out_opt_  ID3DDeviceContextState **ppPreviousState)
 {
 	mOrigContext1->SwapDeviceContextState(pState, ppPreviousState);
+	mBindingShadow.Invalidate();
 
 	// If a game or overlay creates separate context state objects we won't
 	// have had a chance to bind the 3DMigoto resources when it was
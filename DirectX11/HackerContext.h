@@ -4,6 +4,7 @@
 #include <INITGUID.h>
 
 #include "DrawCallInfo.h"
+#include "BindingShadow.h"
 
 #include "CommandList.h"
 
@@ -128,7 +129,30 @@ private:
 	typedef std::unordered_map<ID3D11Resource*, MappedResourceInfo> MappedResources;
 	MappedResources mMappedResources;
 
+	// Shadow copy of the bound resources for command lists to read from
+	BindingShadow mBindingShadow;
+
+	// Usage records pending FlushShaderUsage(), only used with dump_usage.
+	// Collected without taking any locks and merged into the global
+	// ShaderInfoData maps at the end of each frame / command list:
+	ShaderUsageBatch mShaderUsage;
+
+	// One bit per BindingShadowStage set when the shader bound to that
+	// stage needs BeforeDraw / BeforeDispatch to do something (it has a
+	// ShaderOverride or is pending ShaderRegex analysis), plus one for
+	// hunting, so that draw calls that cannot be affected by anything can
+	// skip straight to the driver. Maintained by the SetShader hooks, and
+	// recalculated whenever mDrawProcessingEpoch falls out of date with
+	// G->draw_processing_epoch:
+	unsigned mDrawProcessingMask;
+	LONG mDrawProcessingEpoch;
+
 	// These private methods are utility routines for HackerContext.
+	bool ShaderNeedsProcessing(ID3D11DeviceChild *shader, UINT64 hash);
+	void SetShaderNeedsProcessing(BindingShadowStage stage, bool needs_processing);
+	void RefreshDrawProcessingMask();
+	bool DrawNeedsProcessing();
+	bool DispatchNeedsProcessing();
 	void BeforeDraw(DrawContext &data);
 	void AfterDraw(DrawContext &data);
 	bool BeforeDispatch(DispatchContext *context);
@@ -159,14 +183,17 @@ private:
 		UINT StartSlot,
 		UINT NumViews,
 		ID3D11ShaderResourceView **ppShaderResourceViews)>
-	void RecordShaderResourceUsage(std::map<UINT64, ShaderInfoData> &ShaderInfo, UINT64 currentShader);
-	void _RecordShaderResourceUsage(ShaderInfoData *shader_info,
+	void RecordShaderResourceUsage(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 currentShader);
+	void _RecordShaderResourceUsage(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 currentShader,
 			ID3D11ShaderResourceView *views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT]);
+	void RecordShaderUsage(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 currentShader,
+			ShaderUsageType type, int slot, ID3D11Resource *resource, UINT64 peer = 0);
+	void RecordViewUsage(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 currentShader,
+			ShaderUsageType type, int slot, ID3D11View *view);
 	void RecordGraphicsShaderStats();
 	void RecordComputeShaderStats();
-	void RecordPeerShaders(std::set<UINT64> *PeerShaders, UINT64 this_shader_hash);
+	void RecordPeerShaders(std::map<UINT64, ShaderInfoData> *ShaderInfo, UINT64 this_shader_hash);
 	void RecordRenderTargetInfo(ID3D11RenderTargetView *target, UINT view_num);
-	ID3D11Resource* RecordResourceViewStats(ID3D11View *view, std::set<uint32_t> *resource_info);
 
 	// Templates to reduce duplicated code:
 	template <class ID3D11Shader,
@@ -184,17 +211,18 @@ private:
 		std::set<UINT64> *visitedShaders,
 		UINT64 selectedShader,
 		UINT64 *currentShaderHash,
-		ID3D11Shader **currentShaderHandle);
+		ID3D11Shader **currentShaderHandle,
+		BindingShadowStage stage);
 	template <void (__stdcall ID3D11DeviceContext::*OrigSetShaderResources)(THIS_
 			UINT StartSlot,
 			UINT NumViews,
 			ID3D11ShaderResourceView *const *ppShaderResourceViews)>
-	void BindStereoResources();
+	void BindStereoResources(BindingShadowStage stage);
 	template <void (__stdcall ID3D11DeviceContext::*OrigSetShaderResources)(THIS_
 			UINT StartSlot,
 			UINT NumViews,
 			ID3D11ShaderResourceView *const *ppShaderResourceViews)>
-	void SetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView *const *ppShaderResourceViews);
+	void SetShaderResources(BindingShadowStage stage, UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView *const *ppShaderResourceViews);
 
 protected:
 	// Allow FrameAnalysisContext access to these as an interim measure
@@ -218,12 +246,15 @@ public:
 	ID3D11DeviceContext1* GetPossiblyHookedOrigContext1();
 	ID3D11DeviceContext1* GetPassThroughOrigContext1();
 	void HookContext();
+	void FlushShaderUsage();
+	BindingShadow* GetBindingShadow();
 
 	// public to allow CommandList access
 	virtual void FrameAnalysisLog(char *fmt, ...) {};
 	virtual void FrameAnalysisTrigger(FrameAnalysisOptions new_options) {};
 	virtual void FrameAnalysisDump(ID3D11Resource *resource, FrameAnalysisOptions options,
 		const wchar_t *target, DXGI_FORMAT format, UINT stride, UINT offset) {};
+	virtual void FrameAnalysisFlush() {};
 
 	// These are the shaders the game has set, which may be different from
 	// the ones we have bound to the pipeline:
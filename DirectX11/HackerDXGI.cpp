@@ -54,8 +54,6 @@
 // the HackerSwapChain.  The model is the same as that used in HackerDevice
 // and HackerContext.
 
-// Include before util.h (or any header that includes util.h) to get pretty
-// version of LockResourceCreationMode:
 #include "lock.h"
 
 #include "HackerDXGI.h"
@@ -232,6 +230,11 @@ void HackerSwapChain::RunFrameActions()
 	// so that the most lost will be one frame worth.  Tradeoff of performance to accuracy
 	if (LogFile) fflush(LogFile);
 
+	// Merge the shader usage stats collected over the last frame before
+	// anything has a chance to dump them:
+	if (mHackerContext)
+		mHackerContext->FlushShaderUsage();
+
 	// Run the command list here, before drawing the overlay so that a
 	// custom shader on the present call won't remove the overlay. Also,
 	// run this before most frame actions so that this can be considered as
@@ -250,6 +253,8 @@ void HackerSwapChain::RunFrameActions()
 			// the frame count and reset the draw count:
 			G->analyse_frame_no++;
 		} else {
+			if (mHackerContext)
+				mHackerContext->FrameAnalysisFlush();
 			G->analyse_frame = false;
 			if (G->DumpUsage)
 				DumpUsage(G->ANALYSIS_PATH);
@@ -275,6 +280,10 @@ void HackerSwapChain::RunFrameActions()
 	if (G->gReloadConfigPending)
 		ReloadConfig(mHackerDevice);
 
+	// Create a few more of the custom resources and shaders the config
+	// will need, before a command list has to stall on them:
+	RunPreSubstantiation(mHackerDevice);
+
 	// Draw the on-screen overlay text with hunting and informational
 	// messages, before final Present. We now do this after the shader and
 	// config reloads, so if they have any notices we will see them this
@@ -290,6 +299,10 @@ void HackerSwapChain::RunFrameActions()
 	// incremented when we call the original present call:
 	G->frame_no++;
 
+	// Merge the descriptions of any resources created while hunting this
+	// frame into mResourceInfo:
+	DrainResourceInfo();
+
 	// When not hunting most keybindings won't have been registered, but
 	// still skip the below logic that only applies while hunting.
 	if (G->hunting != HUNTING_MODE_ENABLED)
@@ -310,9 +323,9 @@ void HackerSwapChain::RunFrameActions()
 	// rapidly converge upon all active shaders.
 
 	if (difftime(time(NULL), G->huntTime) > 60) {
-		EnterCriticalSectionPretty(&G->mCriticalSection);
+		EnterCriticalSectionPretty(&G->mHuntingLock);
 		TimeoutHuntingBuffers();
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mHuntingLock);
 	}
 }
 
@@ -576,6 +589,8 @@ STDMETHODIMP HackerSwapChain::Present(THIS_
 		// shaders get the new values for the current frame:
 		UpdateStereoParams();
 
+		FramePresented();
+
 		G->bb_is_upscaling_bb = !!G->SCREEN_UPSCALING && G->upscaling_command_list_using_explicit_bb_flip;
 
 		// Run the post present command list now, which can be used to restore
@@ -605,6 +620,11 @@ STDMETHODIMP HackerSwapChain::GetBuffer(THIS_
 	return hr;
 }
 
+HRESULT HackerSwapChain::GetPresentedBuffer(REFIID riid, void **ppSurface)
+{
+	return GetBuffer(0, riid, ppSurface);
+}
+
 STDMETHODIMP HackerSwapChain::SetFullscreenState(THIS_
 	/* [in] */ BOOL Fullscreen,
 	/* [annotation][in] */
@@ -699,6 +719,7 @@ STDMETHODIMP HackerSwapChain::ResizeBuffers(THIS_
 		G->mResolutionInfo.height = Height;
 		LogInfo("  Got resolution from swap chain: %ix%i\n",
 			G->mResolutionInfo.width, G->mResolutionInfo.height);
+		ClearTextureOverrideDecisionCache();
 	}
 
 	HRESULT hr = mOrigSwapChain1->ResizeBuffers(BufferCount, Width, Height, NewFormat, SwapChainFlags);
@@ -883,6 +904,8 @@ STDMETHODIMP HackerSwapChain::Present1(THIS_
 		// get the new values for the current frame:
 		UpdateStereoParams();
 
+		FramePresented();
+
 		G->bb_is_upscaling_bb = !!G->SCREEN_UPSCALING && G->upscaling_command_list_using_explicit_bb_flip;
 
 		// Run the post present command list now, which can be used to restore
@@ -967,7 +990,7 @@ STDMETHODIMP HackerSwapChain::GetRotation(THIS_
 HackerUpscalingSwapChain::HackerUpscalingSwapChain(IDXGISwapChain1 *pSwapChain, HackerDevice *pHackerDevice, HackerContext *pHackerContext,
 	DXGI_SWAP_CHAIN_DESC* pFakeSwapChainDesc, UINT newWidth, UINT newHeight)
 	: HackerSwapChain(pSwapChain, pHackerDevice, pHackerContext),
-	mFakeBackBuffer(nullptr), mFakeSwapChain1(nullptr), mWidth(0), mHeight(0)
+	mFakeSwapChain1(nullptr), mWidth(0), mHeight(0)
 {
 	CreateRenderTarget(pFakeSwapChainDesc);
 
@@ -980,8 +1003,50 @@ HackerUpscalingSwapChain::~HackerUpscalingSwapChain()
 {
 	if (mFakeSwapChain1)
 		mFakeSwapChain1->Release();
-	if (mFakeBackBuffer)
-		mFakeBackBuffer->Release();
+	ReleaseFakeBackBuffers();
+}
+
+HRESULT HackerUpscalingSwapChain::CreateFakeBackBuffers(D3D11_TEXTURE2D_DESC *desc, UINT count)
+{
+	ID3D11Texture2D *buffer;
+	HRESULT hr = S_OK;
+	UINT i;
+
+	ReleaseFakeBackBuffers();
+
+	// BufferCount counts the front buffer as well in some swap effects,
+	// but it is a reasonable upper bound on how many frames can be in
+	// flight, so use it as is:
+	if (!count)
+		count = 1;
+	if (count > DXGI_MAX_SWAP_CHAIN_BUFFERS)
+		count = DXGI_MAX_SWAP_CHAIN_BUFFERS;
+
+	LockResourceCreationModeShared();
+	for (i = 0; i < count; i++) {
+		hr = mHackerDevice->GetPassThroughOrigDevice1()->CreateTexture2D(desc, nullptr, &buffer);
+		if (FAILED(hr))
+			break;
+		mFakeBackBuffers.push_back(buffer);
+	}
+	UnlockResourceCreationMode();
+
+	// Any buffers we did manage to create are still usable - the ring
+	// just won't be as deep:
+	if (!mFakeBackBuffers.empty())
+		hr = S_OK;
+
+	mFakeBackBufferRing.Reset((UINT)mFakeBackBuffers.size());
+	LogInfo("HackerUpscalingSwapChain: Created %Iu fake back buffers\n", mFakeBackBuffers.size());
+
+	return hr;
+}
+
+void HackerUpscalingSwapChain::ReleaseFakeBackBuffers()
+{
+	for (ID3D11Texture2D *buffer : mFakeBackBuffers)
+		buffer->Release();
+	mFakeBackBuffers.clear();
 }
 
 void HackerUpscalingSwapChain::CreateRenderTarget(DXGI_SWAP_CHAIN_DESC* pFakeSwapChainDesc)
@@ -993,7 +1058,6 @@ void HackerUpscalingSwapChain::CreateRenderTarget(DXGI_SWAP_CHAIN_DESC* pFakeSwa
 	case 0:
 	{
 		// TODO: multisampled swap chain
-		// TODO: multiple buffers within one spaw chain
 		// ==> in this case upscale_mode = 1 should be used at the moment
 		D3D11_TEXTURE2D_DESC fake_buffer_desc;
 		std::memset(&fake_buffer_desc, 0, sizeof(D3D11_TEXTURE2D_DESC));
@@ -1008,9 +1072,7 @@ void HackerUpscalingSwapChain::CreateRenderTarget(DXGI_SWAP_CHAIN_DESC* pFakeSwa
 		fake_buffer_desc.Height = pFakeSwapChainDesc->BufferDesc.Height;
 		fake_buffer_desc.CPUAccessFlags = 0;
 
-		LockResourceCreationMode();
-		hr = mHackerDevice->GetPassThroughOrigDevice1()->CreateTexture2D(&fake_buffer_desc, nullptr, &mFakeBackBuffer);
-		UnlockResourceCreationMode();
+		hr = CreateFakeBackBuffers(&fake_buffer_desc, pFakeSwapChainDesc->BufferCount);
 	}
 	break;
 	case 1:
@@ -1078,12 +1140,14 @@ STDMETHODIMP HackerUpscalingSwapChain::GetBuffer(THIS_
 	HRESULT hr = S_OK;
 
 	// if upscaling is on give the game fake back buffer
-	if (mFakeBackBuffer)
+	if (!mFakeBackBuffers.empty())
 	{
-		// Use QueryInterface on mFakeBackBuffer, which validates that
-		// the requested interface is supported, that ppSurface is not
-		// NULL, and bumps the refcount if successful:
-		hr = mFakeBackBuffer->QueryInterface(riid, ppSurface);
+		UINT i = Buffer ? mFakeBackBufferRing.Peek(Buffer) : mFakeBackBufferRing.Fetch();
+
+		// Use QueryInterface on the fake back buffer, which validates
+		// that the requested interface is supported, that ppSurface is
+		// not NULL, and bumps the refcount if successful:
+		hr = mFakeBackBuffers[i]->QueryInterface(riid, ppSurface);
 	}
 	else if (mFakeSwapChain1)
 	{
@@ -1099,6 +1163,19 @@ STDMETHODIMP HackerUpscalingSwapChain::GetBuffer(THIS_
 	return hr;
 }
 
+HRESULT HackerUpscalingSwapChain::GetPresentedBuffer(REFIID riid, void **ppSurface)
+{
+	if (mFakeBackBuffers.empty())
+		return GetBuffer(0, riid, ppSurface);
+
+	return mFakeBackBuffers[mFakeBackBufferRing.Presented()]->QueryInterface(riid, ppSurface);
+}
+
+void HackerUpscalingSwapChain::FramePresented()
+{
+	mFakeBackBufferRing.FramePresented();
+}
+
 STDMETHODIMP HackerUpscalingSwapChain::SetFullscreenState(THIS_
 	/* [in] */ BOOL Fullscreen,
 	/* [annotation][in] */
@@ -1154,10 +1231,10 @@ STDMETHODIMP HackerUpscalingSwapChain::GetDesc(THIS_
 			//TODO: not sure whether the upscaled resolution or game resolution should be returned
 			// all tested games did not use this function only migoto does
 			// I let them be the game resolution at the moment
-			if (mFakeBackBuffer)
+			if (!mFakeBackBuffers.empty())
 			{
 				D3D11_TEXTURE2D_DESC fd;
-				mFakeBackBuffer->GetDesc(&fd);
+				mFakeBackBuffers[0]->GetDesc(&fd);
 				pDesc->BufferDesc.Width = fd.Width;
 				pDesc->BufferDesc.Height = fd.Height;
 				LogDebug("->Using fake SwapChain Sizes.\n");
@@ -1200,31 +1277,35 @@ STDMETHODIMP HackerUpscalingSwapChain::ResizeBuffers(THIS_
 		G->mResolutionInfo.height = Height;
 		LogInfo("Got resolution from swap chain: %ix%i\n",
 			G->mResolutionInfo.width, G->mResolutionInfo.height);
+		ClearTextureOverrideDecisionCache();
 	}
 
 	HRESULT hr;
 
-	if (mFakeBackBuffer) // UPSCALE_MODE 0
+	if (!mFakeBackBuffers.empty()) // UPSCALE_MODE 0
 	{
 		// TODO: need to consider the new code (G->gForceStereo == 2)
 		// would my stuff work this way? i guess yes. What is with the games that are not calling resize buffer
-		// just try to recreate texture with new game resolution
-		// should be possible without any issues (texture just like the swap chain should not be used at this time point)
+		// just try to recreate textures with new game resolution
+		// should be possible without any issues (textures just like the swap chain should not be used at this time point)
 
 		D3D11_TEXTURE2D_DESC fd;
-		mFakeBackBuffer->GetDesc(&fd);
+		mFakeBackBuffers[0]->GetDesc(&fd);
 
-		if (!(fd.Width == Width && fd.Height == Height))
-		{
-			mFakeBackBuffer->Release();
+		// Zero means preserve the existing value, as for the real swap chain:
+		if (!BufferCount)
+			BufferCount = mFakeBackBufferRing.Count();
+		if (NewFormat == DXGI_FORMAT_UNKNOWN)
+			NewFormat = fd.Format;
 
+		if (!(fd.Width == Width && fd.Height == Height && fd.Format == NewFormat
+				&& BufferCount == mFakeBackBufferRing.Count()))
+		{
 			fd.Width = Width;
 			fd.Height = Height;
 			fd.Format = NewFormat;
-			// just recreate texture with new width and height
-			LockResourceCreationMode();
-			hr = mHackerDevice->GetPassThroughOrigDevice1()->CreateTexture2D(&fd, nullptr, &mFakeBackBuffer);
-			UnlockResourceCreationMode();
+			// just recreate the ring with new width, height and count
+			hr = CreateFakeBackBuffers(&fd, BufferCount);
 		}
 		else  // nothing to resize
 			hr = S_OK;
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <dxgi1_2.h>
+#include <vector>
 
 #include "HackerDevice.h"
 #include "HackerContext.h"
 #include "Overlay.h"
+#include "FakeBackBufferRing.h"
 
 
 // Forward references required because of circular references from the
@@ -36,6 +38,13 @@ public:
 	void RunFrameActions();
 	Overlay *mOverlay;
 
+	// The buffer the game rendered the frame being presented into. This is
+	// what the upscaling command list should use rather than GetBuffer(0),
+	// since the fake back buffers in upscale_mode=0 rotate between frames:
+	virtual HRESULT GetPresentedBuffer(REFIID riid, void **ppSurface);
+	// Called after the frame has been passed to the original swap chain:
+	virtual void FramePresented() {}
+
 
 	/** IUnknown **/
 
@@ -195,7 +204,8 @@ class HackerUpscalingSwapChain : public HackerSwapChain
 {
 private:
 	IDXGISwapChain1 *mFakeSwapChain1;
-	ID3D11Texture2D *mFakeBackBuffer;
+	std::vector<ID3D11Texture2D*> mFakeBackBuffers;
+	FakeBackBufferRing mFakeBackBufferRing;
 
 	UINT mWidth;
 	UINT mHeight;
@@ -207,8 +217,13 @@ public:
 
 private:
 	void CreateRenderTarget(DXGI_SWAP_CHAIN_DESC* pFakeSwapChainDesc);
+	HRESULT CreateFakeBackBuffers(D3D11_TEXTURE2D_DESC *desc, UINT count);
+	void ReleaseFakeBackBuffers();
 
 public:
+	HRESULT GetPresentedBuffer(REFIID riid, void **ppSurface) override;
+	void FramePresented() override;
+
 
 	STDMETHOD(GetBuffer)(THIS_
 		/* [in] */ UINT Buffer,
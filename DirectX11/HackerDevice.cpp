@@ -8,8 +8,6 @@
 // ID3D11Device3	Win10			11.3
 // ID3D11Device4					11.4
 
-// Include before util.h (or any header that includes util.h) to get pretty
-// version of LockResourceCreationMode:
 #include "lock.h"
 
 #include "HackerDevice.h"
@@ -32,6 +30,7 @@
 #include "D3D_Shaders\stdafx.h"
 #include "ResourceHash.h"
 #include "ShaderRegex.h"
+#include "ShaderPipeline.h"
 #include "CommandList.h"
 #include "Hunting.h"
 
@@ -120,7 +119,7 @@ HackerDevice* lookup_hacker_device(IUnknown *unknown)
 		ret = i->second;
 		ret->AddRef();
 	}
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 
 	real_unknown->Release();
 
@@ -184,7 +183,7 @@ static IUnknown* register_hacker_device(HackerDevice *hacker_device)
 
 	EnterCriticalSectionPretty(&G->mCriticalSection);
 	device_map[real_unknown] = hacker_device;
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 
 	real_unknown->Release();
 
@@ -235,7 +234,7 @@ static void unregister_hacker_device(HackerDevice *hacker_device)
 			        real_unknown, hacker_device, i->second);
 		}
 	}
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 }
 
 // -----------------------------------------------------------------------------------------------
@@ -936,7 +935,8 @@ static bool ReplaceASMShader(__in UINT64 hash, const wchar_t *pShaderType, const
 			try
 			{
 				vector<AssemblerParseError> parse_errors;
-				byteCode = AssembleFluganWithOptionalSignatureParsing(&asmTextBytes, G->assemble_signature_comments, &byteCode, &parse_errors);
+				byteCode = AssembleFluganWithOptionalSignatureParsing(&asmTextBytes, G->assemble_signature_comments, &byteCode, &parse_errors,
+						&get_tls()->assembler_ctx);
 
 				// Assuming the re-assembly worked, let's make it the active shader code.
 				pCodeSize = byteCode.size();
@@ -1005,7 +1005,6 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 	FILE *fw = NULL;
 	string shaderModel = "";
 	bool patched = false;
-	bool errorOccurred = false;
 	HRESULT hr;
 
 	if (!G->EXPORT_HLSL && !G->decompiler_settings.fixSvPosition && !G->decompiler_settings.recompileVs)
@@ -1028,28 +1027,18 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 	if (GetFileAttributes(val) != INVALID_FILE_ATTRIBUTES)
 		return NULL;
 
-	// Disassemble old shader for fixing.
-	asmText = BinaryToAsmText(pShaderBytecode, BytecodeLength, false);
-	if (asmText.empty()) {
-		LogInfo("    disassembly of original shader failed.\n");
-		return NULL;
-	}
-
-	// Decompile code.
-	LogInfo("    creating HLSL representation.\n");
-
-	ParseParameters p;
-	p.bytecode = pShaderBytecode;
-	p.decompiled = asmText.c_str();
-	p.decompiledSize = asmText.size();
-	p.ZeroOutput = false;
-	p.G = &G->decompiler_settings;
-	const string decompiledCode = DecompileBinaryHLSL(p, patched, shaderModel, errorOccurred);
-	if (!decompiledCode.size() || errorOccurred)
+	// Disassemble and decompile the old shader for fixing. The results
+	// of both stages are memoised so that hunting operations and config
+	// reloads that don't change the decompiler options don't redo them.
+	DecompiledShader decompiled;
+	if (!CachedDecompileBinaryHLSL(hash, pShaderBytecode, BytecodeLength, &asmText, &decompiled))
 	{
 		LogInfo("    error while decompiling.\n");
 		return NULL;
 	}
+	const string &decompiledCode = decompiled.hlsl;
+	shaderModel = decompiled.shader_model;
+	patched = decompiled.patched;
 
 	if ((G->EXPORT_HLSL >= 1) || (G->EXPORT_FIXED && patched))
 	{
@@ -1320,7 +1309,7 @@ HRESULT HackerDevice::ReplaceShaderFromShaderFixes(UINT64 hash,
 			memcpy(blob->GetBufferPointer(), pShaderBytecode, blob->GetBufferSize());
 			EnterCriticalSectionPretty(&G->mCriticalSection);
 			RegisterForReload(*ppShader, hash, shaderType, shaderModel, pClassLinkage, blob, ftWrite, headerLine, false);
-			LeaveCriticalSection(&G->mCriticalSection);
+			LeaveCriticalSectionPretty(&G->mCriticalSection);
 		}
 	}
 
@@ -1391,7 +1380,7 @@ HRESULT HackerDevice::ProcessShaderNotFoundInShaderFixes(UINT64 hash,
 					G->mOriginalShaders[*ppShader] = *ppShader;
 				}
 			}
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mCriticalSection);
 	}
 
 	return hr;
@@ -1475,7 +1464,7 @@ void CleanupShaderMaps(ID3D11DeviceChild *handle)
 		}
 	}
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 }
 
 // Keep the original shader around if it may be needed by a filter in a
@@ -1514,7 +1503,7 @@ void HackerDevice::KeepOriginalShader(UINT64 hash, wchar_t *shaderType,
 		// the originalShader here since we are *only* storing it, not
 		// also returning it to the game.
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 }
 
 
@@ -2041,6 +2030,103 @@ static void override_resource_desc(D3D11_TEXTURE3D_DESC *desc, TextureOverride *
 	override_resource_desc_common_2d_3d(desc, textureOverride);
 }
 
+// Games tend to create resources with the same description over and over
+// (e.g. while streaming), and unless a TextureOverride matched by hash applies
+// the outcome of the square surface check and fuzzy TextureOverride matching
+// depends on nothing but the description. We remember the final description
+// and surface creation mode for each description we have seen so we can skip
+// straight to the result. Keyed by a hash of the description alone, without
+// any initial data, and cleared whenever the TextureOverrides are reloaded.
+// Fuzzy matches can also compare against the game's resolution (res_width /
+// res_height), so each decision remembers the resolution it was made at and
+// the cache is cleared whenever the resolution changes.
+template <typename DescType>
+struct TextureOverrideDecision
+{
+	DescType orig_desc;
+	DescType new_desc;
+	bool desc_overridden;
+	NVAPI_STEREO_SURFACECREATEMODE new_mode;
+	int square_create_mode;
+	int res_width;
+	int res_height;
+};
+
+template <typename DescType>
+struct TextureOverrideDecisionCache
+{
+	static std::unordered_map<uint32_t, TextureOverrideDecision<DescType>> decisions;
+};
+template <typename DescType>
+std::unordered_map<uint32_t, TextureOverrideDecision<DescType>> TextureOverrideDecisionCache<DescType>::decisions;
+
+// Bound on the number of descriptions cached per resource type, in case a
+// game creates resources of ever changing sizes:
+static const size_t MAX_TEXTURE_OVERRIDE_DECISIONS = 4096;
+static SRWLOCK texture_override_decision_lock = SRWLOCK_INIT;
+
+void ClearTextureOverrideDecisionCache()
+{
+	AcquireSRWLockExclusive(&texture_override_decision_lock);
+	TextureOverrideDecisionCache<D3D11_BUFFER_DESC>::decisions.clear();
+	TextureOverrideDecisionCache<D3D11_TEXTURE1D_DESC>::decisions.clear();
+	TextureOverrideDecisionCache<D3D11_TEXTURE2D_DESC>::decisions.clear();
+	TextureOverrideDecisionCache<D3D11_TEXTURE3D_DESC>::decisions.clear();
+	ReleaseSRWLockExclusive(&texture_override_decision_lock);
+}
+
+template <typename DescType>
+static bool lookup_texture_override_decision(uint32_t desc_hash, const DescType *origDesc,
+		DescType *newDesc, const DescType **ret, NVAPI_STEREO_SURFACECREATEMODE *newMode)
+{
+	typename std::unordered_map<uint32_t, TextureOverrideDecision<DescType>>::iterator i;
+	bool found = false;
+
+	AcquireSRWLockShared(&texture_override_decision_lock);
+
+	i = TextureOverrideDecisionCache<DescType>::decisions.find(desc_hash);
+	if (i != TextureOverrideDecisionCache<DescType>::decisions.end() &&
+	    i->second.square_create_mode == G->gSurfaceSquareCreateMode &&
+	    i->second.res_width == G->mResolutionInfo.width &&
+	    i->second.res_height == G->mResolutionInfo.height &&
+	    !memcmp(&i->second.orig_desc, origDesc, sizeof(DescType))) {
+		if (i->second.desc_overridden) {
+			*newDesc = i->second.new_desc;
+			*ret = newDesc;
+		}
+		*newMode = i->second.new_mode;
+		found = true;
+	}
+
+	ReleaseSRWLockShared(&texture_override_decision_lock);
+
+	return found;
+}
+
+template <typename DescType>
+static void store_texture_override_decision(uint32_t desc_hash, const DescType *origDesc,
+		const DescType *ret, NVAPI_STEREO_SURFACECREATEMODE newMode)
+{
+	TextureOverrideDecision<DescType> decision;
+
+	decision.orig_desc = *origDesc;
+	decision.desc_overridden = (ret != origDesc);
+	if (decision.desc_overridden)
+		decision.new_desc = *ret;
+	decision.new_mode = newMode;
+	decision.square_create_mode = G->gSurfaceSquareCreateMode;
+	decision.res_width = G->mResolutionInfo.width;
+	decision.res_height = G->mResolutionInfo.height;
+
+	AcquireSRWLockExclusive(&texture_override_decision_lock);
+
+	if (TextureOverrideDecisionCache<DescType>::decisions.size() >= MAX_TEXTURE_OVERRIDE_DECISIONS)
+		TextureOverrideDecisionCache<DescType>::decisions.clear();
+	TextureOverrideDecisionCache<DescType>::decisions[desc_hash] = decision;
+
+	ReleaseSRWLockExclusive(&texture_override_decision_lock);
+}
+
 template <typename DescType>
 static const DescType* process_texture_override(uint32_t hash,
 		StereoHandle mStereoHandle,
@@ -2052,10 +2138,24 @@ static const DescType* process_texture_override(uint32_t hash,
 	TextureOverrideMatches matches;
 	TextureOverride *textureOverride = NULL;
 	const DescType* ret = origDesc;
+	uint32_t desc_hash = 0;
+	bool cacheable = false;
 	unsigned i;
 
 	*oldMode = (NVAPI_STEREO_SURFACECREATEMODE) -1;
 
+	// TextureOverrides matched by hash depend on the initial data as well
+	// as the description, so these are never cached. They are the
+	// exception rather than the rule, so this is not a big loss:
+	if (origDesc && lookup_textureoverride(hash) == G->mTextureOverrideMap.end()) {
+		desc_hash = crc32c_hw(0, origDesc, sizeof(DescType));
+		if (lookup_texture_override_decision(desc_hash, origDesc, newDesc, &ret, &newMode)) {
+			LogDebug("  using cached TextureOverride decision for hash=%08x\n", hash);
+			goto set_mode;
+		}
+		cacheable = true;
+	}
+
 	// Check for square surfaces. We used to do this after processing the
 	// StereoMode in TextureOverrides, but realistically we always want the
 	// TextureOverrides to be able to override this since they are more
@@ -2087,6 +2187,11 @@ static const DescType* process_texture_override(uint32_t hash,
 						textureOverride->ini_section.c_str(), hash, buf);
 			}
 
+			// Overrides that only apply to specific iterations have
+			// to be evaluated for every resource they match:
+			if (!textureOverride->iterations.empty())
+				cacheable = false;
+
 			if (!check_texture_override_iteration(textureOverride))
 				continue;
 
@@ -2097,15 +2202,23 @@ static const DescType* process_texture_override(uint32_t hash,
 		}
 	}
 
-	LockResourceCreationMode();
+	if (cacheable)
+		store_texture_override_decision(desc_hash, origDesc, ret, newMode);
 
+set_mode:
+	// Only take the lock exclusively if we are changing the surface
+	// creation mode, otherwise allow other threads to create resources
+	// at the same time:
 	if (newMode != (NVAPI_STEREO_SURFACECREATEMODE) -1) {
+		LockResourceCreationMode();
 		Profiling::NvAPI_Stereo_GetSurfaceCreationMode(mStereoHandle, oldMode);
 		NvAPIOverride();
 		LogInfo("    setting custom surface creation mode %d\n", newMode);
 
 		if (NVAPI_OK != Profiling::NvAPI_Stereo_SetSurfaceCreationMode(mStereoHandle, newMode))
 			LogInfo("      call failed.\n");
+	} else {
+		LockResourceCreationModeShared();
 	}
 
 	return ret;
@@ -2165,14 +2278,11 @@ STDMETHODIMP HackerDevice::CreateBuffer(THIS_
 			// if (pDesc)
 			//	memcpy(&handle_info->descBuf, pDesc, sizeof(D3D11_BUFFER_DESC));
 
-		LeaveCriticalSection(&G->mResourcesLock);
-		EnterCriticalSectionPretty(&G->mCriticalSection);
-			// For stat collection and hash contamination tracking:
-			if (G->hunting && pDesc) {
-				G->mResourceInfo[hash] = *pDesc;
-				G->mResourceInfo[hash].initial_data_used_in_hash = !!data_hash;
-			}
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mResourcesLock);
+
+		// For stat collection and hash contamination tracking:
+		if (G->hunting && pDesc)
+			RecordResourceInfo(hash, pDesc, !!data_hash);
 	}
 	return hr;
 }
@@ -2219,15 +2329,11 @@ STDMETHODIMP HackerDevice::CreateTexture1D(THIS_
 			// TODO: For hash tracking if we ever need it for Texture1Ds:
 			// if (pDesc)
 			// 	memcpy(&handle_info->desc1D, pDesc, sizeof(D3D11_TEXTURE1D_DESC));
-		LeaveCriticalSection(&G->mResourcesLock);
-		EnterCriticalSectionPretty(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mResourcesLock);
 
-			// For stat collection and hash contamination tracking:
-			if (G->hunting && pDesc) {
-				G->mResourceInfo[hash] = *pDesc;
-				G->mResourceInfo[hash].initial_data_used_in_hash = !!data_hash;
-			}
-		LeaveCriticalSection(&G->mCriticalSection);
+		// For stat collection and hash contamination tracking:
+		if (G->hunting && pDesc)
+			RecordResourceInfo(hash, pDesc, !!data_hash);
 	}
 	return hr;
 }
@@ -2283,8 +2389,12 @@ STDMETHODIMP HackerDevice::CreateTexture2D(THIS_
 		G->mResolutionInfo.from == GetResolutionFrom::DEPTH_STENCIL &&
 		heuristic_could_be_possible_resolution(pDesc->Width, pDesc->Height))
 	{
-		G->mResolutionInfo.width = pDesc->Width;
-		G->mResolutionInfo.height = pDesc->Height;
+		if (G->mResolutionInfo.width != (int)pDesc->Width ||
+		    G->mResolutionInfo.height != (int)pDesc->Height) {
+			G->mResolutionInfo.width = pDesc->Width;
+			G->mResolutionInfo.height = pDesc->Height;
+			ClearTextureOverrideDecisionCache();
+		}
 		LogInfo("Got resolution from depth/stencil buffer: %ix%i\n",
 			G->mResolutionInfo.width, G->mResolutionInfo.height);
 	}
@@ -2332,13 +2442,9 @@ STDMETHODIMP HackerDevice::CreateTexture2D(THIS_
 			handle_info->data_hash = data_hash;
 			if (pDesc)
 				memcpy(&handle_info->desc2D, pDesc, sizeof(D3D11_TEXTURE2D_DESC));
-		LeaveCriticalSection(&G->mResourcesLock);
-		EnterCriticalSectionPretty(&G->mCriticalSection);
-			if (G->hunting && pDesc) {
-				G->mResourceInfo[hash] = *pDesc;
-				G->mResourceInfo[hash].initial_data_used_in_hash = !!data_hash;
-			}
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mResourcesLock);
+		if (G->hunting && pDesc)
+			RecordResourceInfo(hash, pDesc, !!data_hash);
 	}
 
 	return hr;
@@ -2369,8 +2475,12 @@ STDMETHODIMP HackerDevice::CreateTexture3D(THIS_
 	if (pDesc && (pDesc->BindFlags & D3D11_BIND_DEPTH_STENCIL) &&
 		G->mResolutionInfo.from == GetResolutionFrom::DEPTH_STENCIL &&
 		heuristic_could_be_possible_resolution(pDesc->Width, pDesc->Height)) {
-		G->mResolutionInfo.width = pDesc->Width;
-		G->mResolutionInfo.height = pDesc->Height;
+		if (G->mResolutionInfo.width != (int)pDesc->Width ||
+		    G->mResolutionInfo.height != (int)pDesc->Height) {
+			G->mResolutionInfo.width = pDesc->Width;
+			G->mResolutionInfo.height = pDesc->Height;
+			ClearTextureOverrideDecisionCache();
+		}
 		LogInfo("Got resolution from depth/stencil buffer: %ix%i\n",
 			G->mResolutionInfo.width, G->mResolutionInfo.height);
 	}
@@ -2402,13 +2512,9 @@ STDMETHODIMP HackerDevice::CreateTexture3D(THIS_
 			handle_info->data_hash = data_hash;
 			if (pDesc)
 				memcpy(&handle_info->desc3D, pDesc, sizeof(D3D11_TEXTURE3D_DESC));
-		LeaveCriticalSection(&G->mResourcesLock);
-		EnterCriticalSectionPretty(&G->mCriticalSection);
-			if (G->hunting && pDesc) {
-				G->mResourceInfo[hash] = *pDesc;
-				G->mResourceInfo[hash].initial_data_used_in_hash = !!data_hash;
-			}
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mResourcesLock);
+		if (G->hunting && pDesc)
+			RecordResourceInfo(hash, pDesc, !!data_hash);
 	}
 
 	LogInfo("  returns result = %x\n", hr);
@@ -2439,7 +2545,7 @@ STDMETHODIMP HackerDevice::CreateShaderResourceView(THIS_
 
 			mZBufferResourceView = *ppSRView;
 		}
-		LeaveCriticalSection(&G->mResourcesLock);
+		LeaveCriticalSectionPretty(&G->mResourcesLock);
 	}
 
 	LogDebug("  returns result = %x\n", hr);
@@ -2583,7 +2689,7 @@ STDMETHODIMP HackerDevice::CreateShader(THIS_
 		EnterCriticalSectionPretty(&G->mCriticalSection);
 			G->mShaders[*ppShader] = hash;
 			LogDebugW(L"    %ls: handle = %p, hash = %016I64x\n", shaderType, *ppShader, hash);
-		LeaveCriticalSection(&G->mCriticalSection);
+		LeaveCriticalSectionPretty(&G->mCriticalSection);
 	}
 
 	LogInfo("  returns result = %x, handle = %p\n", hr, *ppShader);
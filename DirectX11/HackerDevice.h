@@ -505,3 +505,4 @@ public:
 };
 
 HackerDevice* lookup_hacker_device(IUnknown *unknown);
+void ClearTextureOverrideDecisionCache();
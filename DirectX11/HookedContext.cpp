@@ -80,10 +80,10 @@ ID3D11DeviceContext1* lookup_hooked_context(ID3D11DeviceContext1 *orig_context)
 	EnterCriticalSectionPretty(&context_map_lock);
 	i = context_map.find(orig_context);
 	if (i == context_map.end()) {
-		LeaveCriticalSection(&context_map_lock);
+		LeaveCriticalSectionPretty(&context_map_lock);
 		return NULL;
 	}
-	LeaveCriticalSection(&context_map_lock);
+	LeaveCriticalSectionPretty(&context_map_lock);
 
 	return i->second;
 }
@@ -130,7 +130,7 @@ static ULONG STDMETHODCALLTYPE Release(ID3D11DeviceContext1 *This)
 	} else
 		ref = orig_vtable.Release(This);
 
-	LeaveCriticalSection(&context_map_lock);
+	LeaveCriticalSectionPretty(&context_map_lock);
 
 	return ref;
 }
@@ -3544,7 +3544,7 @@ ID3D11DeviceContext1* hook_context(ID3D11DeviceContext1 *orig_context, ID3D11Dev
 	install_hooks(orig_context);
 	EnterCriticalSectionPretty(&context_map_lock);
 	context_map[orig_context] = hacker_context;
-	LeaveCriticalSection(&context_map_lock);
+	LeaveCriticalSectionPretty(&context_map_lock);
 
 	return (ID3D11DeviceContext1*)trampoline_context;
 }
@@ -389,6 +389,7 @@ void override_swap_chain(DXGI_SWAP_CHAIN_DESC *pDesc, DXGI_SWAP_CHAIN_DESC *orig
 		G->mResolutionInfo.height = pDesc->BufferDesc.Height;
 		LogInfo("Got resolution from swap chain: %ix%i\n",
 			G->mResolutionInfo.width, G->mResolutionInfo.height);
+		ClearTextureOverrideDecisionCache();
 	}
 
 	ForceDisplayParams(pDesc);
@@ -75,10 +75,10 @@ ID3D11Device1* lookup_hooked_device(ID3D11Device1 *orig_device)
 	EnterCriticalSectionPretty(&device_map_lock);
 	i = device_map.find(orig_device);
 	if (i == device_map.end()) {
-		LeaveCriticalSection(&device_map_lock);
+		LeaveCriticalSectionPretty(&device_map_lock);
 		return NULL;
 	}
-	LeaveCriticalSection(&device_map_lock);
+	LeaveCriticalSectionPretty(&device_map_lock);
 
 	return i->second;
 }
@@ -131,7 +131,7 @@ static ULONG STDMETHODCALLTYPE Release(
 	} else
 		ref = orig_vtable.Release(This);
 
-	LeaveCriticalSection(&device_map_lock);
+	LeaveCriticalSectionPretty(&device_map_lock);
 
 	return ref;
 }
@@ -1527,7 +1527,7 @@ ID3D11Device1* hook_device(ID3D11Device1 *orig_device, ID3D11Device1 *hacker_dev
 	install_hooks(orig_device);
 	EnterCriticalSectionPretty(&device_map_lock);
 	device_map[orig_device] = hacker_device;
-	LeaveCriticalSection(&device_map_lock);
+	LeaveCriticalSectionPretty(&device_map_lock);
 
 	return (ID3D11Device1*)trampoline_device;
 }
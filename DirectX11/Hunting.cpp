@@ -9,6 +9,7 @@
 #include "wincodec.h"
 
 #include "D3D11Wrapper.h"
+#include "ShaderPipeline.h"
 #include "util.h"
 #include "DecompileHLSL.h"
 #include "Input.h"
@@ -149,99 +150,41 @@ static void DumpUsageResourceInfo(HANDLE f, std::set<uint32_t> *hashes, char *ta
 	}
 }
 
-static void DumpUsageRegister(HANDLE f, char *tag, int id, const ResourceSnapshot &info)
+// Writes ShaderUsage.bin, from which the ShaderUsageReport tool can render the
+// shader sections of ShaderUsage.txt offline. Caller must hold mHuntingLock.
+static void DumpShaderUsageCapture(wchar_t *path, ShaderInfoMap *const info[(int)ShaderUsageStage::COUNT],
+		const std::set<uint32_t> &hash_contaminated)
 {
-	char buf[256];
-	DWORD written;
-
-	sprintf(buf, "  <%s", tag);
-	WriteFile(f, buf, castStrLen(buf), &written, 0);
-
-	if (id != -1) {
-		sprintf(buf, " id=%d", id);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
-	}
+	FILE *fd;
 
-	sprintf(buf, " handle=%p", info.handle);
-	WriteFile(f, buf, castStrLen(buf), &written, 0);
-
-	if (info.orig_hash != info.hash) {
-		sprintf(buf, " orig_hash=%08lx", info.orig_hash);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
+	if (wfopen_ensuring_access(&fd, path, L"wb")) {
+		LogInfo("Error dumping ShaderUsage.bin\n");
+		return;
 	}
 
-	try {
-		if (G->mResourceInfo.at(info.orig_hash).hash_contaminated) {
-			sprintf(buf, " hash_contaminated=true");
-			WriteFile(f, buf, castStrLen(buf), &written, 0);
-		}
-	} catch (std::out_of_range) {
-	}
+	if (!WriteShaderUsageCapture(fd, info, hash_contaminated))
+		LogInfo("Error writing ShaderUsage.bin\n");
 
-	sprintf(buf, ">%08lx</%s>\n", info.hash, tag);
-	WriteFile(f, buf, castStrLen(buf), &written, 0);
+	fclose(fd);
 }
 
-static void DumpShaderUsageInfo(HANDLE f, std::map<UINT64, ShaderInfoData> *info_map, char *tag)
-{
-	std::map<UINT64, ShaderInfoData>::iterator i;
-	std::set<UINT64>::iterator j;
-	std::map<int, std::set<ResourceSnapshot>>::const_iterator k;
-	std::set<ResourceSnapshot>::const_iterator o;
-	std::vector<std::set<ResourceSnapshot>>::iterator m;
-	std::set<ResourceSnapshot>::iterator n;
-	char buf[256];
-	DWORD written;
-	int pos;
-
-	for (i = info_map->begin(); i != info_map->end(); ++i) {
-		sprintf(buf, "<%s hash=\"%016llx\">\n", tag, i->first);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
-
-		// Does not apply to compute shaders:
-		if (!i->second.PeerShaders.empty()) {
-			const char *PEER_HEADER = "  <PeerShaders>";
-			WriteFile(f, PEER_HEADER, castStrLen(PEER_HEADER), &written, 0);
-
-			for (j = i->second.PeerShaders.begin(); j != i->second.PeerShaders.end(); ++j) {
-				sprintf(buf, "%016llx ", *j);
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
-			}
-			const char *REG_HEADER = "</PeerShaders>\n";
-			WriteFile(f, REG_HEADER, castStrLen(REG_HEADER), &written, 0);
-		}
-
-		for (k = i->second.ResourceRegisters.begin(); k != i->second.ResourceRegisters.end(); ++k) {
-			for (o = k->second.begin(); o != k->second.end(); o++)
-				DumpUsageRegister(f, "Register", k->first, *o);
-		}
-
-		// Only applies to pixel shaders:
-		for (m = i->second.RenderTargets.begin(), pos = 0; m != i->second.RenderTargets.end(); m++, pos++) {
-			for (o = (*m).begin(); o != (*m).end(); o++)
-				DumpUsageRegister(f, "RenderTarget", pos, *o);
-		}
-
-		// Only applies to pixel shaders:
-		for (n = i->second.DepthTargets.begin(); n != i->second.DepthTargets.end(); n++) {
-			DumpUsageRegister(f, "DepthTarget", -1, *n);
-		}
-
-		// Applies to pixel and compute shaders:
-		for (k = i->second.UAVs.begin(); k != i->second.UAVs.end(); ++k) {
-			for (o = k->second.begin(); o != k->second.end(); o++)
-				DumpUsageRegister(f, "UAV", k->first, *o);
-		}
-
-		sprintf(buf, "</%s>\n", tag);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
-	}
-}
-
-// Expects the caller to have entered the critical section.
+// Takes the hunting and resource info locks, so callers may hold the config
+// lock, but must not hold mResourcesLock.
 void DumpUsage(wchar_t *dir)
 {
-	wchar_t path[MAX_PATH];
+	wchar_t path[MAX_PATH], capture_path[MAX_PATH];
+	ShaderInfoMap *info[(int)ShaderUsageStage::COUNT] = {
+		&G->mVertexShaderInfo,
+		&G->mHullShaderInfo,
+		&G->mDomainShaderInfo,
+		&G->mGeometryShaderInfo,
+		&G->mPixelShaderInfo,
+		&G->mComputeShaderInfo,
+	};
+	std::set<uint32_t> hash_contaminated;
+	std::string shader_usage;
+	DWORD written;
+	int stage;
 	if (dir) {
 		wcscpy(path, dir);
 		wcscat(path, L"\\");
@@ -250,25 +193,42 @@ void DumpUsage(wchar_t *dir)
 			return;
 		wcsrchr(path, L'\\')[1] = 0;
 	}
+	wcscpy_s(capture_path, MAX_PATH, path);
 	wcscat(path, L"ShaderUsage.txt");
+	wcscat(capture_path, L"ShaderUsage.bin");
+
+	DrainResourceInfo();
+
 	HANDLE f = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (f == INVALID_HANDLE_VALUE) {
 		LogInfo("Error dumping ShaderUsage.txt\n");
 		return;
 	}
 
-	DumpShaderUsageInfo(f, &G->mVertexShaderInfo, "VertexShader");
-	DumpShaderUsageInfo(f, &G->mHullShaderInfo, "HullShader");
-	DumpShaderUsageInfo(f, &G->mDomainShaderInfo, "DomainShader");
-	DumpShaderUsageInfo(f, &G->mGeometryShaderInfo, "GeometryShader");
-	DumpShaderUsageInfo(f, &G->mPixelShaderInfo, "PixelShader");
-	DumpShaderUsageInfo(f, &G->mComputeShaderInfo, "ComputeShader");
+	EnterCriticalSectionPretty(&G->mHuntingLock);
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
+
+	for (auto &i : G->mResourceInfo) {
+		if (i.second.hash_contaminated)
+			hash_contaminated.insert(i.first);
+	}
+
+	for (stage = 0; stage < (int)ShaderUsageStage::COUNT; stage++)
+		FormatShaderUsageInfo(&shader_usage, *info[stage], ShaderUsageStageTags[stage], hash_contaminated);
+	WriteFile(f, shader_usage.data(), (DWORD)shader_usage.size(), &written, 0);
 
 	DumpUsageResourceInfo(f, &G->mRenderTargetInfo, "RenderTarget");
 	DumpUsageResourceInfo(f, &G->mDepthTargetInfo, "DepthTarget");
 	DumpUsageResourceInfo(f, &G->mUnorderedAccessInfo, "UAV");
 	DumpUsageResourceInfo(f, &G->mShaderResourceInfo, "Register");
 	DumpUsageResourceInfo(f, &G->mCopiedResourceInfo, "CopySource");
+
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
+
+	DumpShaderUsageCapture(capture_path, info, hash_contaminated);
+
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
+
 	CloseHandle(f);
 }
 
@@ -296,7 +256,7 @@ static void SimpleScreenShot(HackerDevice *pDevice, HashType hash, char *shaderT
 	if (FAILED(hr))
 		LogInfo("*** Overlay call CoInitializeEx failed: %d\n", hr);
 
-	hr = mHackerSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*)&backBuffer);
+	hr = mHackerSwapChain->GetPresentedBuffer(__uuidof(ID3D11Texture2D), (LPVOID*)&backBuffer);
 	if (SUCCEEDED(hr))
 	{
 		swprintf_s(fullName, MAX_PATH, L"%ls\\%0*llx-%S.jpg", G->SHADER_PATH, hash_len, (UINT64)hash, shaderType);
@@ -343,7 +303,7 @@ static void StereoScreenShot(HackerDevice *pDevice, HashType hash, char *shaderT
 		return;
 	}
 
-	hr = mHackerSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&backBuffer);
+	hr = mHackerSwapChain->GetPresentedBuffer(__uuidof(ID3D11Texture2D), (void**)&backBuffer);
 	if (FAILED(hr))
 		return;
 
@@ -419,33 +379,6 @@ static void MarkingScreenShots(HackerDevice *device, HashType hash, char *short_
 
 //--------------------------------------------------------------------------------------------------
 
-// This is pretty heavyweight obviously, so it is only being done during Mark operations.
-// Todo: another copy/paste job, we really need some subroutines, utility library.
-
-static string Decompile(ID3DBlob *pShaderByteCode, string *asmText)
-{
-	LogInfo("    creating HLSL representation.\n");
-
-	bool patched = false;
-	string shaderModel;
-	bool errorOccurred = false;
-
-	ParseParameters p;
-	p.bytecode = pShaderByteCode->GetBufferPointer();
-	p.decompiled = asmText->c_str();
-	p.decompiledSize = asmText->size();
-	p.ZeroOutput = false;
-	p.G = &G->decompiler_settings;
-	const string decompiledCode = DecompileBinaryHLSL(p, patched, shaderModel, errorOccurred);
-
-	if (!decompiledCode.size())
-	{
-		LogInfo("    error while decompiling.\n");
-	}
-
-	return decompiledCode;
-}
-
 ///////////////////////////////////////////////////////////////////////////////
 // Custom #include handler used to track which shaders need to be reloaded
 // after an included file is modified. Doco for the ID3DInclude interface:
@@ -454,12 +387,26 @@ static string Decompile(ID3DBlob *pShaderByteCode, string *asmText)
 //   https://docs.microsoft.com/en-us/windows/desktop/direct3d11/d3d11-graphics-programming-guide-effects-compile#searching-for-include-files
 //   https://docs.microsoft.com/en-us/windows/desktop/api/d3dcompiler/nf-d3dcompiler-d3dcompile
 
-MigotoIncludeHandler::MigotoIncludeHandler(const char *path)
+MigotoIncludeHandler::MigotoIncludeHandler(const char *path, DeferredLog *log) :
+	log(log)
 {
-	LogDebug("      MigotoIncludeHandler %p for \"%s\"\n", this, path);
+	if (gLogDebug)
+		log_info("      MigotoIncludeHandler %p for \"%s\"\n", this, path);
 	push_dir(path);
 }
 
+void MigotoIncludeHandler::log_info(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (log)
+		log->vLog(-1, fmt, ap);
+	else
+		vLogInfo(fmt, ap);
+	va_end(ap);
+}
+
 // This tracks any directories mentioned when including files, so that files in
 // those directories can include other files relative to themselves rather than
 // having to specify the include path relative to the initial source file.
@@ -494,7 +441,8 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 	wstring wpath;
 	HANDLE f;
 
-	LogDebug("      MigotoIncludeHandler::Open(%p, %u, %s, %p)\n", this, IncludeType, pFileName, pParentData);
+	if (gLogDebug)
+		log_info("      MigotoIncludeHandler::Open(%p, %u, %s, %p)\n", this, IncludeType, pFileName, pParentData);
 
 	// For backwards compatibility with D3D_COMPILE_STANDARD_FILE_INCLUDE
 	// we only search for shaders relative to the *initial* source file by
@@ -534,7 +482,7 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 		f = CreateFile(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	}
 	if (f == INVALID_HANDLE_VALUE) {
-		LogInfo("      Error opening included file: %s\n", apath.c_str());
+		log_info("      Error opening included file: %s\n", apath.c_str());
 		return E_FAIL;
 	}
 
@@ -544,11 +492,11 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 	// #include <3dmigoto.h>
 	switch (IncludeType) {
 		case D3D_INCLUDE_LOCAL:
-			LogInfo("      #include \"%s\"\n", apath.c_str());
+			log_info("      #include \"%s\"\n", apath.c_str());
 			break;
 		case D3D_INCLUDE_SYSTEM:
 		default:
-			LogInfo("      #include <%s>\n", apath.c_str());
+			log_info("      #include <%s>\n", apath.c_str());
 			break;
 	}
 
@@ -556,7 +504,7 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 	buf = new char[size];
 
 	if (!ReadFile(f, buf, size, &read, 0) || size != read) {
-		LogInfo("      Error reading included file.\n");
+		log_info("      Error reading included file.\n");
 		goto err_free;
 	}
 	CloseHandle(f);
@@ -564,7 +512,8 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 	*pBytes = size;
 	*ppData = buf;
 	push_dir(apath.c_str());
-	LogDebug("       -> %p\n", buf);
+	if (gLogDebug)
+		log_info("       -> %p\n", buf);
 
 	return S_OK;
 
@@ -576,7 +525,8 @@ err_free:
 
 STDMETHODIMP MigotoIncludeHandler::Close(LPCVOID pData)
 {
-	LogDebug("      MigotoIncludeHandler::Close(%p, %p)\n", this, pData);
+	if (gLogDebug)
+		log_info("      MigotoIncludeHandler::Close(%p, %p)\n", this, pData);
 	delete [] pData;
 	dir_stack.pop_back();
 	return S_OK;
@@ -704,7 +654,8 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 		{
 			// Treat parse errors on shader reload as fatal since there should
 			// be a shaderhacker at the keyboard ready to fix their bugs.
-			byteCode = AssembleFluganWithOptionalSignatureParsing(&srcData, G->assemble_signature_comments, &byteCode);
+			byteCode = AssembleFluganWithOptionalSignatureParsing(&srcData, G->assemble_signature_comments, &byteCode,
+					NULL, &get_tls()->assembler_ctx);
 		}
 		catch (const exception &e)
 		{
@@ -918,7 +869,7 @@ static bool ReloadShader(wchar_t *shaderPath, wchar_t *fileName, HackerDevice *d
 	}	// for every registered shader in mReloadedShaders 
 
 out:
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 
 	return rc;
 err:
@@ -991,13 +942,20 @@ static bool WriteHLSL(string *asmText, string *hlslText, string *errText,
 {
 	wchar_t fileName[MAX_PATH];
 	wchar_t fullName[MAX_PATH];
+	DecompiledShader decompiled;
 	FILE *fw;
 	bool ret;
 
-	// Try to decompile the current byte code into HLSL:
-	*hlslText = Decompile(shader_info.byteCode, asmText);
-	if (hlslText->empty())
+	// Try to decompile the current byte code into HLSL. If the shader
+	// was already decompiled at load (export_hlsl) or by an earlier mark
+	// with the same decompiler settings this reuses that result:
+	CachedDecompileBinaryHLSL(hash, shader_info.byteCode->GetBufferPointer(),
+			shader_info.byteCode->GetBufferSize(), asmText, &decompiled);
+	*hlslText = decompiled.hlsl;
+	if (hlslText->empty()) {
+		LogInfo("    error while decompiling.\n");
 		return false;
+	}
 
 	// We no longer check if the file exists and touch it at this point -
 	// this has been moved to the earlier shader_already_dumped() routine,
@@ -1116,7 +1074,7 @@ static void CopyToFixes(UINT64 hash, HackerDevice *device)
 				// RDEF making it not all that useful to look at. Instead we will disassemble the
 				// original shader now (with RDEF assuming the game didn't strip that), run
 				// ShaderRegex and output that.
-				asmText = BinaryToAsmText(iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize(), G->patch_cb_offsets);
+				asmText = CachedBinaryToAsmText(hash, iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize(), G->patch_cb_offsets);
 				if (asmText.empty())
 					break;
 				wstring tagline(L"// MANUALLY DUMPED ");
@@ -1134,12 +1092,6 @@ static void CopyToFixes(UINT64 hash, HackerDevice *device)
 			}
 
 			if (G->marking_actions & MarkingAction::HLSL) {
-				// TODO: Allow the decompiler to parse the patched CB offsets
-				// and move this line back to the common code path:
-				asmText = BinaryToAsmText(iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize(), false);
-				if (asmText.empty())
-					break;
-
 				// Save the decompiled text, and ASM text into the HLSL .txt source file:
 				success = WriteHLSL(&asmText, &hlslText, &errText, hash, iter.second, device, asm_enabled);
 				if (success)
@@ -1149,7 +1101,7 @@ static void CopyToFixes(UINT64 hash, HackerDevice *device)
 			}
 
 			if (asm_enabled) {
-				asmText = BinaryToAsmText(iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize(), G->patch_cb_offsets);
+				asmText = CachedBinaryToAsmText(hash, iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize(), G->patch_cb_offsets);
 				if (asmText.empty())
 					break;
 
@@ -1317,14 +1269,14 @@ static void EnableFix(HackerDevice *device, void *private_data)
 	G->fix_enabled = true;
 }
 
-static void _AnalyseFrameStop()
+static void _AnalyseFrameStop(HackerDevice *device)
 {
+	// Complete any readbacks still in flight before we call it done:
+	device->GetHackerContext()->FrameAnalysisFlush();
+
 	G->analyse_frame = false;
-	if (G->DumpUsage) {
-		EnterCriticalSectionPretty(&G->mCriticalSection);
-			DumpUsage(G->ANALYSIS_PATH);
-		LeaveCriticalSection(&G->mCriticalSection);
-	}
+	if (G->DumpUsage)
+		DumpUsage(G->ANALYSIS_PATH);
 	LogOverlay(LOG_INFO, "Frame analysis saved to %S\n", G->ANALYSIS_PATH);
 }
 
@@ -1346,7 +1298,7 @@ static void AnalyseFrame(HackerDevice *device, void *private_data)
 		// already in progress, abort:
 		device->GetHackerContext()->FrameAnalysisLog("----- Frame analysis aborted -----\n");
 		LogOverlay(LOG_NOTICE, "Frame analysis aborted\n");
-		return _AnalyseFrameStop();
+		return _AnalyseFrameStop(device);
 	}
 
 	if (G->hunting != HUNTING_MODE_ENABLED)
@@ -1375,6 +1327,9 @@ static void AnalyseFrame(HackerDevice *device, void *private_data)
 
 	G->cur_analyse_options = G->def_analyse_options;
 	G->frame_analysis_seen_rts.clear();
+	// Forget anything dumped in a previous session, since the deduped
+	// files it refers to are in that session's directory:
+	MarkAllResourcesWritten();
 	G->analyse_frame_no = 1;
 	G->analyse_frame = true;
 }
@@ -1393,7 +1348,7 @@ static void AnalyseFrameStop(HackerDevice *device, void *private_data)
 		// right at a glance.
 		LogOverlay(LOG_NOTICE, "Frame analysis hold mode ended after %i complete frames\n",
 				G->analyse_frame_no - 1);
-		_AnalyseFrameStop();
+		_AnalyseFrameStop(device);
 	}
 }
 
@@ -1458,7 +1413,7 @@ static void HuntNext(char *type, std::set<ItemType> *visited,
 	if (G->hunting != HUNTING_MODE_ENABLED)
 		return;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	{
 		std::set<ItemType>::iterator loc = visited->find(*selected);
 		std::set<ItemType>::iterator end = visited->end();
@@ -1487,44 +1442,44 @@ static void HuntNext(char *type, std::set<ItemType> *visited,
 		}
 	}
 out:
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 
 static void NextVertexBuffer(HackerDevice *device, void *private_data)
 {
 	HuntNext<uint32_t>("vertex buffer", &G->mVisitedVertexBuffers, &G->mSelectedVertexBuffer, &G->mSelectedVertexBufferPos);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	G->mSelectedVertexBuffer_PixelShader.clear();
 	G->mSelectedVertexBuffer_VertexShader.clear();
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 static void NextIndexBuffer(HackerDevice *device, void *private_data)
 {
 	HuntNext<uint32_t>("index buffer", &G->mVisitedIndexBuffers, &G->mSelectedIndexBuffer, &G->mSelectedIndexBufferPos);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	G->mSelectedIndexBuffer_PixelShader.clear();
 	G->mSelectedIndexBuffer_VertexShader.clear();
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 static void NextPixelShader(HackerDevice *device, void *private_data)
 {
 	HuntNext<UINT64>("pixel shader", &G->mVisitedPixelShaders, &G->mSelectedPixelShader, &G->mSelectedPixelShaderPos);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	G->mSelectedPixelShader_VertexBuffer.clear();
 	G->mSelectedPixelShader_IndexBuffer.clear();
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 static void NextVertexShader(HackerDevice *device, void *private_data)
 {
 	HuntNext<UINT64>("vertex shader", &G->mVisitedVertexShaders, &G->mSelectedVertexShader, &G->mSelectedVertexShaderPos);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	G->mSelectedVertexShader_VertexBuffer.clear();
 	G->mSelectedVertexShader_IndexBuffer.clear();
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 static void NextComputeShader(HackerDevice *device, void *private_data)
 {
@@ -1554,7 +1509,7 @@ static void HuntPrev(char *type, std::set<ItemType> *visited,
 	if (G->hunting != HUNTING_MODE_ENABLED)
 		return;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	{
 		std::set<ItemType>::iterator loc = visited->find(*selected);
 		std::set<ItemType>::iterator end = visited->end();
@@ -1584,44 +1539,44 @@ static void HuntPrev(char *type, std::set<ItemType> *visited,
 		}
 	}
 out:
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 
 static void PrevVertexBuffer(HackerDevice *device, void *private_data)
 {
 	HuntPrev<uint32_t>("vertex buffer", &G->mVisitedVertexBuffers, &G->mSelectedVertexBuffer, &G->mSelectedVertexBufferPos);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	G->mSelectedVertexBuffer_PixelShader.clear();
 	G->mSelectedVertexBuffer_VertexShader.clear();
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 static void PrevIndexBuffer(HackerDevice *device, void *private_data)
 {
 	HuntPrev<uint32_t>("index buffer", &G->mVisitedIndexBuffers, &G->mSelectedIndexBuffer, &G->mSelectedIndexBufferPos);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	G->mSelectedIndexBuffer_PixelShader.clear();
 	G->mSelectedIndexBuffer_VertexShader.clear();
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 static void PrevPixelShader(HackerDevice *device, void *private_data)
 {
 	HuntPrev<UINT64>("pixel shader", &G->mVisitedPixelShaders, &G->mSelectedPixelShader, &G->mSelectedPixelShaderPos);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	G->mSelectedPixelShader_VertexBuffer.clear();
 	G->mSelectedPixelShader_IndexBuffer.clear();
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 static void PrevVertexShader(HackerDevice *device, void *private_data)
 {
 	HuntPrev<UINT64>("vertex shader", &G->mVisitedVertexShaders, &G->mSelectedVertexShader, &G->mSelectedVertexShaderPos);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 	G->mSelectedVertexShader_VertexBuffer.clear();
 	G->mSelectedVertexShader_IndexBuffer.clear();
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 static void PrevComputeShader(HackerDevice *device, void *private_data)
 {
@@ -1686,7 +1641,7 @@ static void MarkVertexBuffer(HackerDevice *device, void *private_data)
 	if (G->hunting != HUNTING_MODE_ENABLED)
 		return;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 
 	if (G->marking_actions & MarkingAction::CLIPBOARD)
 		HashToClipboard("vertex buffer", G->mSelectedVertexBuffer);
@@ -1702,7 +1657,7 @@ static void MarkVertexBuffer(HackerDevice *device, void *private_data)
 	if (G->DumpUsage)
 		DumpUsage(NULL);
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 
 static void MarkIndexBuffer(HackerDevice *device, void *private_data)
@@ -1710,7 +1665,7 @@ static void MarkIndexBuffer(HackerDevice *device, void *private_data)
 	if (G->hunting != HUNTING_MODE_ENABLED)
 		return;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 
 	if (G->marking_actions & MarkingAction::CLIPBOARD)
 		HashToClipboard("index buffer", G->mSelectedIndexBuffer);
@@ -1726,7 +1681,7 @@ static void MarkIndexBuffer(HackerDevice *device, void *private_data)
 	if (G->DumpUsage)
 		DumpUsage(NULL);
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 
 static bool MarkShaderBegin(char *type, UINT64 selected)
@@ -1734,7 +1689,10 @@ static bool MarkShaderBegin(char *type, UINT64 selected)
 	if (G->hunting != HUNTING_MODE_ENABLED)
 		return false;
 
+	// Copying the shader to ShaderFixes needs the shader tables, while
+	// the rest of the marking process needs the hunting stats:
 	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 
 	LogInfo(">>>> %s marked: %s hash = %016I64x\n", type, type, selected);
 
@@ -1766,7 +1724,8 @@ static void MarkShaderEnd(HackerDevice *device, char *long_type, char *short_typ
 	if (G->DumpUsage)
 		DumpUsage(NULL);
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 }
 
 static void MarkPixelShader(HackerDevice *device, void *private_data)
@@ -1841,7 +1800,9 @@ static void MarkHullShader(HackerDevice *device, void *private_data)
 
 static uint32_t LogRenderTarget(ID3D11Resource *target, char *log_prefix)
 {
-	char buf[256];
+	char buf[256] = "";
+	uint32_t hash, orig_hash;
+	ResourceInfoMap::iterator info;
 
 	if (!target || target == (ID3D11Resource *)-1)
 	{
@@ -1849,12 +1810,19 @@ static uint32_t LogRenderTarget(ID3D11Resource *target, char *log_prefix)
 		return 0;
 	}
 
-	EnterCriticalSectionPretty(&G->mResourcesLock);
-	uint32_t hash = G->mResources[target].hash;
-	uint32_t orig_hash = G->mResources[target].orig_hash;
-	LeaveCriticalSection(&G->mResourcesLock);
-	struct ResourceHashInfo &info = G->mResourceInfo[orig_hash];
-	StrResourceDesc(buf, 256, info);
+	DrainResourceInfo();
+
+	// The current hash may be updated by hash tracking on another thread,
+	// so this must go through mResourceInfoLock, which GetResourceHash()
+	// takes. Neither lookup adds the target to mResources if it has gone:
+	hash = GetResourceHash(target);
+	orig_hash = GetOrigResourceHash(target);
+
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
+	info = G->mResourceInfo.find(orig_hash);
+	if (info != G->mResourceInfo.end())
+		StrResourceDesc(buf, 256, info->second);
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
 	LogInfo("%srender target handle = %p, hash = %08lx, orig_hash = %08lx, %s\n",
 		log_prefix, target, hash, orig_hash, buf);
 
@@ -1868,7 +1836,7 @@ static void MarkRenderTarget(HackerDevice *device, void *private_data)
 	if (G->hunting != HUNTING_MODE_ENABLED)
 		return;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 
 	hash = LogRenderTarget(G->mSelectedRenderTarget, ">>>> Render target marked: ");
 	for (std::set<ID3D11Resource *>::iterator i = G->mSelectedRenderTargetSnapshotList.begin(); i != G->mSelectedRenderTargetSnapshotList.end(); ++i)
@@ -1882,7 +1850,7 @@ static void MarkRenderTarget(HackerDevice *device, void *private_data)
 
 	MarkingScreenShots(device, hash, "rt");
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 
 
@@ -1911,7 +1879,7 @@ static void TuneDown(HackerDevice *device, void *private_data)
 
 // Start with a fresh set of shaders in the scene - either called explicitly
 // via keypress, or after no hunting for 1 minute (see comment in RunFrameActions)
-// Caller must have taken G->mCriticalSection (if enabled)
+// Caller must have taken G->mHuntingLock
 void TimeoutHuntingBuffers()
 {
 	G->mVisitedVertexBuffers.clear();
@@ -1931,7 +1899,7 @@ static void DoneHunting(HackerDevice *device, void *private_data)
 	if (G->hunting != HUNTING_MODE_ENABLED)
 		return;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mHuntingLock);
 
 	TimeoutHuntingBuffers();
 
@@ -1965,7 +1933,7 @@ static void DoneHunting(HackerDevice *device, void *private_data)
 	G->mSelectedVertexBuffer_VertexShader.clear();
 	G->mSelectedIndexBuffer_VertexShader.clear();
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mHuntingLock);
 }
 
 static void ToggleHunting(HackerDevice *device, void *private_data)
@@ -1974,6 +1942,7 @@ static void ToggleHunting(HackerDevice *device, void *private_data)
 		G->hunting = HUNTING_MODE_SOFT_DISABLED;
 	else
 		G->hunting = HUNTING_MODE_ENABLED;
+	InterlockedIncrement(&G->draw_processing_epoch);
 	LogInfo("> Hunting toggled to %d\n", G->hunting);
 }
 
@@ -1982,6 +1951,7 @@ void ParseHuntingSection()
 	intptr_t i;
 	wchar_t buf[MAX_PATH];
 	int repeat = 8, noRepeat = 0;
+	int readback_depth;
 	MarkingMode new_marking_mode;
 	static MarkingMode prev_marking_mode = MarkingMode::INVALID;
 
@@ -2090,6 +2060,15 @@ void ParseHuntingSection()
 			(FrameAnalysisOptionNames, buf, NULL);
 	} else
 		G->def_analyse_options = FrameAnalysisOptions::INVALID;
+	// Every queued readback holds a staging texture until it is dumped, so
+	// a deep queue costs video memory for little gain - the GPU will have
+	// finished the copies long before then:
+	readback_depth = GetIniInt(L"Hunting", L"analyse_readback_depth", 4, NULL);
+	if (readback_depth < 0 || readback_depth > 64) {
+		LogOverlay(LOG_WARNING, "WARNING: analyse_readback_depth=%i out of range\n", readback_depth);
+		readback_depth = max(0, min(readback_depth, 64));
+	}
+	G->analyse_readback_depth = readback_depth;
 
 	// Quick hacks to see if DX11 features that we only have limited support for are responsible for anything important:
 	RegisterIniKeyBinding(L"Hunting", L"kill_deferred", DisableDeferred, EnableDeferred, noRepeat, NULL);
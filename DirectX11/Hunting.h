@@ -3,15 +3,20 @@
 //  It implements all the shader management based on user input via key presses from Input.
 
 #include "HackerDevice.h"
+#include "DeferredLog.h"
 
 // Custom #include handler used to track which shaders need to be reloaded after an included file is modified
 class MigotoIncludeHandler : public ID3DInclude
 {
 	std::vector<std::string> dir_stack;
+	DeferredLog *log;
 
 	void push_dir(const char *path);
+	void log_info(const char *fmt, ...);
 public:
-	MigotoIncludeHandler(const char *path);
+	// If log is set, anything logged by the handler is buffered there
+	// instead, for handlers used on a worker thread:
+	MigotoIncludeHandler(const char *path, DeferredLog *log = NULL);
 
 	STDMETHOD(Open)(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID *ppData, UINT *pBytes);
 	STDMETHOD(Close)(LPCVOID pData);
@@ -167,6 +167,18 @@ struct WStringInsensitiveLess {
 	{
 		return _wcsicmp(x.c_str(), y.c_str()) < 0;
 	}
+
+	// Allow sections to be looked up by a plain string without having to
+	// construct a temporary wstring for every lookup:
+	typedef void is_transparent;
+	bool operator() (const wstring &x, const wchar_t *y) const
+	{
+		return _wcsicmp(x.c_str(), y) < 0;
+	}
+	bool operator() (const wchar_t *x, const wstring &y) const
+	{
+		return _wcsicmp(x, y.c_str()) < 0;
+	}
 };
 
 
@@ -190,12 +202,126 @@ struct WStringInsensitiveEquality {
 	}
 };
 
-// Unsorted maps for fast case insensitive key lookups by name
-typedef std::unordered_map<wstring, wstring, WStringInsensitiveHash, WStringInsensitiveEquality> IniSectionMap;
 typedef std::unordered_set<wstring, WStringInsensitiveHash, WStringInsensitiveEquality> IniSectionSet;
 
+// Keys are interned into a case folded atom table as the ini files are
+// tokenised, so that each section can store its keys as small integers. The
+// section parsers probe for dozens of optional keys that are almost always
+// absent, and this lets them do so without allocating a wstring, hashing it
+// case insensitively and throwing std::out_of_range for every missing key.
+//
+// The table is only modified while the ini files are being tokenised - once
+// they have been read lookups are read-only and safe from any thread.
+typedef uint32_t IniKeyAtom;
+static const IniKeyAtom INVALID_INI_KEY_ATOM = 0;
+
+class IniKeyAtomTable {
+	struct Slot {
+		uint32_t hash;
+		IniKeyAtom atom;
+	};
+
+	// Open addressed with linear probing, size is a power of two:
+	std::vector<Slot> slots;
+	// Case folded key names, indexed by atom - 1:
+	std::vector<wstring> names;
+
+	static uint32_t hash(const wchar_t *key)
+	{
+		uint32_t h = 2166136261u;
+
+		// FNV-1a over the case folded key:
+		for (; *key; key++)
+			h = (h ^ (uint32_t)towlower(*key)) * 16777619u;
+		return h;
+	}
+
+	const Slot* lookup(const wchar_t *key, uint32_t h) const
+	{
+		size_t mask, i;
+
+		if (slots.empty())
+			return NULL;
+
+		mask = slots.size() - 1;
+		for (i = h & mask; slots[i].atom != INVALID_INI_KEY_ATOM; i = (i + 1) & mask) {
+			if (slots[i].hash == h && !_wcsicmp(names[slots[i].atom - 1].c_str(), key))
+				return &slots[i];
+		}
+		return &slots[i];
+	}
+
+	void grow()
+	{
+		std::vector<Slot> old;
+		size_t mask, i;
+
+		old.swap(slots);
+		slots.resize(old.empty() ? 256 : old.size() * 2, Slot{0, INVALID_INI_KEY_ATOM});
+		mask = slots.size() - 1;
+
+		for (const Slot &slot : old) {
+			if (slot.atom == INVALID_INI_KEY_ATOM)
+				continue;
+			for (i = slot.hash & mask; slots[i].atom != INVALID_INI_KEY_ATOM; i = (i + 1) & mask) {}
+			slots[i] = slot;
+		}
+	}
+
+public:
+	IniKeyAtom find(const wchar_t *key) const
+	{
+		const Slot *slot = lookup(key, hash(key));
+
+		return slot ? slot->atom : INVALID_INI_KEY_ATOM;
+	}
+
+	IniKeyAtom intern(const wstring &key)
+	{
+		uint32_t h = hash(key.c_str());
+		const Slot *slot;
+		wstring folded(key);
+
+		// Keep the load factor under 1/2 so probe sequences stay short:
+		if ((names.size() + 1) * 2 > slots.size())
+			grow();
+
+		slot = lookup(key.c_str(), h);
+		if (slot->atom != INVALID_INI_KEY_ATOM)
+			return slot->atom;
+
+		std::transform(folded.begin(), folded.end(), folded.begin(), ::towlower);
+		names.push_back(folded);
+		slots[slot - slots.data()] = Slot{h, (IniKeyAtom)names.size()};
+		return (IniKeyAtom)names.size();
+	}
+
+	void clear()
+	{
+		slots.clear();
+		names.clear();
+	}
+};
+
+static IniKeyAtomTable ini_key_atoms;
+
+// Flat per-section key lookup table, kept sorted by atom. Only the first
+// occurrence of each key is stored here to match the behaviour of
+// GetPrivateProfileString - sections that allow duplicate keys are processed
+// via the IniSectionVector instead.
+struct IniKeyVal {
+	IniKeyAtom atom;
+	wstring val;
+
+	bool operator<(IniKeyAtom other) const
+	{
+		return atom < other;
+	}
+};
+typedef std::vector<IniKeyVal> IniKeyTable;
+
 struct IniSection {
-	IniSectionMap kv_map;
+	IniKeyTable kv_map;
 	IniSectionVector kv_vec;
 
 	// Stores the ini namespace/path that this section came from. ini_path
@@ -205,6 +331,31 @@ struct IniSection {
 	// sections where the namespacing can be per-line:
 	wstring ini_namespace;
 	wstring ini_path;
+
+	const wstring* find(IniKeyAtom atom) const
+	{
+		IniKeyTable::const_iterator i;
+
+		i = std::lower_bound(kv_map.begin(), kv_map.end(), atom);
+		if (i == kv_map.end() || i->atom != atom)
+			return NULL;
+		return &i->val;
+	}
+
+	// Returns false if the key was already present and overwrite is false:
+	bool insert(IniKeyAtom atom, const wstring &val, bool overwrite)
+	{
+		IniKeyTable::iterator i;
+
+		i = std::lower_bound(kv_map.begin(), kv_map.end(), atom);
+		if (i != kv_map.end() && i->atom == atom) {
+			if (overwrite)
+				i->val = val;
+			return false;
+		}
+		kv_map.insert(i, IniKeyVal{atom, val});
+		return true;
+	}
 };
 
 // std::map is used so this is sorted for iterating over a prefix:
@@ -212,6 +363,61 @@ typedef std::map<wstring, IniSection, WStringInsensitiveLess> IniSections;
 
 IniSections ini_sections;
 
+// Bumped whenever sections are removed from ini_sections, so that any thread's
+// cached section lookup is known to be stale:
+static unsigned ini_sections_generation;
+
+static IniSection* find_ini_section(IniSections *sections, const wchar_t *section)
+{
+	IniSections::iterator i;
+
+	i = sections->find(section);
+	if (i == sections->end())
+		return NULL;
+	return &i->second;
+}
+
+// The section parsers look up many keys in the same section in a row, so each
+// thread remembers the last section it found rather than walking the tree
+// comparing long namespaced section names for every key:
+static const IniSection* find_ini_section_cached(const wchar_t *section)
+{
+	TLS *tls = get_tls();
+	const IniSections::value_type *cached;
+	IniSections::iterator i;
+
+	cached = (const IniSections::value_type*)tls->ini_section_cache;
+	if (cached && tls->ini_section_cache_generation == ini_sections_generation
+			&& !_wcsicmp(cached->first.c_str(), section))
+		return &cached->second;
+
+	i = ini_sections.find(section);
+	if (i == ini_sections.end())
+		return NULL;
+
+	tls->ini_section_cache = &*i;
+	tls->ini_section_cache_generation = ini_sections_generation;
+	return &i->second;
+}
+
+// Returns NULL if the key is not present. A key that does not appear anywhere
+// in the ini files is rejected without looking up the section at all:
+static const wstring* find_ini_key(const wchar_t *section, const wchar_t *key)
+{
+	const IniSection *entry;
+	IniKeyAtom atom;
+
+	atom = ini_key_atoms.find(key);
+	if (atom == INVALID_INI_KEY_ATOM)
+		return NULL;
+
+	entry = find_ini_section_cached(section);
+	if (!entry)
+		return NULL;
+
+	return entry->find(atom);
+}
+
 // Returns an iterator to the first element in a set that does not begin with
 // prefix in a case insensitive way. Combined with set::lower_bound, this can
 // be used to iterate over all elements in the sections set that begin with a
@@ -282,11 +488,13 @@ wstring get_namespaced_var_name_lower(const wstring var, const wstring *ini_name
 
 static bool _get_section_namespace(IniSections *custom_ini_sections, const wchar_t *section, wstring *ret)
 {
-	try {
-		*ret = custom_ini_sections->at(wstring(section)).ini_namespace;
-	} catch (std::out_of_range) {
+	IniSection *entry;
+
+	entry = find_ini_section(custom_ini_sections, section);
+	if (!entry)
 		return false;
-	}
+
+	*ret = entry->ini_namespace;
 	return (!ret->empty());
 }
 
@@ -299,11 +507,9 @@ static bool _get_section_path(IniSections *custom_ini_sections, const wchar_t *s
 {
 	IniSection *entry;
 
-	try {
-		entry = &custom_ini_sections->at(wstring(section));
-	} catch (std::out_of_range) {
+	entry = find_ini_section(custom_ini_sections, section);
+	if (!entry)
 		return false;
-	}
 
 	if (entry->ini_path.empty())
 		*ret = entry->ini_namespace;
@@ -500,6 +706,8 @@ static void ParseIniKeyValLine(wstring *wline, wstring *section,
 {
 	size_t first, last, delim;
 	wstring key, val;
+	IniSection *entry;
+	IniKeyAtom atom;
 	bool inserted;
 
 	if (section->empty() || section_vector == NULL) {
@@ -518,19 +726,18 @@ static void ParseIniKeyValLine(wstring *wline, wstring *section,
 		if (first != wline->npos)
 			val = wline->substr(first);
 
+		entry = find_ini_section(&ini_sections, section->c_str());
+		atom = ini_key_atoms.intern(key);
+
 		if (warn_duplicates == 2) {
 			// Recursively loaded config files are permitted to
 			// override values from the main d3dx.ini:
-			ini_sections.at(*section).kv_map[key] = val;
+			entry->insert(atom, val, true);
 		} else {
-			// We use "at" on the sections to access an existing
-			// section (alternatively we could use the [] operator
-			// to permit it to be created if it doesn't exist), but
-			// we use emplace within the section so that only the
-			// first item with a given key is inserted to match the
-			// behaviour of GetPrivateProfileString for duplicate
-			// keys within a single section:
-			inserted = ini_sections.at(*section).kv_map.emplace(key, val).second;
+			// Only the first item with a given key is inserted to
+			// match the behaviour of GetPrivateProfileString for
+			// duplicate keys within a single section:
+			inserted = entry->insert(atom, val, false);
 			if ((warn_duplicates == 1) && !inserted && !whitelisted_duplicate_key(section->c_str(), key.c_str())) {
 				IniWarning("WARNING: Duplicate key found in d3dx.ini: [%S] %S\n",
 						section->c_str(), key.c_str());
@@ -659,6 +866,8 @@ static void ParseNamespacedIniFile(const wchar_t *ini, const wstring *ini_namesp
 static void ParseIniFile(const wchar_t *ini)
 {
 	ini_sections.clear();
+	ini_sections_generation++;
+	ini_key_atoms.clear();
 
 	return ParseNamespacedIniFile(ini, NULL);
 }
@@ -814,23 +1023,22 @@ static void ParseIniFilesRecursive(wchar_t *migoto_path, const wstring &rel_path
 
 static bool IniHasKey(const wchar_t *section, const wchar_t *key)
 {
-	try {
-		return !!ini_sections.at(section).kv_map.count(key);
-	} catch (std::out_of_range) {
-		return false;
-	}
+	return !!find_ini_key(section, key);
 }
 
 static void _GetIniSection(IniSections *custom_ini_sections, IniSectionVector **key_vals, const wchar_t *section)
 {
 	static IniSectionVector empty_section_vector;
+	IniSection *entry;
 
-	try {
-		*key_vals = &custom_ini_sections->at(section).kv_vec;
-	} catch (std::out_of_range) {
+	entry = find_ini_section(custom_ini_sections, section);
+	if (!entry) {
 		LogDebug("WARNING: GetIniSection() called on a section not in the ini_sections map: %S\n", section);
 		*key_vals = &empty_section_vector;
+		return;
 	}
+
+	*key_vals = &entry->kv_vec;
 }
 
 void GetIniSection(IniSectionVector **key_vals, const wchar_t *section)
@@ -847,28 +1055,29 @@ void GetIniSection(IniSectionVector **key_vals, const wchar_t *section)
 int GetIniString(const wchar_t *section, const wchar_t *key, const wchar_t *def,
 		 wchar_t *ret, unsigned size)
 {
+	const wstring *val;
 	int rc;
 
-	try {
-		wstring &val = ini_sections.at(section).kv_map.at(key);
+	val = find_ini_key(section, key);
+	if (val) {
 		// Note that we now use wcsncpy_s here with _TRUNCATE rather
 		// than wcscpy_s, because it turns out the later may just kill
 		// us immediately on overflow depending on the invalid
 		// parameter handler (refer to issue #84), and this way we more
 		// closely match the behaviour of GetPrivateProfileString.
-		if (wcsncpy_s(ret, size, val.c_str(), _TRUNCATE)) {
+		if (wcsncpy_s(ret, size, val->c_str(), _TRUNCATE)) {
 			// Funky return code of GetPrivateProfileString Not
 			// sure if we depend on this - if we don't I'd like a
 			// nicer return code or to raise an exception.
 			IniWarning("WARNING: [%S] \"%S=%S\" too long\n",
-					section, key, val.c_str());
+					section, key, val->c_str());
 			rc = size - 1;
 		} else {
 			// I'd also rather not have to calculate the string
 			// length if we don't use it
 			rc = (int)wcslen(ret);
 		}
-	} catch (std::out_of_range) {
+	} else {
 		if (def) {
 			if (wcscpy_s(ret, size, def)) {
 				// If someone passed in a default value that is
@@ -894,28 +1103,24 @@ int GetIniString(const wchar_t *section, const wchar_t *key, const wchar_t *def,
 // returns wide characters would be counter-productive to that goal.
 bool GetIniString(const wchar_t *section, const wchar_t *key, const wchar_t *def, std::string *ret)
 {
-	std::wstring wret;
-	bool found = false;
+	const wstring *val;
 
 	if (!ret) {
 		LogInfo("BUG: Misuse of GetIniString()\n");
 		DoubleBeepExit();
 	}
 
-	try {
-		wret = ini_sections.at(section).kv_map.at(key);
-		found = true;
-	} catch (std::out_of_range) {
-		if (def)
-			wret = def;
-		else
-			wret = L"";
-	}
-
 	// TODO: Get rid of all the wide character strings that the old ini
 	// parsing API forced on us so we don't need this re-conversion:
-	*ret = std::string(wret.begin(), wret.end());
-	return found;
+	val = find_ini_key(section, key);
+	if (val)
+		ret->assign(val->begin(), val->end());
+	else if (def)
+		ret->assign(def, def + wcslen(def));
+	else
+		ret->clear();
+
+	return !!val;
 }
 
 // For sections that allow the same key to be used multiple times with
@@ -1285,6 +1490,7 @@ static void ParseIncludedIniFiles()
 		include_sections.clear();
 		include_sections.insert(lower, upper);
 		ini_sections.erase(lower, upper);
+		ini_sections_generation++;
 
 		for (i = include_sections.begin(); i != include_sections.end(); i++) {
 			section_id = i->first.c_str();
@@ -1384,6 +1590,7 @@ static void EnumeratePresetOverrideSections()
 	wstring preset_id;
 	IniSections::iterator lower, upper, i;
 
+	CurrentTransition.ClearScheduledPresets();
 	presetOverrides.clear();
 
 	lower = ini_sections.lower_bound(wstring(L"Preset"));
@@ -1405,10 +1612,12 @@ static void ParsePresetOverrideSections()
 {
 	PresetOverrideMap::iterator i;
 	PresetOverride *preset;
+	unsigned order = 0;
 
 	for (i = begin(presetOverrides); i != end(presetOverrides); i++) {
 		const wchar_t *id = i->first.c_str();
 		preset = &i->second;
+		preset->order = order++;
 
 		LogInfo("[%S]\n", id);
 
@@ -2307,7 +2516,7 @@ static void ParseShaderOverrideSections()
 
 		warn_deprecated_shaderoverride_options(id, override);
 	}
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 }
 
 // Oh C++, do you really not have a .split() in your standard library?
@@ -3056,7 +3265,9 @@ static void warn_if_duplicate_texture_hash(TextureOverride *override, uint32_t h
 	if (override->has_draw_context_match || override->has_match_priority)
 		return;
 
-	i = lookup_textureoverride(hash);
+	// Not using lookup_textureoverride() since the filter has not been
+	// rebuilt yet:
+	i = G->mTextureOverrideMap.find(hash);
 	if (i == G->mTextureOverrideMap.end())
 		return;
 
@@ -3094,6 +3305,7 @@ static void ParseTextureOverrideSections()
 
 	G->mTextureOverrideMap.clear();
 	G->mFuzzyTextureOverrides.clear();
+	ClearTextureOverrideDecisionCache();
 
 	lower = ini_sections.lower_bound(wstring(L"TextureOverride"));
 	upper = prefix_upper_bound(ini_sections, wstring(L"TextureOverride"));
@@ -3140,6 +3352,7 @@ static void ParseTextureOverrideSections()
 		// sort, but given this cost is only paid on launch and config
 		// reload I'd rather keep the sorting down here at the end:
 		std::sort(tolkv.second.begin(), tolkv.second.end(), TextureOverrideLess);
+		build_texture_override_draw_index(&tolkv.second);
 
 		// We cannot register the non-fuzzy TextureOverride command
 		// lists automatically when parsing them like we do for other
@@ -3157,7 +3370,16 @@ static void ParseTextureOverrideSections()
 		}
 	}
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	if (!G->mTextureOverrideFilter.reset(G->mTextureOverrideMap.size()))
+		LogInfo("Out of memory allocating TextureOverride filter\n");
+	for (auto &tolkv : G->mTextureOverrideMap)
+		G->mTextureOverrideFilter.insert(tolkv.first);
+	for (auto &tof : G->mFuzzyTextureOverrides) {
+		G->mTextureOverrideFilter.insert_fuzzy(tof->matches_buffer,
+				tof->matches_tex1d, tof->matches_tex2d, tof->matches_tex3d);
+	}
+
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 }
 
 // https://msdn.microsoft.com/en-us/library/windows/desktop/ff476088(v=vs.85).aspx
@@ -3807,8 +4029,57 @@ static void EnumerateCustomShaderSections()
 	upper = prefix_upper_bound(ini_sections, wstring(L"CustomShader"));
 	_EnumerateCustomShaderSections(lower, upper);
 }
+// Works out the inputs each shader in the [CustomShader] sections will be
+// compiled with, without logging anything, so they can be compiled on worker
+// threads ahead of the main parse. Sections whose compile flags can't be
+// worked out here without warnings are left to be compiled serially.
+static void QueueCustomShaderCompileJobs(CustomShaderCompileQueue *queue)
+{
+	static const wchar_t *stages = L"vhdgpc";
+	CustomShaders::iterator i;
+	const wchar_t *shader_id, *unrecognised;
+	D3DCompileFlags compile_flags;
+	wchar_t setting[MAX_PATH], key[3] = L"?s";
+	wstring namespace_path;
+	int stage;
+
+	for (i = customShaders.begin(); i != customShaders.end(); i++) {
+		shader_id = i->first.c_str();
+
+		compile_flags = i->second.compile_flags;
+		if (GetIniString(shader_id, L"flags", 0, setting, MAX_PATH)) {
+			compile_flags = parse_enum_option_string_prefix<const wchar_t *, D3DCompileFlags>
+				(D3DCompileFlagNames, setting, &unrecognised);
+			if (unrecognised)
+				continue;
+		}
+
+		get_namespaced_section_path(shader_id, &namespace_path);
+
+		for (stage = 0; stages[stage]; stage++) {
+			key[0] = stages[stage];
+			if (!GetIniString(shader_id, key, 0, setting, MAX_PATH) || !_wcsicmp(setting, L"null"))
+				continue;
+
+			queue->jobs.emplace_back(new CustomShaderCompileJob(&i->second,
+					(char)stages[stage], setting, &namespace_path, compile_flags));
+		}
+	}
+}
+
+// Returns the precompiled job for this shader stage, if it is the next in the
+// queue. Jobs are queued in the same order they are consumed:
+static CustomShaderCompileJob* NextCustomShaderCompileJob(CustomShaderCompileQueue *queue,
+		CustomShader *custom_shader, char type)
+{
+	return queue->Next([custom_shader, type](CustomShaderCompileJob *job) {
+		return job->shader == custom_shader && job->type == type;
+	});
+}
+
 static void ParseCustomShaderSections()
 {
+	CustomShaderCompileQueue compile_queue;
 	CustomShaders::iterator i;
 	const wstring *shader_id;
 	CustomShader *custom_shader;
@@ -3816,6 +4087,9 @@ static void ParseCustomShaderSections()
 	bool failed;
 	wstring namespace_path;
 
+	QueueCustomShaderCompileJobs(&compile_queue);
+	compile_custom_shaders(&compile_queue);
+
 	for (i = customShaders.begin(); i != customShaders.end(); i++) {
 		shader_id = &i->first;
 		custom_shader = &i->second;
@@ -3837,17 +4111,23 @@ static void ParseCustomShaderSections()
 		get_namespaced_section_path(i->first.c_str(), &namespace_path);
 
 		if (GetIniString(shader_id->c_str(), L"vs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('v', setting, shader_id, &namespace_path);
+			failed |= custom_shader->compile('v', setting, shader_id, &namespace_path,
+					NextCustomShaderCompileJob(&compile_queue, custom_shader, 'v'));
 		if (GetIniString(shader_id->c_str(), L"hs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('h', setting, shader_id, &namespace_path);
+			failed |= custom_shader->compile('h', setting, shader_id, &namespace_path,
+					NextCustomShaderCompileJob(&compile_queue, custom_shader, 'h'));
 		if (GetIniString(shader_id->c_str(), L"ds", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('d', setting, shader_id, &namespace_path);
+			failed |= custom_shader->compile('d', setting, shader_id, &namespace_path,
+					NextCustomShaderCompileJob(&compile_queue, custom_shader, 'd'));
 		if (GetIniString(shader_id->c_str(), L"gs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('g', setting, shader_id, &namespace_path);
+			failed |= custom_shader->compile('g', setting, shader_id, &namespace_path,
+					NextCustomShaderCompileJob(&compile_queue, custom_shader, 'g'));
 		if (GetIniString(shader_id->c_str(), L"ps", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('p', setting, shader_id, &namespace_path);
+			failed |= custom_shader->compile('p', setting, shader_id, &namespace_path,
+					NextCustomShaderCompileJob(&compile_queue, custom_shader, 'p'));
 		if (GetIniString(shader_id->c_str(), L"cs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('c', setting, shader_id, &namespace_path);
+			failed |= custom_shader->compile('c', setting, shader_id, &namespace_path,
+					NextCustomShaderCompileJob(&compile_queue, custom_shader, 'c'));
 
 		if (failed) {
 			// Don't want to allow a shader to be run if it had an
@@ -4554,12 +4834,17 @@ void ReloadConfig(HackerDevice *device)
 	// Reset the counters on the global parameter save area:
 	OverrideSave.Reset(device);
 
+	// The pre-substantiation queue points into the custom resources and
+	// shaders that are about to be freed:
+	CancelPreSubstantiation();
+
 	LoadConfigFile();
 	optimise_command_lists(device);
 
 	MarkAllShadersDeferredUnprocessed();
+	InterlockedIncrement(&G->draw_processing_epoch);
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mCriticalSection);
 
 	// Execute the [Constants] command list in the immediate context to
 	// initialise iniParams and perform any other custom initialisation the
@@ -301,6 +301,10 @@ void Overlay::RestoreState()
 	mOrigContext->PSSetShaderResources(0, 1, state.pShaderResourceViews);
 	if (state.pShaderResourceViews[0])
 		state.pShaderResourceViews[0]->Release();
+
+	// The overlay draws behind the HackerContext's back, and binding the
+	// back buffer may have silently unbound some of the game's inputs:
+	mHackerContext->GetBindingShadow()->Invalidate();
 }
 
 #ifdef NTDDI_WIN10
@@ -728,7 +732,7 @@ void Overlay::DrawNotices(float *y)
 		}
 	}
 
-	LeaveCriticalSection(&notices.lock);
+	LeaveCriticalSectionPretty(&notices.lock);
 }
 
 void Overlay::DrawProfiling(float *y)
@@ -857,7 +861,7 @@ void ClearNotices()
 	notice_cleared_frame = G->frame_no;
 	has_notice = false;
 
-	LeaveCriticalSection(&notices.lock);
+	LeaveCriticalSectionPretty(&notices.lock);
 }
 
 void LogOverlayW(LogLevel level, wchar_t *fmt, ...)
@@ -879,7 +883,7 @@ void LogOverlayW(LogLevel level, wchar_t *fmt, ...)
 	notices.notices[level].emplace_back(msg);
 	has_notice = true;
 
-	LeaveCriticalSection(&notices.lock);
+	LeaveCriticalSectionPretty(&notices.lock);
 
 	va_end(ap);
 }
@@ -911,7 +915,7 @@ void LogOverlay(LogLevel level, char *fmt, ...)
 		notices.notices[level].emplace_back(wmsg);
 		has_notice = true;
 
-		LeaveCriticalSection(&notices.lock);
+		LeaveCriticalSectionPretty(&notices.lock);
 	}
 
 	va_end(ap);
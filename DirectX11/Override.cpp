@@ -4,7 +4,6 @@
 #include "D3D11Wrapper.h"
 #include "IniHandler.h"
 
-#define _USE_MATH_DEFINES
 #include <math.h>
 #include <strsafe.h>
 #include <algorithm>
@@ -354,17 +353,49 @@ void KeyOverrideCycle::ParseIniSection(LPCWSTR section)
 	}
 }
 
-bool Override::MatchesCurrent(HackerDevice *device)
+bool OverrideStereoSnapshot::GetSeparation(HackerDevice *device, float *val)
+{
+	NvAPI_Status err;
+
+	if (!fetched_separation) {
+		err = Profiling::NvAPI_Stereo_GetSeparation(device->mStereoHandle, &separation);
+		if (err != NVAPI_OK)
+			LogDebug("    Stereo_GetSeparation failed: %i\n", err);
+		valid_separation = (err == NVAPI_OK);
+		fetched_separation = true;
+	}
+
+	*val = separation;
+	return valid_separation;
+}
+
+bool OverrideStereoSnapshot::GetConvergence(HackerDevice *device, float *val)
+{
+	NvAPI_Status err;
+
+	if (!fetched_convergence) {
+		err = Profiling::NvAPI_Stereo_GetConvergence(device->mStereoHandle, &convergence);
+		if (err != NVAPI_OK)
+			LogDebug("    Stereo_GetConvergence failed: %i\n", err);
+		valid_convergence = (err == NVAPI_OK);
+		fetched_convergence = true;
+	}
+
+	*val = convergence;
+	return valid_convergence;
+}
+
+bool Override::MatchesCurrent(HackerDevice *device, OverrideStereoSnapshot *stereo)
 {
 	OverrideParams::iterator i;
 	OverrideVars::iterator j;
-	NvAPI_Status err;
+	OverrideTransitionParam *transition;
 	float val;
 
 	for (i = begin(mOverrideParams); i != end(mOverrideParams); i++) {
-		std::map<OverrideParam, OverrideTransitionParam>::iterator transition = CurrentTransition.params.find(i->first);
-		if (transition != CurrentTransition.params.end() && transition->second.time != -1)
-			val = transition->second.target;
+		transition = CurrentTransition.FindParam(i->first);
+		if (transition)
+			val = transition->target;
 		else
 			val = G->iniParams[i->first.idx].*i->first.component;
 
@@ -373,9 +404,9 @@ bool Override::MatchesCurrent(HackerDevice *device)
 	}
 
 	for (j = begin(mOverrideVars); j != end(mOverrideVars); j++) {
-		std::map<CommandListVariable*, OverrideTransitionParam>::iterator transition = CurrentTransition.vars.find(j->first);
-		if (transition != CurrentTransition.vars.end() && transition->second.time != -1)
-			val = transition->second.target;
+		transition = CurrentTransition.FindVar(j->first);
+		if (transition)
+			val = transition->target;
 		else
 			val = j->first->fval;
 
@@ -384,15 +415,10 @@ bool Override::MatchesCurrent(HackerDevice *device)
 	}
 
 	if (mOverrideSeparation != FLT_MAX) {
-		if (CurrentTransition.separation.time != -1) {
+		if (CurrentTransition.separation.time != -1)
 			val = CurrentTransition.separation.target;
-		} else {
-			err = Profiling::NvAPI_Stereo_GetSeparation(device->mStereoHandle, &val);
-			if (err != NVAPI_OK) {
-				LogDebug("    Stereo_GetSeparation failed: %i\n", err);
-				val = mOverrideSeparation;
-			}
-		}
+		else if (!stereo->GetSeparation(device, &val))
+			val = mOverrideSeparation;
 
 		// nvapi calls can alter the value we set (e.g. 4 -> 3.99999952),
 		// and 0 is special cased to 1% (unless StereoFullHKConfig is set,
@@ -406,15 +432,10 @@ bool Override::MatchesCurrent(HackerDevice *device)
 			return false;
 	}
 	if (mOverrideConvergence != FLT_MAX) {
-		if (CurrentTransition.convergence.time != -1) {
+		if (CurrentTransition.convergence.time != -1)
 			val = CurrentTransition.convergence.target;
-		} else {
-			err = Profiling::NvAPI_Stereo_GetConvergence(device->mStereoHandle, &val);
-			if (err != NVAPI_OK) {
-				LogDebug("    Stereo_GetConvergence failed: %i\n", err);
-				val = mOverrideConvergence;
-			}
-		}
+		else if (!stereo->GetConvergence(device, &val))
+			val = mOverrideConvergence;
 
 		// nvapi calls can alter the value we set (e.g. 0 -> 0.00100000005)
 		// and we can't rely on the entire 24 bits of precision, so compare
@@ -429,15 +450,19 @@ bool Override::MatchesCurrent(HackerDevice *device)
 
 void KeyOverrideCycle::UpdateCurrent(HackerDevice *device)
 {
+	// Separation and convergence won't change while we search, so only
+	// ask nvapi for them once:
+	OverrideStereoSnapshot stereo;
+
 	// If everything in the current preset matches reality or the current
 	// transition target we are good:
-	if (current >= 0 && (size_t)current < presets.size() && presets[current].MatchesCurrent(device))
+	if (current >= 0 && (size_t)current < presets.size() && presets[current].MatchesCurrent(device, &stereo))
 		return;
 
 	// The current preset doesn't match reality - we've got out of sync.
 	// Search for any other presets that do match:
 	for (unsigned i = 0; i < presets.size(); i++) {
-		if (i != current && presets[i].MatchesCurrent(device)) {
+		if (i != current && presets[i].MatchesCurrent(device, &stereo)) {
 			LogInfo("Resynced key cycle: %i -> %i\n", current, i);
 			current = i;
 			return;
@@ -593,6 +618,11 @@ void KeyOverride::UpEvent(HackerDevice *device)
 		return Deactivate(device);
 }
 
+void PresetOverride::Schedule()
+{
+	CurrentTransition.SchedulePreset(this);
+}
+
 void PresetOverride::Trigger(CommandListCommand *triggered_from)
 {
 	if (unique_triggers_required) {
@@ -602,11 +632,16 @@ void PresetOverride::Trigger(CommandListCommand *triggered_from)
 	} else {
 		triggered = true;
 	}
+
+	// Schedule even if we don't have enough unique triggers yet, so that
+	// triggers_this_frame will be cleared at the end of the frame:
+	Schedule();
 }
 
 void PresetOverride::Exclude()
 {
 	excluded = true;
+	Schedule();
 }
 
 // Called on present to update the activation status. If the preset was
@@ -648,6 +683,35 @@ static void _ScheduleTransition(struct OverrideTransitionParam *transition,
 	transition->transition_type = transition_type;
 }
 
+OverrideTransitionParam* OverrideTransition::FindParam(const OverrideParam &param)
+{
+	for (auto &i : params) {
+		if (i.first == param)
+			return i.second.time != -1 ? &i.second : NULL;
+	}
+	return NULL;
+}
+
+OverrideTransitionParam* OverrideTransition::FindVar(CommandListVariable *var)
+{
+	for (auto &i : vars) {
+		if (i.first == var)
+			return i.second.time != -1 ? &i.second : NULL;
+	}
+	return NULL;
+}
+
+void OverrideTransition::SchedulePreset(PresetOverride *preset)
+{
+	scheduled_presets.Schedule(preset);
+}
+
+// Must be called before the presets are destroyed, e.g. on config reload:
+void OverrideTransition::ClearScheduledPresets()
+{
+	scheduled_presets.Clear();
+}
+
 void OverrideTransition::ScheduleTransition(HackerDevice *wrapper,
 		float target_separation, float target_convergence,
 		OverrideParams *targets,
@@ -660,6 +724,7 @@ void OverrideTransition::ScheduleTransition(HackerDevice *wrapper,
 	char buf[8];
 	OverrideParams::iterator i;
 	OverrideVars::iterator j;
+	OverrideTransitionParam *transition;
 
 	LogInfoNoNL(" Override");
 	if (time) {
@@ -681,12 +746,32 @@ void OverrideTransition::ScheduleTransition(HackerDevice *wrapper,
 		_ScheduleTransition(&convergence, "convergence", current, target_convergence, now, time, transition_type);
 	}
 	for (i = targets->begin(); i != targets->end(); i++) {
+		transition = NULL;
+		for (auto &k : params) {
+			if (k.first == i->first)
+				transition = &k.second;
+		}
+		if (!transition) {
+			params.emplace_back(i->first, OverrideTransitionParam());
+			transition = &params.back().second;
+		}
+
 		StringCchPrintfA(buf, 8, "%c%.0i", i->first.chr(), i->first.idx);
-		_ScheduleTransition(&params[i->first], buf, G->iniParams[i->first.idx].*i->first.component,
+		_ScheduleTransition(transition, buf, G->iniParams[i->first.idx].*i->first.component,
 				i->second, now, time, transition_type);
 	}
 	for (j = var_targets->begin(); j != var_targets->end(); j++) {
-		_ScheduleTransition(&vars[j->first], j->first->name.c_str(), j->first->fval,
+		transition = NULL;
+		for (auto &k : vars) {
+			if (k.first == j->first)
+				transition = &k.second;
+		}
+		if (!transition) {
+			vars.emplace_back(j->first, OverrideTransitionParam());
+			transition = &vars.back().second;
+		}
+
+		_ScheduleTransition(transition, j->first->name.c_str(), j->first->fval,
 				j->second, now, time, transition_type);
 	}
 	LogInfo("\n");
@@ -694,51 +779,24 @@ void OverrideTransition::ScheduleTransition(HackerDevice *wrapper,
 
 void OverrideTransition::UpdatePresets(HackerDevice *wrapper)
 {
-	PresetOverrideMap::iterator i;
-
-	// Deactivate any presets that were not triggered this frame:
-	for (i = presetOverrides.begin(); i != presetOverrides.end(); i++)
-		i->second.Update(wrapper);
-}
-
-static float _UpdateTransition(struct OverrideTransitionParam *transition, ULONGLONG now)
-{
-	ULONGLONG time;
-	float percent;
-
-	if (transition->time == -1)
-		return FLT_MAX;
-
-	if (transition->time == 0) {
-		transition->time = -1;
-		return transition->target;
-	}
-
-	time = now - transition->activation_time;
-	percent = (float)time / transition->time;
-
-	if (percent >= 1.0f) {
-		transition->time = -1;
-		return transition->target;
-	}
-
-	if (transition->transition_type == TransitionType::COSINE)
-		percent = (float)((1.0 - cos(percent * M_PI)) / 2.0);
-
-	percent = transition->target * percent + transition->start * (1.0f - percent);
-
-	return percent;
+	// Deactivate any presets that were not triggered this frame. Active
+	// presets need to be visited again next frame in case they are no
+	// longer being triggered:
+	scheduled_presets.Run([wrapper](PresetOverride *preset) {
+		preset->Update(wrapper);
+		return preset->active;
+	});
 }
 
 void OverrideTransition::UpdateTransitions(HackerDevice *wrapper)
 {
-	std::map<OverrideParam, OverrideTransitionParam>::iterator i;
-	std::map<CommandListVariable*, OverrideTransitionParam>::iterator j;
+	OverrideTransitionParams::iterator i;
+	OverrideTransitionVars::iterator j;
 	ULONGLONG now = GetTickCount64();
 	NvAPI_Status err;
 	float val;
 
-	val = _UpdateTransition(&separation, now);
+	val = UpdateTransitionParam(&separation, now);
 	if (val != FLT_MAX) {
 		LogInfo(" Transitioning separation to %#.2f\n", val);
 
@@ -748,7 +806,7 @@ void OverrideTransition::UpdateTransitions(HackerDevice *wrapper)
 			LogDebug("    Stereo_SetSeparation failed: %i\n", err);
 	}
 
-	val = _UpdateTransition(&convergence, now);
+	val = UpdateTransitionParam(&convergence, now);
 	if (val != FLT_MAX) {
 		LogInfo(" Transitioning convergence to %#.2f\n", val);
 
@@ -761,7 +819,7 @@ void OverrideTransition::UpdateTransitions(HackerDevice *wrapper)
 	if (!params.empty()) {
 		LogDebugNoNL(" IniParams remapped to ");
 		for (i = params.begin(); i != params.end();) {
-			float val = _UpdateTransition(&i->second, now);
+			float val = UpdateTransitionParam(&i->second, now);
 			G->iniParams[i->first.idx].*i->first.component = val;
 			LogDebugNoNL("%c%.0i=%#.2g, ", i->first.chr(), i->first.idx, val);
 			if (i->second.time == -1)
@@ -777,7 +835,7 @@ void OverrideTransition::UpdateTransitions(HackerDevice *wrapper)
 	if (!vars.empty()) {
 		LogDebugNoNL(" Variables remapped to ");
 		for (j = vars.begin(); j != vars.end();) {
-			float val = _UpdateTransition(&j->second, now);
+			float val = UpdateTransitionParam(&j->second, now);
 			if (j->first->fval != val) {
 				j->first->fval = val;
 				if (j->first->flags & VariableFlags::PERSIST)
@@ -886,6 +944,7 @@ void OverrideGlobalSave::Save(HackerDevice *wrapper, Override *preset)
 {
 	OverrideParams::iterator i;
 	OverrideVars::iterator j;
+	OverrideTransitionParam *transition;
 	NvAPI_Status err;
 	float val;
 
@@ -918,9 +977,9 @@ void OverrideGlobalSave::Save(HackerDevice *wrapper, Override *preset)
 	}
 
 	for (i = preset->mOverrideParams.begin(); i != preset->mOverrideParams.end(); i++) {
-		std::map<OverrideParam, OverrideTransitionParam>::iterator transition = CurrentTransition.params.find(i->first);
-		if (transition != CurrentTransition.params.end() && transition->second.time != -1)
-			val = transition->second.target;
+		transition = CurrentTransition.FindParam(i->first);
+		if (transition)
+			val = transition->target;
 		else
 			val = G->iniParams[i->first.idx].*i->first.component;
 
@@ -929,9 +988,9 @@ void OverrideGlobalSave::Save(HackerDevice *wrapper, Override *preset)
 	}
 
 	for (j = preset->mOverrideVars.begin(); j != preset->mOverrideVars.end(); j++) {
-		std::map<CommandListVariable*, OverrideTransitionParam>::iterator transition = CurrentTransition.vars.find(j->first);
-		if (transition != CurrentTransition.vars.end() && transition->second.time != -1)
-			val = transition->second.target;
+		transition = CurrentTransition.FindVar(j->first);
+		if (transition)
+			val = transition->target;
 		else
 			val = j->first->fval;
 
@@ -7,6 +7,7 @@
 #include "util.h"
 #include "Input.h"
 #include "HackerDevice.h"
+#include "OverrideSchedule.h"
 
 enum class KeyOverrideType {
 	INVALID = -1,
@@ -23,11 +24,6 @@ static EnumName_t<const wchar_t *, KeyOverrideType> KeyOverrideTypeNames[] = {
 	{NULL, KeyOverrideType::INVALID} // End of list marker
 };
 
-enum class TransitionType {
-	INVALID = -1,
-	LINEAR,
-	COSINE,
-};
 static EnumName_t<const char *, TransitionType> TransitionTypeNames[] = {
 	{"linear", TransitionType::LINEAR},
 	{"cosine", TransitionType::COSINE},
@@ -65,9 +61,36 @@ static inline bool operator<(const OverrideParam &lhs, const OverrideParam &rhs)
 	return ((uintptr_t)&((DirectX::XMFLOAT4*)(NULL)->*(lhs.component)) <
 	        (uintptr_t)&((DirectX::XMFLOAT4*)(NULL)->*(rhs.component)));
 }
+static inline bool operator==(const OverrideParam &lhs, const OverrideParam &rhs)
+{
+	return lhs.idx == rhs.idx && lhs.component == rhs.component;
+}
 typedef std::map<OverrideParam, float> OverrideParams;
 typedef std::map<CommandListVariable*, float> OverrideVars;
 
+// Separation and convergence as seen by nvapi, fetched on first use and then
+// reused for the remainder of the operation (e.g. searching every preset in a
+// key cycle for one that matches), saving a round trip to the driver for
+// every preset that sets them.
+struct OverrideStereoSnapshot
+{
+	bool fetched_separation, fetched_convergence;
+	bool valid_separation, valid_convergence;
+	float separation, convergence;
+
+	OverrideStereoSnapshot() :
+		fetched_separation(false),
+		fetched_convergence(false),
+		valid_separation(false),
+		valid_convergence(false),
+		separation(FLT_MAX),
+		convergence(FLT_MAX)
+	{}
+
+	bool GetSeparation(HackerDevice *device, float *val);
+	bool GetConvergence(HackerDevice *device, float *val);
+};
+
 class OverrideBase
 {
 public:
@@ -127,7 +150,7 @@ public:
 	void Activate(HackerDevice *device, bool override_has_deactivate_condition);
 	void Deactivate(HackerDevice *device);
 	void Toggle(HackerDevice *device);
-	bool MatchesCurrent(HackerDevice *device);
+	bool MatchesCurrent(HackerDevice *device, OverrideStereoSnapshot *stereo);
 };
 
 class KeyOverrideBase : public virtual OverrideBase, public InputListener
@@ -200,14 +223,19 @@ class PresetOverride : public Override
 private:
 	bool triggered;
 	bool excluded;
+	bool scheduled;
 	unordered_set<CommandListCommand*> triggers_this_frame;
 
+	void Schedule();
+
 public:
 	PresetOverride() :
 		Override(),
 		triggered(false),
 		excluded(false),
-		unique_triggers_required(0)
+		scheduled(false),
+		unique_triggers_required(0),
+		order(0)
 	{}
 
 	void Trigger(CommandListCommand *triggered_from);
@@ -215,6 +243,13 @@ public:
 	void Update(HackerDevice *device);
 
 	unsigned unique_triggers_required;
+
+	// Position of this preset in presetOverrides, so that the scheduled
+	// presets can be updated in the same order as the map:
+	unsigned order;
+
+	friend class OverrideTransition;
+	friend class PresetSchedule<PresetOverride>;
 };
 
 // Sorted map so that if multiple presets affect the same thing the results
@@ -222,30 +257,27 @@ public:
 typedef std::map<std::wstring, class PresetOverride> PresetOverrideMap;
 extern PresetOverrideMap presetOverrides;
 
-struct OverrideTransitionParam
-{
-	float start;
-	float target;
-	ULONGLONG activation_time;
-	int time;
-	TransitionType transition_type;
-
-	OverrideTransitionParam() :
-		start(FLT_MAX),
-		target(FLT_MAX),
-		activation_time(0),
-		time(-1),
-		transition_type(TransitionType::LINEAR)
-	{}
-};
+// Only parameters that are currently transitioning are held in these, which
+// is rarely more than a handful, so these are flat arrays rather than maps:
+typedef std::vector<std::pair<OverrideParam, OverrideTransitionParam>> OverrideTransitionParams;
+typedef std::vector<std::pair<CommandListVariable*, OverrideTransitionParam>> OverrideTransitionVars;
 
 class OverrideTransition
 {
+private:
+	PresetSchedule<PresetOverride> scheduled_presets;
+
 public:
-	std::map<OverrideParam, OverrideTransitionParam> params;
-	std::map<CommandListVariable*, OverrideTransitionParam> vars;
+	OverrideTransitionParams params;
+	OverrideTransitionVars vars;
 	OverrideTransitionParam separation, convergence;
 
+	OverrideTransitionParam* FindParam(const OverrideParam &param);
+	OverrideTransitionParam* FindVar(CommandListVariable *var);
+
+	void SchedulePreset(PresetOverride *preset);
+	void ClearScheduledPresets();
+
 	void ScheduleTransition(HackerDevice *wrapper,
 			float target_separation, float target_convergence,
 			OverrideParams *targets, OverrideVars *vars,
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// The bookkeeping behind presets and transitions that runs on every present:
+// which presets need to be visited, and where each transition is up to. The
+// nvapi calls, ini params and command lists are all left to Override.cpp.
+//
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests, which drive it with fake presets and a fake clock.
+
+enum class TransitionType {
+	INVALID = -1,
+	LINEAR,
+	COSINE,
+};
+
+struct OverrideTransitionParam
+{
+	float start;
+	float target;
+	uint64_t activation_time;
+	int time;
+	TransitionType transition_type;
+
+	OverrideTransitionParam() :
+		start(FLT_MAX),
+		target(FLT_MAX),
+		activation_time(0),
+		time(-1),
+		transition_type(TransitionType::LINEAR)
+	{}
+};
+
+// Advances a transition to now, which is in the same milliseconds as the
+// activation_time (GetTickCount64() in the game). Returns the value to set,
+// or FLT_MAX if the transition is not in flight. A transition that reaches
+// its target is finished by setting its time to -1.
+static inline float UpdateTransitionParam(OverrideTransitionParam *transition, uint64_t now)
+{
+	uint64_t time;
+	float percent;
+
+	if (transition->time == -1)
+		return FLT_MAX;
+
+	if (transition->time == 0) {
+		transition->time = -1;
+		return transition->target;
+	}
+
+	time = now - transition->activation_time;
+	percent = (float)time / transition->time;
+
+	if (percent >= 1.0f) {
+		transition->time = -1;
+		return transition->target;
+	}
+
+	if (transition->transition_type == TransitionType::COSINE)
+		percent = (float)((1.0 - cos(percent * 3.14159265358979323846)) / 2.0);
+
+	percent = transition->target * percent + transition->start * (1.0f - percent);
+
+	return percent;
+}
+
+// Presets that were triggered or excluded this frame, or are active and may
+// need to be deactivated. Only these are visited on present, rather than every
+// preset in the config. Kept sorted by Preset::order, so that they are visited
+// in the same order as they would have been by walking the whole config.
+// Preset must have an unsigned order and a bool scheduled member.
+template <class Preset>
+class PresetSchedule
+{
+private:
+	std::vector<Preset*> presets;
+
+	static bool order_less(Preset *lhs, Preset *rhs)
+	{
+		return lhs->order < rhs->order;
+	}
+
+public:
+	void Schedule(Preset *preset)
+	{
+		if (preset->scheduled)
+			return;
+
+		presets.insert(std::upper_bound(presets.begin(), presets.end(),
+				preset, order_less), preset);
+		preset->scheduled = true;
+	}
+
+	// Must be called before the presets are destroyed, e.g. on config reload:
+	void Clear()
+	{
+		presets.clear();
+	}
+
+	bool empty() const
+	{
+		return presets.empty();
+	}
+
+	// Calls update() on each scheduled preset in order, which returns true
+	// if the preset needs to be visited again next frame. Anything that is
+	// scheduled while this runs (e.g. by command lists run from update())
+	// is held for the next frame, as it would have been if we had already
+	// passed it while walking the whole config.
+	template <class Update>
+	void Run(Update update)
+	{
+		std::vector<Preset*> current;
+
+		if (presets.empty())
+			return;
+
+		current.swap(presets);
+		for (Preset *preset : current)
+			preset->scheduled = false;
+
+		for (Preset *preset : current) {
+			if (update(preset))
+				Schedule(preset);
+		}
+	}
+};
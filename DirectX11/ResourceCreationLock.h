@@ -0,0 +1,71 @@
+#pragma once
+
+#include "lock.h"
+
+// How one thread is holding a ResourceCreationLock. Lives in the TLS
+// structure, since the SRW lock it tracks is not recursive:
+struct ResourceCreationLockNesting
+{
+	int depth;
+	bool exclusive;
+
+	ResourceCreationLockNesting() :
+		depth(0),
+		exclusive(false)
+	{}
+};
+
+// The lock behind LockResourceCreationMode() and friends - see util.h for
+// what it protects. This used to be a critical section and we do have paths
+// that take it again while already holding it, so the nesting is tracked per
+// thread and only the outermost Lock()/Unlock() touch the SRW lock.
+//
+// An SRW lock cannot be upgraded from shared to exclusive without dropping it,
+// which would let another thread change the surface creation mode in the
+// middle of whatever the outer level is creating. Anything that might need it
+// exclusively must therefore take it exclusively at the outermost level.
+// Lock() returns false if a nested caller asks for exclusive access while the
+// thread only holds it shared, so that the caller can report the bug - the
+// lock is still held (shared) and must be unlocked as usual.
+//
+// This only depends on the SRW lock API so that it can be built by the unit
+// tests against a stubbed driver.
+class ResourceCreationLock
+{
+private:
+	SRWLOCK lock;
+	volatile LONG *contention;
+
+public:
+	ResourceCreationLock(volatile LONG *contention) :
+		contention(contention)
+	{
+		InitializeSRWLock(&lock);
+	}
+
+	// Gives the lock a name in lock stack dumps. Call this from init code,
+	// not from a global constructor:
+	void SetName(char *name)
+	{
+		NameSRWLock(&lock, name);
+	}
+
+	bool Lock(ResourceCreationLockNesting *nesting, bool exclusive, char *function, int line)
+	{
+		if (nesting->depth++)
+			return !exclusive || nesting->exclusive;
+
+		if (_AcquireSRWLockPretty(&lock, exclusive, function, line))
+			InterlockedIncrement(contention);
+		nesting->exclusive = exclusive;
+		return true;
+	}
+
+	void Unlock(ResourceCreationLockNesting *nesting)
+	{
+		if (--nesting->depth)
+			return;
+
+		ReleaseSRWLockPretty(&lock, nesting->exclusive);
+	}
+};
@@ -1,6 +1,7 @@
 #include "ResourceHash.h"
 
 #include <INITGUID.h>
+#include <algorithm>
 #include "log.h"
 #include "util.h"
 #include "globals.h"
@@ -808,10 +809,10 @@ uint32_t CalcTexture2DDataHashAccurate(
 	return hash;
 }
 
-// Must be called with the critical section held to protect mResources against
-// simultaneous reads & modifications (hmm, tempted to implement a lock free
-// map given that it's add only, or use RCU). Is there anything on Windows like
-// lockdep to statically prove this is called with the lock held?
+// Takes mResourcesLock to protect mResources against simultaneous reads &
+// modifications (hmm, tempted to implement a lock free map given that it's add
+// only, or use RCU). The hash fields of the returned entry may be updated by
+// hash tracking, so hold mResourceInfoLock to read or modify those.
 ResourceHandleInfo* GetResourceHandleInfo(ID3D11Resource *resource)
 {
 	std::unordered_map<ID3D11Resource *, ResourceHandleInfo>::iterator j;
@@ -823,13 +824,13 @@ ResourceHandleInfo* GetResourceHandleInfo(ID3D11Resource *resource)
 	if (j != G->mResources.end())
 		ret = &j->second;
 
-	LeaveCriticalSection(&G->mResourcesLock);
+	LeaveCriticalSectionPretty(&G->mResourcesLock);
 
 	return ret;
 }
 
-// Must be called with the critical section held to protect mResources against
-// simultaneous reads & modifications
+// The original hash never changes once the resource has been created, so this
+// doesn't need any lock beyond the one GetResourceHandleInfo() takes
 uint32_t GetOrigResourceHash(ID3D11Resource *resource)
 {
 	ResourceHandleInfo *handle_info = GetResourceHandleInfo(resource);
@@ -839,13 +840,19 @@ uint32_t GetOrigResourceHash(ID3D11Resource *resource)
 	return 0;
 }
 
-// Must be called with the critical section held to protect mResources against
-// simultaneous reads & modifications
+// The current hash can be updated by hash tracking on another thread, so this
+// takes mResourceInfoLock to read it. Callers may hold the config or hunting
+// locks, but must not hold mResourcesLock.
 uint32_t GetResourceHash(ID3D11Resource *resource)
 {
-	ResourceHandleInfo *handle_info = GetResourceHandleInfo(resource);
+	ResourceHandleInfo *handle_info;
+	uint32_t hash = 0;
+
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
+	handle_info = GetResourceHandleInfo(resource);
 	if (handle_info)
-		return handle_info->hash;
+		hash = handle_info->hash;
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
 
 	// We can get here for a few legitimate reasons where a resource has
 	// not been hashed. Resources created by 3DMigoto bypass the
@@ -857,7 +864,7 @@ uint32_t GetResourceHash(ID3D11Resource *resource)
 	//
 	// Return a 0 so it is obvious that this resource has not been hashed.
 
-	return 0;
+	return hash;
 }
 
 uint32_t CalcTexture1DDataHash(
@@ -989,7 +996,9 @@ void MarkResourceHashContaminated(ID3D11Resource *dest, UINT DstSubresource,
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
 		Profiling::start(&profiling_state);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	DrainResourceInfo();
+
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
 
 	dst_handle_info = GetResourceHandleInfo(dest);
 	if (!dst_handle_info)
@@ -1089,7 +1098,7 @@ void MarkResourceHashContaminated(ID3D11Resource *dest, UINT DstSubresource,
 	}
 
 out_unlock:
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
 
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
 		Profiling::end(&profiling_state, &Profiling::hash_tracking_overhead);
@@ -1114,7 +1123,7 @@ void UpdateResourceHashFromCPU(ID3D11Resource *resource,
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
 		Profiling::start(&profiling_state);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
 
 	info = GetResourceHandleInfo(resource);
 	if (!info)
@@ -1169,7 +1178,7 @@ void UpdateResourceHashFromCPU(ID3D11Resource *resource,
 	LogDebug("  old hash: %08x new hash: %08x\n", old_hash, info->hash);
 
 out_unlock:
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
 
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
 		Profiling::end(&profiling_state, &Profiling::hash_tracking_overhead);
@@ -1187,7 +1196,7 @@ void PropagateResourceHash(ID3D11Resource *dst, ID3D11Resource *src)
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
 		Profiling::start(&profiling_state);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
 
 	dst_info = GetResourceHandleInfo(dst);
 	if (!dst_info)
@@ -1242,7 +1251,7 @@ void PropagateResourceHash(ID3D11Resource *dst, ID3D11Resource *src)
 	LogDebug("  old hash: %08x new hash: %08x\n", old_hash, dst_info->hash);
 
 out_unlock:
-	LeaveCriticalSection(&G->mCriticalSection);
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
 
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
 		Profiling::end(&profiling_state, &Profiling::hash_tracking_overhead);
@@ -1262,6 +1271,267 @@ bool MapTrackResourceHashUpdate(ID3D11Resource *pResource, UINT Subresource)
 	return G->track_texture_updates == 1 && Subresource == 0;
 }
 
+// -----------------------------------------------------------------------------------------------
+//                       Write Generation Tracking for Frame Analysis
+// -----------------------------------------------------------------------------------------------
+
+// Frame analysis uses these to skip re-dumping resources that it has already
+// dumped and that cannot have changed since. Writes we can attribute to a
+// specific resource bump that resource's generation, while writes we cannot
+// attribute (command lists executed from deferred contexts, custom draw calls
+// from our own command lists, etc.) bump the global epoch to invalidate
+// everything. These are only bumped while frame analysis is active, as the
+// epoch is bumped again when a new frame analysis session starts.
+
+static volatile LONG64 resource_write_generation;
+static volatile LONG resource_write_epoch;
+
+uint64_t NextResourceWriteGeneration()
+{
+	return (uint64_t)InterlockedIncrement64(&resource_write_generation);
+}
+
+void MarkResourceWritten(ID3D11Resource *resource)
+{
+	std::unordered_map<ID3D11Resource *, ResourceHandleInfo>::iterator j;
+
+	if (!resource)
+		return;
+
+	EnterCriticalSectionPretty(&G->mResourcesLock);
+
+	j = lookup_resource_handle_info(resource);
+	if (j != G->mResources.end())
+		j->second.write_generation = NextResourceWriteGeneration();
+
+	LeaveCriticalSectionPretty(&G->mResourcesLock);
+}
+
+void MarkViewResourceWritten(ID3D11View *view)
+{
+	ID3D11Resource *resource = NULL;
+
+	if (!view)
+		return;
+
+	view->GetResource(&resource);
+	if (!resource)
+		return;
+
+	MarkResourceWritten(resource);
+	resource->Release();
+}
+
+// As MarkResourceWritten(), but only takes the lock once. NULL entries are
+// skipped. This is used to mark every bound target after each draw call in
+// frame analysis, so it is worth not taking the lock for each one:
+void MarkResourcesWritten(ID3D11Resource *const *resources, unsigned count)
+{
+	std::unordered_map<ID3D11Resource *, ResourceHandleInfo>::iterator j;
+	unsigned i;
+
+	if (!count)
+		return;
+
+	EnterCriticalSectionPretty(&G->mResourcesLock);
+
+	for (i = 0; i < count; i++) {
+		if (!resources[i])
+			continue;
+
+		j = lookup_resource_handle_info(resources[i]);
+		if (j != G->mResources.end())
+			j->second.write_generation = NextResourceWriteGeneration();
+	}
+
+	LeaveCriticalSectionPretty(&G->mResourcesLock);
+}
+
+void MarkAllResourcesWritten()
+{
+	InterlockedIncrement(&resource_write_epoch);
+}
+
+// Returns false for resources we are not tracking (e.g. those created by
+// 3DMigoto or the swap chain), which must always be assumed to have changed.
+bool GetResourceWriteGeneration(ID3D11Resource *resource, uint64_t *generation, LONG *epoch)
+{
+	std::unordered_map<ID3D11Resource *, ResourceHandleInfo>::iterator j;
+	bool ret = false;
+
+	*epoch = resource_write_epoch;
+
+	EnterCriticalSectionPretty(&G->mResourcesLock);
+
+	j = lookup_resource_handle_info(resource);
+	if (j != G->mResources.end()) {
+		*generation = j->second.write_generation;
+		ret = true;
+	}
+
+	LeaveCriticalSectionPretty(&G->mResourcesLock);
+
+	return ret;
+}
+
+// -----------------------------------------------------------------------------------------------
+//                          Deferred Resource Info Recording for Hunting
+// -----------------------------------------------------------------------------------------------
+
+// While hunting we record the description of every resource the game creates
+// in mResourceInfo, which is protected by mResourceInfoLock. Games that
+// stream in assets can create thousands of resources a second from several
+// threads, so rather than take that lock on every one of those, each thread appends to its own buffer and these are drained into
+// mResourceInfo on present, or whenever something is about to look at it.
+
+struct ResourceInfoRecord
+{
+	uint32_t hash;
+	bool initial_data_used_in_hash;
+	D3D11_RESOURCE_DIMENSION type;
+	union {
+		D3D11_BUFFER_DESC buf_desc;
+		D3D11_TEXTURE1D_DESC tex1d_desc;
+		D3D11_TEXTURE2D_DESC tex2d_desc;
+		D3D11_TEXTURE3D_DESC tex3d_desc;
+	};
+};
+
+struct ResourceInfoRecordBuffer
+{
+	SRWLOCK lock;
+	std::vector<ResourceInfoRecord> records;
+
+	ResourceInfoRecordBuffer()
+	{
+		InitializeSRWLock(&lock);
+	}
+};
+
+// Buffers are never freed, since we don't get a reliable notification when a
+// thread exits. There is only one per thread that has ever created a
+// resource while hunting, so this is not a concern:
+static std::vector<ResourceInfoRecordBuffer*> resource_info_buffers;
+static SRWLOCK resource_info_buffers_lock = SRWLOCK_INIT;
+static volatile LONG resource_info_pending;
+
+static ResourceInfoRecordBuffer* get_resource_info_buffer()
+{
+	TLS *tls = get_tls();
+
+	if (!tls->resource_info_buffer) {
+		tls->resource_info_buffer = new ResourceInfoRecordBuffer();
+		AcquireSRWLockExclusive(&resource_info_buffers_lock);
+		resource_info_buffers.push_back(tls->resource_info_buffer);
+		ReleaseSRWLockExclusive(&resource_info_buffers_lock);
+	}
+
+	return tls->resource_info_buffer;
+}
+
+static void record_resource_info(ResourceInfoRecord *record)
+{
+	ResourceInfoRecordBuffer *buffer = get_resource_info_buffer();
+
+	// Only contended while this buffer is being drained:
+	AcquireSRWLockExclusive(&buffer->lock);
+	buffer->records.push_back(*record);
+	ReleaseSRWLockExclusive(&buffer->lock);
+
+	InterlockedIncrement(&resource_info_pending);
+}
+
+void RecordResourceInfo(uint32_t hash, const D3D11_BUFFER_DESC *desc, bool initial_data_used_in_hash)
+{
+	ResourceInfoRecord record;
+
+	record.hash = hash;
+	record.initial_data_used_in_hash = initial_data_used_in_hash;
+	record.type = D3D11_RESOURCE_DIMENSION_BUFFER;
+	record.buf_desc = *desc;
+	record_resource_info(&record);
+}
+
+void RecordResourceInfo(uint32_t hash, const D3D11_TEXTURE1D_DESC *desc, bool initial_data_used_in_hash)
+{
+	ResourceInfoRecord record;
+
+	record.hash = hash;
+	record.initial_data_used_in_hash = initial_data_used_in_hash;
+	record.type = D3D11_RESOURCE_DIMENSION_TEXTURE1D;
+	record.tex1d_desc = *desc;
+	record_resource_info(&record);
+}
+
+void RecordResourceInfo(uint32_t hash, const D3D11_TEXTURE2D_DESC *desc, bool initial_data_used_in_hash)
+{
+	ResourceInfoRecord record;
+
+	record.hash = hash;
+	record.initial_data_used_in_hash = initial_data_used_in_hash;
+	record.type = D3D11_RESOURCE_DIMENSION_TEXTURE2D;
+	record.tex2d_desc = *desc;
+	record_resource_info(&record);
+}
+
+void RecordResourceInfo(uint32_t hash, const D3D11_TEXTURE3D_DESC *desc, bool initial_data_used_in_hash)
+{
+	ResourceInfoRecord record;
+
+	record.hash = hash;
+	record.initial_data_used_in_hash = initial_data_used_in_hash;
+	record.type = D3D11_RESOURCE_DIMENSION_TEXTURE3D;
+	record.tex3d_desc = *desc;
+	record_resource_info(&record);
+}
+
+// Merges everything recorded so far into mResourceInfo. Call this before
+// looking anything up in mResourceInfo. It takes mResourceInfoLock, so it must
+// not be called while holding mResourcesLock.
+void DrainResourceInfo()
+{
+	// Swapped with each thread's buffer, so that the buffers keep their
+	// capacity between drains. Protected by mResourceInfoLock:
+	static std::vector<ResourceInfoRecord> records;
+	struct ResourceHashInfo *info;
+
+	if (!resource_info_pending)
+		return;
+
+	EnterCriticalSectionPretty(&G->mResourceInfoLock);
+	InterlockedExchange(&resource_info_pending, 0);
+	AcquireSRWLockShared(&resource_info_buffers_lock);
+
+	for (ResourceInfoRecordBuffer *buffer : resource_info_buffers) {
+		AcquireSRWLockExclusive(&buffer->lock);
+		records.swap(buffer->records);
+		ReleaseSRWLockExclusive(&buffer->lock);
+
+		for (ResourceInfoRecord &record : records) {
+			info = &G->mResourceInfo[record.hash];
+			switch (record.type) {
+				case D3D11_RESOURCE_DIMENSION_BUFFER:
+					*info = record.buf_desc;
+					break;
+				case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+					*info = record.tex1d_desc;
+					break;
+				case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+					*info = record.tex2d_desc;
+					break;
+				case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+					*info = record.tex3d_desc;
+					break;
+			}
+			info->initial_data_used_in_hash = record.initial_data_used_in_hash;
+		}
+		records.clear();
+	}
+
+	ReleaseSRWLockShared(&resource_info_buffers_lock);
+	LeaveCriticalSectionPretty(&G->mResourceInfoLock);
+}
+
 // -----------------------------------------------------------------------------------------------
 //                       Automatic Data Structure Cleanup on Resource Release
 // -----------------------------------------------------------------------------------------------
@@ -1333,7 +1603,7 @@ ULONG STDMETHODCALLTYPE ResourceReleaseTracker::Release(void)
 
 		EnterCriticalSectionPretty(&G->mResourcesLock);
 		G->mResources.erase(resource);
-		LeaveCriticalSection(&G->mResourcesLock);
+		LeaveCriticalSectionPretty(&G->mResourcesLock);
 		delete this;
 	}
 	return ret;
@@ -1641,19 +1911,60 @@ static bool matches_draw_info(TextureOverride *tex_override, DrawCallInfo *call_
 	return true;
 }
 
+// Returns true if this fuzzy match will only ever match a single value, and
+// what that value is:
+static bool fuzzy_match_exact_value(FuzzyMatch *match, UINT *value)
+{
+	if (match->op != FuzzyMatchOp::EQUAL)
+		return false;
+	if (match->rhs_type1 != FuzzyMatchOperandType::VALUE)
+		return false;
+	if (match->mask != 0xffffffff || !match->denominator)
+		return false;
+
+	*value = match->val * match->numerator / match->denominator;
+	return true;
+}
+
+// Called once the TextureOverrides sharing a hash have been sorted. Indexes
+// those that match a single exact first index so that a draw call only has to
+// check the ones that could possibly match it.
+void build_texture_override_draw_index(TextureOverrideList *list)
+{
+	list->draw_index.Build((unsigned)list->size(), [list](unsigned pos, uint32_t *first_index) {
+		TextureOverride *tex_override = &(*list)[pos];
+
+		return tex_override->has_draw_context_match &&
+		       fuzzy_match_exact_value(&tex_override->match_first_index, first_index);
+	});
+}
+
 static void find_texture_override_for_hash(uint32_t hash, TextureOverrideMatches *matches, DrawCallInfo *call_info)
 {
 	TextureOverrideMap::iterator i;
 	TextureOverrideList::iterator j;
+	TextureOverrideList *list;
 
 	i = lookup_textureoverride(hash);
 	if (i == G->mTextureOverrideMap.end())
 		return;
-
-	for (j = i->second.begin(); j != i->second.end(); j++) {
-		if (matches_draw_info(&(*j), call_info))
-			matches->push_back(&(*j));
+	list = &i->second;
+
+	// Without a draw call none of the overrides with a draw context match
+	// can match, and if none of them match on an exact first index there
+	// is nothing for the index to narrow down:
+	if (!call_info || list->draw_index.empty()) {
+		for (j = list->begin(); j != list->end(); j++) {
+			if (matches_draw_info(&(*j), call_info))
+				matches->push_back(&(*j));
+		}
+		return;
 	}
+
+	list->draw_index.ForEachCandidate(call_info->FirstIndex, [list, matches, call_info](unsigned pos) {
+		if (matches_draw_info(&(*list)[pos], call_info))
+			matches->push_back(&(*list)[pos]);
+	});
 }
 
 static void find_texture_override_for_resource_by_hash(ID3D11Resource *resource, TextureOverrideMatches *matches, DrawCallInfo *call_info)
@@ -1666,20 +1977,38 @@ static void find_texture_override_for_resource_by_hash(ID3D11Resource *resource,
 	if (G->mTextureOverrideMap.empty())
 		return;
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-		hash = GetResourceHash(resource);
-	LeaveCriticalSection(&G->mCriticalSection);
+	hash = GetResourceHash(resource);
 	if (!hash)
 		return;
 
 	find_texture_override_for_hash(hash, matches, call_info);
 }
 
+static bool fuzzy_texture_override_may_match(const D3D11_BUFFER_DESC *desc)
+{
+	return G->mTextureOverrideFilter.fuzzy_may_match_buffer();
+}
+static bool fuzzy_texture_override_may_match(const D3D11_TEXTURE1D_DESC *desc)
+{
+	return G->mTextureOverrideFilter.fuzzy_may_match_tex1d();
+}
+static bool fuzzy_texture_override_may_match(const D3D11_TEXTURE2D_DESC *desc)
+{
+	return G->mTextureOverrideFilter.fuzzy_may_match_tex2d();
+}
+static bool fuzzy_texture_override_may_match(const D3D11_TEXTURE3D_DESC *desc)
+{
+	return G->mTextureOverrideFilter.fuzzy_may_match_tex3d();
+}
+
 template <typename DescType>
 static void find_texture_overrides_for_desc(const DescType *desc, TextureOverrideMatches *matches, DrawCallInfo *call_info)
 {
 	FuzzyTextureOverrides::iterator i;
 
+	if (!fuzzy_texture_override_may_match(desc))
+		return;
+
 	for (i = G->mFuzzyTextureOverrides.begin(); i != G->mFuzzyTextureOverrides.end(); i++) {
 		if ((*i)->matches(desc) && matches_draw_info((*i)->texture_override, call_info))
 			matches->push_back((*i)->texture_override);
@@ -11,6 +11,9 @@
 
 #include "util.h"
 #include "DrawCallInfo.h"
+#include "TextureOverrideFilter.h"
+
+uint64_t NextResourceWriteGeneration();
 
 // Tracks info about specific resource instances:
 struct ResourceHandleInfo
@@ -20,6 +23,12 @@ struct ResourceHandleInfo
 	uint32_t orig_hash;	// Original hash at the time of creation
 	uint32_t data_hash;	// Just the data hash for track_texture_updates
 
+	// Bumped whenever frame analysis sees something that may have written
+	// to this resource. Allocated from a global counter so that a new
+	// resource reusing the address of a released one never appears to
+	// have the same generation as its predecessor.
+	uint64_t write_generation;
+
 	// TODO: If we are sure we understand all possible differences between
 	// the original desc and that obtained by querying the resource we
 	// probably don't need to store these. One possible difference is the
@@ -37,7 +46,8 @@ struct ResourceHandleInfo
 		type(D3D11_RESOURCE_DIMENSION_UNKNOWN),
 		hash(0),
 		orig_hash(0),
-		data_hash(0)
+		data_hash(0),
+		write_generation(NextResourceWriteGeneration())
 	{}
 };
 
@@ -204,6 +214,18 @@ void PropagateResourceHash(ID3D11Resource *dst, ID3D11Resource *src);
 
 bool MapTrackResourceHashUpdate(ID3D11Resource *pResource, UINT Subresource);
 
+void MarkResourceWritten(ID3D11Resource *resource);
+void MarkViewResourceWritten(ID3D11View *view);
+void MarkResourcesWritten(ID3D11Resource *const *resources, unsigned count);
+void MarkAllResourcesWritten();
+bool GetResourceWriteGeneration(ID3D11Resource *resource, uint64_t *generation, LONG *epoch);
+
+void RecordResourceInfo(uint32_t hash, const D3D11_BUFFER_DESC *desc, bool initial_data_used_in_hash);
+void RecordResourceInfo(uint32_t hash, const D3D11_TEXTURE1D_DESC *desc, bool initial_data_used_in_hash);
+void RecordResourceInfo(uint32_t hash, const D3D11_TEXTURE2D_DESC *desc, bool initial_data_used_in_hash);
+void RecordResourceInfo(uint32_t hash, const D3D11_TEXTURE3D_DESC *desc, bool initial_data_used_in_hash);
+void DrainResourceInfo();
+
 int StrResourceDesc(char *buf, size_t size, const D3D11_BUFFER_DESC *desc);
 int StrResourceDesc(char *buf, size_t size, const D3D11_TEXTURE1D_DESC *desc);
 int StrResourceDesc(char *buf, size_t size, const D3D11_TEXTURE2D_DESC *desc);
@@ -366,6 +388,7 @@ public:
 // we'll hold off until post 1.3 since the FrameAnalysisOptions needs to go in
 // FrameAnalysis.h to make that work, and that is an area that diverged from 1.2:
 struct TextureOverride;
+struct TextureOverrideList;
 
 class FuzzyMatchResourceDesc {
 private:
@@ -422,3 +445,4 @@ typedef std::vector<TextureOverride*> TextureOverrideMatches;
 template <typename DescType>
 void find_texture_overrides(uint32_t hash, const DescType *desc, TextureOverrideMatches *matches, DrawCallInfo *call_info);
 void find_texture_overrides_for_resource(ID3D11Resource *resource, TextureOverrideMatches *matches, DrawCallInfo *call_info);
+void build_texture_override_draw_index(TextureOverrideList *list);
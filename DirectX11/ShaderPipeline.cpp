@@ -0,0 +1,244 @@
+#include "ShaderPipeline.h"
+#include "globals.h"
+#include "lock.h"
+#include "log.h"
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+CRITICAL_SECTION shader_pipeline_cache_lock;
+
+// Upper bound on the memory used by the cached artifacts. This only needs to
+// be large enough to hold the shaders someone is likely to be working with
+// during a hunting session - it is not intended to hold every shader in the
+// game, which would be far more than we want to keep around.
+static const size_t SHADER_PIPELINE_CACHE_BUDGET = 32 * 1024 * 1024;
+
+enum class PipelineStage {
+	DISASSEMBLY,
+	DECOMPILE,
+};
+
+struct PipelineKey
+{
+	PipelineStage stage;
+	UINT64 hash;
+	uint32_t crc;
+	size_t length;
+	size_t options;
+	// DecompilerSettings::CacheKey(), for the decompile stage:
+	std::string settings;
+
+	bool operator==(const PipelineKey &other) const
+	{
+		return stage == other.stage &&
+			hash == other.hash &&
+			crc == other.crc &&
+			length == other.length &&
+			options == other.options &&
+			settings == other.settings;
+	}
+};
+
+struct PipelineKeyHash
+{
+	size_t operator()(const PipelineKey &key) const
+	{
+		size_t h = std::hash<UINT64>()(key.hash);
+		h ^= std::hash<size_t>()(key.crc ^ ((size_t)key.stage << 24)) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		h ^= std::hash<size_t>()(key.options) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		h ^= std::hash<std::string>()(key.settings) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		return h;
+	}
+};
+
+struct PipelineArtifact
+{
+	std::string asm_text;
+	DecompiledShader decompiled;
+
+	size_t size() const
+	{
+		return asm_text.size() + decompiled.hlsl.size() + sizeof(PipelineArtifact);
+	}
+};
+
+typedef std::list<PipelineKey> PipelineLRU;
+struct PipelineEntry
+{
+	std::shared_ptr<const PipelineArtifact> artifact;
+	PipelineLRU::iterator lru;
+};
+
+static std::unordered_map<PipelineKey, PipelineEntry, PipelineKeyHash> pipeline_cache;
+static PipelineLRU pipeline_lru;
+static size_t pipeline_cache_size;
+
+// The disassembler and decompiler both stamp their output with the time it was
+// created. Cached artifacts may be hours old by the time they are used again,
+// so the stamp is brought up to date in each copy handed out:
+static const std::string asm_timestamp_marker =
+	"//   using 3Dmigoto v" + std::string(VER_FILE_VERSION_STR) + " on ";
+static const std::string hlsl_timestamp_marker =
+	"// ---- Created with 3Dmigoto v" + std::string(VER_FILE_VERSION_STR) + " on ";
+
+static void refresh_timestamp(std::string *text, const std::string &marker)
+{
+	size_t pos, end;
+
+	pos = text->find(marker);
+	if (pos == std::string::npos)
+		return;
+	pos += marker.size();
+
+	// LogTime() includes the newline:
+	end = text->find('\n', pos);
+	if (end == std::string::npos)
+		return;
+
+	text->replace(pos, end + 1 - pos, LogTime());
+}
+
+static PipelineKey make_key(PipelineStage stage, UINT64 hash, const void *pShaderBytecode, size_t BytecodeLength,
+		size_t options, const DecompilerSettings *settings = NULL)
+{
+	PipelineKey key;
+
+	key.stage = stage;
+	key.hash = hash;
+	key.crc = crc32c_hw(0, pShaderBytecode, BytecodeLength);
+	key.length = BytecodeLength;
+	key.options = options;
+	if (settings)
+		key.settings = settings->CacheKey();
+
+	return key;
+}
+
+static std::shared_ptr<const PipelineArtifact> lookup_artifact(const PipelineKey &key)
+{
+	std::shared_ptr<const PipelineArtifact> ret;
+
+	EnterCriticalSectionPretty(&shader_pipeline_cache_lock);
+
+	auto i = pipeline_cache.find(key);
+	if (i != pipeline_cache.end()) {
+		pipeline_lru.splice(pipeline_lru.begin(), pipeline_lru, i->second.lru);
+		ret = i->second.artifact;
+	}
+
+	LeaveCriticalSectionPretty(&shader_pipeline_cache_lock);
+
+	return ret;
+}
+
+static void store_artifact(const PipelineKey &key, std::shared_ptr<const PipelineArtifact> artifact)
+{
+	EnterCriticalSectionPretty(&shader_pipeline_cache_lock);
+
+	// Another thread may have raced us to create the same artifact:
+	if (pipeline_cache.count(key))
+		goto out_unlock;
+
+	pipeline_lru.push_front(key);
+	pipeline_cache[key] = { artifact, pipeline_lru.begin() };
+	pipeline_cache_size += artifact->size();
+
+	while (pipeline_cache_size > SHADER_PIPELINE_CACHE_BUDGET && pipeline_lru.size() > 1) {
+		auto i = pipeline_cache.find(pipeline_lru.back());
+		pipeline_cache_size -= i->second.artifact->size();
+		pipeline_cache.erase(i);
+		pipeline_lru.pop_back();
+	}
+
+out_unlock:
+	LeaveCriticalSectionPretty(&shader_pipeline_cache_lock);
+}
+
+// Memoised version of BinaryToAsmText(). The returned string is a copy, so
+// callers are free to modify it (e.g. for ShaderRegex).
+std::string CachedBinaryToAsmText(UINT64 hash, const void *pShaderBytecode, size_t BytecodeLength,
+		bool patch_cb_offsets, bool disassemble_undecipherable_data)
+{
+	std::shared_ptr<const PipelineArtifact> cached;
+	std::shared_ptr<PipelineArtifact> artifact;
+	std::string asm_text;
+	PipelineKey key;
+
+	key = make_key(PipelineStage::DISASSEMBLY, hash, pShaderBytecode, BytecodeLength,
+			(patch_cb_offsets ? 1 : 0) | (disassemble_undecipherable_data ? 2 : 0));
+
+	cached = lookup_artifact(key);
+	if (cached) {
+		LogDebug("    using cached disassembly of %016llx\n", hash);
+		asm_text = cached->asm_text;
+		refresh_timestamp(&asm_text, asm_timestamp_marker);
+		return asm_text;
+	}
+
+	artifact = std::make_shared<PipelineArtifact>();
+	artifact->asm_text = BinaryToAsmText(pShaderBytecode, BytecodeLength,
+			patch_cb_offsets, disassemble_undecipherable_data);
+	if (artifact->asm_text.empty())
+		return "";
+
+	store_artifact(key, artifact);
+	return artifact->asm_text;
+}
+
+// Memoised version of BinaryToAsmText() + DecompileBinaryHLSL() using the
+// global decompiler settings. If asm_text is not NULL it will receive the
+// disassembly the decompiler worked from. Returns false if either stage
+// failed, in which case the result should not be used. Failures are cached
+// as well so we don't keep retrying a shader the decompiler chokes on.
+bool CachedDecompileBinaryHLSL(UINT64 hash, const void *pShaderBytecode, size_t BytecodeLength,
+		std::string *asm_text, DecompiledShader *result)
+{
+	std::shared_ptr<const PipelineArtifact> cached;
+	std::shared_ptr<PipelineArtifact> artifact;
+	PipelineKey key;
+
+	key = make_key(PipelineStage::DECOMPILE, hash, pShaderBytecode, BytecodeLength,
+			0, &G->decompiler_settings);
+
+	cached = lookup_artifact(key);
+	if (cached) {
+		LogInfo("    using cached HLSL representation.\n");
+		if (asm_text) {
+			*asm_text = cached->asm_text;
+			refresh_timestamp(asm_text, asm_timestamp_marker);
+		}
+		*result = cached->decompiled;
+		refresh_timestamp(&result->hlsl, hlsl_timestamp_marker);
+		return !result->hlsl.empty() && !result->error;
+	}
+
+	artifact = std::make_shared<PipelineArtifact>();
+
+	// The decompiler cannot parse the patched CB offsets:
+	artifact->asm_text = CachedBinaryToAsmText(hash, pShaderBytecode, BytecodeLength, false);
+	if (artifact->asm_text.empty()) {
+		LogInfo("    disassembly of original shader failed.\n");
+		return false;
+	}
+
+	LogInfo("    creating HLSL representation.\n");
+
+	ParseParameters p;
+	p.bytecode = pShaderBytecode;
+	p.decompiled = artifact->asm_text.c_str();
+	p.decompiledSize = artifact->asm_text.size();
+	p.ZeroOutput = false;
+	p.G = &G->decompiler_settings;
+	artifact->decompiled.hlsl = DecompileBinaryHLSL(p, artifact->decompiled.patched,
+			artifact->decompiled.shader_model, artifact->decompiled.error,
+			&get_tls()->decompiler_ctx);
+
+	store_artifact(key, artifact);
+
+	if (asm_text)
+		*asm_text = artifact->asm_text;
+	*result = artifact->decompiled;
+	return !result->hlsl.empty() && !result->error;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+// The shader decompile pipeline runs the same chain of stages for a given
+// shader whether it is being auto-fixed at load, exported with export_hlsl, or
+// copied to ShaderFixes via hunting:
+//
+//   disassembly -> decompilation (incl. stereo auto-fix) -> D3DCompile
+//
+// These wrappers memoise the intermediate artifacts of the first two stages,
+// keyed by the shader hash, a checksum of the bytecode and the options that
+// affect that stage, so that repeated hunting operations and config reloads
+// that only touch a later stage's options do not have to redo the early ones.
+//
+// The stereo correction is applied by the decompiler while it parses the code,
+// so the decompiled HLSL is cached post-patching and keyed by the complete set
+// of decompiler settings rather than as a separate stage.
+
+struct DecompiledShader
+{
+	std::string hlsl;
+	std::string shader_model;
+	bool patched;
+	bool error;
+
+	DecompiledShader() :
+		patched(false),
+		error(false)
+	{}
+};
+
+extern CRITICAL_SECTION shader_pipeline_cache_lock;
+
+std::string CachedBinaryToAsmText(UINT64 hash, const void *pShaderBytecode, size_t BytecodeLength,
+		bool patch_cb_offsets, bool disassemble_undecipherable_data = true);
+bool CachedDecompileBinaryHLSL(UINT64 hash, const void *pShaderBytecode, size_t BytecodeLength,
+		std::string *asm_text, DecompiledShader *result);
@@ -643,6 +643,32 @@ void save_shader_regex_cache_bin(UINT64 hash, const wchar_t *shader_type, vector
 	fclose(f);
 }
 
+// Checks whether any ShaderRegex group is interested in shaders of this model
+// so that we can skip disassembling the shader altogether if none are. A
+// shader model of "bin" is resolved from the bytecode where possible, and the
+// result stored back in shader_model. If the model cannot be determined
+// without disassembling we err on the side of running the full check.
+bool shader_regex_groups_want_model(const void *bytecode, size_t length, std::string *shader_model)
+{
+	ShaderRegexGroups::iterator i;
+	DXBCMetadata meta;
+
+	if (*shader_model == std::string("bin")) {
+		if (!ProbeDXBCMetadata(bytecode, length, &meta) || meta.has_aon9)
+			return true;
+		*shader_model = std::string(meta.program_type) + "_" +
+			std::to_string(meta.major_version) + "_" +
+			std::to_string(meta.minor_version);
+	}
+
+	for (i = shader_regex_groups.begin(); i != shader_regex_groups.end(); i++) {
+		if (i->second.shader_models.count(*shader_model))
+			return true;
+	}
+
+	return false;
+}
+
 bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type, std::string *shader_model, UINT64 hash, std::wstring *tagline)
 {
 	ShaderRegexGroups::iterator i;
@@ -662,9 +688,6 @@ bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type
 	for (i = shader_regex_groups.begin(), j = 0; i != shader_regex_groups.end(); i++, j++) {
 		group = &i->second;
 
-		// FIXME: Don't even disassemble if the shader model isn't in
-		// any of the regex groups and we aren't applying any other
-		// forms of deferred patches
 		if (!group->shader_models.count(*shader_model))
 			continue;
 
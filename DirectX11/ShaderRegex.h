@@ -16,6 +16,7 @@ enum class ShaderRegexCache {
 	PATCH
 };
 
+bool shader_regex_groups_want_model(const void *bytecode, size_t length, std::string *shader_model);
 bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type, std::string *shader_model, UINT64 hash, std::wstring *tagline);
 ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode, std::wstring *tagline);
 void save_shader_regex_cache_bin(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode);
@@ -0,0 +1,286 @@
+#include "ShaderUsage.h"
+
+#include <string.h>
+
+const char *ShaderUsageStageTags[(int)ShaderUsageStage::COUNT] = {
+	"VertexShader",
+	"HullShader",
+	"DomainShader",
+	"GeometryShader",
+	"PixelShader",
+	"ComputeShader",
+};
+
+void ShaderUsageBatch::Merge(std::set<uint32_t> *shader_resource_info, std::set<uint32_t> *unordered_access_info)
+{
+	ShaderInfoData *info;
+
+	for (const ShaderUsageRecord &rec : records) {
+		info = &(*rec.info_map)[rec.shader];
+
+		switch (rec.type) {
+		case ShaderUsageType::PEER:
+			info->PeerShaders.insert(rec.peer);
+			break;
+		case ShaderUsageType::REGISTER:
+			// We are using the original resource hash for stat
+			// collection - things get tricky otherwise
+			if (rec.resource.orig_hash && shader_resource_info)
+				shader_resource_info->insert(rec.resource.orig_hash);
+			info->ResourceRegisters[rec.slot].insert(rec.resource);
+			break;
+		case ShaderUsageType::RENDER_TARGET:
+			while (info->RenderTargets.size() <= (size_t)rec.slot)
+				info->RenderTargets.push_back(std::set<ResourceSnapshot>());
+			info->RenderTargets[rec.slot].insert(rec.resource);
+			break;
+		case ShaderUsageType::DEPTH_TARGET:
+			info->DepthTargets.insert(rec.resource);
+			break;
+		case ShaderUsageType::UAV:
+			if (rec.resource.orig_hash && unordered_access_info)
+				unordered_access_info->insert(rec.resource.orig_hash);
+			info->UAVs[rec.slot].insert(rec.resource);
+			break;
+		}
+	}
+
+	records.clear();
+}
+
+// -----------------------------------------------------------------------------
+// ShaderUsage.bin
+
+static const char CAPTURE_MAGIC[4] = {'3', 'D', 'M', 'U'};
+static const uint32_t CAPTURE_VERSION = 1;
+
+// In addition to the ShaderUsageTypes, a record may mark that a shader is
+// present in the map (so shaders with no usage are still listed), or that a
+// resource is hash_contaminated:
+static const uint8_t CAPTURE_SHADER = 0x80;
+static const uint8_t CAPTURE_HASH_CONTAMINATED = 0x81;
+
+struct ShaderUsageCaptureHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t pointer_size;
+	uint32_t num_records;
+};
+
+struct ShaderUsageCaptureRecord
+{
+	uint64_t shader;
+	uint64_t peer_or_handle;
+	uint32_t hash;
+	uint32_t orig_hash;
+	int32_t slot;
+	uint8_t stage;
+	uint8_t type;
+	uint16_t reserved;
+};
+static_assert(sizeof(ShaderUsageCaptureRecord) == 32, "ShaderUsage.bin record size changed");
+
+static void capture_record(std::vector<ShaderUsageCaptureRecord> *records,
+		int stage, uint8_t type, uint64_t shader, int slot,
+		uint64_t peer_or_handle, uint32_t hash, uint32_t orig_hash)
+{
+	ShaderUsageCaptureRecord rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.shader = shader;
+	rec.peer_or_handle = peer_or_handle;
+	rec.hash = hash;
+	rec.orig_hash = orig_hash;
+	rec.slot = slot;
+	rec.stage = (uint8_t)stage;
+	rec.type = type;
+
+	records->push_back(rec);
+}
+
+static void capture_snapshots(std::vector<ShaderUsageCaptureRecord> *records,
+		int stage, ShaderUsageType type, uint64_t shader, int slot,
+		const std::set<ResourceSnapshot> &snapshots)
+{
+	for (const ResourceSnapshot &snapshot : snapshots) {
+		capture_record(records, stage, (uint8_t)type, shader, slot,
+				(uint64_t)(uintptr_t)snapshot.handle, snapshot.hash, snapshot.orig_hash);
+	}
+}
+
+bool WriteShaderUsageCapture(FILE *f, ShaderInfoMap *const info[(int)ShaderUsageStage::COUNT],
+		const std::set<uint32_t> &hash_contaminated)
+{
+	std::vector<ShaderUsageCaptureRecord> records;
+	ShaderUsageCaptureHeader header;
+	int stage, slot;
+
+	for (stage = 0; stage < (int)ShaderUsageStage::COUNT; stage++) {
+		for (auto &i : *info[stage]) {
+			capture_record(&records, stage, CAPTURE_SHADER, i.first, -1, 0, 0, 0);
+
+			for (uint64_t peer : i.second.PeerShaders)
+				capture_record(&records, stage, (uint8_t)ShaderUsageType::PEER, i.first, -1, peer, 0, 0);
+			for (auto &k : i.second.ResourceRegisters)
+				capture_snapshots(&records, stage, ShaderUsageType::REGISTER, i.first, k.first, k.second);
+			for (slot = 0; slot < (int)i.second.RenderTargets.size(); slot++)
+				capture_snapshots(&records, stage, ShaderUsageType::RENDER_TARGET, i.first, slot, i.second.RenderTargets[slot]);
+			capture_snapshots(&records, stage, ShaderUsageType::DEPTH_TARGET, i.first, -1, i.second.DepthTargets);
+			for (auto &k : i.second.UAVs)
+				capture_snapshots(&records, stage, ShaderUsageType::UAV, i.first, k.first, k.second);
+		}
+	}
+
+	for (uint32_t hash : hash_contaminated)
+		capture_record(&records, 0, CAPTURE_HASH_CONTAMINATED, 0, -1, 0, hash, hash);
+
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = CAPTURE_VERSION;
+	header.pointer_size = sizeof(void*);
+	header.num_records = (uint32_t)records.size();
+
+	if (fwrite(&header, sizeof(header), 1, f) != 1)
+		return false;
+	if (records.size() && fwrite(records.data(), sizeof(ShaderUsageCaptureRecord), records.size(), f) != records.size())
+		return false;
+	return true;
+}
+
+// Rebuilds the maps through a ShaderUsageBatch, the same way as they were
+// built in the process that wrote the capture:
+bool ReadShaderUsageCapture(FILE *f, ShaderUsageCapture *capture)
+{
+	ShaderUsageCaptureHeader header;
+	ShaderUsageCaptureRecord rec;
+	ShaderUsageBatch batch;
+	ShaderInfoMap *info_map;
+	bool due;
+	uint32_t i;
+
+	if (fread(&header, sizeof(header), 1, f) != 1)
+		return false;
+	if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) || header.version != CAPTURE_VERSION)
+		return false;
+	capture->pointer_size = header.pointer_size;
+
+	for (i = 0; i < header.num_records; i++) {
+		if (fread(&rec, sizeof(rec), 1, f) != 1)
+			return false;
+		if (rec.stage >= (int)ShaderUsageStage::COUNT)
+			return false;
+		info_map = &capture->info[rec.stage];
+		due = false;
+
+		switch (rec.type) {
+		case CAPTURE_SHADER:
+			(*info_map)[rec.shader];
+			break;
+		case CAPTURE_HASH_CONTAMINATED:
+			capture->hash_contaminated.insert(rec.orig_hash);
+			break;
+		case (uint8_t)ShaderUsageType::PEER:
+			due = batch.Record(info_map, rec.shader, ShaderUsageType::PEER, rec.slot,
+					ResourceSnapshot(NULL, 0, 0), rec.peer_or_handle);
+			break;
+		case (uint8_t)ShaderUsageType::REGISTER:
+		case (uint8_t)ShaderUsageType::RENDER_TARGET:
+		case (uint8_t)ShaderUsageType::DEPTH_TARGET:
+		case (uint8_t)ShaderUsageType::UAV:
+			if (rec.slot < -1 || (rec.type == (uint8_t)ShaderUsageType::RENDER_TARGET && rec.slot < 0))
+				return false;
+			due = batch.Record(info_map, rec.shader, (ShaderUsageType)rec.type, rec.slot,
+					ResourceSnapshot((ID3D11Resource*)(uintptr_t)rec.peer_or_handle,
+						rec.hash, rec.orig_hash));
+			break;
+		default:
+			return false;
+		}
+
+		if (due)
+			batch.Merge(NULL, NULL);
+	}
+
+	batch.Merge(NULL, NULL);
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// ShaderUsage.txt
+
+static void format_usage_register(std::string *out, const char *tag, int id,
+		const ResourceSnapshot &info, const std::set<uint32_t> &hash_contaminated,
+		unsigned pointer_size)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), "  <%s", tag);
+	*out += buf;
+
+	if (id != -1) {
+		snprintf(buf, sizeof(buf), " id=%d", id);
+		*out += buf;
+	}
+
+	// Formatted the same as %p in the MSVC runtime:
+	snprintf(buf, sizeof(buf), " handle=%0*llX", (int)pointer_size * 2,
+			(unsigned long long)(uintptr_t)info.handle);
+	*out += buf;
+
+	if (info.orig_hash != info.hash) {
+		snprintf(buf, sizeof(buf), " orig_hash=%08x", info.orig_hash);
+		*out += buf;
+	}
+
+	if (hash_contaminated.count(info.orig_hash))
+		*out += " hash_contaminated=true";
+
+	snprintf(buf, sizeof(buf), ">%08x</%s>\n", info.hash, tag);
+	*out += buf;
+}
+
+void FormatShaderUsageInfo(std::string *out, const ShaderInfoMap &info_map, const char *tag,
+		const std::set<uint32_t> &hash_contaminated, unsigned pointer_size)
+{
+	char buf[256];
+	int pos;
+
+	for (auto &i : info_map) {
+		snprintf(buf, sizeof(buf), "<%s hash=\"%016llx\">\n", tag, (unsigned long long)i.first);
+		*out += buf;
+
+		// Does not apply to compute shaders:
+		if (!i.second.PeerShaders.empty()) {
+			*out += "  <PeerShaders>";
+			for (uint64_t peer : i.second.PeerShaders) {
+				snprintf(buf, sizeof(buf), "%016llx ", (unsigned long long)peer);
+				*out += buf;
+			}
+			*out += "</PeerShaders>\n";
+		}
+
+		for (auto &k : i.second.ResourceRegisters) {
+			for (auto &o : k.second)
+				format_usage_register(out, "Register", k.first, o, hash_contaminated, pointer_size);
+		}
+
+		// Only applies to pixel shaders:
+		for (pos = 0; pos < (int)i.second.RenderTargets.size(); pos++) {
+			for (auto &o : i.second.RenderTargets[pos])
+				format_usage_register(out, "RenderTarget", pos, o, hash_contaminated, pointer_size);
+		}
+
+		// Only applies to pixel shaders:
+		for (auto &n : i.second.DepthTargets)
+			format_usage_register(out, "DepthTarget", -1, n, hash_contaminated, pointer_size);
+
+		// Applies to pixel and compute shaders:
+		for (auto &k : i.second.UAVs) {
+			for (auto &o : k.second)
+				format_usage_register(out, "UAV", k.first, o, hash_contaminated, pointer_size);
+		}
+
+		snprintf(buf, sizeof(buf), "</%s>\n", tag);
+		*out += buf;
+	}
+}
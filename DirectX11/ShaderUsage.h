@@ -0,0 +1,181 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// The data behind the shader sections of ShaderUsage.txt (dump_usage=1), and
+// the batching used to collect it from draw calls without taking a global
+// lock on every draw.
+//
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests and by the ShaderUsageReport tool, which renders the
+// shader sections of ShaderUsage.txt from the ShaderUsage.bin capture.
+
+struct ID3D11Resource;
+
+// We use this when collecting resource info for ShaderUsage.txt to take a
+// snapshot of the resource handle, hash and original hash. We used to just
+// save the resource handle, but that was problematic since handles can get
+// reused, and so we could record the wrong hash in the ShaderUsage.txt
+struct ResourceSnapshot
+{
+	ID3D11Resource *handle;
+	uint32_t hash;
+	uint32_t orig_hash;
+
+	ResourceSnapshot(ID3D11Resource *handle, uint32_t hash, uint32_t orig_hash):
+		handle(handle), hash(hash), orig_hash(orig_hash)
+	{}
+};
+static inline bool operator<(const ResourceSnapshot &lhs, const ResourceSnapshot &rhs)
+{
+	if (lhs.orig_hash != rhs.orig_hash)
+		return (lhs.orig_hash < rhs.orig_hash);
+	if (lhs.hash != rhs.hash)
+		return (lhs.hash < rhs.hash);
+	return (lhs.handle < rhs.handle);
+}
+
+struct ShaderInfoData
+{
+	// All are std::map or std::set so that ShaderUsage.txt is sorted - lookup time is O(log N)
+	std::map<int, std::set<ResourceSnapshot>> ResourceRegisters;
+	std::set<uint64_t> PeerShaders;
+	std::vector<std::set<ResourceSnapshot>> RenderTargets;
+	std::map<int, std::set<ResourceSnapshot>> UAVs;
+	std::set<ResourceSnapshot> DepthTargets;
+};
+
+typedef std::map<uint64_t, ShaderInfoData> ShaderInfoMap;
+
+enum class ShaderUsageType {
+	PEER,
+	REGISTER,
+	RENDER_TARGET,
+	DEPTH_TARGET,
+	UAV,
+};
+
+// One fixed size record per shader & peer or slot & resource seen in a draw
+// call. The resource hashes are snapshotted when the record is made, since
+// hash tracking may have changed them by the time the batch is merged.
+struct ShaderUsageRecord {
+	ShaderInfoMap *info_map;
+	uint64_t shader;
+	uint64_t peer;
+	ResourceSnapshot resource;
+	int slot;
+	ShaderUsageType type;
+
+	ShaderUsageRecord(ShaderInfoMap *info_map, uint64_t shader, ShaderUsageType type,
+			int slot, const ResourceSnapshot &resource, uint64_t peer) :
+		info_map(info_map),
+		shader(shader),
+		peer(peer),
+		resource(resource),
+		slot(slot),
+		type(type)
+	{}
+
+	bool operator==(const ShaderUsageRecord &other) const
+	{
+		return info_map == other.info_map &&
+			shader == other.shader &&
+			peer == other.peer &&
+			resource.handle == other.resource.handle &&
+			resource.hash == other.resource.hash &&
+			resource.orig_hash == other.resource.orig_hash &&
+			slot == other.slot &&
+			type == other.type;
+	}
+};
+
+struct ShaderUsageRecordHash {
+	size_t operator()(const ShaderUsageRecord &rec) const
+	{
+		size_t h = std::hash<uint64_t>()(rec.shader);
+		h ^= std::hash<uint64_t>()(rec.peer) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		h ^= std::hash<void*>()(rec.resource.handle) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		h ^= std::hash<uint64_t>()(((uint64_t)rec.resource.hash << 32) | rec.resource.orig_hash) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		h ^= std::hash<size_t>()(((size_t)rec.slot << 8) | (size_t)rec.type) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		return h;
+	}
+};
+
+// Usage records collected by one context between merges. Duplicates are
+// dropped as they are recorded, which is the common case since most draw
+// calls in a frame re-use the same shader & resource combinations. Not
+// thread safe - each context owns one, and merging into the shared maps is
+// left to the caller's locking.
+class ShaderUsageBatch
+{
+	std::unordered_set<ShaderUsageRecord, ShaderUsageRecordHash> records;
+
+public:
+	// Maximum number of distinct records to accumulate before the caller
+	// should merge them. This is normally only reached by games that draw
+	// with a huge variety of resources within a single frame.
+	static const size_t FLUSH_THRESHOLD = 16384;
+
+	// Returns true if the batch is due to be merged:
+	bool Record(ShaderInfoMap *info_map, uint64_t shader, ShaderUsageType type,
+			int slot, const ResourceSnapshot &resource, uint64_t peer = 0)
+	{
+		records.emplace(info_map, shader, type, slot, resource, peer);
+		return records.size() >= FLUSH_THRESHOLD;
+	}
+
+	bool empty() const
+	{
+		return records.empty();
+	}
+
+	// Merges the records into the ShaderInfoData maps they were recorded
+	// against and empties the batch. The original hashes of any shader
+	// resources and UAVs are also added to the given sets, which are the
+	// lists of resources in the other sections of ShaderUsage.txt.
+	void Merge(std::set<uint32_t> *shader_resource_info, std::set<uint32_t> *unordered_access_info);
+};
+
+// ShaderUsage.bin is a compact binary capture of the ShaderInfoData maps of
+// each shader type, written alongside ShaderUsage.txt. It is a header
+// followed by fixed size records equivalent to the ShaderUsageRecords that
+// were merged to build the maps, plus the hash_contaminated resources, so
+// the shader sections of ShaderUsage.txt can be rendered offline.
+enum class ShaderUsageStage {
+	VS,
+	HS,
+	DS,
+	GS,
+	PS,
+	CS,
+	COUNT
+};
+
+extern const char *ShaderUsageStageTags[(int)ShaderUsageStage::COUNT];
+
+struct ShaderUsageCapture
+{
+	ShaderInfoMap info[(int)ShaderUsageStage::COUNT];
+	std::set<uint32_t> hash_contaminated;
+	// Size of a pointer in the process that wrote the capture, so that
+	// resource handles are printed the same way as they were in-process:
+	unsigned pointer_size;
+
+	ShaderUsageCapture() :
+		pointer_size(sizeof(void*))
+	{}
+};
+
+bool WriteShaderUsageCapture(FILE *f, ShaderInfoMap *const info[(int)ShaderUsageStage::COUNT],
+		const std::set<uint32_t> &hash_contaminated);
+bool ReadShaderUsageCapture(FILE *f, ShaderUsageCapture *capture);
+
+// Renders the section of ShaderUsage.txt for one shader type:
+void FormatShaderUsageInfo(std::string *out, const ShaderInfoMap &info_map, const char *tag,
+		const std::set<uint32_t> &hash_contaminated, unsigned pointer_size = sizeof(void*));
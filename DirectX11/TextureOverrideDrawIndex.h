@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Index over the TextureOverrides sharing a hash, for mods that pick out many
+// sub-meshes of the same buffer with dozens of TextureOverrides that only
+// differ by match_first_index. Those that can only match a single exact first
+// index are sorted by it, so a draw call can find the handful it could match
+// with a binary search, while everything else has to be checked for every
+// draw call. Positions refer to the position in the sorted TextureOverride
+// list, which is the order of priority between them.
+//
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests.
+class TextureOverrideDrawIndex
+{
+private:
+	std::vector<std::pair<uint32_t, unsigned>> by_first_index;
+	std::vector<unsigned> unindexed;
+
+public:
+	// exact_first_index(pos, &first_index) returns true if the override at
+	// pos can only ever match the one first index it returns:
+	template <class ExactFirstIndex>
+	void Build(unsigned count, ExactFirstIndex exact_first_index)
+	{
+		uint32_t first_index;
+		unsigned pos;
+
+		by_first_index.clear();
+		unindexed.clear();
+
+		for (pos = 0; pos < count; pos++) {
+			if (exact_first_index(pos, &first_index))
+				by_first_index.emplace_back(first_index, pos);
+			else
+				unindexed.push_back(pos);
+		}
+
+		std::sort(by_first_index.begin(), by_first_index.end());
+	}
+
+	// If there are no exact first indices there is nothing for the index
+	// to narrow down, and the caller may as well walk the whole list:
+	bool empty() const
+	{
+		return by_first_index.empty();
+	}
+
+	// Calls visit(pos) for every override that could match a draw call
+	// with this first index, in the same priority order as the full list.
+	// The overrides matching this first index and the ones we could not
+	// index are both in list order, so this is a merge of the two.
+	template <class Visit>
+	void ForEachCandidate(uint32_t first_index, Visit visit) const
+	{
+		std::vector<std::pair<uint32_t, unsigned>>::const_iterator k, k_end;
+		std::vector<unsigned>::const_iterator l;
+		unsigned pos;
+
+		k = std::lower_bound(by_first_index.begin(), by_first_index.end(),
+				std::make_pair(first_index, 0u));
+		k_end = by_first_index.end();
+		l = unindexed.begin();
+		while (true) {
+			if (k != k_end && k->first == first_index &&
+			    (l == unindexed.end() || k->second < *l))
+				pos = (k++)->second;
+			else if (l != unindexed.end())
+				pos = *(l++);
+			else
+				break;
+
+			visit(pos);
+		}
+	}
+};
@@ -0,0 +1,114 @@
+#include "TextureOverrideFilter.h"
+
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static uint64_t* alloc_blocks(size_t num_blocks)
+{
+#ifdef _WIN32
+	return (uint64_t*)_aligned_malloc(num_blocks * 64, 64);
+#else
+	return (uint64_t*)aligned_alloc(64, num_blocks * 64);
+#endif
+}
+
+static void free_blocks(uint64_t *blocks)
+{
+#ifdef _WIN32
+	_aligned_free(blocks);
+#else
+	free(blocks);
+#endif
+}
+
+TextureOverrideFilter::TextureOverrideFilter() :
+	blocks(NULL),
+	num_blocks_allocated(0),
+	block_mask(0),
+	fuzzy_buffer(true),
+	fuzzy_tex1d(true),
+	fuzzy_tex2d(true),
+	fuzzy_tex3d(true)
+{}
+
+TextureOverrideFilter::~TextureOverrideFilter()
+{
+	free_blocks(blocks);
+	for (uint64_t *retired : retired_blocks)
+		free_blocks(retired);
+}
+
+// Clears the filter and sizes it for the given number of hashes, which must
+// all be passed to insert() before it will give the right answers again.
+// Returns false if the filter could not be allocated, in which case it will
+// let every lookup through to the full TextureOverride map.
+bool TextureOverrideFilter::reset(size_t num_hashes)
+{
+	uint64_t *new_blocks;
+	size_t num_blocks = 1;
+
+	while (num_blocks * 512 < num_hashes * BITS_PER_HASH)
+		num_blocks <<= 1;
+
+	fuzzy_buffer = fuzzy_tex1d = fuzzy_tex2d = fuzzy_tex3d = false;
+
+	// Anything that raced the previous reload has long since finished
+	// with the allocations it retired:
+	for (uint64_t *retired : retired_blocks)
+		free_blocks(retired);
+	retired_blocks.clear();
+
+	// Readers may be using the mask to index the current blocks, so mask
+	// them down to the first block before touching them. Any of these
+	// allocations has at least one block:
+	block_mask = 0;
+
+	if (num_blocks > num_blocks_allocated) {
+		new_blocks = alloc_blocks(num_blocks);
+		if (!new_blocks) {
+			if (blocks)
+				retired_blocks.push_back(blocks);
+			blocks = NULL;
+			num_blocks_allocated = 0;
+			return false;
+		}
+		memset(new_blocks, 0, num_blocks * 64);
+		if (blocks)
+			retired_blocks.push_back(blocks);
+		blocks = new_blocks;
+		num_blocks_allocated = num_blocks;
+	} else
+		memset(blocks, 0, num_blocks_allocated * 64);
+
+	block_mask = num_blocks - 1;
+	return true;
+}
+
+void TextureOverrideFilter::insert(uint32_t hash)
+{
+	uint64_t *block;
+	uint64_t h, bits;
+	unsigned i, bit;
+
+	if (!blocks)
+		return;
+
+	h = mix(hash);
+	block = blocks + ((size_t)(h >> 40) & block_mask) * 8;
+	bits = mix(h);
+	for (i = 0; i < BITS_SET_PER_HASH; i++, bits >>= 9) {
+		bit = bits & 511;
+		block[bit >> 6] |= 1ULL << (bit & 63);
+	}
+}
+
+void TextureOverrideFilter::insert_fuzzy(bool buffer, bool tex1d, bool tex2d, bool tex3d)
+{
+	fuzzy_buffer = fuzzy_buffer || buffer;
+	fuzzy_tex1d = fuzzy_tex1d || tex1d;
+	fuzzy_tex2d = fuzzy_tex2d || tex2d;
+	fuzzy_tex3d = fuzzy_tex3d || tex3d;
+}
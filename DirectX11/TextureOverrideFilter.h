@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Compact summary of the TextureOverride sections in the config, consulted
+// before the full lookups so that the common case of a resource that has no
+// TextureOverride can be answered from a single cache line. Hashes go into a
+// blocked bloom filter - each hash selects one 64 byte block and tests a few
+// bits within it - which may give false positives (in which case the full
+// lookup is done as usual), but never false negatives. Fuzzy matches are
+// summarised by which resource types any of them could match.
+//
+// This is rebuilt in place along with the TextureOverride sections when the
+// config is (re)loaded, and like the TextureOverride map it is read without a
+// lock, so anything racing a config reload may briefly see no overrides.
+//
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests.
+class TextureOverrideFilter {
+private:
+	static const unsigned BITS_PER_HASH = 16;
+	static const unsigned BITS_SET_PER_HASH = 7;
+
+	uint64_t *blocks; // 8 words per block
+	size_t num_blocks_allocated;
+	size_t block_mask;
+	// Allocations replaced by a larger one during a reload are kept until
+	// the following reload in case anything racing the first one is still
+	// reading from them:
+	std::vector<uint64_t*> retired_blocks;
+
+	bool fuzzy_buffer;
+	bool fuzzy_tex1d;
+	bool fuzzy_tex2d;
+	bool fuzzy_tex3d;
+
+	static inline uint64_t mix(uint64_t x)
+	{
+		// splitmix64 finaliser. The hashes we are given are already
+		// CRCs, but that alone is not enough to spread them evenly
+		// over both the block index and the bits within it:
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+public:
+	TextureOverrideFilter();
+	~TextureOverrideFilter();
+
+	bool reset(size_t num_hashes);
+	void insert(uint32_t hash);
+	void insert_fuzzy(bool buffer, bool tex1d, bool tex2d, bool tex3d);
+
+	bool might_contain(uint32_t hash) const
+	{
+		const uint64_t *block;
+		uint64_t h, bits;
+		unsigned i, bit;
+
+		// No filter (never built, or out of memory) has to fall back
+		// to the full lookup - answering "no" here would hide every
+		// TextureOverride:
+		if (!blocks)
+			return true;
+
+		h = mix(hash);
+		block = blocks + ((size_t)(h >> 40) & block_mask) * 8;
+		bits = mix(h);
+		for (i = 0; i < BITS_SET_PER_HASH; i++, bits >>= 9) {
+			bit = bits & 511;
+			if (!(block[bit >> 6] & (1ULL << (bit & 63))))
+				return false;
+		}
+		return true;
+	}
+
+	bool fuzzy_may_match_buffer() const { return fuzzy_buffer; }
+	bool fuzzy_may_match_tex1d() const { return fuzzy_tex1d; }
+	bool fuzzy_may_match_tex2d() const { return fuzzy_tex2d; }
+	bool fuzzy_may_match_tex3d() const { return fuzzy_tex3d; }
+};
@@ -18,6 +18,9 @@
 #include "CommandList.h"
 #include "profiling.h"
 #include "lock.h"
+#include "ResourceCreationLock.h"
+#include "ShaderUsage.h"
+#include "TextureOverrideDrawIndex.h"
 
 extern HINSTANCE migoto_handle;
 
@@ -154,6 +157,7 @@ enum class FrameAnalysisOptions {
 	FMT_DESC        = 0x00000800,
 
 	// Masks:
+	DUMP_BIND_MASK  = 0x0000003f, // Any bind selection, to check if a draw call will dump anything
 	DUMP_XB_MASK    = 0x00000038, // CB+VB+IB, to check if a user specified any of these
 	FMT_2D_MASK     = 0x000009c0, // Mask of Texture2D formats
 	FMT_BUF_MASK    = 0x00000e00, // Mask of Buffer formats
@@ -329,41 +333,17 @@ typedef std::unordered_map<ID3D11Resource *, ResourceHandleInfo> ResourceMap;
 // We can't use a std::set to enforce this ordering, as that makes the
 // TextureOverrides const, but there are a few places we modify it. Instead, we
 // will sort it in the ini parser when we create the list.
-typedef std::vector<struct TextureOverride> TextureOverrideList;
-typedef std::unordered_map<uint32_t, TextureOverrideList> TextureOverrideMap;
-
-// We use this when collecting resource info for ShaderUsage.txt to take a
-// snapshot of the resource handle, hash and original hash. We used to just
-// save the resource handle, but that was problematic since handles can get
-// reused, and so we could record the wrong hash in the ShaderUsage.txt
-struct ResourceSnapshot
-{
-	ID3D11Resource *handle;
-	uint32_t hash;
-	uint32_t orig_hash;
-
-	ResourceSnapshot(ID3D11Resource *handle, uint32_t hash, uint32_t orig_hash):
-		handle(handle), hash(hash), orig_hash(orig_hash)
-	{}
-};
-static inline bool operator<(const ResourceSnapshot &lhs, const ResourceSnapshot &rhs)
+//
+// Mods that pick out many sub-meshes of the same buffer can have dozens of
+// TextureOverrides sharing a hash that only differ by match_first_index, so
+// once sorted these are also indexed by the exact first index they match
+// (see build_texture_override_draw_index), allowing a draw call to find the
+// handful it could possibly match with a binary search.
+struct TextureOverrideList : public std::vector<struct TextureOverride>
 {
-	if (lhs.orig_hash != rhs.orig_hash)
-		return (lhs.orig_hash < rhs.orig_hash);
-	if (lhs.hash != rhs.hash)
-		return (lhs.hash < rhs.hash);
-	return (lhs.handle < rhs.handle);
-}
-
-struct ShaderInfoData
-{
-	// All are std::map or std::set so that ShaderUsage.txt is sorted - lookup time is O(log N)
-	std::map<int, std::set<ResourceSnapshot>> ResourceRegisters;
-	std::set<UINT64> PeerShaders;
-	std::vector<std::set<ResourceSnapshot>> RenderTargets;
-	std::map<int, std::set<ResourceSnapshot>> UAVs;
-	std::set<ResourceSnapshot> DepthTargets;
+	TextureOverrideDrawIndex draw_index;
 };
+typedef std::unordered_map<uint32_t, TextureOverrideList> TextureOverrideMap;
 
 enum class GetResolutionFrom {
 	INVALID       = -1,
@@ -444,6 +424,10 @@ struct Globals
 
 	UINT hunting;
 	bool fix_enabled;
+	// Bumped whenever something changes that may alter which draw calls
+	// need processing, e.g. hunting being toggled or a config reload, to
+	// tell each HackerContext to refresh its draw processing mask:
+	volatile LONG draw_processing_epoch;
 	bool config_reloadable;
 	bool show_original_enabled;
 	time_t huntTime;
@@ -455,6 +439,7 @@ struct Globals
 	bool frame_analysis_registered;
 	bool analyse_frame;
 	unsigned analyse_frame_no;
+	unsigned analyse_readback_depth;
 	wchar_t ANALYSIS_PATH[MAX_PATH];
 	FrameAnalysisOptions def_analyse_options, cur_analyse_options;
 	std::unordered_set<void*> frame_analysis_seen_rts;
@@ -499,7 +484,42 @@ struct Globals
 	bool cursor_upscaling_bypass;
 	bool check_foreground_window;
 
+	// 3DMigoto's global state is split between a few domain locks, which
+	// must always be taken in this order (enforced by lock.cpp in debug
+	// builds, or with debug_locks=1):
+	//
+	//   mCriticalSection:   Config, command lists, shader overrides and the
+	//                       shader tables (mShaders, mReloadedShaders,
+	//                       mOriginalShaders). Held for the entirety of a
+	//                       config reload or shader reload.
+	//   mHuntingLock:       Hunting visit/selection sets and the ShaderUsage
+	//                       statistics (mVisited*, mSelected*, m*Info)
+	//   mResourceInfoLock:  mResourceInfo, mCopiedResourceInfo, and the
+	//                       current hash of each entry in mResources
+	//   mResourcesLock:     mResources itself (see the warning below)
+	//
+	// The shader pipeline cache and the pre-substantiation queue have their
+	// own leaf locks, and must never take any of the above while held.
+	//
+	// mCriticalSection is still a coarse lock covering several domains
+	// that have not been split apart yet. Each is listed with the rank it
+	// will get once it has a lock of its own:
+	//
+	//   Config, command lists and shader/texture overrides: stay under
+	//     mCriticalSection at CONFIG. Config reload holds it throughout.
+	//   Shader tables: a new rank between CONFIG and HUNTING. Config and
+	//     shader reload, ShaderRegex patching and DeferredShaderReplacement
+	//     take them under the config, and shader marking takes the hunting
+	//     lock while holding them.
+	//   HackerDevice registry (lookup/register/unregister_hacker_device):
+	//     LEAF, since none of our other locks are taken while it is held.
+	//
+	// The overlay does not take mCriticalSection. Its notice queue lock
+	// would also be LEAF, but it is initialised from a global constructor
+	// where it cannot safely be registered with a rank, so it will need to
+	// be initialised from InitD311() first.
 	CRITICAL_SECTION mCriticalSection;
+	CRITICAL_SECTION mHuntingLock;
 
 	std::set<uint32_t> mVisitedIndexBuffers;				// std::set is sorted for consistent order while hunting
 	uint32_t mSelectedIndexBuffer;
@@ -549,6 +569,7 @@ struct Globals
 	ShaderOverrideMap mShaderOverrideMap;
 	TextureOverrideMap mTextureOverrideMap;
 	FuzzyTextureOverrides mFuzzyTextureOverrides;
+	TextureOverrideFilter mTextureOverrideFilter;
 
 	// Statistics
 	///////////////////////////////////////////////////////////////////////
@@ -566,9 +587,9 @@ struct Globals
 	// is another locking order dependency in the other direction,       //
 	// leading to an AB-BA type deadlock.                                //
 	//                                                                   //
-	// If you ever need to obtain both mCriticalSection and              //
-	// mResourcesLock simultaneously, be sure to take mCriticalSection   //
-	// first so as not to introduce a three way AB-BC-CA deadlock.       //
+	// If you ever need to obtain any of the other domain locks together //
+	// with mResourcesLock, be sure to take mResourcesLock last so as    //
+	// not to introduce a three way AB-BC-CA deadlock.                   //
 	//                                                                   //
 	// It's recommended to enable debug_locks=1 when working on any code //
 	// dealing with these locks to detect ordering violations that have  //
@@ -581,6 +602,7 @@ struct Globals
 	std::unordered_map<ID3D11Asynchronous*, AsyncQueryType> mQueryTypes;
 
 	// These five items work with the *original* resource hash:
+	CRITICAL_SECTION mResourceInfoLock;
 	ResourceInfoMap mResourceInfo;
 	std::set<uint32_t> mRenderTargetInfo;					// std::set so that ShaderUsage.txt is sorted - lookup time is O(log N)
 	std::set<uint32_t> mUnorderedAccessInfo;				// std::set so that ShaderUsage.txt is sorted - lookup time is O(log N)
@@ -627,6 +649,7 @@ struct Globals
 
 		hunting(HUNTING_MODE_DISABLED),
 		fix_enabled(true),
+		draw_processing_epoch(0),
 		config_reloadable(false),
 		show_original_enabled(false),
 		huntTime(0),
@@ -638,6 +661,7 @@ struct Globals
 		frame_analysis_registered(false),
 		analyse_frame(false),
 		analyse_frame_no(0),
+		analyse_readback_depth(4),
 		def_analyse_options(FrameAnalysisOptions::INVALID),
 		cur_analyse_options(FrameAnalysisOptions::INVALID),
 
@@ -744,9 +768,29 @@ struct TLS
 	bool hooking_quirk_protection;
 
 	LockStack locks_held;
+	RankedLocksHeld ranked_locks_held;
+
+	ResourceCreationLockNesting resource_creation_lock_nesting;
+
+	// Scratch memory reused by the assembler & decompiler on this thread,
+	// since shaders are assembled and decompiled in bulk at load time:
+	AssemblerContext assembler_ctx;
+	DecompilerContext decompiler_ctx;
+
+	// Where this thread records the descriptions of resources it creates
+	// while hunting, until they are drained into mResourceInfo:
+	struct ResourceInfoRecordBuffer *resource_info_buffer;
+
+	// The ini section this thread last looked up a key in, and the
+	// generation of the section map it was found in:
+	const void *ini_section_cache;
+	unsigned ini_section_cache_generation;
 
 	TLS() :
-		hooking_quirk_protection(false)
+		hooking_quirk_protection(false),
+		resource_info_buffer(NULL),
+		ini_section_cache(NULL),
+		ini_section_cache_generation(0)
 	{}
 };
 
@@ -793,5 +837,10 @@ static inline ResourceMap::iterator lookup_resource_handle_info(ID3D11Resource *
 
 static inline TextureOverrideMap::iterator lookup_textureoverride(uint32_t hash)
 {
+	if (!G->mTextureOverrideFilter.might_contain(hash)) {
+		if (Profiling::mode == Profiling::Mode::SUMMARY)
+			Profiling::textureoverride_filter_rejections++;
+		return G->mTextureOverrideMap.end();
+	}
 	return Profiling::lookup_map(G->mTextureOverrideMap, hash, &Profiling::textureoverride_lookup_overhead);
 }
@@ -20,12 +20,12 @@
 // d) The driver
 //
 // We can only see the 3DMigoto locks directly, but those are the least
-// interesting because by itself it is fairly simple, with little more than one
-// big lock protecting a whole bunch of data structures and therefore minimal
-// potential for deadlocks (but perhaps some confusion over when exactly we
-// need to take the lock and why - we would be good to adopt the kernel's
-// way of looking at things to reduce that confusion: that data structures are
-// locked, not code).
+// interesting because by itself it is fairly simple, with a handful of domain
+// locks that are always taken in a fixed order (see LockRank in lock.h) and
+// therefore minimal potential for deadlocks (but perhaps some confusion over
+// when exactly we need to take each lock and why - we would be good to adopt
+// the kernel's way of looking at things to reduce that confusion: that data
+// structures are locked, not code).
 //
 // Things get more interesting when DirectX and a multi-threaded game is in the
 // mix, because we have the potential that we might get called with a already
@@ -73,6 +73,25 @@ static uintptr_t ntdll_base, ntdll_end;
 static uintptr_t apphelp_base, apphelp_end;
 
 static std::unordered_map<CRITICAL_SECTION*, std::string> lock_names;
+
+// Locks registered with a rank are checked against the acquisition order
+// documented by LockRank. This is independent of the dependency graph - it
+// catches a violation the first time the offending path runs, rather than
+// only once both sides of a potential deadlock have been seen. Only written
+// while initialising, so no lock is needed to read it.
+struct ranked_lock_info {
+	CRITICAL_SECTION *lock;
+	LockRank rank;
+};
+static std::vector<ranked_lock_info> ranked_locks;
+static SRWLOCK lock_order_reported_lock = SRWLOCK_INIT;
+static std::set<std::pair<char*, int>> lock_order_reported;
+
+#ifdef _DEBUG
+static bool lock_order_checks_enabled = true;
+#else
+static bool lock_order_checks_enabled;
+#endif
 static const char* lock_name(CRITICAL_SECTION *lock, char buf[20])
 {
 	auto i = lock_names.find(lock);
@@ -355,8 +374,92 @@ static void EnterCriticalSectionHook(CRITICAL_SECTION *lock)
 	get_tls()->hooking_quirk_protection = false;
 }
 
+static LockRank lock_rank(CRITICAL_SECTION *lock)
+{
+	for (auto &info : ranked_locks) {
+		if (info.lock == lock)
+			return info.rank;
+	}
+	return LockRank::NONE;
+}
+
+static void check_lock_order(RankedLocksHeld *held, CRITICAL_SECTION *new_lock,
+		LockRank new_rank, char *function, int line)
+{
+	CRITICAL_SECTION *held_lock = NULL;
+	char buf1[20], buf2[20];
+	bool reported;
+	int rank;
+
+	// Critical sections are re-entrant, so taking a lock we already hold
+	// is fine regardless of what else we have taken since:
+	if (held->depth[(int)new_rank] && held->lock[(int)new_rank] == new_lock)
+		return;
+
+	for (rank = (int)new_rank; rank < NUM_LOCK_RANKS; rank++) {
+		if (held->depth[rank]) {
+			held_lock = held->lock[rank];
+			break;
+		}
+	}
+	if (!held_lock)
+		return;
+
+	// Only report each offending call site once:
+	AcquireSRWLockExclusive(&lock_order_reported_lock);
+	reported = !lock_order_reported.insert({function, line}).second;
+	ReleaseSRWLockExclusive(&lock_order_reported_lock);
+	if (reported)
+		return;
+
+	LogOverlay(LOG_NOTICE, "%04x: Lock order violation: %s taken while holding %s in %s(%d)\n",
+			GetCurrentThreadId(), lock_name(new_lock, buf1), lock_name(held_lock, buf2), function, line);
+	dump_stack_trace();
+
+	if (IsDebuggerPresent())
+		__debugbreak();
+}
+
+// Each thread counts the ranked locks it enters and leaves through the Pretty
+// wrappers in its TLS, rather than asking the critical section who owns it.
+// Locks entered before the checks were enabled are not counted, so leaving
+// those must not take the depth below zero.
+static void ranked_lock_entered(CRITICAL_SECTION *lock, char *function, int line)
+{
+	RankedLocksHeld *held;
+	LockRank rank;
+
+	rank = lock_rank(lock);
+	if (rank == LockRank::NONE)
+		return;
+
+	held = &get_tls()->ranked_locks_held;
+	check_lock_order(held, lock, rank, function, line);
+
+	if (!held->depth[(int)rank])
+		held->lock[(int)rank] = lock;
+	held->depth[(int)rank]++;
+}
+
+static void ranked_lock_left(CRITICAL_SECTION *lock)
+{
+	RankedLocksHeld *held;
+	LockRank rank;
+
+	rank = lock_rank(lock);
+	if (rank == LockRank::NONE)
+		return;
+
+	held = &get_tls()->ranked_locks_held;
+	if (held->depth[(int)rank])
+		held->depth[(int)rank]--;
+}
+
 void _EnterCriticalSectionPretty(CRITICAL_SECTION *lock, char *function, int line)
 {
+	if (lock_order_checks_enabled)
+		ranked_lock_entered(lock, function, line);
+
 	if (!lock_dependency_checks_enabled)
 		return EnterCriticalSection(lock);
 
@@ -374,6 +477,14 @@ void _EnterCriticalSectionPretty(CRITICAL_SECTION *lock, char *function, int lin
 	get_tls()->hooking_quirk_protection = false;
 }
 
+void LeaveCriticalSectionPretty(CRITICAL_SECTION *lock)
+{
+	if (lock_order_checks_enabled)
+		ranked_lock_left(lock);
+
+	LeaveCriticalSection(lock);
+}
+
 static BOOL TryEnterCriticalSectionHook(CRITICAL_SECTION *lock)
 {
 	BOOL ret = _TryEnterCriticalSection(lock);
@@ -431,6 +542,73 @@ static void LeaveCriticalSectionHook(CRITICAL_SECTION *lock)
 	get_tls()->hooking_quirk_protection = false;
 }
 
+// SRW locks share the lock graph and lock stacks with critical sections. Their
+// address is only ever used to identify them, never dereferenced as a critical
+// section, so borrowing the type is harmless:
+static CRITICAL_SECTION* srw_lock_key(SRWLOCK *lock)
+{
+	return (CRITICAL_SECTION*)lock;
+}
+
+bool _AcquireSRWLockPretty(SRWLOCK *lock, bool exclusive, char *function, int line)
+{
+	bool tracked = false;
+	bool contended = false;
+
+	if (lock_dependency_checks_enabled && !get_tls()->hooking_quirk_protection) {
+		get_tls()->hooking_quirk_protection = true;
+		tracked = true;
+
+		LockStack &locks_held = get_tls()->locks_held;
+		push_lock(locks_held, srw_lock_key(lock), (uintptr_t)_ReturnAddress(), function, line);
+		validate_lock(locks_held, srw_lock_key(lock));
+	}
+
+	if (exclusive) {
+		if (!TryAcquireSRWLockExclusive(lock)) {
+			contended = true;
+			AcquireSRWLockExclusive(lock);
+		}
+	} else {
+		if (!TryAcquireSRWLockShared(lock)) {
+			contended = true;
+			AcquireSRWLockShared(lock);
+		}
+	}
+
+	if (tracked)
+		get_tls()->hooking_quirk_protection = false;
+
+	return contended;
+}
+
+void ReleaseSRWLockPretty(SRWLOCK *lock, bool exclusive)
+{
+	if (exclusive)
+		ReleaseSRWLockExclusive(lock);
+	else
+		ReleaseSRWLockShared(lock);
+
+	if (!lock_dependency_checks_enabled || get_tls()->hooking_quirk_protection)
+		return;
+	get_tls()->hooking_quirk_protection = true;
+
+	LockStack *locks_held = &(get_tls()->locks_held);
+	for (auto i = locks_held->rbegin(); i != locks_held->rend(); i++) {
+		if (i->lock == srw_lock_key(lock)) {
+			locks_held->erase(i.base() - 1);
+			break;
+		}
+	}
+
+	get_tls()->hooking_quirk_protection = false;
+}
+
+void NameSRWLock(SRWLOCK *lock, char *lock_name)
+{
+	lock_names[srw_lock_key(lock)] = lock_name;
+}
+
 static void DeleteCriticalSectionHook(CRITICAL_SECTION *lock)
 {
 	// If a TLS structure hasn't been allocated yet for this thread, we
@@ -469,7 +647,7 @@ static void DeleteCriticalSectionHook(CRITICAL_SECTION *lock)
 	_DeleteCriticalSection(lock);
 }
 
-void _InitializeCriticalSectionPretty(CRITICAL_SECTION *lock, char *lock_name)
+void _InitializeCriticalSectionPretty(CRITICAL_SECTION *lock, char *lock_name, LockRank rank)
 {
 	InitializeCriticalSection(lock);
 	// NOTE: If we have been called from a global constructor, this may
@@ -481,6 +659,8 @@ void _InitializeCriticalSectionPretty(CRITICAL_SECTION *lock, char *lock_name)
 	// 3DMigoto Loader.exe is in use.
 	// https://yosefk.com/c++fqa/ctors.html#fqa-10.12
 	lock_names[lock] = lock_name;
+	if (rank != LockRank::NONE)
+		ranked_locks.push_back({lock, rank});
 }
 
 void enable_lock_dependency_checks()
@@ -492,6 +672,7 @@ void enable_lock_dependency_checks()
 	if (lock_dependency_checks_enabled)
 		return;
 	lock_dependency_checks_enabled = true;
+	lock_order_checks_enabled = true;
 
 	InitializeCriticalSectionPretty(&graph_lock);
 
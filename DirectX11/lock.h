@@ -9,14 +9,60 @@
 	_EnterCriticalSectionPretty(lock, __FUNCTION__, __LINE__)
 void _EnterCriticalSectionPretty(CRITICAL_SECTION *lock, char *function, int line);
 
+// Locks entered with EnterCriticalSectionPretty must be left with this, so
+// that the lock order checks know which ranked locks this thread still holds:
+void LeaveCriticalSectionPretty(CRITICAL_SECTION *lock);
+
+// 3DMigoto's domain locks must be taken in this order. A thread holding one
+// of these may take any lock of a higher rank, but never one of a lower rank.
+// Locks with the same rank are never held together. Unranked locks are not
+// checked against the order (but are still covered by debug_locks=1).
+// See the comments above mCriticalSection in globals.h for what each protects.
+enum class LockRank {
+	NONE = 0,
+	CONFIG,         // G->mCriticalSection
+	HUNTING,        // G->mHuntingLock
+	RESOURCE_INFO,  // G->mResourceInfoLock
+	RESOURCES,      // G->mResourcesLock
+	LEAF,           // Anything that never takes another lock while held
+};
+static const int NUM_LOCK_RANKS = (int)LockRank::LEAF + 1;
+
+// Which ranked locks this thread holds, kept in its TLS. Only one lock of each
+// rank can be held at a time, so one slot per rank is enough, with a depth
+// since critical sections are re-entrant.
+struct RankedLocksHeld {
+	CRITICAL_SECTION *lock[NUM_LOCK_RANKS];
+	unsigned depth[NUM_LOCK_RANKS];
+
+	RankedLocksHeld() :
+		lock(),
+		depth()
+	{}
+};
+
 // Use this when initialising a critical section in 3DMigoto to give it a nice
-// name in lock stack dumps rather than using its address.
+// name in lock stack dumps rather than using its address. The ranked version
+// also registers the lock to have its acquisition order checked in debug
+// builds, or whenever debug_locks=1.
 //
 // **AVOID CALLING THIS FROM GLOBAL CONSTRUCTORS**
 // https://yosefk.com/c++fqa/ctors.html#fqa-10.12
 #define InitializeCriticalSectionPretty(lock) \
 	_InitializeCriticalSectionPretty(lock, #lock)
-void _InitializeCriticalSectionPretty(CRITICAL_SECTION *lock, char *lock_name);
+#define InitializeCriticalSectionRanked(lock, rank) \
+	_InitializeCriticalSectionPretty(lock, #lock, rank)
+void _InitializeCriticalSectionPretty(CRITICAL_SECTION *lock, char *lock_name, LockRank rank = LockRank::NONE);
+
+// SRW locks are not covered by the critical section hooks, so 3DMigoto's own
+// SRW locks use these to show up in lock stack dumps and take part in the lock
+// dependency checks when debug_locks=1. They are not recursive and are not
+// ranked. Acquiring returns true if the lock was contended.
+#define AcquireSRWLockPretty(lock, exclusive) \
+	_AcquireSRWLockPretty(lock, exclusive, __FUNCTION__, __LINE__)
+bool _AcquireSRWLockPretty(SRWLOCK *lock, bool exclusive, char *function, int line);
+void ReleaseSRWLockPretty(SRWLOCK *lock, bool exclusive);
+void NameSRWLock(SRWLOCK *lock, char *lock_name);
 
 void enable_lock_dependency_checks();
 struct held_lock_info {
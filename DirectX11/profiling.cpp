@@ -46,8 +46,11 @@ namespace Profiling {
 	unsigned max_copies_per_frame_exceeded;
 	unsigned injected_draw_calls;
 	unsigned skipped_draw_calls;
+	unsigned fast_path_draw_calls;
 	unsigned max_executions_per_frame_exceeded;
 	unsigned iniparams_updates;
+	unsigned textureoverride_filter_rejections;
+	volatile LONG resource_creation_lock_contention;
 }
 
 static LARGE_INTEGER profiling_start_time;
@@ -120,6 +123,19 @@ static void update_txt_cto_warning()
 	Profiling::text += L" (post [TextureOverride] commands):\n" + Profiling::cto_warning;
 }
 
+static double textureoverride_false_positive_rate()
+{
+	unsigned negatives = Profiling::textureoverride_filter_rejections +
+		Profiling::textureoverride_lookup_overhead.count -
+		Profiling::textureoverride_lookup_overhead.hits;
+
+	if (!negatives)
+		return 0.0;
+
+	return 100.0 * (Profiling::textureoverride_lookup_overhead.count -
+			Profiling::textureoverride_lookup_overhead.hits) / negatives;
+}
+
 static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER freq, unsigned frames)
 {
 	LARGE_INTEGER present_overhead = {0};
@@ -265,6 +281,23 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 	);
 	Profiling::text += buf;
 
+	_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
+			    L"\n"
+			    L"Resource creation lock contended: %4u times\n",
+			    (unsigned)Profiling::resource_creation_lock_contention
+	);
+	Profiling::text += buf;
+
+	// Every lookup that got past the filter but missed in the map was a
+	// false positive:
+	_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
+			    L"TextureOverride filter: %u/%u rejected/frame, %.2f%% false positives\n",
+			    Profiling::textureoverride_filter_rejections / frames,
+			    (Profiling::textureoverride_filter_rejections + Profiling::textureoverride_lookup_overhead.count) / frames,
+			    textureoverride_false_positive_rate()
+	);
+	Profiling::text += buf;
+
 	_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
 			    L"\n"
 			    L"GPU Performance Impacting Stats (costs are guidelines only):\n"
@@ -281,6 +314,7 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 			    L"    max_copies_per_frame exceeded: %4u/frame (Cost saving)\n"
 			    L"     Injected draw/dispatch calls: %4u/frame\n"
 			    L"               Skipped draw calls: %4u/frame (Cost saving)\n"
+			    L"    Fast path draw/dispatch calls: %4u/frame (Cost saving)\n"
 			    L"max_executions_per_frame exceeded: %4u/frame (Cost saving)\n"
 			    ,
 			    Profiling::iniparams_updates / frames, G->iniParams.size() * sizeof(DirectX::XMFLOAT4),
@@ -296,6 +330,7 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 			    Profiling::max_copies_per_frame_exceeded / frames,
 			    Profiling::injected_draw_calls / frames,
 			    Profiling::skipped_draw_calls / frames,
+			    Profiling::fast_path_draw_calls / frames,
 			    Profiling::max_executions_per_frame_exceeded / frames
 	);
 	Profiling::text += buf;
@@ -475,8 +510,11 @@ void Profiling::clear()
 	max_copies_per_frame_exceeded = 0;
 	injected_draw_calls = 0;
 	skipped_draw_calls = 0;
+	fast_path_draw_calls = 0;
 	max_executions_per_frame_exceeded = 0;
 	iniparams_updates = 0;
+	textureoverride_filter_rejections = 0;
+	resource_creation_lock_contention = 0;
 
 	start_frame_no = G->frame_no;
 	QueryPerformanceCounter(&profiling_start_time);
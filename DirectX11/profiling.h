@@ -97,8 +97,11 @@ namespace Profiling {
 	extern unsigned max_copies_per_frame_exceeded;
 	extern unsigned injected_draw_calls;
 	extern unsigned skipped_draw_calls;
+	extern unsigned fast_path_draw_calls;
 	extern unsigned max_executions_per_frame_exceeded;
 	extern unsigned iniparams_updates;
+	extern unsigned textureoverride_filter_rejections;
+	extern volatile LONG resource_creation_lock_contention; // Updated from multiple threads
 
 	// NvAPI profiling:
 
@@ -25,6 +25,7 @@
 #include <algorithm>
 
 #include "DecompileHLSL.h"
+#include "DecompilerOutput.h"
 
 #include "BinaryDecompiler\internal_includes\structs.h"
 #include "BinaryDecompiler\internal_includes\decode.h"
@@ -176,7 +177,7 @@ public:
 
 	DecompilerSettings *G;
 
-	vector<char> mOutput;
+	DecompilerOutput mOutput;
 	size_t mCodeStartPos;		// Used as index into buffer, name misleadingly suggests pointer usage.
 	bool mErrorOccurred;
 	bool mPatched;
@@ -427,7 +428,7 @@ public:
 		mRemappedInputRegisters.clear();
 		// Write header.  Extra space handles odd case for no input and no output sections.
 		const char *inputHeader = "\nvoid main(\n";
-		mOutput.insert(mOutput.end(), inputHeader, inputHeader + strlen(inputHeader));
+		mOutput.append(inputHeader, inputHeader + strlen(inputHeader));
 
 		// Read until header.
 		const char *headerid = "// Input signature:";
@@ -507,7 +508,7 @@ public:
 			// Write, e.g.  centroid  float4 v4 : TEXCOORD2,
 			char buffer[256];
 			sprintf(buffer, "  %s%s %s : %s%d,\n", modifier.c_str(), format2, regNameStr.c_str(), name, index);
-			mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+			mOutput.append(buffer, buffer + strlen(buffer));
 			NextLine(c, pos, size);
 			// End?
 			if (!strncmp(c + pos, "//\n", 3) || !strncmp(c + pos, "//\r", 3))
@@ -591,7 +592,7 @@ public:
 				// Write.
 				char buffer[256];
 				sprintf(buffer, "  out %s %s : %s%d,\n", format2, regNameStr.c_str(), name, index);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 				if (!strcmp(name, "SV_Position"))
 					mSV_Position = regNameStr;
 				mOutputRegisterType[regNameStr] = TranslateType(format2);
@@ -607,7 +608,7 @@ public:
 				numRead = sscanf_s(c + pos, "// %s %d %s %s %s %s",
 					name, UCOUNTOF(name), &index, mask, UCOUNTOF(mask), reg, UCOUNTOF(reg), sysValue, UCOUNTOF(sysValue), format, UCOUNTOF(format));
 				sprintf(buffer, "  out %s %s : %s,\n", format, reg, name);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			if (numRead != 6)
 			{
@@ -623,7 +624,7 @@ public:
 		mOutput.pop_back();
 		mOutput.pop_back();
 		const char *mainFooter = ")\n{\n";
-		mOutput.insert(mOutput.end(), mainFooter, mainFooter + strlen(mainFooter));
+		mOutput.append(mainFooter, mainFooter + strlen(mainFooter));
 	}
 
 	void WriteZeroOutputSignature(const char *c, size_t size)
@@ -675,7 +676,7 @@ public:
 				// Write.
 				char buffer[256];
 				sprintf(buffer, "  %s = 0;\n", regNameStr.c_str());
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			else if (numRead == 3)
 			{
@@ -685,7 +686,7 @@ public:
 				// Write.
 				char buffer[256];
 				sprintf(buffer, "  %s = 0;\n", sysValue);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			if (numRead != 6)
 			{
@@ -999,7 +1000,7 @@ public:
 	{
 		char buffer[256];
 		_snprintf_s(buffer, 256, 256, "\n");
-		mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+		mOutput.append(buffer, buffer + strlen(buffer));
 
 		for (map<int, string>::iterator i = mSamplerNames.begin(); i != mSamplerNames.end(); ++i)
 		{
@@ -1018,13 +1019,13 @@ public:
 				"  MipLODBias = -100;\n"
 				"};\n", i->second.c_str(), i->first+5);
 				*/
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			else if (mSamplerNamesArraySize[i->first] > 1)
 			{
 				string baseName = i->second.substr(0, i->second.find('['));
 				sprintf(buffer, "SamplerState %s[%d] : register(s%d);\n", baseName.c_str(), mSamplerNamesArraySize[i->first], i->first);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 		}
 		for (map<int, string>::iterator i = mSamplerComparisonNames.begin(); i != mSamplerComparisonNames.end(); ++i)
@@ -1044,13 +1045,13 @@ public:
 				"  MipLODBias = -100;\n"
 				"};\n", i->second.c_str(), i->first+5);
 				*/
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			else if (mSamplerComparisonNamesArraySize[i->first] > 1)
 			{
 				string baseName = i->second.substr(0, i->second.find('['));
 				sprintf(buffer, "SamplerComparisonState %s[%d] : register(s%d);\n", baseName.c_str(), mSamplerComparisonNamesArraySize[i->first], i->first);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 		}
 		for (map<int, string>::iterator i = mTextureNames.begin(); i != mTextureNames.end(); ++i)
@@ -1058,13 +1059,13 @@ public:
 			if (mTextureNamesArraySize[i->first] == 1)
 			{
 				sprintf(buffer, "%s %s : register(t%d);\n", mTextureType[i->first].c_str(), i->second.c_str(), i->first);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			else if (mTextureNamesArraySize[i->first] > 1)
 			{
 				string baseName = i->second.substr(0, i->second.find('['));
 				sprintf(buffer, "%s %s[%d] : register(t%d);\n", mTextureType[i->first].c_str(), baseName.c_str(), mTextureNamesArraySize[i->first], i->first);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 		}
 		for (map<int, string>::iterator i = mUAVNames.begin(); i != mUAVNames.end(); ++i)
@@ -1072,13 +1073,13 @@ public:
 			if (mUAVNamesArraySize[i->first] == 1)
 			{
 				sprintf(buffer, "%s %s : register(u%d);\n", mUAVType[i->first].c_str(), i->second.c_str(), i->first);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			else if (mUAVNamesArraySize[i->first] > 1)
 			{
 				string baseName = i->second.substr(0, i->second.find('['));
 				sprintf(buffer, "%s %s[%d] : register(u%d);\n", mUAVType[i->first].c_str(), baseName.c_str(), mUAVNamesArraySize[i->first], i->first);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 		}
 	}
@@ -1171,7 +1172,7 @@ public:
 			char buffer[256];
 			if (name[0] == '$') name[0] = '_';
 			_snprintf_s(buffer, 256, 256, "\ncbuffer %s : register(b%d)\n{\n", name, bufferRegister);
-			mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+			mOutput.append(buffer, buffer + strlen(buffer));
 			do
 			{
 				const char *eolPos = strchr(c + pos, '\n');
@@ -1199,22 +1200,22 @@ public:
 				if (strstr(buffer, " struct\n") || strstr(buffer, " struct ") || strstr(buffer, "//   struct\r\n")) //dx9
 				{
 					++structLevel;
-					mOutput.insert(mOutput.end(), '\n');
+					mOutput.append('\n');
 					for (int i = -1; i < structLevel; ++i)
 					{
-						mOutput.insert(mOutput.end(), ' '); mOutput.insert(mOutput.end(), ' ');
+						mOutput.append(' '); mOutput.append(' ');
 					}
 					const char *structHeader = strstr(buffer, "struct");
 					// Can't use structure declaration: If we use the structure name, it has to be copied on top.
 					//if (structLevel)
 					structHeader = "struct\n";
-					mOutput.insert(mOutput.end(), structHeader, structHeader + strlen(structHeader));
+					mOutput.append(structHeader, structHeader + strlen(structHeader));
 					for (int i = -1; i < structLevel; ++i)
 					{
 						mOutput.push_back(' '); mOutput.push_back(' ');
 					}
 					const char *structHeader2 = "{\n";
-					mOutput.insert(mOutput.end(), structHeader2, structHeader2 + strlen(structHeader2));
+					mOutput.append(structHeader2, structHeader2 + strlen(structHeader2));
 					//skip struct's next line"//   {\r\n" //dx9 (Was there a point to this commented out line? -DSS)
 					NextLine(c, pos, size);
 					continue;
@@ -1244,7 +1245,7 @@ public:
 					{
 						mOutput.push_back(' '); mOutput.push_back(' ');
 					}
-					mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+					mOutput.append(buffer, buffer + strlen(buffer));
 					// Prefix struct attributes.
 					if (structLevel < 0) {
 						logDecompileError("structLevel is negative - malformed shader?\n");
@@ -1486,7 +1487,7 @@ public:
 						}
 						else
 							sprintf(buffer, "  %s%s%s %s = %s;\n", structSpacing.c_str(), modifier.c_str(), type, name, bString.c_str());
-						mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+						mOutput.append(buffer, buffer + strlen(buffer));
 					}
 					// Special int case, to avoid converting to float badly, creating #QNAN instead. 
 					else if (e.bt == DT_int || e.bt == DT_int2 || e.bt == DT_int3 || e.bt == DT_int4)
@@ -1506,15 +1507,15 @@ public:
 						else
 							sprintf(buffer, "  %s%s%s %s = {", structSpacing.c_str(), modifier.c_str(), type, name);
 						
-						mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+						mOutput.append(buffer, buffer + strlen(buffer));
 
 						for (int i = 0; i < numRead - 1; ++i)
 						{
 							sprintf(buffer, "%i,", in[i]);
-							mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+							mOutput.append(buffer, buffer + strlen(buffer));
 						}
 						sprintf(buffer, "%i};\n", in[numRead - 1]);
-						mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+						mOutput.append(buffer, buffer + strlen(buffer));
 					}
 					else if (e.bt == DT_float || e.bt == DT_float2 || e.bt == DT_float3 || e.bt == DT_float4)
 					{
@@ -1532,15 +1533,15 @@ public:
 						else
 							sprintf(buffer, "  %s%s%s %s = {", structSpacing.c_str(), modifier.c_str(), type, name);
 
-						mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+						mOutput.append(buffer, buffer + strlen(buffer));
 
 						for (int i = 0; i < numRead - 1; ++i)
 						{
 							sprintf(buffer, "%.9g,", v[i]);
-							mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+							mOutput.append(buffer, buffer + strlen(buffer));
 						}
 						sprintf(buffer, "%.9g};\n", v[numRead - 1]);
-						mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+						mOutput.append(buffer, buffer + strlen(buffer));
 					}
 					// Only 4x4 for now, not sure this is all working, so going with known needed case.
 					else if (e.bt == DT_float4x4)
@@ -1567,15 +1568,15 @@ public:
 						else
 							sprintf(buffer, "  %s%s%s %s = {", structSpacing.c_str(), modifier.c_str(), type, name);
 
-						mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+						mOutput.append(buffer, buffer + strlen(buffer));
 
 						for (int i = 0; i < 16 - 1; ++i)
 						{
 							sprintf(buffer, "%.9g,", v[i]);
-							mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+							mOutput.append(buffer, buffer + strlen(buffer));
 						}
 						sprintf(buffer, "%.9g};\n", v[15]);
-						mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+						mOutput.append(buffer, buffer + strlen(buffer));
 					}
 					// If we don't know what the initializer is, let's not just keep reading through it.  Let's now scan 
 					// them and output them, with a bad line in between for hand-fixing.  But, the shader will be generated.
@@ -1610,13 +1611,13 @@ public:
 					}
 					else
 						sprintf(buffer, "  %s%s%s %s;\n", structSpacing.c_str(), modifier.c_str(), type, name);
-					mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+					mOutput.append(buffer, buffer + strlen(buffer));
 				}
 			} while (strncmp(c + pos, "// }", 4));
 			
 			// Write closing declaration.
 			const char *endBuffer = "}\n";
-			mOutput.insert(mOutput.end(), endBuffer, endBuffer + strlen(endBuffer));
+			mOutput.append(endBuffer, endBuffer + strlen(endBuffer));
 		}
 	}
 
@@ -1771,7 +1772,7 @@ public:
 				}
 			}
 			hlsl += "};\n";
-			mOutput.insert(mOutput.end(), hlsl.begin(), hlsl.end());
+			mOutput.append(hlsl.begin(), hlsl.end());
 		}
 	}
 
@@ -2913,7 +2914,7 @@ public:
 					{
 						pos = strchr(lastPos, '\n');
 						const char *viewDirectionDecl = "\nout float3 viewDirection : TEXCOORD31,";
-						mOutput.insert(mOutput.begin() + (pos - mOutput.data()), viewDirectionDecl, viewDirectionDecl + strlen(viewDirectionDecl));
+						mOutput.insert(pos - mOutput.data(), viewDirectionDecl, viewDirectionDecl + strlen(viewDirectionDecl));
 					}
 					// Add view direction calculation.
 					char buf[512];
@@ -2921,19 +2922,19 @@ public:
 						sprintf(buf, "  viewDirection = float3(%s);\n", G->BackProject_Vector1.c_str());
 					else
 						sprintf(buf, "  viewDirection = float3(%s);\n", G->BackProject_Vector2.c_str());
-					mOutput.insert(mOutput.end() - 1, buf, buf + strlen(buf));
+					mOutput.insert(mOutput.size() - 1, buf, buf + strlen(buf));
 					mPatched = true;
 
 					// If we have a projection, make mono.
 					if (viewProjectMatrix)
 					{
-						vector<char>::iterator writePos = mOutput.end() - 1;
-						if (*writePos != '\n') --writePos;
+						size_t writePos = mOutput.size() - 1;
+						if (mOutput[writePos] != '\n') --writePos;
 						mOutput.insert(writePos, StereoDecl, StereoDecl + strlen(StereoDecl));
 						stereoParamsWritten = true;
 						char buffer[256];
 						sprintf(buffer, "%s.x -= separation * (%s.w - convergence);\n", mSV_Position.c_str(), mSV_Position.c_str());
-						mOutput.insert(mOutput.end() - 1, buffer, buffer + strlen(buffer));
+						mOutput.insert(mOutput.size() - 1, buffer, buffer + strlen(buffer));
 					}
 				}
 				mOutput.pop_back();
@@ -2965,22 +2966,22 @@ public:
 							// Write params before return;.
 							if (!stereoParamsWritten)
 							{
-								vector<char>::iterator writePos = mOutput.end() - 1;
-								while (*writePos != '\n')
+								size_t writePos = mOutput.size() - 1;
+								while (mOutput[writePos] != '\n')
 									--writePos;
 								--writePos;
-								while (*writePos != '\n')
+								while (mOutput[writePos] != '\n')
 									--writePos;
 								mOutput.insert(writePos, StereoDecl, StereoDecl + strlen(StereoDecl));
 								stereoParamsWritten = true;
 							}
 
 							// Back up to before the final return statement to output.
-							vector<char>::iterator writePos = mOutput.end() - 1;
-							while (*writePos != '\n')
+							size_t writePos = mOutput.size() - 1;
+							while (mOutput[writePos] != '\n')
 								--writePos;
 							--writePos;
-							while (*writePos != '\n')
+							while (mOutput[writePos] != '\n')
 								--writePos;
 							char buffer[256];
 							string outputReg = i->first;
@@ -3051,8 +3052,7 @@ public:
 						{
 							// Copy depth texture usage to top.
 							//mCodeStartPos = mOutput.insert(mOutput.begin() + mCodeStartPos, buf, buf + strlen(buf)) - mOutput.begin();
-							vector<char>::iterator iter = mOutput.insert(mOutput.begin() + mCodeStartPos, buf, buf + strlen(buf));
-							mCodeStartPos = iter - mOutput.begin();
+							mOutput.insert(mCodeStartPos, buf, buf + strlen(buf));
 							mCodeStartPos += strlen(buf);
 						}
 						else if (!wposAvailable)
@@ -3060,14 +3060,14 @@ public:
 							// Leave declaration where it is.
 							while (*pos != '\n') --pos;
 							//mCodeStartPos = mOutput.insert(mOutput.begin() + (pos + 1 - mOutput.data()), buf, buf + strlen(buf)) - mOutput.begin();
-							vector<char>::iterator iter = mOutput.insert(mOutput.begin() + (pos + 1 - mOutput.data()), buf, buf + strlen(buf));
-							mCodeStartPos = iter - mOutput.begin();
+							mCodeStartPos = pos + 1 - mOutput.data();
+							mOutput.insert(mCodeStartPos, buf, buf + strlen(buf));
 							mCodeStartPos += strlen(buf);
 						}
 						else
 						{
 							while (*pos != '\n') --pos;
-							mOutput.insert(mOutput.begin() + (pos + 1 - mOutput.data()), buf, buf + strlen(buf));
+							mOutput.insert(pos + 1 - mOutput.data(), buf, buf + strlen(buf));
 						}
 						searchPos += strlen(buf);
 						wposAvailable = true;
@@ -3107,10 +3107,10 @@ public:
 							endPos = strchr(endPos, '\n');
 							while (*--endPos != ')'); ++endPos; pos += 3;
 							string depthBufferStatement(pos, endPos);
-							vector<char>::iterator wpos = mOutput.begin();
-							wpos = mOutput.erase(wpos + (pos - mOutput.data()), wpos + (endPos - mOutput.data()));
+							size_t wpos = pos - mOutput.data();
+							mOutput.erase(wpos, endPos - mOutput.data());
 							const char ZPOS_REG[] = "zpos4";
-							wpos = mOutput.insert(wpos, ZPOS_REG, ZPOS_REG + strlen(ZPOS_REG));
+							mOutput.insert(wpos, ZPOS_REG, ZPOS_REG + strlen(ZPOS_REG));
 							char buf[256];
 							sprintf(buf, "float4 zpos4 = %s;\n"
 								"float zTex = zpos4.%c;\n"
@@ -3133,17 +3133,16 @@ public:
 							{
 								// Copy depth texture usage to top.
 								//mCodeStartPos = mOutput.insert(mOutput.begin() + mCodeStartPos, buf, buf + strlen(buf)) - mOutput.begin();
-								vector<char>::iterator iter = mOutput.insert(mOutput.begin() + mCodeStartPos, buf, buf + strlen(buf));
-								mCodeStartPos = iter - mOutput.begin();
+								mOutput.insert(mCodeStartPos, buf, buf + strlen(buf));
 								mCodeStartPos += strlen(buf);
 							}
 							else
 							{
 								// Leave declaration where it is.
-								while (*wpos != '\n') --wpos;
+								while (mOutput[wpos] != '\n') --wpos;
 								//mCodeStartPos = mOutput.insert(wpos + 1, buf, buf + strlen(buf)) - mOutput.begin();
-								vector<char>::iterator iter = mOutput.insert(wpos + 1, buf, buf + strlen(buf));
-								mCodeStartPos = iter - mOutput.begin();
+								mCodeStartPos = wpos + 1;
+								mOutput.insert(mCodeStartPos, buf, buf + strlen(buf));
 								mCodeStartPos += strlen(buf);
 							}
 							wposAvailable = true;
@@ -3184,8 +3183,8 @@ public:
 						pos = strchr(pos, '\n');
 
 						//mCodeStartPos = mOutput.insert(mOutput.begin() + (pos - mOutput.data()), buf, buf + strlen(buf)) - mOutput.begin();
-						vector<char>::iterator iter = mOutput.insert(mOutput.begin() + (pos - mOutput.data()), buf, buf + strlen(buf));
-						mCodeStartPos = iter - mOutput.begin();
+						mCodeStartPos = pos - mOutput.data();
+						mOutput.insert(mCodeStartPos, buf, buf + strlen(buf));
 						mCodeStartPos += strlen(buf);
 						wposAvailable = true;
 					}
@@ -3201,8 +3200,7 @@ public:
 					"float wpos = 1.0 / zpos;\n";
 				// Copy depth texture usage to top.
 				//mCodeStartPos = mOutput.insert(mOutput.begin() + mCodeStartPos, INJECT_HEADER, INJECT_HEADER + strlen(INJECT_HEADER)) - mOutput.begin();
-				vector<char>::iterator iter = mOutput.insert(mOutput.begin() + mCodeStartPos, INJECT_HEADER, INJECT_HEADER + strlen(INJECT_HEADER));
-				mCodeStartPos = iter - mOutput.begin();
+				mOutput.insert(mCodeStartPos, INJECT_HEADER, INJECT_HEADER + strlen(INJECT_HEADER));
 				mCodeStartPos += strlen(INJECT_HEADER);
 
 				// Add screen position parameter.
@@ -3225,7 +3223,7 @@ public:
 				assert(pos != NULL);
 
 				const char *PARAM_HEADER = "\nfloat4 injectedScreenPos : SV_Position,";
-				mOutput.insert(mOutput.begin() + (pos - mOutput.data()), PARAM_HEADER, PARAM_HEADER + strlen(PARAM_HEADER));
+				mOutput.insert(pos - mOutput.data(), PARAM_HEADER, PARAM_HEADER + strlen(PARAM_HEADER));
 				mCodeStartPos += strlen(PARAM_HEADER);
 				wposAvailable = true;
 			}
@@ -3254,8 +3252,7 @@ public:
 					{
 						if (mOutput[mCodeStartPos] != '\n') --mCodeStartPos;
 						//mCodeStartPos = mOutput.insert(mOutput.begin() + mCodeStartPos, StereoDecl, StereoDecl + strlen(StereoDecl)) - mOutput.begin();
-						vector<char>::iterator iter = mOutput.insert(mOutput.begin() + mCodeStartPos, StereoDecl, StereoDecl + strlen(StereoDecl));
-						mCodeStartPos = iter - mOutput.begin();
+						mOutput.insert(mCodeStartPos, StereoDecl, StereoDecl + strlen(StereoDecl));
 						mCodeStartPos += strlen(StereoDecl);
 						stereoParamsWritten = true;
 					}
@@ -3279,7 +3276,7 @@ public:
 								if (dotPos >= 0) regName = regName.substr(0, dotPos + 2);
 								while (*mpos != '\n') --mpos;
 								sprintf(buf, "\n%s -= separation * (wpos - convergence);", regName.c_str());
-								mOutput.insert(mOutput.begin() + (mpos - mOutput.data()), buf, buf + strlen(buf));
+								mOutput.insert(mpos - mOutput.data(), buf, buf + strlen(buf));
 								mPatched = true;
 							}
 							else
@@ -3295,7 +3292,7 @@ public:
 									if (dotPos >= 0) regName = regName.substr(0, dotPos + 2);
 									while (*mpos != '\n') --mpos;
 									sprintf(buf, "\n%s -= separation * (wpos - convergence);", regName.c_str());
-									mOutput.insert(mOutput.begin() + (mpos - mOutput.data()), buf, buf + strlen(buf));
+									mOutput.insert(mpos - mOutput.data(), buf, buf + strlen(buf));
 									mPatched = true;
 								}
 							}
@@ -3344,7 +3341,7 @@ public:
 									op4, lightPosDecl[2], uuidVar);
 								++uuidVar;
 								pos = strchr(pos, '\n');
-								mOutput.insert(mOutput.begin() + (pos - mOutput.data()), buf, buf + strlen(buf));
+								mOutput.insert(pos - mOutput.data(), buf, buf + strlen(buf));
 								offset += strlen(buf);
 								mPatched = true;
 								if (!parameterWritten)
@@ -3353,7 +3350,7 @@ public:
 									char *posParam2 = strstr(mOutput.data(), ParamPos2);
 									char *posParam = posParam1 ? posParam1 : posParam2;
 									while (*posParam != '\n') --posParam;
-									mOutput.insert(mOutput.begin() + (posParam - mOutput.data()), NewParam, NewParam + strlen(NewParam));
+									mOutput.insert(posParam - mOutput.data(), NewParam, NewParam + strlen(NewParam));
 									offset += strlen(NewParam);
 									parameterWritten = true;
 								}
@@ -3399,7 +3396,7 @@ public:
 									op4, spotPosDecl[2], uuidVar);
 								++uuidVar;
 								pos = strchr(pos, '\n');
-								mOutput.insert(mOutput.begin() + (pos - mOutput.data()), buf, buf + strlen(buf));
+								mOutput.insert(pos - mOutput.data(), buf, buf + strlen(buf));
 								offset += strlen(buf);
 								mPatched = true;
 								if (!parameterWritten)
@@ -3408,7 +3405,7 @@ public:
 									char *posParam2 = strstr(mOutput.data(), ParamPos2);
 									char *posParam = posParam1 ? posParam1 : posParam2;
 									while (*posParam != '\n') --posParam;
-									mOutput.insert(mOutput.begin() + (posParam - mOutput.data()), NewParam, NewParam + strlen(NewParam));
+									mOutput.insert(posParam - mOutput.data(), NewParam, NewParam + strlen(NewParam));
 									offset += strlen(NewParam);
 									parameterWritten = true;
 								}
@@ -3443,7 +3440,7 @@ public:
 								regName2.c_str(), uuidVar,
 								regName3.c_str(), uuidVar);
 							++uuidVar;
-							mOutput.insert(mOutput.begin() + (pos - mOutput.data()), buf, buf + strlen(buf));
+							mOutput.insert(pos - mOutput.data(), buf, buf + strlen(buf));
 							mPatched = true;
 
 							if (!parameterWritten)
@@ -3454,7 +3451,7 @@ public:
 								if (posParam != NULL)
 								{
 									while (*posParam != '\n') --posParam;
-									mOutput.insert(mOutput.begin() + (posParam - mOutput.data()), NewParam, NewParam + strlen(NewParam));
+									mOutput.insert(posParam - mOutput.data(), NewParam, NewParam + strlen(NewParam));
 									parameterWritten = true;
 								}
 							}
@@ -3485,7 +3482,7 @@ public:
 		mTextureType[bufIndex] = texType + "<" + form4 + ">";
 
 		sprintf(buffer, "%s t%d : register(t%d);\n\n", mTextureType[bufIndex].c_str(), bufIndex, bufIndex);
-		mOutput.insert(mOutput.begin(), buffer, buffer + strlen(buffer));
+		mOutput.prepend(buffer, buffer + strlen(buffer));
 		mCodeStartPos += strlen(buffer);
 	}
 
@@ -3500,12 +3497,12 @@ public:
 			nestCount--;
 		for (int i = 0; i < nestCount; i++)
 		{
-			mOutput.insert(mOutput.end(), indent, indent + strlen(indent));
+			mOutput.append(indent, indent + strlen(indent));
 		}
 		if (open)
 			nestCount++;
 
-		mOutput.insert(mOutput.end(), line, line + strlen(line));
+		mOutput.append(line, line + strlen(line));
 	}
 
 	static const char * offset2swiz(DataType type, int offset)
@@ -4148,11 +4145,11 @@ public:
 			else if (!strcmp(statement, "dcl_immediateConstantBuffer"))
 			{
 				sprintf(buffer, "  const float4 icb[] =");
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 				pos += strlen(statement);
 				while (c[pos] != 0x0a && pos < size)
-					mOutput.insert(mOutput.end(), c[pos++]);
-				mOutput.insert(mOutput.end(), '\n');
+					mOutput.append(c[pos++]);
+				mOutput.append('\n');
 			}
 			else if (!strcmp(statement, "dcl_constantbuffer"))
 			{
@@ -4195,7 +4192,7 @@ public:
 							"{\n"
 							"  float4 cb%d[%d];\n"
 							"}\n\n", bufIndex, bufIndex, bufIndex, bufSize);
-						mOutput.insert(mOutput.begin(), buffer, buffer + strlen(buffer));
+						mOutput.prepend(buffer, buffer + strlen(buffer));
 						mCodeStartPos += strlen(buffer);
 						for (int j = 0; j < bufSize; ++j)
 						{
@@ -4236,7 +4233,7 @@ public:
 						"%sStructuredBuffer<%c%d_t> %c%d : register(%c%d);\n\n",
 						prefix, bufIndex, bufStride / 4, uav ? "RW" : "",
 						prefix, bufIndex, prefix, bufIndex, prefix, bufIndex);
-					mOutput.insert(mOutput.begin(), buffer, buffer + strlen(buffer));
+					mOutput.prepend(buffer, buffer + strlen(buffer));
 					mCodeStartPos += strlen(buffer);
 
 					if (bufStride % 4) {
@@ -4246,7 +4243,7 @@ public:
 						// but in practice are 32bits on PC. If it does happen we need to know about it:
 						sprintf(buffer, "FIXME: StructuredBuffer t%d stride %d is not a multiple of 4\n\n",
 								bufIndex, bufStride);
-						mOutput.insert(mOutput.begin(), buffer, buffer + strlen(buffer));
+						mOutput.prepend(buffer, buffer + strlen(buffer));
 						mCodeStartPos += strlen(buffer);
 					}
 				}
@@ -4276,7 +4273,7 @@ public:
 				// bound resources. Use an inline type definition for conciseness:
 				sprintf(buffer, "groupshared struct { float val[%d]; } g%d[%d];\n",
 					bufStride / 4, bufIndex, bufCount);
-				mOutput.insert(mOutput.begin(), buffer, buffer + strlen(buffer));
+				mOutput.prepend(buffer, buffer + strlen(buffer));
 				mCodeStartPos += strlen(buffer);
 			}
 			// Create new map entries if there aren't any for dcl_sampler.  This can happen if
@@ -4299,7 +4296,7 @@ public:
 							sprintf(buffer, "s%d_s", bufIndex);
 							mSamplerNames[bufIndex] = buffer;
 							sprintf(buffer, "SamplerState %s : register(s%d);\n\n", mSamplerNames[bufIndex].c_str(), bufIndex);
-							mOutput.insert(mOutput.begin(), buffer, buffer + strlen(buffer));
+							mOutput.prepend(buffer, buffer + strlen(buffer));
 							mCodeStartPos += strlen(buffer);
 						}
 					}
@@ -4311,7 +4308,7 @@ public:
 							sprintf(buffer, "s%d_s", bufIndex);
 							mSamplerComparisonNames[bufIndex] = buffer;
 							sprintf(buffer, "SamplerComparisonState %s : register(s%d);\n\n", mSamplerComparisonNames[bufIndex].c_str(), bufIndex);
-							mOutput.insert(mOutput.begin(), buffer, buffer + strlen(buffer));
+							mOutput.prepend(buffer, buffer + strlen(buffer));
 							mCodeStartPos += strlen(buffer);
 						}
 					}
@@ -4398,7 +4395,7 @@ public:
 							sprintf(buffer, "Texture2DMS<%s> t%d : register(t%d);\n\n", form4.c_str(), bufIndex, bufIndex);
 						else
 							sprintf(buffer, "Texture2DMS<%s,%d> t%d : register(t%d);\n\n", form4.c_str(), dim, bufIndex, bufIndex);
-						mOutput.insert(mOutput.begin(), buffer, buffer + strlen(buffer));
+						mOutput.prepend(buffer, buffer + strlen(buffer));
 						mCodeStartPos += strlen(buffer);
 					}
 				}
@@ -4483,10 +4480,10 @@ public:
 				//                      { 0, 0, 1.000000, 0},
 				//                      { 0, 0, 0, 1.000000} }
 				while (c[pos] != 0x0a && pos < size)
-					mOutput.insert(mOutput.end(), c[pos++]);
+					mOutput.append(c[pos++]);
 				if (c[pos - 1] == '}')
-					mOutput.insert(mOutput.end(), ';');
-				mOutput.insert(mOutput.end(), c[pos++]);
+					mOutput.append(';');
+				mOutput.append(c[pos++]);
 				continue;
 			}
 			else if (!strcmp(statement, "dcl_indexrange"))
@@ -4498,7 +4495,7 @@ public:
 					sprintf_s(buffer + strlen(buffer), sizeof(buffer) - strlen(buffer), "v%d,", i);
 				buffer[strlen(buffer) - 1] = 0;
 				strcat(buffer, " };\n");
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			else if (!strcmp(statement, "dcl_indexableTemp"))
 			{
@@ -4508,7 +4505,7 @@ public:
 				char varName[opcodeSize];
 				sscanf_s(op1, "%[^[][%d]", varName, opcodeSize, &numIndex);
 				sprintf(buffer, "  float4 %s[%d];\n", varName, numIndex);
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 			}
 			else if (!strcmp(statement, "dcl_input"))
 			{
@@ -4519,39 +4516,39 @@ public:
 					char *pos = strstr(mOutput.data(), "void main(");
 					while (*pos != 0x0a) pos++; pos++;
 					sprintf(buffer, "  uint vCoverage : SV_Coverage,\n");
-					mOutput.insert(mOutput.begin() + (pos - mOutput.data()), buffer, buffer + strlen(buffer));
+					mOutput.insert(pos - mOutput.data(), buffer, buffer + strlen(buffer));
 				}
 			}
 			else if (!strcmp(statement, "dcl_temps"))
 			{
 				const char *varDecl = "  float4 ";
-				mOutput.insert(mOutput.end(), varDecl, varDecl + strlen(varDecl));
+				mOutput.append(varDecl, varDecl + strlen(varDecl));
 				int numTemps;
 				sscanf_s(c + pos, "%s %d", statement, UCOUNTOF(statement), &numTemps);
 				for (int i = 0; i < numTemps; ++i)
 				{
 					sprintf(buffer, "r%d,", i);
-					mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+					mOutput.append(buffer, buffer + strlen(buffer));
 				}
 				mOutput.pop_back();
 				mOutput.push_back(';');
 				mOutput.push_back('\n');
 				const char *helperDecl = "  uint4 bitmask, uiDest;\n  float4 fDest;\n\n";
-				mOutput.insert(mOutput.end(), helperDecl, helperDecl + strlen(helperDecl));
+				mOutput.append(helperDecl, helperDecl + strlen(helperDecl));
 			}
 			// For Geometry Shaders, e.g. dcl_stream m0  TODO: make it StreamN, add to varlist
 			else if (!strcmp(statement, "dcl_stream"))
 			{
 				// Write out original ASM, inline, for reference.
 				sprintf(buffer, "// Needs manual fix for instruction:  \n//");
-				mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+				mOutput.append(buffer, buffer + strlen(buffer));
 				ASMLineOut(c, pos, size);
 				// Move back to input section and output something close to right
 				char *main_ptr = strstr(mOutput.data(), "void main(");
 				size_t offset = main_ptr - mOutput.data();
 				NextLine(mOutput.data(), offset, mOutput.size());
 				sprintf(buffer, "  inout TriangleStream<float> m0,\n");
-				mOutput.insert(mOutput.begin() + offset , buffer, buffer + strlen(buffer));
+				mOutput.insert(offset, buffer, buffer + strlen(buffer));
 			}
 			// For Geometry Shaders, e.g. dcl_maxout n
 			else if (!strcmp(statement, "dcl_maxout"))
@@ -4559,7 +4556,7 @@ public:
 				char *main_ptr = strstr(mOutput.data(), "void main(");
 				size_t offset = main_ptr - mOutput.data();
 				sprintf(buffer, "[maxvertexcount(%s)]\n", op1);
-				mOutput.insert(mOutput.begin() + offset, buffer, buffer + strlen(buffer));
+				mOutput.insert(offset, buffer, buffer + strlen(buffer));
 			}
 			else if (!strncmp(statement, "dcl_", 4))
 			{
@@ -4574,9 +4571,9 @@ public:
 				{
 					// Other declarations, unforeseen.
 					sprintf(buffer, "// Needs manual fix for instruction:\n");
-					mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+					mOutput.append(buffer, buffer + strlen(buffer));
 					sprintf(buffer, "// unknown dcl_: ");
-					mOutput.insert(mOutput.end(), buffer, buffer + strlen(buffer));
+					mOutput.append(buffer, buffer + strlen(buffer));
 					ASMLineOut(c, pos, size);
 				}
 			}
@@ -6753,7 +6750,7 @@ public:
 		declaration +=
 			"\n";
 
-		mOutput.insert(mOutput.end(), declaration.c_str(), declaration.c_str() + declaration.length());
+		mOutput.append(declaration.c_str(), declaration.c_str() + declaration.length());
 	}
 
 
@@ -6766,13 +6763,41 @@ public:
 			"// ---- Created with 3Dmigoto v" + string(VER_FILE_VERSION_STR) + " on " + LogTime();
 
 		// using .begin() to ensure first lines in files.
-		mOutput.insert(mOutput.begin(), header.c_str(), header.c_str() + header.length());
+		mOutput.prepend(header.c_str(), header.c_str() + header.length());
 	}
 };
 
-const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred)
+// Lends the DecompilerContext's output buffer to the decompiler and hands it
+// back however DecompileBinaryHLSL() returns, including on an unrecognised
+// shader or an exception, so its allocation is not lost for the next shader:
+class DecompilerContextOutput
+{
+	DecompilerOutput *output;
+	DecompilerContext *ctx;
+
+public:
+	DecompilerContextOutput(DecompilerOutput *output, DecompilerContext *ctx) :
+		output(output),
+		ctx(ctx)
+	{
+		if (ctx) {
+			ctx->output.clear();
+			output->swap_buffer(&ctx->output);
+		}
+	}
+
+	~DecompilerContextOutput()
+	{
+		if (ctx)
+			output->swap_buffer(&ctx->output);
+	}
+};
+
+const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred,
+		DecompilerContext *ctx)
 {
 	Decompiler d;
+	DecompilerContextOutput ctx_output(&d.mOutput, ctx);
 
 	d.mCodeStartPos = 0;
 	d.mCorrectedIndexRegisters.clear();
@@ -6829,7 +6854,7 @@ const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::st
 		FreeShaderInfo(shader->sInfo);
 		delete shader;
 		patched = d.mPatched;
-		return string(d.mOutput.begin(), d.mOutput.end());
+		return d.mOutput.str();
 	}
 	catch (...)
 	{
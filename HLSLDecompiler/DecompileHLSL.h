@@ -12,6 +12,8 @@
 const int opcodeSize = 128;
 const int stringSize = 256;
 
+// Any settings added here also need to be added to CacheKey() below so that
+// cached decompilations are not reused after they have been changed.
 struct DecompilerSettings
 {
 	int StereoParamsReg;
@@ -40,6 +42,55 @@ struct DecompilerSettings
 		ZRepair_DepthTextureReg2('\0'),
 		ZRepair_DepthBuffer(false)
 	{}
+
+	// Cached decompilations are keyed on every setting, since any of them
+	// can change the decompiled output. Each value is length prefixed so
+	// that no two different sets of settings can produce the same key.
+	std::string CacheKey() const
+	{
+		std::string key;
+
+		append_key(&key, std::to_string(StereoParamsReg));
+		append_key(&key, std::to_string(IniParamsReg));
+		append_key(&key, std::string(1, fixSvPosition ? '1' : '0'));
+		append_key(&key, std::string(1, recompileVs ? '1' : '0'));
+		append_key(&key, std::string(1, ZRepair_DepthTextureReg1));
+		append_key(&key, std::string(1, ZRepair_DepthTextureReg2));
+		append_key(&key, ZRepair_DepthTexture1);
+		append_key(&key, ZRepair_DepthTexture2);
+		append_key(&key, ZRepair_Dependencies1);
+		append_key(&key, ZRepair_Dependencies2);
+		append_key(&key, ZRepair_ZPosCalc1);
+		append_key(&key, ZRepair_ZPosCalc2);
+		append_key(&key, ZRepair_PositionTexture);
+		append_key(&key, std::string(1, ZRepair_DepthBuffer ? '1' : '0'));
+		append_key(&key, InvTransforms);
+		append_key(&key, ZRepair_WorldPosCalc);
+		append_key(&key, BackProject_Vector1);
+		append_key(&key, BackProject_Vector2);
+		append_key(&key, ObjectPos_ID1);
+		append_key(&key, ObjectPos_ID2);
+		append_key(&key, ObjectPos_MUL1);
+		append_key(&key, ObjectPos_MUL2);
+		append_key(&key, MatrixPos_ID1);
+		append_key(&key, MatrixPos_MUL1);
+
+		return key;
+	}
+
+private:
+	static void append_key(std::string *key, const std::string &val)
+	{
+		*key += std::to_string(val.size()) + ":" + val;
+	}
+
+	static void append_key(std::string *key, const std::vector<std::string> &vals)
+	{
+		*key += std::to_string(vals.size()) + "[";
+		for (auto &val : vals)
+			append_key(key, val);
+		*key += "]";
+	}
 };
 
 struct ParseParameters
@@ -57,4 +108,14 @@ struct ParseParameters
 	DecompilerSettings *G;
 };
 
-const std::string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred);
+// Scratch memory for the decompiler that can be kept around and passed to
+// successive DecompileBinaryHLSL() calls when decompiling shaders in bulk, so
+// the output buffer does not need to be grown from scratch for every shader.
+// Must not be shared between threads.
+struct DecompilerContext
+{
+	std::vector<char> output;
+};
+
+const std::string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred,
+		DecompilerContext *ctx = NULL);
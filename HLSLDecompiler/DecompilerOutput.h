@@ -0,0 +1,148 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Output buffer for the decompiler. Most output is appended to the end, but
+// declarations that can only be discovered while parsing the code (such as
+// resources and constant buffers in shaders with stripped reflection
+// information), the file header and the stereo patches are inserted into the
+// middle, which used to move the rest of the buffer each time. Inserted text
+// is now held as separate pieces and only spliced into the buffer when
+// something needs to look at or modify the text by position, so a run of
+// insertions with no reads in between costs one pass over the buffer rather
+// than one each. Most patches still search the text for where the next one
+// goes, so those splice as often as before.
+//
+// Sizes and positions (such as mCodeStartPos) always refer to the complete
+// text including any pieces that have not been spliced in yet.
+//
+// This is kept free of any decompiler state so that it can be built by the
+// unit tests.
+class DecompilerOutput
+{
+	struct Piece {
+		size_t pos;	// Offset in buf this goes before
+		std::string text;
+	};
+
+	std::vector<char> buf;
+	std::vector<Piece> pieces;	// Sorted by pos, ties in output order
+	size_t pieces_len;
+
+	void flatten()
+	{
+		if (pieces.empty())
+			return;
+
+		std::vector<char> tmp;
+		size_t from = 0;
+
+		tmp.reserve((std::max)(buf.capacity(), buf.size() + pieces_len));
+		for (auto &piece : pieces) {
+			tmp.insert(tmp.end(), buf.begin() + from, buf.begin() + piece.pos);
+			tmp.insert(tmp.end(), piece.text.begin(), piece.text.end());
+			from = piece.pos;
+		}
+		tmp.insert(tmp.end(), buf.begin() + from, buf.end());
+		buf.swap(tmp);
+
+		pieces.clear();
+		pieces_len = 0;
+	}
+
+public:
+	DecompilerOutput() :
+		pieces_len(0)
+	{}
+
+	// Appending does not need the pieces to be spliced in:
+	void append(char c)
+	{
+		buf.push_back(c);
+	}
+	template<class InputIt>
+	void append(InputIt first, InputIt last)
+	{
+		buf.insert(buf.end(), first, last);
+	}
+	void push_back(char c)
+	{
+		buf.push_back(c);
+	}
+	void pop_back()
+	{
+		if (!pieces.empty() && pieces.back().pos == buf.size())
+			flatten();
+		buf.pop_back();
+	}
+
+	// Inserts text at a position in the complete text:
+	void insert(size_t pos, const char *first, const char *last)
+	{
+		size_t before = 0;	// Length of the pieces ahead of i
+		size_t start;
+		auto i = pieces.begin();
+
+		for (; i != pieces.end(); ++i) {
+			start = i->pos + before;
+			if (pos <= start)
+				break;
+			if (pos <= start + i->text.size()) {
+				i->text.insert(pos - start, first, last - first);
+				pieces_len += last - first;
+				return;
+			}
+			before += i->text.size();
+		}
+
+		pieces.insert(i, Piece{pos - before, std::string(first, last)});
+		pieces_len += last - first;
+	}
+	void prepend(const char *first, const char *last)
+	{
+		insert(0, first, last);
+	}
+	void erase(size_t first, size_t last)
+	{
+		flatten();
+		buf.erase(buf.begin() + first, buf.begin() + last);
+	}
+
+	size_t size() const
+	{
+		return buf.size() + pieces_len;
+	}
+	void reserve(size_t n)
+	{
+		buf.reserve(n);
+	}
+
+	// Exchanges the underlying buffer with a caller provided one so that
+	// its allocation can be reused for the next shader:
+	void swap_buffer(std::vector<char> *other)
+	{
+		flatten();
+		buf.swap(*other);
+	}
+
+	// Anything that accesses the buffer by position needs the complete text:
+	char* data()
+	{
+		flatten();
+		return buf.data();
+	}
+	char& operator[](size_t pos)
+	{
+		flatten();
+		return buf[pos];
+	}
+
+	std::string str()
+	{
+		flatten();
+		return std::string(buf.begin(), buf.end());
+	}
+};
+
@@ -20,6 +20,10 @@ using namespace std;
 FILE *LogFile = stderr; // Log to stderr by default
 bool gLogDebug = false;
 
+// Reused for every shader processed in this run:
+static AssemblerContext assembler_ctx;
+static DecompilerContext decompiler_ctx;
+
 static void PrintHelp(int argc, char *argv[])
 {
 	LogInfo("usage: %s [OPTION] FILE...\n\n", argv[0]);
@@ -280,7 +284,7 @@ static int validate_assembly(string *assembly, vector<char> *old_shader)
 	// from the assembler. FIXME: We really need to clean up how the
 	// buffers are passed between these functions
 	try {
-		hret = AssembleFluganWithSignatureParsing(&assembly_vec, &new_shader);
+		hret = AssembleFluganWithSignatureParsing(&assembly_vec, &new_shader, NULL, &assembler_ctx);
 		if (FAILED(hret)) {
 			LogInfo("\n*** Assembly verification pass failed: Reassembly failed 0x%x\n", hret);
 			return 1;
@@ -395,7 +399,10 @@ static int validate_assembly(string *assembly, vector<char> *old_shader)
 }
 
 
-static HRESULT Decompile(const void *pShaderBytecode, size_t BytecodeLength, string *hlslText, string *shaderModel)
+// If the MS disassembly has already been produced for this shader (e.g.
+// --disassemble-ms was used alongside -D) pass it in to skip that stage:
+static HRESULT Decompile(const void *pShaderBytecode, size_t BytecodeLength, string *hlslText, string *shaderModel,
+		string const *ms_disassembly = NULL)
 {
 	// Set all to zero, so we only init the ones we are using here:
 	ParseParameters p = {0};
@@ -405,9 +412,13 @@ static HRESULT Decompile(const void *pShaderBytecode, size_t BytecodeLength, str
 	string disassembly;
 	HRESULT hret;
 
-	hret = DisassembleMS(pShaderBytecode, BytecodeLength, &disassembly);
-	if (FAILED(hret))
-		return E_FAIL;
+	if (ms_disassembly) {
+		disassembly = *ms_disassembly;
+	} else {
+		hret = DisassembleMS(pShaderBytecode, BytecodeLength, &disassembly);
+		if (FAILED(hret))
+			return E_FAIL;
+	}
 
 	LogInfo("    creating HLSL representation\n");
 
@@ -427,7 +438,7 @@ static HRESULT Decompile(const void *pShaderBytecode, size_t BytecodeLength, str
 	d.IniParamsReg = -1;
 	d.StereoParamsReg = -1;
 
-	*hlslText = DecompileBinaryHLSL(p, patched, *shaderModel, errorOccurred);
+	*hlslText = DecompileBinaryHLSL(p, patched, *shaderModel, errorOccurred, &decompiler_ctx);
 	if (!hlslText->size() || errorOccurred) {
 		LogInfo("    error while decompiling\n");
 		return E_FAIL;
@@ -530,6 +541,7 @@ static int process(string const *filename)
 {
 	HRESULT hret;
 	string output;
+	string ms_disassembly;
 	vector<char> srcData;
 	string model;
 
@@ -549,6 +561,9 @@ static int process(string const *filename)
 
 		if (WriteOutput(filename, ".msasm", &output))
 			return EXIT_FAILURE;
+
+		// Keep this around so the decompiler doesn't redo it:
+		ms_disassembly = output;
 	}
 
 	if (args.disassemble_flugan || args.disassemble_hexdump || args.disassemble_46) {
@@ -572,14 +587,14 @@ static int process(string const *filename)
 		LogInfo("Assembling %s...\n", filename->c_str());
 		vector<byte> new_bytecode;
 		if (args.reflection_reference.empty()) {
-			hret = AssembleFluganWithSignatureParsing(&srcData, &new_bytecode);
+			hret = AssembleFluganWithSignatureParsing(&srcData, &new_bytecode, NULL, &assembler_ctx);
 			if (FAILED(hret))
 				return EXIT_FAILURE;
 		} else {
 			vector<byte> refData;
 			if (ReadInput(&refData, &args.reflection_reference))
 				return EXIT_FAILURE;
-			new_bytecode = AssembleFluganWithOptionalSignatureParsing(&srcData, false, &refData);
+			new_bytecode = AssembleFluganWithOptionalSignatureParsing(&srcData, false, &refData, NULL, &assembler_ctx);
 		}
 
 		// TODO:
@@ -594,7 +609,8 @@ static int process(string const *filename)
 
 	if (args.decompile) {
 		LogInfo("Decompiling %s...\n", filename->c_str());
-		hret = Decompile(srcData.data(), srcData.size(), &output, &model);
+		hret = Decompile(srcData.data(), srcData.size(), &output, &model,
+				ms_disassembly.empty() ? NULL : &ms_disassembly);
 		if (FAILED(hret))
 			return EXIT_FAILURE;
 
@@ -0,0 +1,47 @@
+// Renders the shader sections of ShaderUsage.txt from the ShaderUsage.bin
+// capture written alongside it by dump_usage=1, e.g. to compare captures
+// from different sessions or to process them on another machine. The
+// resource sections at the end of ShaderUsage.txt need the resource
+// descriptions, which are not part of the capture.
+//
+// Has no DirectX dependencies, so it can be built with the Makefile here on
+// Linux (or anywhere else with a C++ compiler and make):
+//
+//   $ make -C ShaderUsageReport
+//   $ ShaderUsageReport/shader_usage_report ShaderUsage.bin > ShaderUsage.txt
+
+#include "ShaderUsage.h"
+
+int main(int argc, char *argv[])
+{
+	ShaderUsageCapture capture;
+	std::string out;
+	FILE *f;
+	int stage;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s ShaderUsage.bin\n", argv[0]);
+		return 2;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	if (!ReadShaderUsageCapture(f, &capture)) {
+		fprintf(stderr, "%s: Not a valid ShaderUsage.bin\n", argv[1]);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+
+	for (stage = 0; stage < (int)ShaderUsageStage::COUNT; stage++) {
+		FormatShaderUsageInfo(&out, capture.info[stage], ShaderUsageStageTags[stage],
+				capture.hash_contaminated, capture.pointer_size);
+	}
+
+	fwrite(out.data(), 1, out.size(), stdout);
+	return 0;
+}
@@ -0,0 +1,206 @@
+// Counts the heap allocations made by the D3D_Shaders assembler per shader,
+// with and without a reused AssemblerContext, over the assembly shaders in
+// TestShaders/GameExamples. These are the shaders 3DMigoto dumped from games
+// (<hash>-<type>.txt), which is the same text the assembler sees for ShaderFixes
+// replacements, ShaderRegex and cmd_Decompiler.
+//
+// We don't have the original bytecode for these, but the assembler replaces
+// the whole code chunk, so a minimal DXBC container with an empty SHEX/SHDR
+// chunk is enough. Both ways of calling the assembler must produce the same
+// bytecode.
+//
+//   $ make -C UnitTests bench
+
+#include "test.h"
+#include "stdafx.h"
+
+#include <dirent.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static size_t allocations;
+static size_t allocated_bytes;
+
+void* operator new(size_t size)
+{
+	void *ret = malloc(size ? size : 1);
+
+	if (!ret)
+		throw std::bad_alloc();
+	allocations++;
+	allocated_bytes += size;
+	return ret;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+static bool read_file(const std::string &path, vector<char> *buf)
+{
+	FILE *f;
+	long size;
+
+	f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf->resize(size);
+	if (fread(buf->data(), 1, size, f) != (size_t)size) {
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	return true;
+}
+
+// Some of the dumped .txt files are decompiled HLSL rather than assembly. The
+// first line of an assembly shader that is not a comment is its shader model:
+static bool is_assembly(vector<char> &text)
+{
+	const char *pos = text.data();
+	const char *end = pos + text.size();
+	const char *eol;
+
+	for (; pos < end; pos = eol + 1) {
+		eol = std::find(pos, end, '\n');
+		if (eol - pos < 2 || !strncmp(pos, "//", 2) || *pos == '\r')
+			continue;
+		return eol - pos >= 6 && pos[1] == 's' && pos[2] == '_' && pos[4] == '_';
+	}
+
+	return false;
+}
+
+// Lists the <hash>-<type>.txt files one directory down, i.e. one per game:
+static void find_shaders(const std::string &dir, std::vector<std::string> *paths)
+{
+	std::vector<std::string> games;
+	struct dirent *ent;
+	std::string name;
+	DIR *d, *g;
+
+	d = opendir(dir.c_str());
+	if (!d)
+		return;
+	while ((ent = readdir(d)))
+		if (ent->d_name[0] != '.')
+			games.push_back(dir + "/" + ent->d_name);
+	closedir(d);
+
+	for (std::string &game : games) {
+		g = opendir(game.c_str());
+		if (!g)
+			continue;
+		while ((ent = readdir(g))) {
+			name = ent->d_name;
+			if (name.size() > 7 && name.compare(name.size() - 7, 1, "-") == 0 &&
+			    name.compare(name.size() - 5, 5, "s.txt") == 0)
+				paths->push_back(game + "/" + name);
+		}
+		closedir(g);
+	}
+
+	std::sort(paths->begin(), paths->end());
+}
+
+// The smallest DXBC container the assembler will accept: the header, one
+// chunk offset, and a code chunk holding just the version and length tokens.
+static vector<byte> make_container(vector<char> &asm_text)
+{
+	static const char shader_model_5[] = "_5_";
+	vector<byte> container(36 + 8 + 8);
+	DWORD *dwords = (DWORD*)container.data();
+	bool shex;
+
+	shex = std::search(asm_text.begin(), asm_text.end(),
+			shader_model_5, shader_model_5 + 3) != asm_text.end();
+
+	memcpy(container.data(), "DXBC", 4);
+	dwords[5] = 1;
+	dwords[6] = (DWORD)container.size();
+	dwords[7] = 1;
+	dwords[8] = 36;
+	memcpy(container.data() + 36, shex ? "SHEX" : "SHDR", 4);
+	dwords[10] = 8;
+	dwords[11] = 0;
+	dwords[12] = 2;
+
+	return container;
+}
+
+int main(int argc, char *argv[])
+{
+	std::string dir = argc > 1 ? argv[1] : "../TestShaders/GameExamples";
+	std::vector<std::string> paths;
+	vector<AssemblerParseError> parse_errors;
+	AssemblerContext ctx;
+	vector<char> asm_text;
+	vector<byte> container, fresh, reused;
+	size_t fresh_allocations = 0, fresh_bytes = 0;
+	size_t reused_allocations = 0, reused_bytes = 0;
+	size_t start, start_bytes, shaders = 0, errors = 0;
+
+	find_shaders(dir, &paths);
+	CHECK(!paths.empty());
+
+	// The first call builds the assembler's static opcode tables, which
+	// would otherwise be counted against whichever shader came first:
+	for (std::string &path : paths) {
+		if (read_file(path, &asm_text) && is_assembly(asm_text)) {
+			assembler(&asm_text, make_container(asm_text), &parse_errors);
+			break;
+		}
+	}
+
+	for (std::string &path : paths) {
+		if (!read_file(path, &asm_text)) {
+			CHECK(!"read_file");
+			continue;
+		}
+		if (!is_assembly(asm_text))
+			continue;
+		container = make_container(asm_text);
+
+		// Each shader with a new context, as before:
+		parse_errors.clear();
+		start = allocations;
+		start_bytes = allocated_bytes;
+		fresh = assembler(&asm_text, container, &parse_errors);
+		fresh_allocations += allocations - start;
+		fresh_bytes += allocated_bytes - start_bytes;
+		errors += parse_errors.size();
+
+		// And with the context shared across the whole run, as the
+		// per-thread TLS context and cmd_Decompiler do:
+		parse_errors.clear();
+		start = allocations;
+		start_bytes = allocated_bytes;
+		reused = assembler(&asm_text, container, &parse_errors, &ctx);
+		reused_allocations += allocations - start;
+		reused_bytes += allocated_bytes - start_bytes;
+
+		CHECK(fresh == reused);
+		shaders++;
+	}
+
+	printf("%zu shaders from %s, %zu parse errors\n", shaders, dir.c_str(), errors);
+	if (shaders) {
+		printf("  new context:    %8.1f allocations, %9.1f bytes per shader\n",
+				(double)fresh_allocations / shaders, (double)fresh_bytes / shaders);
+		printf("  shared context: %8.1f allocations, %9.1f bytes per shader\n",
+				(double)reused_allocations / shaders, (double)reused_bytes / shaders);
+	}
+
+	return test_result("AssemblerAllocations");
+}
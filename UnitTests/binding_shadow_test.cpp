@@ -0,0 +1,659 @@
+#include "test.h"
+#include "BindingShadow.h"
+
+#include <string.h>
+#include <random>
+#include <vector>
+#include <memory>
+
+// Drives a BindingShadow and a fake context through the same random sequence
+// of binding calls, and checks that everything the shadow reports matches
+// what the fake context says is bound. The fake context models the runtime's
+// input/output hazard resolution (unbinding inputs when their resource is
+// bound as an output and refusing to bind an input that is currently bound as
+// an output), which the shadow does not replicate and has to notice instead.
+
+struct FakeResource : public ID3D11Buffer {
+	int refs = 1;
+	ULONG AddRef() { return ++refs; }
+	ULONG Release() { return --refs; }
+};
+
+struct FakeViewBase {
+	FakeResource *resource;
+	FakeViewBase(FakeResource *resource) : resource(resource) {}
+};
+
+template <typename Interface>
+struct FakeView : public Interface, public FakeViewBase {
+	int refs = 1;
+	unsigned get_resource_calls = 0;
+
+	FakeView(FakeResource *resource) : FakeViewBase(resource) {}
+	ULONG AddRef() { return ++refs; }
+	ULONG Release() { return --refs; }
+	void GetResource(ID3D11Resource **ppResource)
+	{
+		get_resource_calls++;
+		resource->AddRef();
+		*ppResource = resource;
+	}
+};
+
+typedef FakeView<ID3D11ShaderResourceView> FakeSRV;
+typedef FakeView<ID3D11RenderTargetView> FakeRTV;
+typedef FakeView<ID3D11DepthStencilView> FakeDSV;
+typedef FakeView<ID3D11UnorderedAccessView> FakeUAV;
+
+static ID3D11Resource* resource_of(ID3D11View *view)
+{
+	ID3D11Resource *resource = NULL;
+
+	// Peek without counting the call against the shadow:
+	if (view)
+		resource = dynamic_cast<FakeViewBase*>(view)->resource;
+	return resource;
+}
+
+static const int NUM_STAGES = (int)BindingShadowStage::COUNT;
+
+class FakeContext : public ID3D11DeviceContext {
+public:
+	UINT num_uav_slots;
+
+	ID3D11ShaderResourceView *srvs[NUM_STAGES][D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+	ID3D11Buffer *cbs[NUM_STAGES][D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+	ID3D11Buffer *vbs[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	UINT vb_strides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	UINT vb_offsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	ID3D11Buffer *ib;
+	DXGI_FORMAT ib_format;
+	UINT ib_offset;
+	ID3D11Buffer *so[D3D11_SO_BUFFER_SLOT_COUNT];
+	ID3D11RenderTargetView *rtvs[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+	ID3D11DepthStencilView *dsv;
+	ID3D11UnorderedAccessView *ps_uavs[D3D11_1_UAV_SLOT_COUNT];
+	ID3D11UnorderedAccessView *cs_uavs[D3D11_1_UAV_SLOT_COUNT];
+
+	FakeContext(UINT num_uav_slots) : num_uav_slots(num_uav_slots) { clear_state(); }
+
+	ULONG AddRef() { return 1; }
+	ULONG Release() { return 1; }
+
+	void clear_state()
+	{
+		memset(srvs, 0, sizeof(srvs));
+		memset(cbs, 0, sizeof(cbs));
+		memset(vbs, 0, sizeof(vbs));
+		memset(vb_strides, 0, sizeof(vb_strides));
+		memset(vb_offsets, 0, sizeof(vb_offsets));
+		ib = NULL;
+		ib_format = DXGI_FORMAT_UNKNOWN;
+		ib_offset = 0;
+		memset(so, 0, sizeof(so));
+		memset(rtvs, 0, sizeof(rtvs));
+		dsv = NULL;
+		memset(ps_uavs, 0, sizeof(ps_uavs));
+		memset(cs_uavs, 0, sizeof(cs_uavs));
+	}
+
+	// ---- Runtime hazard model ----
+
+	bool is_output(ID3D11Resource *resource)
+	{
+		UINT i;
+
+		for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+			if (resource_of(rtvs[i]) == resource)
+				return true;
+		}
+		if (resource_of(dsv) == resource)
+			return true;
+		for (i = 0; i < num_uav_slots; i++) {
+			if (resource_of(ps_uavs[i]) == resource || resource_of(cs_uavs[i]) == resource)
+				return true;
+		}
+		for (i = 0; i < D3D11_SO_BUFFER_SLOT_COUNT; i++) {
+			if (so[i] == resource)
+				return true;
+		}
+		return false;
+	}
+
+	void unbind_inputs(ID3D11Resource *resource)
+	{
+		int s;
+		UINT i;
+
+		for (s = 0; s < NUM_STAGES; s++) {
+			for (i = 0; i < D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT; i++) {
+				if (resource_of(srvs[s][i]) == resource)
+					srvs[s][i] = NULL;
+			}
+			for (i = 0; i < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT; i++) {
+				if (cbs[s][i] == resource)
+					cbs[s][i] = NULL;
+			}
+		}
+		for (i = 0; i < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT; i++) {
+			if (vbs[i] == resource)
+				vbs[i] = NULL;
+		}
+		if (ib == resource)
+			ib = NULL;
+	}
+
+	enum OutputType { OM, PS_UAV, CS_UAV, SO };
+
+	void unbind_other_outputs(ID3D11Resource *resource, OutputType keep)
+	{
+		UINT i;
+
+		if (keep != OM) {
+			for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+				if (resource_of(rtvs[i]) == resource)
+					rtvs[i] = NULL;
+			}
+			if (resource_of(dsv) == resource)
+				dsv = NULL;
+		}
+		for (i = 0; i < num_uav_slots; i++) {
+			if (keep != PS_UAV && resource_of(ps_uavs[i]) == resource)
+				ps_uavs[i] = NULL;
+			if (keep != CS_UAV && resource_of(cs_uavs[i]) == resource)
+				cs_uavs[i] = NULL;
+		}
+		for (i = 0; keep != SO && i < D3D11_SO_BUFFER_SLOT_COUNT; i++) {
+			if (so[i] == resource)
+				so[i] = NULL;
+		}
+	}
+
+	void bind_output(ID3D11Resource *resource, OutputType type)
+	{
+		if (!resource)
+			return;
+		unbind_inputs(resource);
+		unbind_other_outputs(resource, type);
+	}
+
+	// ---- Binding calls, as the game would make them ----
+
+	void SetShaderResources(int stage, UINT start, UINT num, ID3D11ShaderResourceView *const *views)
+	{
+		for (UINT i = 0; i < num; i++) {
+			ID3D11ShaderResourceView *view = views[i];
+			if (view && is_output(resource_of(view)))
+				view = NULL;
+			srvs[stage][start + i] = view;
+		}
+	}
+
+	void SetConstantBuffers(int stage, UINT start, UINT num, ID3D11Buffer *const *bufs)
+	{
+		for (UINT i = 0; i < num; i++)
+			cbs[stage][start + i] = (bufs[i] && is_output(bufs[i])) ? NULL : bufs[i];
+	}
+
+	void SetVertexBuffers(UINT start, UINT num, ID3D11Buffer *const *bufs, const UINT *strides, const UINT *offsets)
+	{
+		for (UINT i = 0; i < num; i++) {
+			vbs[start + i] = (bufs[i] && is_output(bufs[i])) ? NULL : bufs[i];
+			vb_strides[start + i] = strides[i];
+			vb_offsets[start + i] = offsets[i];
+		}
+	}
+
+	void SetIndexBuffer(ID3D11Buffer *buf, DXGI_FORMAT format, UINT offset)
+	{
+		ib = (buf && is_output(buf)) ? NULL : buf;
+		ib_format = format;
+		ib_offset = offset;
+	}
+
+	void SOSetTargets(UINT num, ID3D11Buffer *const *bufs)
+	{
+		for (UINT i = 0; i < D3D11_SO_BUFFER_SLOT_COUNT; i++) {
+			so[i] = i < num ? bufs[i] : NULL;
+			bind_output(so[i], SO);
+		}
+	}
+
+	void OMSetRenderTargetsAndUnorderedAccessViews(UINT num_rtvs, ID3D11RenderTargetView *const *new_rtvs,
+			ID3D11DepthStencilView *new_dsv, UINT uav_start, UINT num_uavs,
+			ID3D11UnorderedAccessView *const *uavs)
+	{
+		UINT i;
+
+		if (num_rtvs != D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL) {
+			for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+				rtvs[i] = i < num_rtvs ? new_rtvs[i] : NULL;
+				bind_output(resource_of(rtvs[i]), OM);
+			}
+			dsv = new_dsv;
+			bind_output(resource_of(dsv), OM);
+			if (num_uavs == D3D11_KEEP_UNORDERED_ACCESS_VIEWS) {
+				for (i = 0; i < num_rtvs; i++)
+					ps_uavs[i] = NULL;
+			}
+		}
+
+		if (num_uavs != D3D11_KEEP_UNORDERED_ACCESS_VIEWS) {
+			for (i = 0; i < num_uav_slots; i++) {
+				ps_uavs[i] = (i >= uav_start && i - uav_start < num_uavs) ? uavs[i - uav_start] : NULL;
+				bind_output(resource_of(ps_uavs[i]), PS_UAV);
+			}
+			if (num_rtvs == D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL) {
+				for (i = uav_start; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++)
+					rtvs[i] = NULL;
+			}
+		}
+	}
+
+	void CSSetUnorderedAccessViews(UINT start, UINT num, ID3D11UnorderedAccessView *const *uavs)
+	{
+		for (UINT i = 0; i < num; i++) {
+			cs_uavs[start + i] = uavs[i];
+			bind_output(resource_of(uavs[i]), CS_UAV);
+		}
+	}
+
+	// ---- Get calls used by the shadow to resynchronise ----
+
+	unsigned get_calls = 0;
+
+	template <typename T>
+	void get(T **dst, T *const *src, UINT num)
+	{
+		get_calls++;
+		for (UINT i = 0; i < num; i++) {
+			dst[i] = src[i];
+			if (dst[i])
+				dst[i]->AddRef();
+		}
+	}
+
+	void VSGetShaderResources(UINT start, UINT num, ID3D11ShaderResourceView **views) { get(views, srvs[0] + start, num); }
+	void HSGetShaderResources(UINT start, UINT num, ID3D11ShaderResourceView **views) { get(views, srvs[1] + start, num); }
+	void DSGetShaderResources(UINT start, UINT num, ID3D11ShaderResourceView **views) { get(views, srvs[2] + start, num); }
+	void GSGetShaderResources(UINT start, UINT num, ID3D11ShaderResourceView **views) { get(views, srvs[3] + start, num); }
+	void PSGetShaderResources(UINT start, UINT num, ID3D11ShaderResourceView **views) { get(views, srvs[4] + start, num); }
+	void CSGetShaderResources(UINT start, UINT num, ID3D11ShaderResourceView **views) { get(views, srvs[5] + start, num); }
+	void VSGetConstantBuffers(UINT start, UINT num, ID3D11Buffer **bufs) { get(bufs, cbs[0] + start, num); }
+	void HSGetConstantBuffers(UINT start, UINT num, ID3D11Buffer **bufs) { get(bufs, cbs[1] + start, num); }
+	void DSGetConstantBuffers(UINT start, UINT num, ID3D11Buffer **bufs) { get(bufs, cbs[2] + start, num); }
+	void GSGetConstantBuffers(UINT start, UINT num, ID3D11Buffer **bufs) { get(bufs, cbs[3] + start, num); }
+	void PSGetConstantBuffers(UINT start, UINT num, ID3D11Buffer **bufs) { get(bufs, cbs[4] + start, num); }
+	void CSGetConstantBuffers(UINT start, UINT num, ID3D11Buffer **bufs) { get(bufs, cbs[5] + start, num); }
+
+	void IAGetVertexBuffers(UINT start, UINT num, ID3D11Buffer **bufs, UINT *strides, UINT *offsets)
+	{
+		get(bufs, vbs + start, num);
+		memcpy(strides, vb_strides + start, num * sizeof(UINT));
+		memcpy(offsets, vb_offsets + start, num * sizeof(UINT));
+	}
+
+	void IAGetIndexBuffer(ID3D11Buffer **buf, DXGI_FORMAT *format, UINT *offset)
+	{
+		get(buf, &ib, 1);
+		*format = ib_format;
+		*offset = ib_offset;
+	}
+
+	void SOGetTargets(UINT num, ID3D11Buffer **bufs) { get(bufs, so, num); }
+
+	void OMGetRenderTargets(UINT num, ID3D11RenderTargetView **views, ID3D11DepthStencilView **depth)
+	{
+		get(views, rtvs, num);
+		get(depth, &dsv, 1);
+	}
+
+	void OMGetRenderTargetsAndUnorderedAccessViews(UINT num_rtvs, ID3D11RenderTargetView **views,
+			ID3D11DepthStencilView **depth, UINT uav_start, UINT num_uavs,
+			ID3D11UnorderedAccessView **uavs)
+	{
+		CHECK(num_rtvs == 0 && !views && !depth);
+		CHECK(uav_start + num_uavs <= num_uav_slots);
+		get(uavs, ps_uavs + uav_start, num_uavs);
+	}
+
+	void CSGetUnorderedAccessViews(UINT start, UINT num, ID3D11UnorderedAccessView **uavs)
+	{
+		CHECK(start + num <= num_uav_slots);
+		get(uavs, cs_uavs + start, num);
+	}
+};
+
+// Issues each call to the fake context and then to the shadow, in the same
+// way HackerContext passes each call to the driver and then the shadow:
+class Harness {
+public:
+	FakeContext ctx;
+	BindingShadow shadow;
+	std::mt19937 rng;
+
+	std::vector<std::unique_ptr<FakeResource>> resources;
+	std::vector<std::unique_ptr<FakeSRV>> srv_pool;
+	std::vector<std::unique_ptr<FakeRTV>> rtv_pool;
+	std::vector<std::unique_ptr<FakeDSV>> dsv_pool;
+	std::vector<std::unique_ptr<FakeUAV>> uav_pool;
+
+	Harness(D3D_FEATURE_LEVEL level, unsigned seed) :
+		ctx(level >= D3D_FEATURE_LEVEL_11_1 ? D3D11_1_UAV_SLOT_COUNT : D3D11_PS_CS_UAV_REGISTER_COUNT),
+		rng(seed)
+	{
+		unsigned i;
+
+		shadow.SetFeatureLevel(level);
+
+		// A small pool makes hazards between inputs and outputs
+		// common. Every resource can be viewed in every way, which
+		// isn't realistic but doesn't matter to the shadow:
+		for (i = 0; i < 8; i++)
+			resources.emplace_back(new FakeResource());
+		for (i = 0; i < 16; i++) {
+			srv_pool.emplace_back(new FakeSRV(resources[i % 8].get()));
+			rtv_pool.emplace_back(new FakeRTV(resources[(i * 3) % 8].get()));
+			dsv_pool.emplace_back(new FakeDSV(resources[(i * 5) % 8].get()));
+			uav_pool.emplace_back(new FakeUAV(resources[(i * 7) % 8].get()));
+		}
+	}
+
+	unsigned rand(unsigned n) { return rng() % n; }
+
+	// NULL a quarter of the time:
+	template <typename T, typename Pool>
+	T* pick(Pool &pool)
+	{
+		unsigned i = rand(pool.size() * 4 / 3);
+		return i < pool.size() ? pool[i].get() : NULL;
+	}
+
+	ID3D11Buffer* pick_buffer() { return pick<ID3D11Buffer>(resources); }
+
+	void random_op()
+	{
+		ID3D11ShaderResourceView *srvs[4];
+		ID3D11Buffer *bufs[4];
+		ID3D11RenderTargetView *rtvs[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+		ID3D11UnorderedAccessView *uavs[D3D11_1_UAV_SLOT_COUNT];
+		UINT strides[4], offsets[4];
+		UINT i, start, num, num_rtvs, num_uavs;
+		ID3D11DepthStencilView *dsv;
+		DXGI_FORMAT format;
+		int stage;
+
+		switch (rand(20)) {
+		case 0: case 1: case 2: case 3: case 4: case 5:
+			stage = rand(NUM_STAGES);
+			num = 1 + rand(4);
+			// Favour the low slots, where games bind most, so
+			// that the same views get rebound to the same slots:
+			start = rand(2) ? rand(4) : rand(D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT - num + 1);
+			for (i = 0; i < num; i++)
+				srvs[i] = pick<ID3D11ShaderResourceView>(srv_pool);
+			ctx.SetShaderResources(stage, start, num, srvs);
+			shadow.SetShaderResources(&ctx, (BindingShadowStage)stage, start, num, srvs);
+			break;
+		case 6: case 7:
+			stage = rand(NUM_STAGES);
+			num = 1 + rand(4);
+			start = rand(D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT - num + 1);
+			for (i = 0; i < num; i++)
+				bufs[i] = pick_buffer();
+			ctx.SetConstantBuffers(stage, start, num, bufs);
+			shadow.SetConstantBuffers(&ctx, (BindingShadowStage)stage, start, num, bufs);
+			break;
+		case 8: case 9:
+			num = 1 + rand(4);
+			start = rand(D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT - num + 1);
+			for (i = 0; i < num; i++) {
+				bufs[i] = pick_buffer();
+				strides[i] = rand(64);
+				offsets[i] = rand(1024);
+			}
+			ctx.SetVertexBuffers(start, num, bufs, strides, offsets);
+			shadow.SetVertexBuffers(&ctx, start, num, bufs, strides, offsets);
+			break;
+		case 10:
+			bufs[0] = pick_buffer();
+			format = rand(2) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+			offsets[0] = rand(1024);
+			ctx.SetIndexBuffer(bufs[0], format, offsets[0]);
+			shadow.SetIndexBuffer(&ctx, bufs[0], format, offsets[0]);
+			break;
+		case 11:
+			num = rand(D3D11_SO_BUFFER_SLOT_COUNT + 1);
+			for (i = 0; i < num; i++)
+				bufs[i] = pick_buffer();
+			ctx.SOSetTargets(num, bufs);
+			shadow.SetStreamOutputTargets(num, bufs);
+			break;
+		case 12: case 13: case 14:
+			// OMSetRenderTargets, OMSetRenderTargetsAndUnorderedAccessViews
+			// and the KEEP variants of the latter:
+			num_rtvs = rand(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT + 1);
+			for (i = 0; i < num_rtvs; i++)
+				rtvs[i] = pick<ID3D11RenderTargetView>(rtv_pool);
+			dsv = pick<ID3D11DepthStencilView>(dsv_pool);
+			start = num_rtvs + rand(ctx.num_uav_slots - num_rtvs + 1);
+			num_uavs = rand(ctx.num_uav_slots - start + 1);
+			for (i = 0; i < num_uavs; i++)
+				uavs[i] = pick<ID3D11UnorderedAccessView>(uav_pool);
+			switch (rand(4)) {
+			case 0:
+				num_uavs = D3D11_KEEP_UNORDERED_ACCESS_VIEWS;
+				break;
+			case 1:
+				num_rtvs = D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL;
+				break;
+			case 2:
+				start = num_rtvs;
+				num_uavs = 0;
+				break;
+			}
+			ctx.OMSetRenderTargetsAndUnorderedAccessViews(num_rtvs, rtvs, dsv, start, num_uavs, uavs);
+			shadow.SetRenderTargetsAndUnorderedAccessViews(num_rtvs, rtvs, dsv, start, num_uavs, uavs);
+			break;
+		case 15: case 16:
+			num = 1 + rand(4);
+			start = rand(ctx.num_uav_slots - num + 1);
+			for (i = 0; i < num; i++)
+				uavs[i] = pick<ID3D11UnorderedAccessView>(uav_pool);
+			ctx.CSSetUnorderedAccessViews(start, num, uavs);
+			shadow.SetComputeShaderUAVs(start, num, uavs);
+			break;
+		case 17:
+			if (rand(10))
+				break;
+			// ClearState:
+			ctx.clear_state();
+			shadow.Reset();
+			break;
+		case 18:
+			if (rand(10))
+				break;
+			// Something changed the state behind the shadow's
+			// back, e.g. SwapDeviceContextState:
+			for (i = 0; i < 4; i++)
+				ctx.srvs[rand(NUM_STAGES)][rand(8)] = pick<ID3D11ShaderResourceView>(srv_pool);
+			ctx.rtvs[rand(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT)] = NULL;
+			ctx.cs_uavs[rand(ctx.num_uav_slots)] = NULL;
+			ctx.ib = NULL;
+			shadow.Invalidate();
+			break;
+		case 19:
+			compare();
+			break;
+		}
+	}
+
+	// Compares everything the shadow reports with the fake context:
+	void compare()
+	{
+		ID3D11Resource *resource;
+		ID3D11Buffer *buf;
+		ID3D11View *view;
+		DXGI_FORMAT format;
+		UINT i, stride, offset;
+		int s;
+
+		for (s = 0; s < NUM_STAGES; s++) {
+			for (i = 0; i < D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT; i++) {
+				view = shadow.GetShaderResource(&ctx, (BindingShadowStage)s, i, &resource);
+				check_view(view, resource, ctx.srvs[s][i]);
+			}
+			for (i = 0; i < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT; i++) {
+				buf = shadow.GetConstantBuffer(&ctx, (BindingShadowStage)s, i);
+				check_buffer(buf, ctx.cbs[s][i]);
+			}
+		}
+
+		for (i = 0; i < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT; i++) {
+			buf = shadow.GetVertexBuffer(&ctx, i, &stride, &offset);
+			check_buffer(buf, ctx.vbs[i]);
+			if (ctx.vbs[i]) {
+				CHECK_EQ(stride, ctx.vb_strides[i]);
+				CHECK_EQ(offset, ctx.vb_offsets[i]);
+			}
+		}
+
+		buf = shadow.GetIndexBuffer(&ctx, &format, &offset);
+		check_buffer(buf, ctx.ib);
+		if (ctx.ib) {
+			CHECK_EQ(format, ctx.ib_format);
+			CHECK_EQ(offset, ctx.ib_offset);
+		}
+
+		for (i = 0; i < D3D11_SO_BUFFER_SLOT_COUNT; i++)
+			check_buffer(shadow.GetStreamOutputTarget(&ctx, i), ctx.so[i]);
+
+		for (i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++) {
+			view = shadow.GetRenderTarget(&ctx, i, &resource);
+			check_view(view, resource, ctx.rtvs[i]);
+		}
+		view = shadow.GetDepthStencil(&ctx, &resource);
+		check_view(view, resource, ctx.dsv);
+
+		for (i = 0; i < D3D11_1_UAV_SLOT_COUNT; i++) {
+			view = shadow.GetUnorderedAccessView(&ctx, BindingShadowStage::PS, i, &resource);
+			check_view(view, resource, i < ctx.num_uav_slots ? ctx.ps_uavs[i] : NULL);
+			view = shadow.GetUnorderedAccessView(&ctx, BindingShadowStage::CS, i, &resource);
+			check_view(view, resource, i < ctx.num_uav_slots ? ctx.cs_uavs[i] : NULL);
+		}
+	}
+
+	void check_view(ID3D11View *view, ID3D11Resource *resource, ID3D11View *expected)
+	{
+		CHECK(view == expected);
+		CHECK(resource == resource_of(expected));
+		if (view)
+			view->Release();
+		if (resource)
+			resource->Release();
+	}
+
+	void check_buffer(ID3D11Buffer *buf, ID3D11Buffer *expected)
+	{
+		CHECK(buf == expected);
+		if (buf)
+			buf->Release();
+	}
+
+	void check_refs()
+	{
+		for (auto &r : resources)
+			CHECK_EQ(r->refs, 1);
+		for (auto &v : srv_pool)
+			CHECK_EQ(v->refs, 1);
+		for (auto &v : rtv_pool)
+			CHECK_EQ(v->refs, 1);
+		for (auto &v : dsv_pool)
+			CHECK_EQ(v->refs, 1);
+		for (auto &v : uav_pool)
+			CHECK_EQ(v->refs, 1);
+	}
+};
+
+static void test_random_sequences(D3D_FEATURE_LEVEL level)
+{
+	unsigned seed, op;
+
+	for (seed = 0; seed < 20; seed++) {
+		Harness h(level, seed);
+
+		for (op = 0; op < 20000 && !test_failures; op++)
+			h.random_op();
+		h.compare();
+		h.check_refs();
+	}
+}
+
+// Rebinding the view already recorded in a slot should not need to ask the
+// view for its resource, or the driver for anything:
+static void test_rebind_is_free()
+{
+	Harness h(D3D_FEATURE_LEVEL_11_0, 0);
+	ID3D11ShaderResourceView *srv = h.srv_pool[0].get();
+	ID3D11RenderTargetView *rtv = h.rtv_pool[1].get();
+	unsigned get_resource_calls, get_calls, i;
+
+	h.ctx.clear_state();
+	h.shadow.Reset();
+
+	h.ctx.SetShaderResources(4, 0, 1, &srv);
+	h.shadow.SetShaderResources(&h.ctx, BindingShadowStage::PS, 0, 1, &srv);
+	h.ctx.OMSetRenderTargetsAndUnorderedAccessViews(1, &rtv, NULL, 1, 0, NULL);
+	h.shadow.SetRenderTargetsAndUnorderedAccessViews(1, &rtv, NULL, 1, 0, NULL);
+
+	get_resource_calls = h.srv_pool[0]->get_resource_calls + h.rtv_pool[1]->get_resource_calls;
+	get_calls = h.ctx.get_calls;
+	for (i = 0; i < 100; i++) {
+		h.ctx.SetShaderResources(4, 0, 1, &srv);
+		h.shadow.SetShaderResources(&h.ctx, BindingShadowStage::PS, 0, 1, &srv);
+		h.ctx.OMSetRenderTargetsAndUnorderedAccessViews(1, &rtv, NULL, 1, 0, NULL);
+		h.shadow.SetRenderTargetsAndUnorderedAccessViews(1, &rtv, NULL, 1, 0, NULL);
+	}
+	CHECK_EQ(h.srv_pool[0]->get_resource_calls + h.rtv_pool[1]->get_resource_calls, get_resource_calls);
+	CHECK_EQ(h.ctx.get_calls, get_calls);
+
+	h.compare();
+	h.check_refs();
+}
+
+// A compute UAV in a slot above 8 on feature level 11.1 must still unbind
+// inputs that share its resource:
+static void test_high_uav_slot_hazard()
+{
+	Harness h(D3D_FEATURE_LEVEL_11_1, 0);
+	ID3D11ShaderResourceView *srv = h.srv_pool[0].get();
+	ID3D11UnorderedAccessView *uav = NULL;
+	unsigned i;
+
+	for (i = 0; i < h.uav_pool.size(); i++) {
+		if (h.uav_pool[i]->resource == h.srv_pool[0]->resource)
+			uav = h.uav_pool[i].get();
+	}
+	CHECK(uav);
+
+	h.ctx.clear_state();
+	h.shadow.Reset();
+	h.ctx.SetShaderResources(0, 3, 1, &srv);
+	h.shadow.SetShaderResources(&h.ctx, BindingShadowStage::VS, 3, 1, &srv);
+	h.ctx.CSSetUnorderedAccessViews(40, 1, &uav);
+	h.shadow.SetComputeShaderUAVs(40, 1, &uav);
+	h.ctx.OMSetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL, 20, 1, &uav);
+	h.shadow.SetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL, 20, 1, &uav);
+	h.compare();
+	h.check_refs();
+}
+
+int main()
+{
+	test_rebind_is_free();
+	test_high_uav_slot_hazard();
+	test_random_sequences(D3D_FEATURE_LEVEL_11_0);
+	test_random_sequences(D3D_FEATURE_LEVEL_11_1);
+
+	return test_result("BindingShadow");
+}
@@ -0,0 +1,289 @@
+#include "test.h"
+#include "CompileJobQueue.h"
+#include "DeferredLog.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Mirrors CustomShaderCompileJob: the inputs the shader is compiled with, and
+// the results and buffered log messages the config parser consumes.
+struct FakeCompileJob {
+	// Inputs:
+	int shader;
+	char type;
+	std::string filename;
+	unsigned compile_flags;
+
+	// Results:
+	std::string bytecode;
+	bool failed;
+	bool done;
+	DeferredLog log;
+	std::string cache_path;
+	bool store_cache;
+
+	// For the test to force jobs to finish out of order:
+	std::atomic<bool> finished;
+	unsigned finish_order;
+
+	FakeCompileJob(int shader, char type, const std::string &filename, unsigned compile_flags) :
+		shader(shader),
+		type(type),
+		filename(filename),
+		compile_flags(compile_flags),
+		failed(false),
+		done(false),
+		store_cache(false),
+		finished(false),
+		finish_order(0)
+	{}
+};
+
+typedef CompileJobQueue<FakeCompileJob> FakeCompileQueue;
+
+// Stands in for the include handler logging from inside the compile:
+static void fake_include(DeferredLog *log, const std::string &filename, int n)
+{
+	log->Log(-1, "      #include \"common%d.hlsl\"\n", n);
+	if (((int)filename.size() + n) % 3 == 0)
+		log->Log(-1, "      Error opening included file: %s.missing\n", filename.c_str());
+}
+
+// Stands in for compile_custom_shader(). Like the real thing it only touches
+// its own job, and the result depends only on the job's inputs:
+static void fake_compile(FakeCompileJob *job)
+{
+	int i;
+
+	job->done = true;
+	job->failed = true;
+
+	job->log.Log(-1, "    Compiling %s as %cs_5_0 with flags 0x%x\n",
+			job->filename.c_str(), job->type, job->compile_flags);
+	for (i = 0; i < (int)job->filename.size() % 4; i++) {
+		fake_include(&job->log, job->filename, i);
+		std::this_thread::yield();
+	}
+	if (job->filename.find("broken") != std::string::npos) {
+		job->log.Log(3, "%s(1,1): error X3000: syntax error\n", job->filename.c_str());
+		job->log.Log(2, "Error compiling custom shader\n");
+		return;
+	}
+
+	job->bytecode = job->filename + "/" + job->type + "/" + std::to_string(job->compile_flags);
+	job->cache_path = job->filename + "." + job->type + "s_5_0." + std::to_string(job->compile_flags) + ".bin";
+	job->store_cache = true;
+	job->failed = false;
+}
+
+static std::atomic<unsigned> finish_counter;
+static std::atomic<bool> force_out_of_order;
+
+// Every third job waits for the one queued after it to finish first. The job
+// after it is always handed to the next free worker, so this can't deadlock
+// with two or more threads:
+static void fake_compile_out_of_order(FakeCompileQueue *queue, FakeCompileJob *job)
+{
+	size_t i;
+
+	for (i = 0; i < queue->jobs.size(); i++) {
+		if (queue->jobs[i].get() == job)
+			break;
+	}
+
+	if (force_out_of_order && i % 3 == 0 && i + 1 < queue->jobs.size()) {
+		while (!queue->jobs[i + 1]->finished)
+			std::this_thread::yield();
+	}
+
+	fake_compile(job);
+	job->finish_order = finish_counter++;
+	job->finished = true;
+}
+
+// A [CustomShader] section as the parser sees it when it consumes the results:
+struct FakeSection {
+	int shader;
+	char type;
+	std::string filename;
+	unsigned compile_flags;
+	bool queued;
+};
+
+// Several sections share a shader file, so they share the same cache file,
+// some fail to compile, one was changed by the time it was consumed (e.g. the
+// compile flags could not be worked out silently when queuing), and one was
+// never queued at all:
+static std::vector<FakeSection> make_sections()
+{
+	static const char *files[] = {
+		"ShaderFixes/upscale.hlsl",
+		"ShaderFixes/sbs.hlsl",
+		"ShaderFixes/broken.hlsl",
+		"ShaderFixes/hud.hlsl",
+		"ShaderFixes/3dvision2sbs.hlsl",
+	};
+	std::vector<FakeSection> sections;
+	int shader;
+
+	for (shader = 0; shader < 40; shader++) {
+		sections.push_back({shader, 'v', files[shader % 5], 0, true});
+		sections.push_back({shader, 'p', files[(shader * 3) % 5], (unsigned)(shader % 2), true});
+		if (shader % 7 == 0)
+			sections.push_back({shader, 'c', files[shader % 3], 0x800, true});
+	}
+	sections[17].queued = false;
+	sections[30].compile_flags = 0x4;
+
+	return sections;
+}
+
+// Queues the jobs the same way QueueCustomShaderCompileJobs() does, with the
+// inputs as they were when queued:
+static void queue_jobs(FakeCompileQueue *queue, const std::vector<FakeSection> &sections)
+{
+	for (auto &section : sections) {
+		if (!section.queued)
+			continue;
+		queue->jobs.emplace_back(new FakeCompileJob(section.shader, section.type, section.filename,
+				section.compile_flags == 0x4 ? 0 : section.compile_flags));
+	}
+}
+
+// Consumes the results in section order, as ParseCustomShaderSections() and
+// CustomShader::compile() do, replaying each job's log and writing the shared
+// shader cache. Returns everything that would have reached the log:
+static std::string consume(FakeCompileQueue *queue, const std::vector<FakeSection> &sections,
+		std::map<std::string, std::string> *cache)
+{
+	std::unique_ptr<FakeCompileJob> serial_job;
+	FakeCompileJob *job;
+	std::string out;
+
+	for (auto &section : sections) {
+		job = queue->Next([&section](FakeCompileJob *job) {
+			return job->shader == section.shader && job->type == section.type;
+		});
+
+		out += "  " + std::string(1, section.type) + "s=" + section.filename + "\n";
+
+		// Only use a precompiled result if it was compiled from the
+		// same inputs we have now, otherwise compile it here:
+		if (!job || !job->done || job->compile_flags != section.compile_flags
+				|| job->filename != section.filename) {
+			serial_job.reset(new FakeCompileJob(section.shader, section.type,
+					section.filename, section.compile_flags));
+			job = serial_job.get();
+			fake_compile(job);
+		}
+
+		job->log.Replay(
+			[&out](const char *msg) { out += msg; },
+			[&out](int level, const char *msg) { out += "[" + std::to_string(level) + "] " + msg; });
+
+		if (job->failed)
+			continue;
+
+		if (job->store_cache) {
+			out += "    Storing compiled shader to " + job->cache_path + "\n";
+			(*cache)[job->cache_path] = job->bytecode;
+		}
+	}
+
+	return out;
+}
+
+static std::string run(unsigned num_threads, bool out_of_order,
+		std::map<std::string, std::string> *cache, bool *finished_out_of_order)
+{
+	std::vector<FakeSection> sections = make_sections();
+	std::vector<std::thread> threads;
+	FakeCompileQueue queue;
+	unsigned i;
+
+	queue_jobs(&queue, sections);
+
+	finish_counter = 0;
+	force_out_of_order = out_of_order;
+	for (i = 0; i < num_threads; i++) {
+		threads.emplace_back([&queue] {
+			queue.Work([&queue](FakeCompileJob *job) {
+				fake_compile_out_of_order(&queue, job);
+			});
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	*finished_out_of_order = false;
+	for (i = 1; i < queue.jobs.size(); i++) {
+		if (num_threads && queue.jobs[i]->finish_order < queue.jobs[i - 1]->finish_order)
+			*finished_out_of_order = true;
+	}
+
+	return consume(&queue, sections, cache);
+}
+
+// The log and shader cache must come out the same whether the jobs were run on
+// a pool of threads finishing in any order, on a single worker, or not at all
+// (if the pool could not be started) so that every result was compiled as it
+// was consumed:
+static void test_serial_vs_parallel()
+{
+	std::map<std::string, std::string> serial_cache, single_cache, parallel_cache;
+	std::string serial, single, parallel;
+	bool out_of_order;
+
+	serial = run(0, false, &serial_cache, &out_of_order);
+	CHECK(!out_of_order);
+
+	single = run(1, false, &single_cache, &out_of_order);
+	CHECK(!out_of_order);
+
+	parallel = run(8, true, &parallel_cache, &out_of_order);
+	CHECK(out_of_order);
+
+	CHECK(serial.find("Error opening included file") != std::string::npos);
+	CHECK(serial.find("[2] Error compiling custom shader") != std::string::npos);
+	CHECK(serial.find("flags 0x4") != std::string::npos);
+	CHECK(single == serial);
+	CHECK(parallel == serial);
+
+	// Sections sharing a shader file share its cache file:
+	CHECK(serial_cache.size() < make_sections().size());
+	CHECK(single_cache == serial_cache);
+	CHECK(parallel_cache == serial_cache);
+}
+
+// A section that was not queued must not consume the job queued for the next
+// section:
+static void test_next()
+{
+	FakeCompileQueue queue;
+
+	queue.jobs.emplace_back(new FakeCompileJob(1, 'v', "a.hlsl", 0));
+	queue.jobs.emplace_back(new FakeCompileJob(2, 'p', "b.hlsl", 0));
+
+	auto is = [](int shader, char type) {
+		return [shader, type](FakeCompileJob *job) {
+			return job->shader == shader && job->type == type;
+		};
+	};
+
+	CHECK(queue.Next(is(1, 'v')) == queue.jobs[0].get());
+	CHECK(queue.Next(is(1, 'p')) == NULL);
+	CHECK(queue.Next(is(2, 'p')) == queue.jobs[1].get());
+	CHECK(queue.Next(is(2, 'p')) == NULL);
+}
+
+int main()
+{
+	test_next();
+	test_serial_vs_parallel();
+
+	return test_result("CompileJobQueue");
+}
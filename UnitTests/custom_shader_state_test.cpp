@@ -0,0 +1,231 @@
+#include "test.h"
+#include "CustomShaderState.h"
+
+#include <string.h>
+#include <vector>
+
+// Plain stand ins for a D3D11 state description and state object:
+struct FakeDesc {
+	int fill_mode;
+	int cull_mode;
+	int depth_bias;
+	float slope_scaled_depth_bias;
+	unsigned char flags[4];
+};
+
+struct FakeState {
+	FakeDesc desc;
+	int refs;
+
+	FakeState(const FakeDesc &desc) :
+		desc(desc),
+		refs(1)
+	{}
+
+	void AddRef()
+	{
+		refs++;
+	}
+
+	void Release()
+	{
+		refs--;
+	}
+};
+
+static FakeDesc make_desc(int fill, int cull, int bias, float slope, unsigned char flags)
+{
+	FakeDesc desc;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.fill_mode = fill;
+	desc.cull_mode = cull;
+	desc.depth_bias = bias;
+	desc.slope_scaled_depth_bias = slope;
+	memset(desc.flags, flags, sizeof(desc.flags));
+	return desc;
+}
+
+// Only the masked fields come from the game's state:
+static void test_masked_merge()
+{
+	FakeDesc ours = make_desc(1, 2, 3, 4.0f, 0x0f);
+	FakeDesc mask;
+	FakeDesc game = make_desc(10, 20, 30, 40.0f, 0xf0);
+
+	memset(&mask, 0, sizeof(mask));
+	memset(&mask.cull_mode, 0xff, sizeof(mask.cull_mode));
+	memset(&mask.slope_scaled_depth_bias, 0xff, sizeof(mask.slope_scaled_depth_bias));
+	mask.flags[1] = 0xff;
+	mask.flags[2] = 0x3c;
+
+	memcpy_masked_merge(&ours, &game, &mask, sizeof(FakeDesc));
+
+	CHECK_EQ(ours.fill_mode, 1);
+	CHECK_EQ(ours.cull_mode, 20);
+	CHECK_EQ(ours.depth_bias, 3);
+	CHECK(ours.slope_scaled_depth_bias == 40.0f);
+	CHECK_EQ(ours.flags[0], 0x0f);
+	CHECK_EQ(ours.flags[1], 0xf0);
+	CHECK_EQ(ours.flags[2], 0x33);
+	CHECK_EQ(ours.flags[3], 0x0f);
+}
+
+// The cache is keyed on the game's state alone, which is only valid if the
+// merged result doesn't depend on whatever was merged before:
+static void test_merge_depends_only_on_source()
+{
+	FakeDesc ours = make_desc(1, 2, 3, 4.0f, 0x5a);
+	FakeDesc mask;
+	FakeDesc a = make_desc(10, 20, 30, 40.0f, 0xf0);
+	FakeDesc b = make_desc(11, 21, 31, 41.0f, 0x0f);
+	FakeDesc first;
+
+	memset(&mask, 0, sizeof(mask));
+	memset(&mask.fill_mode, 0xff, sizeof(mask.fill_mode));
+	memset(&mask.depth_bias, 0xff, sizeof(mask.depth_bias));
+	mask.flags[0] = 0xaa;
+
+	memcpy_masked_merge(&ours, &a, &mask, sizeof(FakeDesc));
+	first = ours;
+	memcpy_masked_merge(&ours, &b, &mask, sizeof(FakeDesc));
+	CHECK(memcmp(&first, &ours, sizeof(FakeDesc)));
+	memcpy_masked_merge(&ours, &a, &mask, sizeof(FakeDesc));
+	CHECK(!memcmp(&first, &ours, sizeof(FakeDesc)));
+}
+
+// Mirrors CustomShader::merge_rasterizer_states(), with a fake device that
+// counts how many state objects it has created:
+struct FakeCustomShader {
+	FakeDesc desc;
+	FakeDesc mask;
+	FakeState *state;
+	CustomShaderStateCache<FakeState> merged_states;
+	std::vector<FakeState*> created;
+
+	FakeCustomShader() :
+		state(NULL)
+	{
+		desc = make_desc(1, 2, 3, 4.0f, 0);
+		memset(&mask, 0, sizeof(mask));
+		memset(&mask.cull_mode, 0xff, sizeof(mask.cull_mode));
+	}
+
+	~FakeCustomShader()
+	{
+		if (state)
+			state->Release();
+		merged_states.clear();
+		for (FakeState *s : created)
+			delete s;
+	}
+
+	void merge(FakeState *src_state)
+	{
+		FakeDesc src_desc = src_state ? src_state->desc : make_desc(0, 0, 0, 0.0f, 0);
+
+		if (state)
+			state->Release();
+		state = merged_states.find(src_state);
+		if (state) {
+			state->AddRef();
+			return;
+		}
+
+		memcpy_masked_merge(&desc, &src_desc, &mask, sizeof(FakeDesc));
+		created.push_back(new FakeState(desc));
+		state = created.back();
+		merged_states.insert(src_state, state);
+	}
+};
+
+static void test_cache_reuses_merged_states()
+{
+	FakeState game_a(make_desc(10, 20, 30, 40.0f, 0));
+	FakeState game_b(make_desc(11, 21, 31, 41.0f, 0));
+	int i;
+
+	{
+		FakeCustomShader shader;
+
+		// Run per draw call, alternating between two game states
+		// and the default (no state bound):
+		for (i = 0; i < 300; i++) {
+			shader.merge(i % 3 == 0 ? &game_a : i % 3 == 1 ? &game_b : NULL);
+			if (i % 3 == 0)
+				CHECK_EQ(shader.state->desc.cull_mode, 20);
+			else if (i % 3 == 1)
+				CHECK_EQ(shader.state->desc.cull_mode, 21);
+			else
+				CHECK_EQ(shader.state->desc.cull_mode, 0);
+			CHECK_EQ(shader.state->desc.fill_mode, 1);
+		}
+		CHECK_EQ(shader.created.size(), 3);
+		CHECK_EQ(shader.merged_states.size(), 3);
+
+		// The cache holds the game's states while they are keys:
+		CHECK_EQ(game_a.refs, 2);
+		CHECK_EQ(game_b.refs, 2);
+
+		// The reference from creation passes to the shader, and is
+		// dropped when it moves on to another state, so only the
+		// state it last merged has more than the cache's reference:
+		CHECK_EQ(shader.created[0]->refs, 1);
+		CHECK_EQ(shader.created[1]->refs, 1);
+		CHECK_EQ(shader.created[2]->refs, 2);
+	}
+
+	CHECK_EQ(game_a.refs, 1);
+	CHECK_EQ(game_b.refs, 1);
+}
+
+// A shader run with a new state every time (e.g. a game creating states on
+// the fly) must not pin an unbounded number of them:
+static void test_cache_is_bounded()
+{
+	const size_t max_entries = CustomShaderStateCache<FakeState>::MAX_ENTRIES;
+	std::vector<FakeState*> game_states;
+	size_t i, held = 0;
+
+	{
+		FakeCustomShader shader;
+
+		for (i = 0; i < max_entries * 3 + 5; i++) {
+			game_states.push_back(new FakeState(make_desc(0, (int)i, 0, 0.0f, 0)));
+			shader.merge(game_states.back());
+			CHECK(shader.merged_states.size() <= max_entries);
+			CHECK_EQ(shader.state->desc.cull_mode, (int)i);
+		}
+
+		for (FakeState *s : game_states)
+			held += s->refs - 1;
+		CHECK_EQ(held, shader.merged_states.size());
+	}
+
+	for (FakeState *s : game_states) {
+		CHECK_EQ(s->refs, 1);
+		delete s;
+	}
+}
+
+static void test_insert_failed_creation()
+{
+	CustomShaderStateCache<FakeState> cache;
+	FakeState game(make_desc(0, 0, 0, 0.0f, 0));
+
+	cache.insert(&game, NULL);
+	CHECK_EQ(cache.size(), 0);
+	CHECK_EQ(game.refs, 1);
+	CHECK(cache.find(&game) == NULL);
+}
+
+int main()
+{
+	test_masked_merge();
+	test_merge_depends_only_on_source();
+	test_cache_reuses_merged_states();
+	test_cache_is_bounded();
+	test_insert_failed_creation();
+
+	return test_result("CustomShaderState");
+}
@@ -0,0 +1,92 @@
+#include "test.h"
+#include "DecompilerOutput.h"
+
+#include <random>
+#include <string.h>
+
+// Checks the deferred pieces against a plain vector<char> given the same
+// sequence of edits, with reads mixed in at random so that edits land both
+// on a flattened buffer and on top of pieces that are still pending:
+static void test_random_edits()
+{
+	std::mt19937 rng(1);
+	static const char *words[] = { "", "a", "\n", "float4 zpos4 = ", "// Auto-fixed shader\n" };
+	unsigned iteration, op;
+
+	for (iteration = 0; iteration < 2000; iteration++) {
+		DecompilerOutput output;
+		std::vector<char> model;
+
+		for (op = 0; op < 50; op++) {
+			const char *word = words[rng() % 5];
+			const char *word_end = word + strlen(word);
+			size_t pos = rng() % (model.size() + 1);
+
+			switch (rng() % 8) {
+			case 0:
+			case 1:
+				output.append(word, word_end);
+				model.insert(model.end(), word, word_end);
+				break;
+			case 2:
+				output.push_back('x');
+				model.push_back('x');
+				break;
+			case 3:
+				if (!model.empty()) {
+					output.pop_back();
+					model.pop_back();
+				}
+				break;
+			case 4:
+				output.prepend(word, word_end);
+				model.insert(model.begin(), word, word_end);
+				break;
+			case 5:
+				if (rng() % 4 == 0 && pos < model.size()) {
+					size_t last = pos + rng() % (model.size() - pos + 1);
+					output.erase(pos, last);
+					model.erase(model.begin() + pos, model.begin() + last);
+				} else {
+					CHECK_EQ(output.size(), model.size());
+					if (pos < model.size())
+						CHECK_EQ(output[pos], model[pos]);
+				}
+				break;
+			default:
+				output.insert(pos, word, word_end);
+				model.insert(model.begin() + pos, word, word_end);
+				break;
+			}
+			CHECK_EQ(output.size(), model.size());
+		}
+
+		CHECK(output.str() == std::string(model.begin(), model.end()));
+	}
+}
+
+// Insertions at the same position come out in the order the text would have
+// had if each had been inserted immediately, i.e. the last one first:
+static void test_same_position()
+{
+	DecompilerOutput output;
+
+	output.append("main", "main" + 4);
+	output.insert(0, "b", "b" + 1);
+	output.insert(0, "a", "a" + 1);
+	output.insert(1, "-", "-" + 1);
+	output.insert(output.size(), "!", "!" + 1);
+	output.insert(output.size() - 1, "()", "()" + 2);
+	CHECK(output.str() == "a-bmain()!");
+
+	output.pop_back();
+	CHECK(output.str() == "a-bmain()");
+}
+
+int main()
+{
+	test_random_edits();
+	test_same_position();
+
+	return test_result("DecompilerOutput");
+}
@@ -0,0 +1,90 @@
+#include "test.h"
+#include "DecompileHLSL.h"
+
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+// Changing any one setting must change the key, or a cached decompilation
+// made with the old settings would be reused:
+static void test_every_setting()
+{
+	std::vector<std::function<void(DecompilerSettings*)>> changes = {
+		[](DecompilerSettings *s) { s->StereoParamsReg = 125; },
+		[](DecompilerSettings *s) { s->IniParamsReg = 120; },
+		[](DecompilerSettings *s) { s->fixSvPosition = true; },
+		[](DecompilerSettings *s) { s->recompileVs = true; },
+		[](DecompilerSettings *s) { s->ZRepair_DepthTextureReg1 = 'x'; },
+		[](DecompilerSettings *s) { s->ZRepair_DepthTextureReg2 = 'x'; },
+		[](DecompilerSettings *s) { s->ZRepair_DepthTexture1 = "t1"; },
+		[](DecompilerSettings *s) { s->ZRepair_DepthTexture2 = "t1"; },
+		[](DecompilerSettings *s) { s->ZRepair_Dependencies1 = {"dep"}; },
+		[](DecompilerSettings *s) { s->ZRepair_Dependencies2 = {"dep"}; },
+		[](DecompilerSettings *s) { s->ZRepair_ZPosCalc1 = "calc"; },
+		[](DecompilerSettings *s) { s->ZRepair_ZPosCalc2 = "calc"; },
+		[](DecompilerSettings *s) { s->ZRepair_PositionTexture = "pos"; },
+		[](DecompilerSettings *s) { s->ZRepair_DepthBuffer = true; },
+		[](DecompilerSettings *s) { s->InvTransforms = {"inv"}; },
+		[](DecompilerSettings *s) { s->ZRepair_WorldPosCalc = "calc"; },
+		[](DecompilerSettings *s) { s->BackProject_Vector1 = "vec"; },
+		[](DecompilerSettings *s) { s->BackProject_Vector2 = "vec"; },
+		[](DecompilerSettings *s) { s->ObjectPos_ID1 = "id"; },
+		[](DecompilerSettings *s) { s->ObjectPos_ID2 = "id"; },
+		[](DecompilerSettings *s) { s->ObjectPos_MUL1 = "mul"; },
+		[](DecompilerSettings *s) { s->ObjectPos_MUL2 = "mul"; },
+		[](DecompilerSettings *s) { s->MatrixPos_ID1 = "id"; },
+		[](DecompilerSettings *s) { s->MatrixPos_MUL1 = "mul"; },
+	};
+	std::set<std::string> keys;
+
+	keys.insert(DecompilerSettings().CacheKey());
+	for (auto &change : changes) {
+		DecompilerSettings settings;
+
+		change(&settings);
+		keys.insert(settings.CacheKey());
+	}
+
+	CHECK_EQ(keys.size(), changes.size() + 1);
+}
+
+// Values that would run together if they were simply concatenated:
+static void test_boundaries()
+{
+	DecompilerSettings a, b;
+
+	a.ZRepair_DepthTexture1 = "ab";
+	a.ZRepair_DepthTexture2 = "c";
+	b.ZRepair_DepthTexture1 = "a";
+	b.ZRepair_DepthTexture2 = "bc";
+	CHECK(a.CacheKey() != b.CacheKey());
+
+	a = b = DecompilerSettings();
+	a.ZRepair_Dependencies1 = {"a", "b"};
+	b.ZRepair_Dependencies1 = {"a"};
+	b.ZRepair_Dependencies2 = {"b"};
+	CHECK(a.CacheKey() != b.CacheKey());
+
+	a = b = DecompilerSettings();
+	a.InvTransforms = {"a;b"};
+	b.InvTransforms = {"a", "b"};
+	CHECK(a.CacheKey() != b.CacheKey());
+
+	a = b = DecompilerSettings();
+	a.ZRepair_Dependencies1 = {""};
+	CHECK(a.CacheKey() != b.CacheKey());
+
+	a = b = DecompilerSettings();
+	a.ObjectPos_ID1 = "x";
+	b.ObjectPos_ID1 = "x";
+	CHECK(a.CacheKey() == b.CacheKey());
+}
+
+int main()
+{
+	test_every_setting();
+	test_boundaries();
+
+	return test_result("DecompilerSettings");
+}
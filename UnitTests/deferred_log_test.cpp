@@ -0,0 +1,54 @@
+#include "test.h"
+#include "DeferredLog.h"
+
+#include <string>
+
+// Messages long enough that formatting them walks the arguments well past
+// anything a small buffer would hold, so that reusing an already walked
+// va_list would show up as garbage here or as a crash under the sanitizers:
+static void test_format()
+{
+	DeferredLog log;
+	std::string path(300, 'x');
+
+	log.Log(-1, "    Loaded cached shader: %s\n", path.c_str());
+	log.Log(3, "%s:%d:%d: error X%04d: %s\n", path.c_str(), 12, 34, 3004, "undeclared identifier");
+	log.Log(2, "%s", "");
+
+	CHECK_EQ(log.entries.size(), 2);
+	CHECK_EQ(log.entries[0].first, -1);
+	CHECK(log.entries[0].second == "    Loaded cached shader: " + path + "\n");
+	CHECK_EQ(log.entries[1].first, 3);
+	CHECK(log.entries[1].second == path + ":12:34: error X3004: undeclared identifier\n");
+}
+
+// Messages logged with LogInfo and LogOverlay must be replayed in the order
+// they were logged, each to the right place:
+static void test_replay()
+{
+	DeferredLog log;
+	std::string out;
+
+	log.Log(-1, "    Compiling %s\n", "upscale.hlsl");
+	log.Log(3, "upscale.hlsl(%d,%d): error X3000: syntax error\n", 10, 2);
+	log.Log(-1, "%s", "---- END ----\n");
+	log.Log(2, "Error compiling custom shader\n");
+
+	log.Replay(
+		[&out](const char *msg) { out += "info: "; out += msg; },
+		[&out](int level, const char *msg) { out += "overlay " + std::to_string(level) + ": " + msg; });
+
+	CHECK(out ==
+		"info:     Compiling upscale.hlsl\n"
+		"overlay 3: upscale.hlsl(10,2): error X3000: syntax error\n"
+		"info: ---- END ----\n"
+		"overlay 2: Error compiling custom shader\n");
+}
+
+int main()
+{
+	test_format();
+	test_replay();
+
+	return test_result("DeferredLog");
+}
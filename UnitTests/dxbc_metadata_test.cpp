@@ -0,0 +1,211 @@
+#include "test.h"
+#include "dxbc_metadata.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// The shader models of the compiled shaders in TestShaders/GameExamples, as
+// reported by the disassembler. The MGSV shaders were built for feature level
+// 9, which the disassembler reports with a "_level_9_x" suffix that is not in
+// the version token, so GetShaderModel() still disassembles those.
+struct ExpectedModel {
+	const char *path;
+	const char *model;
+	bool aon9;
+};
+
+static const ExpectedModel expected_models[] = {
+	{"Blacklist/6c2fc2b0b3401423-hs.bin", "hs_5_0", false},
+	{"Blacklist/d2775ae3a4a4351d-ps.bin", "ps_5_0", false},
+	{"Cars/fefda141c125c8c5-ps.bin", "ps_4_1", false},
+	{"DOAXVV/ba2ad61fa36ff709-vs.bin", "vs_5_0", false},
+	{"Hellblade/9a9de1c9f996e820-ps.bin", "ps_5_0", false},
+	{"MGSV/000000000546607b-vs.bin", "vs_4_0", true},
+	{"MGSV/00000000190922c2-ps.bin", "ps_4_0", true},
+	{"MGSV/000000003c3f12bd-vs.bin", "vs_4_0", true},
+	{"MGSV/0000000057ca916d-ps.bin", "ps_5_0", false},
+	{"MGSV/000000006d7bf717-ps.bin", "ps_4_0", true},
+	{"MGSV/00000000f2d09295-ps.bin", "ps_4_0", true},
+	{"re2/0110cb7eba779c1d-cs.bin", "cs_5_0", false},
+	{"re2/03cdbb1d64be7c53-cs.bin", "cs_5_0", false},
+	{"re2/0595176bbd097b54-cs.bin", "cs_5_0", false},
+	{"re2/1b0e69b5822a3086-cs.bin", "cs_5_0", false},
+	{"re2/1d62a8c00ed1f398-cs.bin", "cs_5_0", false},
+	{"re2/1e80aa2735aa2196-cs.bin", "cs_5_0", false},
+	{"re2/2100df7cbf15f25b-cs.bin", "cs_5_0", false},
+	{"re2/487a3303e222397f-cs.bin", "cs_5_0", false},
+	{"re2/7f8c84dc0321a1ac-cs.bin", "cs_5_0", false},
+	{"re2/81b1cb7882ac0625-ps.bin", "ps_5_0", false},
+	{"re2/9b4b0a8af22165cc-cs.bin", "cs_5_0", false},
+	{"re2/b63aa16c94606551-cs.bin", "cs_5_0", false},
+	{"re2/d1be753b51e1709e-cs.bin", "cs_5_0", false},
+	{"re2/d8f5182654da5a44-cs.bin", "cs_5_0", false},
+	{"re2/ed740e7eec57dbde-cs.bin", "cs_5_0", false},
+	{"re2/f1936c9f748ef9b0-ps.bin", "ps_5_0", false},
+};
+
+static const size_t NUM_EXPECTED_MODELS = sizeof(expected_models) / sizeof(expected_models[0]);
+
+static bool read_file(const std::string &path, std::vector<char> *buf)
+{
+	FILE *f;
+	long size;
+
+	f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf->resize(size);
+	if (fread(buf->data(), 1, size, f) != (size_t)size) {
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	return true;
+}
+
+// Lists the <game>/<hash>-<type>.bin files one directory down:
+static void find_binaries(const std::string &dir, std::vector<std::string> *paths)
+{
+	std::vector<std::string> games;
+	struct dirent *ent;
+	std::string name;
+	DIR *d, *g;
+
+	d = opendir(dir.c_str());
+	if (!d)
+		return;
+	while ((ent = readdir(d)))
+		if (ent->d_name[0] != '.')
+			games.push_back(ent->d_name);
+	closedir(d);
+
+	for (std::string &game : games) {
+		g = opendir((dir + "/" + game).c_str());
+		if (!g)
+			continue;
+		while ((ent = readdir(g))) {
+			name = ent->d_name;
+			if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0)
+				paths->push_back(game + "/" + name);
+		}
+		closedir(g);
+	}
+
+	std::sort(paths->begin(), paths->end());
+}
+
+// Lengths to truncate a shader to: anywhere in the header and chunk offsets,
+// and either side of the start of each chunk and its first two tokens. Every
+// length would take too long on the larger shaders.
+static std::vector<size_t> truncation_points(const std::vector<char> &bytecode)
+{
+	const struct dxbc_header *header = (const struct dxbc_header*)bytecode.data();
+	const uint32_t *offsets = (const uint32_t*)(bytecode.data() + sizeof(struct dxbc_header));
+	std::vector<size_t> ret;
+	size_t length, offset;
+	uint32_t i;
+
+	for (length = 0; length < sizeof(struct dxbc_header) + header->num_sections * sizeof(uint32_t); length++)
+		ret.push_back(length);
+
+	for (i = 0; i < header->num_sections; i++) {
+		offset = offsets[i];
+		for (length = offset - 1; length <= offset + sizeof(struct section_header) + 8; length++) {
+			if (length < bytecode.size())
+				ret.push_back(length);
+		}
+	}
+	ret.push_back(bytecode.size() - 1);
+
+	return ret;
+}
+
+// The model string exactly as GetShaderModel() builds it:
+static std::string shader_model(const DXBCMetadata &meta)
+{
+	return std::string(meta.program_type) + "_" + std::to_string(meta.major_version) + "_" + std::to_string(meta.minor_version);
+}
+
+static void test_corpus(const std::string &dir)
+{
+	std::vector<std::string> paths;
+	std::vector<char> bytecode;
+	size_t i;
+
+	// Make sure any new shaders added to the corpus get an entry:
+	find_binaries(dir, &paths);
+	CHECK_EQ(paths.size(), NUM_EXPECTED_MODELS);
+	for (std::string &path : paths) {
+		for (i = 0; i < NUM_EXPECTED_MODELS; i++) {
+			if (path == expected_models[i].path)
+				break;
+		}
+		if (i == NUM_EXPECTED_MODELS)
+			fprintf(stderr, "No expected model for %s\n", path.c_str());
+		CHECK(i < NUM_EXPECTED_MODELS);
+	}
+
+	for (i = 0; i < NUM_EXPECTED_MODELS; i++) {
+		const ExpectedModel *expected = &expected_models[i];
+		std::string path = expected->path;
+		DXBCMetadata meta;
+
+		if (!read_file(dir + "/" + path, &bytecode)) {
+			fprintf(stderr, "Unable to read %s\n", path.c_str());
+			CHECK(!"read_file");
+			continue;
+		}
+
+		CHECK(ProbeDXBCMetadata(bytecode.data(), bytecode.size(), &meta));
+		if (!meta.program_type)
+			continue;
+		if (shader_model(meta) != expected->model)
+			fprintf(stderr, "%s: probed %s, expected %s\n", path.c_str(), shader_model(meta).c_str(), expected->model);
+		CHECK(shader_model(meta) == expected->model);
+		CHECK_EQ(meta.has_aon9, expected->aon9);
+
+		// And the type in the file name that 3DMigoto dumped it with:
+		CHECK(!path.compare(path.size() - 6, 2, meta.program_type));
+
+		// Every compiled shader has these, and a program long enough
+		// to hold at least its version and length tokens:
+		CHECK(meta.has_isgn);
+		CHECK(meta.has_osgn);
+		CHECK(meta.program_length >= 2);
+
+		// Truncated bytecode must be rejected without reading past
+		// the end, which the sanitizer builds will catch:
+		for (size_t length : truncation_points(bytecode)) {
+			std::vector<char> truncated(bytecode.begin(), bytecode.begin() + length);
+			DXBCMetadata truncated_meta;
+
+			CHECK(!ProbeDXBCMetadata(truncated.data(), truncated.size(), &truncated_meta));
+		}
+	}
+}
+
+static void test_not_dxbc()
+{
+	// The start of a DX9 ps_3_0 shader, which GetShaderModel() has to
+	// disassemble instead:
+	static const uint32_t dx9[] = {0xffff0300, 0x0024fffe, 0x42415443, 0x0000001c};
+	DXBCMetadata meta;
+
+	CHECK(!ProbeDXBCMetadata(dx9, sizeof(dx9), &meta));
+	CHECK(!ProbeDXBCMetadata(NULL, 0, &meta));
+	CHECK(meta.program_type == NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	test_corpus(argc > 1 ? argv[1] : "../TestShaders/GameExamples");
+	test_not_dxbc();
+
+	return test_result("DXBCMetadata");
+}
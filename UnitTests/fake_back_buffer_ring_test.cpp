@@ -0,0 +1,121 @@
+#include "test.h"
+#include "FakeBackBufferRing.h"
+
+// A game that gets the back buffer once and keeps rendering to it must keep
+// getting the same buffer presented, as it did before the ring existed:
+static void test_fetch_once()
+{
+	FakeBackBufferRing ring;
+	unsigned frame;
+
+	ring.Reset(3);
+	CHECK_EQ(ring.Fetch(), 0);
+	for (frame = 0; frame < 10; frame++) {
+		CHECK_EQ(ring.Presented(), 0);
+		ring.FramePresented();
+	}
+	CHECK_EQ(ring.Presented(), 0);
+}
+
+// A game that calls GetBuffer(0) every frame starts rotating after the second
+// frame, and the upscaling command list always sees the buffer the game just
+// rendered into rather than the one it is about to render into:
+static void test_fetch_every_frame()
+{
+	FakeBackBufferRing ring;
+	unsigned expected[] = { 0, 0, 1, 2, 0, 1, 2, 0 };
+	unsigned frame, buffer;
+
+	ring.Reset(3);
+	for (frame = 0; frame < sizeof(expected) / sizeof(expected[0]); frame++) {
+		buffer = ring.Fetch();
+		CHECK_EQ(buffer, expected[frame]);
+		CHECK_EQ(ring.Presented(), buffer);
+		ring.FramePresented();
+		// Once rotating, the next frame never reuses the buffer
+		// that was just presented:
+		if (frame >= 1)
+			CHECK(ring.Peek(0) != buffer);
+	}
+}
+
+// Missing a frame stops the rotation until the game has fetched on two
+// consecutive frames again, and the last fetched buffer stays presented:
+static void test_rotation_restarts()
+{
+	FakeBackBufferRing ring;
+
+	ring.Reset(2);
+	ring.Fetch(); ring.FramePresented();
+	ring.Fetch(); ring.FramePresented();
+	CHECK_EQ(ring.Fetch(), 1);
+	ring.FramePresented();
+	CHECK_EQ(ring.Peek(0), 0);
+
+	ring.FramePresented();
+	CHECK_EQ(ring.Presented(), 1);
+	CHECK_EQ(ring.Peek(0), 0);
+
+	CHECK_EQ(ring.Fetch(), 0);
+	ring.FramePresented();
+	CHECK_EQ(ring.Peek(0), 0);
+	CHECK_EQ(ring.Fetch(), 0);
+	ring.FramePresented();
+	CHECK_EQ(ring.Peek(0), 1);
+}
+
+// GetBuffer(n) peeks along the ring without advancing it:
+static void test_peek()
+{
+	FakeBackBufferRing ring;
+
+	ring.Reset(4);
+	ring.Fetch(); ring.FramePresented();
+	ring.Fetch(); ring.FramePresented();
+	CHECK_EQ(ring.Peek(0), 1);
+	CHECK_EQ(ring.Peek(1), 2);
+	CHECK_EQ(ring.Peek(3), 0);
+	CHECK_EQ(ring.Peek(5), 2);
+	CHECK_EQ(ring.Fetch(), 1);
+}
+
+// ResizeBuffers recreates the ring, which starts over at the first buffer,
+// and a buffer count of zero is treated as one:
+static void test_reset()
+{
+	FakeBackBufferRing ring;
+	unsigned frame;
+
+	CHECK_EQ(ring.Count(), 1);
+	ring.Reset(3);
+	for (frame = 0; frame < 3; frame++) {
+		ring.Fetch();
+		ring.FramePresented();
+	}
+	CHECK_EQ(ring.Peek(0), 2);
+
+	ring.Reset(2);
+	CHECK_EQ(ring.Count(), 2);
+	CHECK_EQ(ring.Presented(), 0);
+	CHECK_EQ(ring.Fetch(), 0);
+	ring.FramePresented();
+	CHECK_EQ(ring.Fetch(), 0);
+
+	ring.Reset(0);
+	CHECK_EQ(ring.Count(), 1);
+	for (frame = 0; frame < 4; frame++) {
+		CHECK_EQ(ring.Fetch(), 0);
+		ring.FramePresented();
+	}
+}
+
+int main()
+{
+	test_fetch_once();
+	test_fetch_every_frame();
+	test_rotation_restarts();
+	test_peek();
+	test_reset();
+
+	return test_result("FakeBackBufferRing");
+}
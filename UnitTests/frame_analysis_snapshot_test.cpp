@@ -0,0 +1,164 @@
+#include "test.h"
+#include "FrameAnalysisSnapshot.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Stands in for mResources, protected by a mutex in place of the locks. The
+// game recycles its resources every frame: each one is released and a new one
+// created at the same address, with hashes from the new frame. The hash of a
+// resource encodes which frame it was created in, so that the test can tell
+// whether every file from a draw call was named from the same frame.
+struct FakeResourceTable {
+	std::mutex lock;
+	std::unordered_map<ID3D11Resource*, std::pair<uint32_t, uint32_t>> resources;
+
+	// Must be called with the lock held:
+	void lookup(ID3D11Resource *handle, FrameAnalysisHashSnapshot *snapshot)
+	{
+		auto i = resources.find(handle);
+
+		if (i == resources.end())
+			return;
+		snapshot->hash = i->second.first;
+		snapshot->orig_hash = i->second.second;
+		snapshot->contaminated = snapshot->hash != snapshot->orig_hash;
+	}
+};
+
+static const unsigned NUM_RESOURCES = 16;
+
+static ID3D11Resource* fake_handle(unsigned i)
+{
+	return (ID3D11Resource*)(uintptr_t)(0x1000 + i * 0x10);
+}
+
+static uint32_t fake_hash(unsigned frame, unsigned i)
+{
+	return frame << 8 | i;
+}
+
+static void test_add_and_find()
+{
+	FrameAnalysisSnapshotTable table;
+	FakeResourceTable resources;
+	unsigned lookups = 0;
+
+	resources.resources[fake_handle(1)] = {0x11, 0x11};
+	resources.resources[fake_handle(2)] = {0x22, 0x20};
+
+	CHECK(table.empty());
+	table.add(fake_handle(2));
+	table.add(NULL);
+	table.add(fake_handle(1));
+	table.add(fake_handle(2));
+	table.add(fake_handle(3));
+	table.take([&](ID3D11Resource *handle, FrameAnalysisHashSnapshot *snapshot) {
+		lookups++;
+		resources.lookup(handle, snapshot);
+	});
+
+	// Looked up once each, however many slots they are bound to:
+	CHECK_EQ(lookups, 3);
+	CHECK_EQ(table.size(), 3);
+
+	CHECK_EQ(table.find(fake_handle(1))->hash, 0x11);
+	CHECK(!table.find(fake_handle(1))->contaminated);
+	CHECK_EQ(table.find(fake_handle(2))->hash, 0x22);
+	CHECK_EQ(table.find(fake_handle(2))->orig_hash, 0x20);
+	CHECK(table.find(fake_handle(2))->contaminated);
+
+	// Not in the resource table, so named without a hash:
+	CHECK(table.find(fake_handle(3)) != NULL);
+	CHECK_EQ(table.find(fake_handle(3))->hash, 0);
+	CHECK(!table.find(fake_handle(3))->contaminated);
+
+	// Never bound, so the caller falls back to snapshotting it alone:
+	CHECK(table.find(fake_handle(4)) == NULL);
+
+	table.clear();
+	CHECK(table.empty());
+	CHECK(table.find(fake_handle(1)) == NULL);
+}
+
+// Dumps draw calls with every resource bound to two slots, while another
+// thread recycles them all, and checks each draw call's files were named from
+// a single frame. This is what snapshot_bound_resources() relies on to be able
+// to dump with the locks released.
+static void test_consistent_under_concurrent_release()
+{
+	FakeResourceTable resources;
+	std::atomic<bool> stop(false);
+	std::atomic<unsigned> frames(0);
+	unsigned draw, slot, i, frame;
+	unsigned inconsistent = 0;
+	unsigned missing = 0;
+
+	for (i = 0; i < NUM_RESOURCES; i++)
+		resources.resources[fake_handle(i)] = {fake_hash(1, i), fake_hash(1, i)};
+
+	std::thread game([&]() {
+		unsigned frame, i;
+
+		for (frame = 2; !stop; frame++) {
+			std::lock_guard<std::mutex> lock(resources.lock);
+
+			for (i = 0; i < NUM_RESOURCES; i++)
+				resources.resources.erase(fake_handle(i));
+			for (i = 0; i < NUM_RESOURCES; i++)
+				resources.resources[fake_handle(i)] = {fake_hash(frame, i), fake_hash(frame, i)};
+			frames = frame;
+		}
+	});
+
+	// Make sure the game is up and running before we start drawing:
+	while (frames < 3)
+		std::this_thread::yield();
+
+	for (draw = 0; draw < 2000; draw++) {
+		FrameAnalysisSnapshotTable table;
+
+		for (slot = 0; slot < 2; slot++)
+			for (i = 0; i < NUM_RESOURCES; i++)
+				table.add(fake_handle(i));
+
+		{
+			std::lock_guard<std::mutex> lock(resources.lock);
+			table.take([&](ID3D11Resource *handle, FrameAnalysisHashSnapshot *snapshot) {
+				resources.lookup(handle, snapshot);
+			});
+		}
+
+		// The dump itself runs here with the lock released, and
+		// names each slot from the snapshot:
+		std::this_thread::yield();
+		frame = table.find(fake_handle(0))->hash >> 8;
+		for (slot = 0; slot < 2; slot++) {
+			for (i = 0; i < NUM_RESOURCES; i++) {
+				const FrameAnalysisHashSnapshot *snapshot = table.find(fake_handle(i));
+
+				if (!snapshot || !snapshot->hash)
+					missing++;
+				else if (snapshot->hash != fake_hash(frame, i))
+					inconsistent++;
+			}
+		}
+	}
+
+	stop = true;
+	game.join();
+
+	CHECK_EQ(missing, 0);
+	CHECK_EQ(inconsistent, 0);
+}
+
+int main()
+{
+	test_add_and_find();
+	test_consistent_under_concurrent_release();
+
+	return test_result("FrameAnalysisSnapshot");
+}
@@ -0,0 +1,258 @@
+#include "test.h"
+#include "OverrideSchedule.h"
+
+#include <math.h>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Transitions, driven by a fake clock in milliseconds
+
+static bool near(float a, float b)
+{
+	return fabs(a - b) < 0.0001f;
+}
+
+static OverrideTransitionParam make_transition(float start, float target,
+		uint64_t now, int time, TransitionType type)
+{
+	OverrideTransitionParam transition;
+
+	transition.start = start;
+	transition.target = target;
+	transition.activation_time = now;
+	transition.time = time;
+	transition.transition_type = type;
+
+	return transition;
+}
+
+static void test_linear_transition()
+{
+	OverrideTransitionParam transition = make_transition(10.0f, 20.0f, 1000, 400, TransitionType::LINEAR);
+
+	CHECK(near(UpdateTransitionParam(&transition, 1000), 10.0f));
+	CHECK(near(UpdateTransitionParam(&transition, 1100), 12.5f));
+	CHECK(near(UpdateTransitionParam(&transition, 1200), 15.0f));
+	CHECK_EQ(transition.time, 400);
+
+	// Frames don't land exactly on the end, so anything past it finishes:
+	CHECK(near(UpdateTransitionParam(&transition, 1450), 20.0f));
+	CHECK_EQ(transition.time, -1);
+	CHECK(UpdateTransitionParam(&transition, 1500) == FLT_MAX);
+}
+
+static void test_cosine_transition()
+{
+	OverrideTransitionParam transition = make_transition(0.0f, 1.0f, 0, 1000, TransitionType::COSINE);
+
+	// Eases in and out, passing the midpoint at the same time as linear:
+	CHECK(UpdateTransitionParam(&transition, 100) < 0.1f);
+	CHECK(near(UpdateTransitionParam(&transition, 500), 0.5f));
+	CHECK(UpdateTransitionParam(&transition, 900) > 0.9f);
+	CHECK(near(UpdateTransitionParam(&transition, 1000), 1.0f));
+	CHECK_EQ(transition.time, -1);
+}
+
+static void test_immediate_and_idle_transitions()
+{
+	OverrideTransitionParam idle;
+	OverrideTransitionParam immediate = make_transition(1.0f, 5.0f, 1000, 0, TransitionType::LINEAR);
+
+	CHECK(UpdateTransitionParam(&idle, 12345) == FLT_MAX);
+
+	// A transition time of 0 applies the target on the next update only:
+	CHECK(near(UpdateTransitionParam(&immediate, 1000), 5.0f));
+	CHECK_EQ(immediate.time, -1);
+	CHECK(UpdateTransitionParam(&immediate, 1001) == FLT_MAX);
+}
+
+// -----------------------------------------------------------------------------
+// Preset scheduling
+
+// Stands in for PresetOverride, with the same trigger/exclude rules that
+// PresetOverride::Update() applies on present:
+struct FakePreset {
+	unsigned order;
+	bool scheduled;
+	bool triggered;
+	bool excluded;
+	bool active;
+	int updates;
+
+	FakePreset(unsigned order) :
+		order(order),
+		scheduled(false),
+		triggered(false),
+		excluded(false),
+		active(false),
+		updates(0)
+	{}
+};
+
+struct FakeConfig {
+	std::vector<FakePreset> presets;
+	PresetSchedule<FakePreset> schedule;
+	std::vector<unsigned> visited;
+
+	FakeConfig(unsigned count)
+	{
+		unsigned i;
+
+		for (i = 0; i < count; i++)
+			presets.emplace_back(i);
+	}
+
+	void Trigger(unsigned i)
+	{
+		presets[i].triggered = true;
+		schedule.Schedule(&presets[i]);
+	}
+
+	void Exclude(unsigned i)
+	{
+		presets[i].excluded = true;
+		schedule.Schedule(&presets[i]);
+	}
+
+	// Runs the schedule the same way as OverrideTransition::UpdatePresets():
+	template <class Activated>
+	void Present(Activated activated)
+	{
+		visited.clear();
+		schedule.Run([&](FakePreset *preset) {
+			visited.push_back(preset->order);
+			preset->updates++;
+			if (!preset->active && preset->triggered && !preset->excluded) {
+				preset->active = true;
+				activated(preset);
+			} else if (preset->active && (!preset->triggered || preset->excluded)) {
+				preset->active = false;
+			}
+			preset->triggered = false;
+			preset->excluded = false;
+			return preset->active;
+		});
+	}
+
+	void Present()
+	{
+		Present([](FakePreset*) {});
+	}
+
+	// What a full walk of every preset would have done, for comparison:
+	unsigned Active()
+	{
+		unsigned count = 0;
+
+		for (auto &preset : presets)
+			count += preset.active;
+		return count;
+	}
+};
+
+static void test_only_scheduled_presets_visited()
+{
+	FakeConfig config(500);
+	unsigned total_updates = 0;
+
+	config.Present();
+	CHECK(config.visited.empty());
+
+	// Triggered out of order, visited in config order:
+	config.Trigger(300);
+	config.Trigger(7);
+	config.Trigger(42);
+	config.Trigger(7);
+	config.Present();
+	CHECK(config.visited == std::vector<unsigned>({7, 42, 300}));
+	CHECK_EQ(config.Active(), 3);
+
+	// Still triggered, stays active:
+	config.Trigger(42);
+	config.Present();
+	CHECK(config.visited == std::vector<unsigned>({7, 42, 300}));
+	CHECK_EQ(config.Active(), 1);
+	CHECK(config.presets[42].active);
+
+	// No longer triggered, deactivated and dropped from the schedule:
+	config.Present();
+	CHECK(config.visited == std::vector<unsigned>({42}));
+	CHECK_EQ(config.Active(), 0);
+	config.Present();
+	CHECK(config.visited.empty());
+
+	for (auto &preset : config.presets)
+		total_updates += preset.updates;
+	CHECK_EQ(total_updates, 7);
+}
+
+static void test_exclude()
+{
+	FakeConfig config(10);
+
+	config.Trigger(3);
+	config.Exclude(3);
+	config.Present();
+	CHECK(!config.presets[3].active);
+	CHECK(config.schedule.empty());
+
+	config.Trigger(3);
+	config.Present();
+	CHECK(config.presets[3].active);
+
+	// Excluding an active preset deactivates it even if still triggered:
+	config.Trigger(3);
+	config.Exclude(3);
+	config.Present();
+	CHECK(!config.presets[3].active);
+}
+
+// A preset activated during present may run a command list that triggers
+// other presets. Those belong to the next frame, whether they come before or
+// after the current one in the config:
+static void test_trigger_during_present()
+{
+	FakeConfig config(10);
+
+	config.Trigger(5);
+	config.Present([&](FakePreset *preset) {
+		config.Trigger(2);
+		config.Trigger(8);
+	});
+	CHECK(config.visited == std::vector<unsigned>({5}));
+	CHECK(config.presets[5].active);
+	CHECK(!config.presets[2].active);
+	CHECK(!config.presets[8].active);
+
+	config.Present();
+	CHECK(config.visited == std::vector<unsigned>({2, 5, 8}));
+	CHECK(config.presets[2].active);
+	CHECK(config.presets[8].active);
+	CHECK(!config.presets[5].active);
+}
+
+static void test_clear()
+{
+	FakeConfig config(4);
+
+	config.Trigger(1);
+	config.Trigger(2);
+	config.schedule.Clear();
+	CHECK(config.schedule.empty());
+	config.Present();
+	CHECK(config.visited.empty());
+}
+
+int main()
+{
+	test_linear_transition();
+	test_cosine_transition();
+	test_immediate_and_idle_transitions();
+
+	test_only_scheduled_presets_visited();
+	test_exclude();
+	test_trigger_during_present();
+	test_clear();
+
+	return test_result("OverrideSchedule");
+}
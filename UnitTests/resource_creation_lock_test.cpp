@@ -0,0 +1,219 @@
+#include "test.h"
+#include "ResourceCreationLock.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// The lock dependency checker in lock.cpp is Windows only, so these just take
+// the lock and count how often the SRW lock itself is touched:
+static std::atomic<int> srw_acquires;
+static std::atomic<int> srw_releases;
+
+bool _AcquireSRWLockPretty(SRWLOCK *lock, bool exclusive, char *function, int line)
+{
+	bool contended = false;
+
+	srw_acquires++;
+	if (exclusive) {
+		if (!TryAcquireSRWLockExclusive(lock)) {
+			contended = true;
+			AcquireSRWLockExclusive(lock);
+		}
+	} else {
+		if (!TryAcquireSRWLockShared(lock)) {
+			contended = true;
+			AcquireSRWLockShared(lock);
+		}
+	}
+	return contended;
+}
+
+void ReleaseSRWLockPretty(SRWLOCK *lock, bool exclusive)
+{
+	srw_releases++;
+	if (exclusive)
+		ReleaseSRWLockExclusive(lock);
+	else
+		ReleaseSRWLockShared(lock);
+}
+
+void NameSRWLock(SRWLOCK *lock, char *lock_name)
+{
+}
+
+static char test_function[] = "test";
+
+// Stands in for nvapi's surface creation mode, which is global to the process
+// and is what the lock is protecting. Creating a "resource" samples the mode
+// and checks that nobody changed it while the driver was busy:
+enum { MODE_AUTO, MODE_FORCESTEREO, MODE_FORCEMONO };
+static std::atomic<int> surface_creation_mode;
+static std::atomic<int> exclusive_holders;
+static std::atomic<int> shared_holders;
+static std::atomic<int> violations;
+
+static void fake_create_resource(int expected_mode)
+{
+	if (surface_creation_mode != expected_mode)
+		violations++;
+	std::this_thread::yield();
+	if (surface_creation_mode != expected_mode)
+		violations++;
+}
+
+static void fake_set_mode_and_create(ResourceCreationLock *lock,
+		ResourceCreationLockNesting *nesting, int mode, bool nest)
+{
+	int orig_mode;
+
+	CHECK(lock->Lock(nesting, true, test_function, __LINE__));
+	exclusive_holders++;
+	if (exclusive_holders != 1 || shared_holders != 0)
+		violations++;
+
+	orig_mode = surface_creation_mode;
+	surface_creation_mode = mode;
+
+	// e.g. a custom resource copy that goes through the hooked device
+	// and takes the lock again from process_texture_override():
+	if (nest)
+		CHECK(lock->Lock(nesting, false, test_function, __LINE__));
+	fake_create_resource(mode);
+	if (nest)
+		lock->Unlock(nesting);
+
+	surface_creation_mode = orig_mode;
+
+	exclusive_holders--;
+	lock->Unlock(nesting);
+}
+
+static void fake_create_with_current_mode(ResourceCreationLock *lock,
+		ResourceCreationLockNesting *nesting)
+{
+	CHECK(lock->Lock(nesting, false, test_function, __LINE__));
+	shared_holders++;
+	if (exclusive_holders != 0)
+		violations++;
+
+	fake_create_resource(MODE_AUTO);
+
+	shared_holders--;
+	lock->Unlock(nesting);
+}
+
+// Only the outermost level touches the SRW lock:
+static void test_nesting()
+{
+	volatile LONG contention = 0;
+	ResourceCreationLock lock(&contention);
+	ResourceCreationLockNesting nesting;
+
+	srw_acquires = srw_releases = 0;
+
+	CHECK(lock.Lock(&nesting, false, test_function, __LINE__));
+	CHECK(lock.Lock(&nesting, false, test_function, __LINE__));
+	lock.Unlock(&nesting);
+	lock.Unlock(&nesting);
+
+	CHECK(lock.Lock(&nesting, true, test_function, __LINE__));
+	CHECK(lock.Lock(&nesting, false, test_function, __LINE__));
+	CHECK(lock.Lock(&nesting, true, test_function, __LINE__));
+	lock.Unlock(&nesting);
+	lock.Unlock(&nesting);
+	lock.Unlock(&nesting);
+
+	CHECK_EQ(srw_acquires, 2);
+	CHECK_EQ(srw_releases, 2);
+	CHECK_EQ(nesting.depth, 0);
+	CHECK_EQ(contention, 0);
+}
+
+// Asking for exclusive access under a shared lock is reported, and must not
+// let another thread in to change the mode by dropping the lock to upgrade:
+static void test_no_upgrade()
+{
+	volatile LONG contention = 0;
+	ResourceCreationLock lock(&contention);
+	ResourceCreationLockNesting nesting;
+	std::atomic<bool> other_thread_locked(false);
+
+	srw_acquires = srw_releases = 0;
+
+	CHECK(lock.Lock(&nesting, false, test_function, __LINE__));
+	CHECK(!lock.Lock(&nesting, true, test_function, __LINE__));
+
+	std::thread other([&] {
+		ResourceCreationLockNesting other_nesting;
+		lock.Lock(&other_nesting, true, test_function, __LINE__);
+		other_thread_locked = true;
+		lock.Unlock(&other_nesting);
+	});
+
+	usleep(50000);
+	CHECK(!other_thread_locked);
+	lock.Unlock(&nesting);
+	CHECK(!other_thread_locked);
+	lock.Unlock(&nesting);
+
+	other.join();
+	CHECK(other_thread_locked);
+	CHECK_EQ(srw_acquires, 2);
+	CHECK_EQ(srw_releases, 2);
+	CHECK_EQ(contention, 1);
+}
+
+// Several threads creating resources, some of them overriding the creation
+// mode, must never see a mode other than the one they expect:
+static void test_threads()
+{
+	volatile LONG contention = 0;
+	ResourceCreationLock lock(&contention);
+	std::vector<std::thread> threads;
+	unsigned i;
+
+	violations = 0;
+	surface_creation_mode = MODE_AUTO;
+
+	for (i = 0; i < 8; i++) {
+		threads.emplace_back([&lock, i] {
+			ResourceCreationLockNesting nesting;
+			std::mt19937 rng(i);
+			unsigned j;
+
+			for (j = 0; j < 20000; j++) {
+				switch (rng() % 8) {
+				case 0:
+					fake_set_mode_and_create(&lock, &nesting, MODE_FORCESTEREO, false);
+					break;
+				case 1:
+					fake_set_mode_and_create(&lock, &nesting, MODE_FORCEMONO, true);
+					break;
+				default:
+					fake_create_with_current_mode(&lock, &nesting);
+					break;
+				}
+			}
+			CHECK_EQ(nesting.depth, 0);
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	CHECK_EQ(violations, 0);
+	CHECK_EQ(surface_creation_mode, MODE_AUTO);
+	CHECK_EQ(exclusive_holders, 0);
+	CHECK_EQ(shared_holders, 0);
+}
+
+int main()
+{
+	test_nesting();
+	test_no_upgrade();
+	test_threads();
+
+	return test_result("ResourceCreationLock");
+}
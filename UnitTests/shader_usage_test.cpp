@@ -0,0 +1,136 @@
+#include "test.h"
+#include "ShaderUsage.h"
+
+#include <random>
+
+static ID3D11Resource* fake_handle(uintptr_t n)
+{
+	return (ID3D11Resource*)(n * 0x10);
+}
+
+// Repeated draws with the same bindings collapse into one record, and the
+// hash each record was made with is the one that ends up in the maps, even
+// if hash tracking updated the resource before the batch was merged:
+static void test_record_and_merge()
+{
+	ShaderInfoMap ps_info;
+	std::set<uint32_t> srv_info, uav_info;
+	ShaderUsageBatch batch;
+	ID3D11Resource *tex = fake_handle(1);
+	ShaderInfoData *info;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		CHECK(!batch.Record(&ps_info, 0x1234, ShaderUsageType::REGISTER, 0, ResourceSnapshot(tex, 0xaaaa, 0xaaaa)));
+		CHECK(!batch.Record(&ps_info, 0x1234, ShaderUsageType::PEER, -1, ResourceSnapshot(NULL, 0, 0), 0x5678));
+	}
+	CHECK(!batch.Record(&ps_info, 0x1234, ShaderUsageType::REGISTER, 0, ResourceSnapshot(tex, 0xbbbb, 0xaaaa)));
+	CHECK(!batch.Record(&ps_info, 0x1234, ShaderUsageType::RENDER_TARGET, 2, ResourceSnapshot(fake_handle(2), 0xcccc, 0xcccc)));
+	CHECK(!batch.Record(&ps_info, 0x1234, ShaderUsageType::UAV, 1, ResourceSnapshot(fake_handle(3), 0xdddd, 0xdddd)));
+	CHECK(ps_info.empty());
+
+	batch.Merge(&srv_info, &uav_info);
+	CHECK(batch.empty());
+
+	CHECK_EQ(ps_info.size(), 1);
+	info = &ps_info[0x1234];
+	CHECK_EQ(info->PeerShaders.size(), 1);
+	CHECK_EQ(info->ResourceRegisters[0].size(), 2);
+	CHECK_EQ(info->ResourceRegisters[0].begin()->hash, 0xaaaa);
+	CHECK_EQ(info->ResourceRegisters[0].rbegin()->hash, 0xbbbb);
+	CHECK_EQ(info->RenderTargets.size(), 3);
+	CHECK_EQ(info->RenderTargets[2].size(), 1);
+	CHECK_EQ(info->UAVs[1].size(), 1);
+	CHECK_EQ(srv_info.size(), 1);
+	CHECK_EQ(*srv_info.begin(), 0xaaaa);
+	CHECK_EQ(uav_info.size(), 1);
+	CHECK_EQ(*uav_info.begin(), 0xdddd);
+}
+
+static void test_flush_threshold()
+{
+	ShaderInfoMap vs_info;
+	ShaderUsageBatch batch;
+	size_t i;
+
+	for (i = 1; i < ShaderUsageBatch::FLUSH_THRESHOLD; i++)
+		CHECK(!batch.Record(&vs_info, i, ShaderUsageType::PEER, -1, ResourceSnapshot(NULL, 0, 0), 1));
+	CHECK(batch.Record(&vs_info, i, ShaderUsageType::PEER, -1, ResourceSnapshot(NULL, 0, 0), 1));
+	batch.Merge(NULL, NULL);
+	CHECK_EQ(vs_info.size(), ShaderUsageBatch::FLUSH_THRESHOLD);
+}
+
+// ShaderUsageReport must render the same shader sections from ShaderUsage.bin
+// as were written to ShaderUsage.txt in-process:
+static void test_capture_round_trip()
+{
+	ShaderInfoMap maps[(int)ShaderUsageStage::COUNT];
+	ShaderInfoMap *info[(int)ShaderUsageStage::COUNT];
+	std::set<uint32_t> hash_contaminated;
+	ShaderUsageCapture capture;
+	std::string expected, actual;
+	std::mt19937 rng(79);
+	ShaderUsageBatch batch;
+	char truncated[100];
+	int stage, i;
+	FILE *f;
+
+	for (stage = 0; stage < (int)ShaderUsageStage::COUNT; stage++)
+		info[stage] = &maps[stage];
+
+	for (i = 0; i < 5000; i++) {
+		ShaderUsageType type = (ShaderUsageType)(rng() % 5);
+		uint32_t orig_hash = rng() % 64;
+		uint32_t hash = rng() % 4 ? orig_hash : (uint32_t)rng();
+		int slot = type == ShaderUsageType::DEPTH_TARGET ? -1 : (int)(rng() % 8);
+
+		batch.Record(&maps[rng() % (int)ShaderUsageStage::COUNT], rng() % 32, type, slot,
+				ResourceSnapshot(fake_handle(rng() % 128), hash, orig_hash), rng() % 32);
+	}
+	batch.Merge(NULL, NULL);
+	// A shader with no usage, e.g. created by looking up the selected shader:
+	maps[(int)ShaderUsageStage::CS][0xffff];
+	hash_contaminated.insert(5);
+	hash_contaminated.insert(17);
+
+	for (stage = 0; stage < (int)ShaderUsageStage::COUNT; stage++)
+		FormatShaderUsageInfo(&expected, maps[stage], ShaderUsageStageTags[stage], hash_contaminated);
+	CHECK(expected.find("hash_contaminated=true") != std::string::npos);
+	CHECK(expected.find("<ComputeShader hash=\"000000000000ffff\">\n</ComputeShader>\n") != std::string::npos);
+
+	f = tmpfile();
+	CHECK(f);
+	if (!f)
+		return;
+	CHECK(WriteShaderUsageCapture(f, info, hash_contaminated));
+	rewind(f);
+	CHECK(ReadShaderUsageCapture(f, &capture));
+
+	for (stage = 0; stage < (int)ShaderUsageStage::COUNT; stage++) {
+		FormatShaderUsageInfo(&actual, capture.info[stage], ShaderUsageStageTags[stage],
+				capture.hash_contaminated, capture.pointer_size);
+	}
+	CHECK(expected == actual);
+
+	// A truncated capture is rejected rather than rendered partially:
+	rewind(f);
+	CHECK_EQ(fread(truncated, 1, sizeof(truncated), f), sizeof(truncated));
+	fclose(f);
+	f = tmpfile();
+	CHECK(f);
+	if (!f)
+		return;
+	fwrite(truncated, 1, sizeof(truncated), f);
+	rewind(f);
+	CHECK(!ReadShaderUsageCapture(f, &capture));
+	fclose(f);
+}
+
+int main()
+{
+	test_record_and_merge();
+	test_flush_threshold();
+	test_capture_round_trip();
+
+	return test_result("ShaderUsage");
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// Just enough of D3DCompiler.h for the unit tests to build the D3D_Shaders
+// assembler. Assembling never calls into d3dcompiler, so D3DDisassemble always
+// fails here and the disassembler is not covered by the tests.
+
+#include "windows.h"
+
+typedef int32_t HRESULT;
+typedef unsigned int UINT;
+typedef const char *LPCSTR;
+typedef unsigned char byte;
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+
+#define D3D_DISASM_ENABLE_DEFAULT_VALUE_PRINTS 0x00000002
+#define D3D_DISASM_DISABLE_DEBUG_INFO 0x00000010
+
+struct ID3DBlob {
+	virtual void* GetBufferPointer() = 0;
+	virtual size_t GetBufferSize() = 0;
+	virtual unsigned long Release() = 0;
+};
+
+static inline HRESULT D3DDisassemble(const void *src, size_t size, UINT flags,
+		LPCSTR comments, ID3DBlob **disassembly)
+{
+	*disassembly = NULL;
+	return E_NOTIMPL;
+}
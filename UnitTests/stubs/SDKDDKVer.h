@@ -0,0 +1,4 @@
+#pragma once
+
+// Included by targetver.h to pick the Windows platform to build for, which
+// means nothing to the unit tests.
@@ -0,0 +1,78 @@
+#pragma once
+
+// Just enough of d3d11_1.h for the unit tests to build the parts of 3DMigoto
+// that only pass D3D11 interfaces around and call a handful of methods on
+// them. The tests implement these interfaces with fakes. Methods that the
+// code under test does not use are left out, so adding a call to one of them
+// will fail to build rather than silently calling the wrong thing.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef unsigned int UINT;
+typedef unsigned long ULONG;
+
+#define D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT 128
+#define D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT 14
+#define D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT 32
+#define D3D11_SO_BUFFER_SLOT_COUNT 4
+#define D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT 8
+#define D3D11_PS_CS_UAV_REGISTER_COUNT 8
+#define D3D11_1_UAV_SLOT_COUNT 64
+#define D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL 0xffffffff
+#define D3D11_KEEP_UNORDERED_ACCESS_VIEWS 0xffffffff
+
+enum DXGI_FORMAT {
+	DXGI_FORMAT_UNKNOWN = 0,
+	DXGI_FORMAT_R32_UINT = 42,
+	DXGI_FORMAT_R16_UINT = 57,
+};
+
+enum D3D_FEATURE_LEVEL {
+	D3D_FEATURE_LEVEL_10_0 = 0xa000,
+	D3D_FEATURE_LEVEL_10_1 = 0xa100,
+	D3D_FEATURE_LEVEL_11_0 = 0xb000,
+	D3D_FEATURE_LEVEL_11_1 = 0xb100,
+};
+
+struct IUnknown {
+	virtual ULONG AddRef() = 0;
+	virtual ULONG Release() = 0;
+};
+
+struct ID3D11DeviceChild : public IUnknown {};
+struct ID3D11Resource : public ID3D11DeviceChild {};
+struct ID3D11Buffer : public ID3D11Resource {};
+
+struct ID3D11View : public ID3D11DeviceChild {
+	virtual void GetResource(ID3D11Resource **ppResource) = 0;
+};
+struct ID3D11ShaderResourceView : public ID3D11View {};
+struct ID3D11RenderTargetView : public ID3D11View {};
+struct ID3D11DepthStencilView : public ID3D11View {};
+struct ID3D11UnorderedAccessView : public ID3D11View {};
+
+struct ID3D11DeviceContext : public ID3D11DeviceChild {
+	virtual void VSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView **ppShaderResourceViews) = 0;
+	virtual void HSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView **ppShaderResourceViews) = 0;
+	virtual void DSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView **ppShaderResourceViews) = 0;
+	virtual void GSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView **ppShaderResourceViews) = 0;
+	virtual void PSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView **ppShaderResourceViews) = 0;
+	virtual void CSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView **ppShaderResourceViews) = 0;
+
+	virtual void VSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer **ppConstantBuffers) = 0;
+	virtual void HSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer **ppConstantBuffers) = 0;
+	virtual void DSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer **ppConstantBuffers) = 0;
+	virtual void GSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer **ppConstantBuffers) = 0;
+	virtual void PSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer **ppConstantBuffers) = 0;
+	virtual void CSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer **ppConstantBuffers) = 0;
+
+	virtual void IAGetVertexBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer **ppVertexBuffers, UINT *pStrides, UINT *pOffsets) = 0;
+	virtual void IAGetIndexBuffer(ID3D11Buffer **pIndexBuffer, DXGI_FORMAT *Format, UINT *Offset) = 0;
+	virtual void SOGetTargets(UINT NumBuffers, ID3D11Buffer **ppSOTargets) = 0;
+	virtual void OMGetRenderTargets(UINT NumViews, ID3D11RenderTargetView **ppRenderTargetViews, ID3D11DepthStencilView **ppDepthStencilView) = 0;
+	virtual void OMGetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs, ID3D11RenderTargetView **ppRenderTargetViews,
+			ID3D11DepthStencilView **ppDepthStencilView, UINT UAVStartSlot, UINT NumUAVs,
+			ID3D11UnorderedAccessView **ppUnorderedAccessViews) = 0;
+	virtual void CSGetUnorderedAccessViews(UINT StartSlot, UINT NumUAVs, ID3D11UnorderedAccessView **ppUnorderedAccessViews) = 0;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+// Just enough of the MSVC CRT extensions for the unit tests to build the
+// D3D_Shaders assembler, implemented on top of the standard C library. These
+// only cover how the assembler uses them: sscanf_s is only ever passed numeric
+// conversions there when assembling, so it can map straight to sscanf. Also
+// pulls in the standard headers that MSVC's headers include implicitly.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <cstring>
+#include <stdexcept>
+
+#define _TRUNCATE ((size_t)-1)
+
+template <typename T, size_t N>
+char (&_countof_helper(T (&)[N]))[N];
+#define _countof(a) (sizeof(_countof_helper(a)))
+
+#define sscanf_s sscanf
+
+static inline int sprintf_s(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+template <size_t N>
+static inline int sprintf_s(char (&buf)[N], const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, N, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+// Only the _TRUNCATE behaviour is implemented, which is also what the
+// assembler gets when count is no larger than the buffer:
+static inline int _snprintf_s(char *buf, size_t size, size_t count, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	if (count < size)
+		size = count + 1;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+	return ret < (int)size ? ret : -1;
+}
+
+static inline int fopen_s(FILE **f, const char *filename, const char *mode)
+{
+	*f = fopen(filename, mode);
+	return *f ? 0 : errno;
+}
+
+static inline unsigned int _rotl(unsigned int value, int shift)
+{
+	shift &= 31;
+	return shift ? (value << shift) | (value >> (32 - shift)) : value;
+}
+
+static inline unsigned int _rotr(unsigned int value, int shift)
+{
+	shift &= 31;
+	return shift ? (value >> shift) | (value << (32 - shift)) : value;
+}
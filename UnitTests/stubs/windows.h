@@ -0,0 +1,63 @@
+#pragma once
+
+// Just enough of windows.h for the unit tests to build the parts of 3DMigoto
+// that use SRW locks and interlocked operations, implemented on top of POSIX
+// threads. As with the d3d11_1.h stub, anything not used by the code under
+// test is left out.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef long LONG;
+typedef uint32_t DWORD;
+typedef unsigned char BOOLEAN;
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+// lock.h only passes pointers to these around:
+struct CRITICAL_SECTION;
+
+struct SRWLOCK {
+	pthread_rwlock_t rwlock;
+};
+
+static inline void InitializeSRWLock(SRWLOCK *lock)
+{
+	pthread_rwlock_init(&lock->rwlock, NULL);
+}
+
+static inline void AcquireSRWLockExclusive(SRWLOCK *lock)
+{
+	pthread_rwlock_wrlock(&lock->rwlock);
+}
+
+static inline void AcquireSRWLockShared(SRWLOCK *lock)
+{
+	pthread_rwlock_rdlock(&lock->rwlock);
+}
+
+static inline BOOLEAN TryAcquireSRWLockExclusive(SRWLOCK *lock)
+{
+	return !pthread_rwlock_trywrlock(&lock->rwlock);
+}
+
+static inline BOOLEAN TryAcquireSRWLockShared(SRWLOCK *lock)
+{
+	return !pthread_rwlock_tryrdlock(&lock->rwlock);
+}
+
+static inline void ReleaseSRWLockExclusive(SRWLOCK *lock)
+{
+	pthread_rwlock_unlock(&lock->rwlock);
+}
+
+static inline void ReleaseSRWLockShared(SRWLOCK *lock)
+{
+	pthread_rwlock_unlock(&lock->rwlock);
+}
+
+static inline LONG InterlockedIncrement(volatile LONG *addend)
+{
+	return __sync_add_and_fetch(addend, 1);
+}
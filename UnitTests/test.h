@@ -0,0 +1,36 @@
+#pragma once
+
+// Minimal helpers for the unit tests in this directory. These cover the parts
+// of 3DMigoto that do not depend on DirectX, and are built with the Makefile
+// here on Linux (or anywhere else with a C++ compiler and make).
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+	long long _a = (long long)(a), _b = (long long)(b); \
+	if (_a != _b) { \
+		fprintf(stderr, "%s:%d: CHECK_EQ failed: %s == %s (%lld != %lld)\n", \
+				__FILE__, __LINE__, #a, #b, _a, _b); \
+		test_failures++; \
+	} \
+} while (0)
+
+static inline int test_result(const char *name)
+{
+	if (test_failures) {
+		printf("FAIL: %s (%i failures)\n", name, test_failures);
+		return 1;
+	}
+	printf("PASS: %s\n", name);
+	return 0;
+}
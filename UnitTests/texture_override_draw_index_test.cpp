@@ -0,0 +1,152 @@
+#include "test.h"
+#include "TextureOverrideDrawIndex.h"
+
+#include <vector>
+
+// Stands in for a sorted TextureOverrideList. Each override either matches a
+// single exact first index, or could match any draw call (no draw context
+// match, a range, an unrelated match_vertex_count, etc).
+struct FakeOverride {
+	bool exact;
+	uint32_t first_index;
+};
+
+static std::vector<unsigned> candidates(const std::vector<FakeOverride> &list, uint32_t first_index)
+{
+	TextureOverrideDrawIndex index;
+	std::vector<unsigned> ret;
+
+	index.Build((unsigned)list.size(), [&list](unsigned pos, uint32_t *first_index) {
+		*first_index = list[pos].first_index;
+		return list[pos].exact;
+	});
+	index.ForEachCandidate(first_index, [&ret](unsigned pos) {
+		ret.push_back(pos);
+	});
+
+	return ret;
+}
+
+// What walking the whole list would have considered, in priority order:
+static std::vector<unsigned> brute_force(const std::vector<FakeOverride> &list, uint32_t first_index)
+{
+	std::vector<unsigned> ret;
+	unsigned pos;
+
+	for (pos = 0; pos < list.size(); pos++) {
+		if (!list[pos].exact || list[pos].first_index == first_index)
+			ret.push_back(pos);
+	}
+
+	return ret;
+}
+
+static void test_priority_order()
+{
+	// Indexed and unindexed overrides interleaved, with the indexed ones
+	// out of order by first index and sharing first indices:
+	std::vector<FakeOverride> list = {
+		{true, 300},
+		{false, 0},
+		{true, 100},
+		{true, 300},
+		{false, 0},
+		{false, 0},
+		{true, 0},
+		{true, 300},
+		{false, 0},
+	};
+
+	CHECK(candidates(list, 300) == std::vector<unsigned>({0, 1, 3, 4, 5, 7, 8}));
+	CHECK(candidates(list, 100) == std::vector<unsigned>({1, 2, 4, 5, 8}));
+	CHECK(candidates(list, 0) == std::vector<unsigned>({1, 4, 5, 6, 8}));
+	CHECK(candidates(list, 200) == std::vector<unsigned>({1, 4, 5, 8}));
+	CHECK(candidates(list, 0xffffffff) == std::vector<unsigned>({1, 4, 5, 8}));
+}
+
+static void test_only_indexed()
+{
+	std::vector<FakeOverride> list = {
+		{true, 36},
+		{true, 12},
+		{true, 36},
+	};
+
+	CHECK(candidates(list, 36) == std::vector<unsigned>({0, 2}));
+	CHECK(candidates(list, 12) == std::vector<unsigned>({1}));
+	CHECK(candidates(list, 24).empty());
+}
+
+static void test_empty()
+{
+	TextureOverrideDrawIndex index;
+	std::vector<FakeOverride> list = {
+		{false, 0},
+		{false, 0},
+	};
+
+	CHECK(index.empty());
+
+	// Nothing indexed, so callers should walk the whole list, but the
+	// index still gives the right answer if they don't:
+	index.Build((unsigned)list.size(), [](unsigned, uint32_t*) { return false; });
+	CHECK(index.empty());
+	CHECK(candidates(list, 5) == std::vector<unsigned>({0, 1}));
+
+	CHECK(candidates(std::vector<FakeOverride>(), 5).empty());
+}
+
+// Rebuilding after a config reload must not keep anything from before:
+static void test_rebuild()
+{
+	TextureOverrideDrawIndex index;
+	std::vector<unsigned> ret;
+
+	index.Build(3, [](unsigned pos, uint32_t *first_index) {
+		*first_index = 7;
+		return true;
+	});
+	index.Build(2, [](unsigned pos, uint32_t *first_index) {
+		*first_index = 9;
+		return pos == 1;
+	});
+	index.ForEachCandidate(7, [&ret](unsigned pos) { ret.push_back(pos); });
+	CHECK(ret == std::vector<unsigned>({0}));
+
+	ret.clear();
+	index.ForEachCandidate(9, [&ret](unsigned pos) { ret.push_back(pos); });
+	CHECK(ret == std::vector<unsigned>({0, 1}));
+}
+
+// Random lists of the shape a mod picking out sub-meshes would produce, with
+// a few first indices shared by many overrides:
+static void test_random()
+{
+	std::vector<FakeOverride> list;
+	unsigned seed = 12345;
+	unsigned iteration, i, count;
+	uint32_t first_index;
+
+	for (iteration = 0; iteration < 200; iteration++) {
+		count = (seed = seed * 1103515245 + 12345) >> 16 & 0x3f;
+		list.clear();
+		for (i = 0; i < count; i++) {
+			seed = seed * 1103515245 + 12345;
+			list.push_back({(seed >> 16 & 3) != 0, (seed >> 20 & 7) * 1000});
+		}
+
+		for (first_index = 0; first_index <= 8000; first_index += 500)
+			CHECK(candidates(list, first_index) == brute_force(list, first_index));
+	}
+}
+
+int main()
+{
+	test_priority_order();
+	test_only_indexed();
+	test_empty();
+	test_rebuild();
+	test_random();
+
+	return test_result("TextureOverrideDrawIndex");
+}
@@ -0,0 +1,75 @@
+#include "test.h"
+#include "TextureOverrideFilter.h"
+
+#include <random>
+#include <unordered_set>
+
+// The filter may only ever say "no" for hashes that were not inserted - a
+// false negative would silently disable a TextureOverride. False positives
+// just cost a map lookup, but should stay rare at 16 bits per hash.
+static void check_random_set(std::mt19937 &rng, TextureOverrideFilter *filter, size_t num_hashes)
+{
+	std::unordered_set<uint32_t> hashes;
+	size_t false_positives = 0, probes = 0;
+	unsigned i;
+
+	while (hashes.size() < num_hashes)
+		hashes.insert(rng());
+
+	CHECK(filter->reset(hashes.size()));
+	for (uint32_t hash : hashes)
+		filter->insert(hash);
+
+	for (uint32_t hash : hashes)
+		CHECK(filter->might_contain(hash));
+
+	for (i = 0; i < 200000; i++) {
+		uint32_t hash = rng();
+		if (hashes.count(hash))
+			continue;
+		probes++;
+		if (filter->might_contain(hash))
+			false_positives++;
+	}
+
+	printf("  %6zu hashes: %.4f%% false positives\n", num_hashes, 100.0 * false_positives / probes);
+	CHECK(false_positives * 100 < probes);
+}
+
+int main()
+{
+	std::mt19937 rng(0x3d319070);
+	TextureOverrideFilter filter;
+	size_t sizes[] = { 0, 1, 7, 100, 1000, 5000, 50000, 12, 3000, 200000, 10 };
+
+	// Before the first config load there is no filter, and every lookup
+	// has to go through to the full map:
+	CHECK(filter.might_contain(0));
+	CHECK(filter.might_contain(0x12345678));
+	CHECK(filter.fuzzy_may_match_tex2d());
+
+	// An empty filter says no to everything:
+	CHECK(filter.reset(0));
+	CHECK(!filter.might_contain(0));
+	CHECK(!filter.might_contain(0x12345678));
+	CHECK(!filter.fuzzy_may_match_buffer());
+
+	// Grow and shrink between "reloads" to exercise both reusing and
+	// replacing the allocation:
+	for (size_t size : sizes)
+		check_random_set(rng, &filter, size);
+
+	filter.reset(10);
+	filter.insert_fuzzy(false, false, true, false);
+	CHECK(!filter.fuzzy_may_match_buffer());
+	CHECK(!filter.fuzzy_may_match_tex1d());
+	CHECK(filter.fuzzy_may_match_tex2d());
+	CHECK(!filter.fuzzy_may_match_tex3d());
+	filter.insert_fuzzy(true, false, false, false);
+	CHECK(filter.fuzzy_may_match_buffer());
+	CHECK(filter.fuzzy_may_match_tex2d());
+	filter.reset(10);
+	CHECK(!filter.fuzzy_may_match_tex2d());
+
+	return test_result("TextureOverrideFilter");
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "shader.h"
+
+// This file deliberately has no DirectX dependencies so that it can be built
+// by the unit tests, which check it against the shaders in
+// TestShaders/GameExamples.
+
+// Minimal metadata read directly from the DXBC container and the version
+// token at the start of the SHDR/SHEX chunk, without disassembling anything.
+// program_length is the length of the shader program in DWORDs as recorded
+// in the token following the version token, which is a cheap approximation
+// of the instruction count.
+struct DXBCMetadata
+{
+	const char *program_type;
+	uint32_t major_version;
+	uint32_t minor_version;
+	uint32_t program_length;
+	bool has_rdef;
+	bool has_isgn;
+	bool has_osgn;
+	bool has_sfi0;
+	bool has_stat;
+	bool has_aon9;
+
+	DXBCMetadata() :
+		program_type(NULL),
+		major_version(0),
+		minor_version(0),
+		program_length(0),
+		has_rdef(false),
+		has_isgn(false),
+		has_osgn(false),
+		has_sfi0(false),
+		has_stat(false),
+		has_aon9(false)
+	{}
+};
+
+// Returns false if this is not a DXBC container (e.g. DX9 bytecode), if it is
+// truncated, or if it does not contain a program chunk we understand.
+static bool ProbeDXBCMetadata(const void *pShaderBytecode, size_t bytecodeLength, DXBCMetadata *meta)
+{
+	static const char *program_types[] = { "ps", "vs", "gs", "hs", "ds", "cs" };
+	const struct dxbc_header *header = (const struct dxbc_header*)pShaderBytecode;
+	const uint32_t *offsets, *tokens = NULL;
+	const struct section_header *section;
+	uint32_t program_type;
+	unsigned i;
+
+	if (!pShaderBytecode || bytecodeLength < sizeof(struct dxbc_header))
+		return false;
+	if (strncmp(header->signature, "DXBC", 4))
+		return false;
+	if (header->num_sections > (bytecodeLength - sizeof(struct dxbc_header)) / sizeof(uint32_t))
+		return false;
+
+	offsets = (const uint32_t*)((const char*)header + sizeof(struct dxbc_header));
+	for (i = 0; i < header->num_sections; i++) {
+		if (offsets[i] > bytecodeLength - sizeof(struct section_header))
+			return false;
+		section = (const struct section_header*)((const char*)header + offsets[i]);
+		if (section->size > bytecodeLength - offsets[i] - sizeof(struct section_header))
+			return false;
+
+		if (!strncmp(section->signature, "RDEF", 4))
+			meta->has_rdef = true;
+		else if (!strncmp(section->signature, "ISGN", 4) || !strncmp(section->signature, "ISG1", 4))
+			meta->has_isgn = true;
+		else if (!strncmp(section->signature, "OSGN", 4) || !strncmp(section->signature, "OSG5", 4) || !strncmp(section->signature, "OSG1", 4))
+			meta->has_osgn = true;
+		else if (!strncmp(section->signature, "SFI0", 4))
+			meta->has_sfi0 = true;
+		else if (!strncmp(section->signature, "STAT", 4))
+			meta->has_stat = true;
+		else if (!strncmp(section->signature, "Aon9", 4))
+			meta->has_aon9 = true;
+		else if (!strncmp(section->signature, "SHDR", 4) || !strncmp(section->signature, "SHEX", 4)) {
+			if (section->size >= 2 * sizeof(uint32_t))
+				tokens = (const uint32_t*)((const char*)section + sizeof(struct section_header));
+		}
+	}
+
+	if (!tokens)
+		return false;
+
+	program_type = tokens[0] >> 16;
+	if (program_type >= sizeof(program_types) / sizeof(program_types[0]))
+		return false;
+
+	meta->program_type = program_types[program_type];
+	meta->major_version = (tokens[0] >> 4) & 0xf;
+	meta->minor_version = tokens[0] & 0xf;
+	meta->program_length = tokens[1];
+
+	return true;
+}
@@ -17,6 +17,8 @@
 #include "log.h"
 #include "crc32c.h"
 #include "util_min.h"
+#include "shader.h"
+#include "dxbc_metadata.h"
 
 #include "D3D_Shaders\stdafx.h"
 
@@ -46,31 +48,29 @@ const int INI_PARAMS_SIZE_WARNING = 256;
 
 // -----------------------------------------------------------------------------------------------
 
-// This critical section must be held to avoid race conditions when creating
-// any resource. The nvapi functions used to set the resource creation mode
+// This lock must be held to avoid race conditions when creating any
+// resource. The nvapi functions used to set the resource creation mode
 // affect global state, so if multiple threads are creating resources
 // simultaneously it is possible for a StereoMode override or stereo/mono copy
 // on one thread to affect another. This should be taken before setting the
 // surface creation mode and released only after it has been restored. If the
 // creation mode is not being set it should still be taken around the actual
-// CreateXXX call.
+// CreateXXX call, but only needs to be taken shared with
+// LockResourceCreationModeShared() so that multiple threads can still create
+// resources simultaneously - only changing the creation mode needs to take it
+// exclusively with LockResourceCreationMode(). Either may be nested, and both
+// are released with UnlockResourceCreationMode(), but a nested lock can never
+// upgrade a shared lock held further up the stack, so any path that might
+// change the creation mode has to take it exclusively from the start.
 //
-// The actual variable definition is in the DX11 project to remind anyone using
-// this from another project that they need to InitializeCriticalSection[Pretty]
-extern CRITICAL_SECTION resource_creation_mode_lock;
-
-// Use the pretty lock debugging version if lock.h is included first, otherwise
-// use the regular EnterCriticalSection:
-#ifdef EnterCriticalSectionPretty
-#define LockResourceCreationMode() \
-	EnterCriticalSectionPretty(&resource_creation_mode_lock)
-#else
+// The implementation is in the DX11 project, since it tracks the nesting in
+// the DX11 TLS structure.
+void _LockResourceCreationMode(bool exclusive, char *function, int line);
 #define LockResourceCreationMode() \
-	EnterCriticalSection(&resource_creation_mode_lock)
-#endif
-
-#define UnlockResourceCreationMode() \
-	LeaveCriticalSection(&resource_creation_mode_lock)
+	_LockResourceCreationMode(true, __FUNCTION__, __LINE__)
+#define LockResourceCreationModeShared() \
+	_LockResourceCreationMode(false, __FUNCTION__, __LINE__)
+void UnlockResourceCreationMode();
 
 // -----------------------------------------------------------------------------------------------
 
@@ -763,79 +763,50 @@ static string BinaryToAsmText(const void *pShaderBytecode, size_t BytecodeLength
 {
 	string comments;
 	vector<byte> byteCode(BytecodeLength);
-	vector<byte> disassembly;
 	HRESULT r;
 
 	comments = "//   using 3Dmigoto v" + string(VER_FILE_VERSION_STR) + " on " + LogTime() + "//\n";
 	memcpy(byteCode.data(), pShaderBytecode, BytecodeLength);
 
 #if MIGOTO_DX == 9
+	vector<byte> disassembly;
+
 	r = disassemblerDX9(&byteCode, &disassembly, comments.c_str());
+	if (FAILED(r)) {
+		LogInfo("  disassembly failed. Error: %x\n", r);
+		return "";
+	}
+
+	return string((char*)disassembly.data(), disassembly.size());
 #elif MIGOTO_DX == 11
+	// The DX11 disassembler writes straight into the returned string:
+	string disassembly;
+
 	r = disassembler(&byteCode, &disassembly, comments.c_str(), hexdump,
 			d3dcompiler_46_compat, disassemble_undecipherable_data, patch_cb_offsets);
-#endif // MIGOTO_DX
 	if (FAILED(r)) {
 		LogInfo("  disassembly failed. Error: %x\n", r);
 		return "";
 	}
 
-	return string(disassembly.begin(), disassembly.end());
+	return disassembly;
+#endif // MIGOTO_DX
 }
 
 // Get the shader model from the binary shader bytecode.
 //
-// This used to disassemble, then search for the text string, but if we are going to
-// do all that work, we might as well use the James-Jones decoder to get it.
-// The other reason to do it this way is that we have seen multiple shader versions
-// in Unity games, and the old technique of searching for the first uncommented line
-// would fail.
-
-// This is an interesting idea, but doesn't work well here because of project structure.
-// for the moment, let's leave this here, but use the disassemble search approach.
-
-//static string GetShaderModel(const void *pShaderBytecode)
-//{
-//	Shader *shader = DecodeDXBC((uint32_t*)pShaderBytecode);
-//	if (shader == nullptr)
-//		return "";
-//
-//	string shaderModel;
-//	
-//	switch (shader->eShaderType)
-//	{
-//	case PIXEL_SHADER:
-//		shaderModel = "ps";
-//		break;
-//	case VERTEX_SHADER:
-//		shaderModel = "vs";
-//		break;
-//	case GEOMETRY_SHADER:
-//		shaderModel = "gs";
-//		break;
-//	case HULL_SHADER:
-//		shaderModel = "hs";
-//		break;
-//	case DOMAIN_SHADER:
-//		shaderModel = "ds";
-//		break;
-//	case COMPUTE_SHADER:
-//		shaderModel = "cs";
-//		break;
-//	default:
-//		return "";		// Failure.
-//	}
-//
-//	shaderModel += "_" + shader->ui32MajorVersion;
-//	shaderModel += "_" + shader->ui32MinorVersion;
-//
-//	delete shader;
-//
-//	return shaderModel;
-//}
-
+// For DXBC shaders this is read straight from the version token of the
+// program chunk. We still fall back to disassembling and searching for the
+// first uncommented line for anything the probe does not handle - DX9
+// bytecode, and feature level 9 shaders where the disassembler reports a
+// "_level_9_x" suffix that is not recorded in the version token.
 static string GetShaderModel(const void *pShaderBytecode, size_t bytecodeLength)
 {
+	DXBCMetadata meta;
+
+	if (ProbeDXBCMetadata(pShaderBytecode, bytecodeLength, &meta) && !meta.has_aon9)
+		return string(meta.program_type) + "_" + std::to_string(meta.major_version) + "_" + std::to_string(meta.minor_version);
+
 	string asmText = BinaryToAsmText(pShaderBytecode, bytecodeLength, false);
 	if (asmText.empty())
 		return "";